@@ -0,0 +1,423 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Loopback benchmark of the native protocol.
+ *
+ * Starts the server in process on 127.0.0.1 and runs every combination of the given parameters,
+ * each client connection keeps "pipeline" requests in flight.
+ * The same workload can be sent over the native protocol and the Redis protocol (RESP2).
+ * The native protocol can also be sent over a Unix socket or a shared memory channel (see lib/hypershm/hypershm.hpp).
+ *
+ * Parameters are passed as --name=value, lists are comma separated:
+ *   --protocol=native,resp      protocol of the clients (native, resp, unix or shm)
+ *   --connections=1,4,16        client connections (one thread per connection)
+ *   --pipeline=1,16,64          requests in flight per connection
+ *   --mix=90:10                 get:set ratio (in percent)
+ *   --value_size=64             value size in bytes
+ *   --keys=100000               number of keys (preloaded)
+ *   --ops=1000000               requests per run (split over the connections)
+ *   --threads=0                 server threads (0 = number of cores)
+ *   --backend=epoll             server backend (epoll or io_uring)
+ *   --format=csv                output format (csv or json, one object per line)
+ *
+ * Output columns: protocol,connections,pipeline,mix,value_size,ops,ops_per_sec,p50_us,p99_us,p999_us
+ * (latency is measured from the write of a request to the read of its response)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+#include "core.hpp"
+#include "lib/hypershm/hypershm.hpp"
+#include "lib/protocol/protocol.hpp"
+#include "server.hpp"
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+using asio::local::stream_protocol;
+
+namespace {
+	struct Options {
+		vector<string> protocol = {"native", "resp"};
+		vector<size_t> connections = {1, 4, 16};
+		vector<size_t> pipeline = {1, 16, 64};
+		vector<pair<unsigned, unsigned>> mix = {{90, 10}};
+		vector<size_t> value_size = {64};
+		size_t keys = 100000;
+		size_t ops = 1000000;
+		size_t threads = 0;
+		server::Backend backend = server::EPOLL;
+		string format = "csv";
+	};
+
+	struct Result {
+		double ops_per_sec;
+		double p50_us;
+		double p99_us;
+		double p999_us;
+	};
+
+	using Clock = chrono::steady_clock;
+
+	template <typename T>
+	vector<T> parse_list(const string& val, T (*parse)(const string&)) {
+		vector<T> list;
+		size_t pos = 0;
+		while (pos <= val.size()) {
+			size_t next = val.find(',', pos);
+			if (next == string::npos) next = val.size();
+			list.push_back(parse(val.substr(pos, next - pos)));
+			pos = next + 1;
+		}
+		return list;
+	}
+
+	pair<unsigned, unsigned> parse_mix(const string& val) {
+		unsigned get = 0, set = 0;
+		if (sscanf(val.c_str(), "%u:%u", &get, &set) != 2 || get + set != 100)
+			throw invalid_argument("Mix must be get:set with a sum of 100: " + val);
+		return {get, set};
+	}
+
+	Options parse_options(int argc, char** argv) {
+		const auto to_string_val = [](const string& s) { return s; };
+		const auto to_size = [](const string& s) { return static_cast<size_t>(stoull(s)); };
+
+		Options opts;
+		for (int i = 1; i < argc; i++) {
+			const string arg = argv[i];
+			const size_t eq = arg.find('=');
+			if (arg.rfind("--", 0) != 0 || eq == string::npos)
+				throw invalid_argument("Expected --name=value, got: " + arg);
+			const string name = arg.substr(2, eq - 2);
+			const string val = arg.substr(eq + 1);
+
+			if (name == "protocol") opts.protocol = parse_list<string>(val, to_string_val);
+			else if (name == "connections") opts.connections = parse_list<size_t>(val, to_size);
+			else if (name == "pipeline") opts.pipeline = parse_list<size_t>(val, to_size);
+			else if (name == "mix") opts.mix = parse_list<pair<unsigned, unsigned>>(val, parse_mix);
+			else if (name == "value_size") opts.value_size = parse_list<size_t>(val, to_size);
+			else if (name == "keys") opts.keys = stoull(val);
+			else if (name == "ops") opts.ops = stoull(val);
+			else if (name == "threads") opts.threads = stoull(val);
+			else if (name == "backend") {
+				if (val == "epoll") opts.backend = server::EPOLL;
+				else if (val == "io_uring") opts.backend = server::URING;
+				else throw invalid_argument("Unknown backend: " + val);
+			}
+			else if (name == "format") opts.format = val;
+			else throw invalid_argument("Unknown parameter: " + name);
+		}
+		for (const string& protocol : opts.protocol)
+			if (protocol != "native" && protocol != "resp" && protocol != "unix" && protocol != "shm") throw invalid_argument("Unknown protocol: " + protocol);
+		if (opts.keys == 0) throw invalid_argument("At least one key is required");
+		if (opts.format != "csv" && opts.format != "json") throw invalid_argument("Unknown format: " + opts.format);
+		return opts;
+	}
+
+	string make_key(size_t index) {
+		return "key:" + to_string(index);
+	}
+
+	// Writes a request of the workload (a get of key or a set of key to value)
+	void write_native(vector<uint8_t>& out, uint32_t id, bool get, const string& key, const string& value) {
+		protocol::Writer writer(out);
+		if (get) {
+			writer.begin(id, protocol::GET);
+			writer.raw(key);
+		} else {
+			writer.begin(id, protocol::SET);
+			writer.str(key);
+			writer.raw(value);
+		}
+		writer.end();
+	}
+
+	void write_resp(vector<uint8_t>& out, bool get, const string& key, const string& value) {
+		const auto bulk = [&](const string& val) {
+			const string header = "$" + to_string(val.size()) + "\r\n";
+			out.insert(out.end(), header.begin(), header.end());
+			out.insert(out.end(), val.begin(), val.end());
+			out.push_back('\r');
+			out.push_back('\n');
+		};
+		const string header = get ? "*2\r\n" : "*3\r\n";
+		out.insert(out.end(), header.begin(), header.end());
+		bulk(get ? "GET" : "SET");
+		bulk(key);
+		if (!get) bulk(value);
+	}
+
+	// Returns the size of the response at data (0 if it is incomplete), throws if the request failed
+	size_t read_native(const uint8_t* data, size_t size) {
+		if (size < protocol::header_size) return 0;
+		const size_t length = protocol::get_u32(data);
+		if (size < length + protocol::length_size) return 0;
+		const uint8_t status = data[protocol::header_size - 1];
+		if (status != protocol::OK && status != protocol::NOT_FOUND)
+			throw runtime_error("Request failed with status " + to_string(status));
+		return length + protocol::length_size;
+	}
+
+	size_t read_resp(const uint8_t* data, size_t size) {
+		const uint8_t* end = static_cast<const uint8_t*>(memchr(data, '\n', size));
+		if (!end) return 0;
+		const size_t line = static_cast<size_t>(end - data) + 1;
+		if (data[0] == '-') throw runtime_error("Request failed: " + string(reinterpret_cast<const char*>(data), line));
+		if (data[0] != '$') return line;
+		const long length = strtol(reinterpret_cast<const char*>(data) + 1, nullptr, 10);
+		if (length < 0) return line;
+		if (size < line + static_cast<size_t>(length) + 2) return 0;
+		return line + static_cast<size_t>(length) + 2;
+	}
+
+	/**
+	 * Server endpoint of a workload (TCP port, Unix socket path or shared memory channel socket path)
+	 */
+	struct Target {
+		string protocol;
+		uint16_t port;
+		string path;
+	};
+
+	/**
+	 * Client connection that keeps a fixed number of requests in flight
+	 */
+	class Client {
+	public:
+		Client(const Target& target) : socket(context), local(context) {
+			if (target.protocol == "shm") {
+				// Spins for the whole run, a sleeping client would measure the wakeup latency
+				channel = make_unique<hypershm::Client>(target.path, chrono::seconds(1));
+			} else if (target.protocol == "unix") {
+				local.connect(stream_protocol::endpoint(target.path));
+			} else {
+				socket.connect(tcp::endpoint(asio::ip::make_address("127.0.0.1"), target.port));
+				socket.set_option(tcp::no_delay(true));
+			}
+		};
+
+		/**
+		 * Sends "ops" requests with "pipeline" requests in flight, returns the latencies in ns
+		 *
+		 * next(out, index) appends the request with the given index, read(data, size) returns the size
+		 * of the response at data (0 if it is incomplete). Responses arrive in request order.
+		 */
+		template <typename Next_T, typename Read_T>
+		vector<uint32_t> run(size_t ops, size_t pipeline, Next_T&& next, Read_T&& read) {
+			vector<uint32_t> latencies;
+			latencies.reserve(ops);
+			vector<Clock::time_point> sent(pipeline);
+			vector<uint8_t> out;
+			vector<uint8_t> in(1 << 20);
+			size_t in_begin = 0, in_end = 0;
+			size_t issued = 0;
+
+			const auto issue = [&](size_t count) {
+				out.clear();
+				const Clock::time_point now = Clock::now();
+				for (size_t i = 0; i < count && issued < ops; i++, issued++) {
+					next(out, issued);
+					sent[issued % pipeline] = now;
+				}
+				if (!out.empty()) write(out);
+			};
+
+			issue(pipeline);
+			while (latencies.size() < ops) {
+				if (in_begin == in_end) in_begin = in_end = 0;
+				if (in.size() - in_end < 4096) {
+					memmove(in.data(), in.data() + in_begin, in_end - in_begin);
+					in_end -= in_begin;
+					in_begin = 0;
+					if (in.size() - in_end < 4096) in.resize(in.size() * 2);
+				}
+				in_end += read_some(in.data() + in_end, in.size() - in_end);
+
+				const Clock::time_point now = Clock::now();
+				size_t completed = 0;
+				while (in_begin < in_end) {
+					const size_t size = read(in.data() + in_begin, in_end - in_begin);
+					if (!size) break;
+					latencies.push_back(static_cast<uint32_t>(min<int64_t>(
+						chrono::duration_cast<chrono::nanoseconds>(now - sent[latencies.size() % pipeline]).count(), UINT32_MAX)));
+					in_begin += size;
+					completed++;
+				}
+				issue(completed);
+			}
+			return latencies;
+		};
+	private:
+		void write(const vector<uint8_t>& out) {
+			if (channel) channel->write(out.data(), out.size());
+			else if (local.is_open()) asio::write(local, asio::buffer(out));
+			else asio::write(socket, asio::buffer(out));
+		};
+
+		size_t read_some(uint8_t* data, size_t size) {
+			if (channel) return channel->read_some(data, size);
+			if (local.is_open()) return local.read_some(asio::buffer(data, size));
+			return socket.read_some(asio::buffer(data, size));
+		};
+
+		asio::io_context context;
+		tcp::socket socket;
+		stream_protocol::socket local;
+		unique_ptr<hypershm::Client> channel;
+	};
+
+	struct Workload {
+		string protocol;
+		size_t connections;
+		size_t pipeline;
+		pair<unsigned, unsigned> mix;
+		size_t value_size;
+	};
+
+	Result run(const server::Server& server, const server::ServerConfig& config, const Options& opts, const Workload& w) {
+		const string value(w.value_size, 'v');
+		const bool resp = w.protocol == "resp";
+		const Target target{w.protocol, resp ? server.resp_port() : server.port(),
+			w.protocol == "shm" ? config.shm_path : config.unix_path};
+		const auto next = [&](vector<uint8_t>& out, size_t index, bool get, const string& key) {
+			if (resp) write_resp(out, get, key, value);
+			else write_native(out, static_cast<uint32_t>(index), get, key, value);
+		};
+		const auto read = [&](const uint8_t* data, size_t size) {
+			return resp ? read_resp(data, size) : read_native(data, size);
+		};
+
+		// Preload all keys (so every get is a hit)
+		{
+			Client loader(target);
+			loader.run(opts.keys, 64, [&](vector<uint8_t>& out, size_t index) {
+				next(out, index, false, make_key(index));
+			}, read);
+		}
+		const size_t connections = w.connections;
+
+		vector<unique_ptr<Client>> clients;
+		for (size_t c = 0; c < connections; c++) clients.push_back(make_unique<Client>(target));
+
+		const size_t ops_per_client = max<size_t>(1, opts.ops / connections);
+		vector<vector<uint32_t>> latencies(connections);
+		atomic<size_t> ready = 0;
+		atomic<bool> start = false;
+		vector<thread> workers;
+		for (size_t c = 0; c < connections; c++) {
+			workers.emplace_back([&, c] {
+				mt19937_64 rng(c + 1);
+				string key;
+				ready++;
+				while (!start.load(memory_order_acquire)) this_thread::yield();
+				latencies[c] = clients[c]->run(ops_per_client, w.pipeline, [&](vector<uint8_t>& out, size_t index) {
+					key = make_key(rng() % opts.keys);
+					next(out, index, rng() % 100 < w.mix.first, key);
+				}, read);
+			});
+		}
+
+		while (ready.load() < connections) this_thread::yield();
+		const auto begin = Clock::now();
+		start.store(true, memory_order_release);
+		for (auto& worker : workers) worker.join();
+		const double seconds = chrono::duration<double>(Clock::now() - begin).count();
+
+		vector<uint32_t> all;
+		for (const auto& list : latencies) all.insert(all.end(), list.begin(), list.end());
+		const auto percentile = [&](double p) {
+			const size_t idx = min(all.size() - 1, static_cast<size_t>(p * all.size()));
+			nth_element(all.begin(), all.begin() + idx, all.end());
+			return all[idx] / 1e3;
+		};
+		return Result{all.size() / seconds, percentile(0.5), percentile(0.99), percentile(0.999)};
+	}
+
+	void print(const Options& opts, const Workload& w, const Result& r) {
+		const size_t ops = max<size_t>(1, opts.ops / w.connections) * w.connections;
+		if (opts.format == "json") {
+			printf("{\"protocol\":\"%s\",\"connections\":%zu,\"pipeline\":%zu,\"mix\":\"%u:%u\",\"value_size\":%zu,\"ops\":%zu,"
+						 "\"ops_per_sec\":%.0f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f}\n",
+						 w.protocol.c_str(), w.connections, w.pipeline, w.mix.first, w.mix.second, w.value_size, ops,
+						 r.ops_per_sec, r.p50_us, r.p99_us, r.p999_us);
+		} else {
+			printf("%s,%zu,%zu,%u:%u,%zu,%zu,%.0f,%.2f,%.2f,%.2f\n",
+						 w.protocol.c_str(), w.connections, w.pipeline, w.mix.first, w.mix.second, w.value_size, ops,
+						 r.ops_per_sec, r.p50_us, r.p99_us, r.p999_us);
+		}
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options opts;
+	try {
+		opts = parse_options(argc, argv);
+	} catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	core::CoreMap map(bit_ceil(opts.keys * 2));
+	server::ServerConfig config;
+	config.address = "127.0.0.1";
+	config.port = 0;
+	config.resp_port = 0;
+	config.threads = opts.threads;
+	config.backend = opts.backend;
+	const string socket_prefix = "/tmp/hypercache_bench_" + to_string(getpid());
+	config.unix_path = socket_prefix + ".sock";
+	config.shm_path = socket_prefix + ".shm";
+	server::Server server(map, config);
+	server.start();
+	if (server.backend() != opts.backend) fprintf(stderr, "io_uring is not supported, the server runs on epoll\n");
+
+	if (opts.format == "csv") printf("protocol,connections,pipeline,mix,value_size,ops,ops_per_sec,p50_us,p99_us,p999_us\n");
+
+	for (const string& protocol : opts.protocol)
+		for (const size_t connections : opts.connections)
+			for (const size_t pipeline : opts.pipeline)
+				for (const auto& mix : opts.mix)
+					for (const size_t value_size : opts.value_size) {
+						const Workload w{protocol, connections, pipeline, mix, value_size};
+						try {
+							print(opts, w, run(server, config, opts, w));
+						} catch (const std::exception& e) {
+							fprintf(stderr, "%s\n", e.what());
+							return 1;
+						}
+					}
+	server.stop();
+	return 0;
+}
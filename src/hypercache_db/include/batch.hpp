@@ -0,0 +1,161 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <sys/uio.h>
+#include <boost/asio/buffer.hpp>
+
+#include "lib/datachunk/datachunk.hpp"
+
+using namespace std;
+
+namespace server {
+	/**
+	 * ResponseBatch collects the responses of one event loop turn, they are written with a single gather write
+	 *
+	 * Response headers and small values are appended to a byte arena, large values are appended as ProtoPin,
+	 * their bytes are referenced by the gather list and not copied. The pins are held until clear() is called
+	 * (after the write completed).
+	 */
+	class ResponseBatch {
+	public:
+		// Values up to this size are copied into the arena (a copy is cheaper than a separate iovec)
+		static constexpr size_t copy_limit = 1024;
+		// Arena capacity that is kept after clear()
+		static constexpr size_t keep_capacity = 1 << 20;
+
+		ResponseBatch() = default;
+		ResponseBatch(const ResponseBatch&) = delete;
+		ResponseBatch& operator=(const ResponseBatch&) = delete;
+
+		/**
+		 * Returns the byte arena, response frames are written to it directly (see protocol::Writer)
+		 */
+		vector<uint8_t>& bytes() noexcept {
+			return arena;
+		};
+
+		/**
+		 * Appends the bytes of the pinned value
+		 */
+		void append(datachunk::ProtoPin&& pin) {
+			if (!pin.size()) return;
+			if (pin.size() <= copy_limit) {
+				views.clear();
+				pin.buffers(views);
+				for (const iovec& view : views) {
+					const uint8_t* data = static_cast<const uint8_t*>(view.iov_base);
+					arena.insert(arena.end(), data, data + view.iov_len);
+				}
+				return;
+			}
+			pinned += pin.size();
+			pins.push_back(PinnedRange{arena.size(), std::move(pin)});
+		};
+
+		/**
+		 * Returns the gather list of the batch
+		 *
+		 * The list is valid until the batch is modified.
+		 */
+		const vector<boost::asio::const_buffer>& buffers() {
+			list.clear();
+			size_t offset = 0;
+			for (PinnedRange& range : pins) {
+				if (range.offset > offset) list.emplace_back(arena.data() + offset, range.offset - offset);
+				offset = range.offset;
+				views.clear();
+				range.pin.buffers(views);
+				for (const iovec& view : views) list.emplace_back(view.iov_base, view.iov_len);
+			}
+			if (arena.size() > offset) list.emplace_back(arena.data() + offset, arena.size() - offset);
+			return list;
+		};
+
+		/**
+		 * Returns the number of bytes in the batch
+		 */
+		size_t size() const noexcept {
+			return arena.size() + pinned;
+		};
+
+		bool empty() const noexcept {
+			return arena.empty() && pins.empty();
+		};
+
+		/**
+		 * Position in the batch, see truncate()
+		 */
+		struct Mark {
+			size_t bytes;
+			size_t pins;
+		};
+
+		/**
+		 * Returns the current position of the batch
+		 */
+		Mark mark() const noexcept {
+			return Mark{arena.size(), pins.size()};
+		};
+
+		/**
+		 * Removes everything that was appended after the mark and releases the pins of it
+		 */
+		void truncate(const Mark& mark) {
+			while (pins.size() > mark.pins) {
+				pinned -= pins.back().pin.size();
+				pins.pop_back();
+			}
+			arena.resize(mark.bytes);
+		};
+
+		/**
+		 * Clears the batch and releases the pins
+		 */
+		void clear() {
+			if (arena.capacity() > keep_capacity) arena = vector<uint8_t>();
+			else arena.clear();
+			pins.clear();
+			list.clear();
+			pinned = 0;
+		};
+
+	private:
+		// Pin that is inserted at offset of the arena
+		struct PinnedRange {
+			size_t offset;
+			datachunk::ProtoPin pin;
+		};
+
+		vector<uint8_t> arena;
+		// Pins are not moved after insertion (views point into them)
+		deque<PinnedRange> pins;
+		size_t pinned = 0;
+		vector<boost::asio::const_buffer> list;
+		vector<iovec> views;
+	};
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core.hpp"
+#include "batch.hpp"
+#include "lease.hpp"
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+namespace server {
+	/**
+	 * BinaryCodec executes the frames of the native protocol (see lib/protocol/protocol.hpp)
+	 *
+	 * One codec is used per connection, it is not thread safe.
+	 * Writes invalidate the leases of the key if a LeaseTable is passed, LEASE requests are only granted a lease
+	 * after the connection subscribed to the invalidations (see Session), otherwise they are answered with lease 0.
+	 */
+	class BinaryCodec {
+	public:
+		BinaryCodec(core::CoreMap& map, size_t max_frame, LeaseTable* leases = nullptr)
+			: map(map), max_frame(max_frame), leases(leases) {};
+
+		/**
+		 * Sets the subscriber that receives the invalidations of the leases of this connection
+		 */
+		void subscribe(shared_ptr<Subscriber> subscriber) {
+			if (leases) this->subscriber = std::move(subscriber);
+		};
+
+		/**
+		 * Executes all complete frames in data and appends their responses to the batch
+		 *
+		 * Returns the number of consumed bytes, an incomplete frame at the end is not consumed.
+		 * Throws a runtime_error if a frame is invalid (the connection must be closed then).
+		 */
+		size_t process(const uint8_t* data, size_t size, ResponseBatch& batch);
+	private:
+		void execute(uint32_t id, uint8_t op, protocol::Reader& payload, ResponseBatch& batch);
+		// Invalidates the leases of the key (after it was written)
+		void written(string_view key) {
+			if (leases) leases->invalidate(key);
+		};
+
+		core::CoreMap& map;
+		size_t max_frame;
+		LeaseTable* leases;
+		shared_ptr<Subscriber> subscriber;
+		// Scratch buffers for the request fields (map operations take const string&)
+		string key;
+		string member;
+		vector<string> keys;
+	};
+}
+
+#endif
@@ -22,14 +22,259 @@
 
 #include <chrono>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
+#include <boost/asio/buffer.hpp>
+
+#include "lib/hypermap/hypermap.hpp"
+#include "lib/datachunk/datachunk.hpp"
+
 using namespace std;
 
+namespace core {
+	/**
+	 * Map type that holds all data of the database
+	 *
+	 * The keys are chosen by the clients, so the map uses the keyed SipHash13 policy (collisions can not be precomputed).
+	 */
+	using CoreMap = hypermap::BasicHyperMap<hyperhash::SipHash13,
+		datachunk::DataChunk, datachunk::ProtoChunk, datachunk::CountChunk, datachunk::GroupChunk>;
+
+	/**
+	 * Thrown if a key holds a value of another type than the operation expects
+	 */
+	class type_error : public runtime_error {
+	public:
+		using runtime_error::runtime_error;
+	};
+
+	/**
+	 * Key operations
+	 *
+	 * Operations on a single key that are shared by the frontends,
+	 * a type_error is thrown if the key holds a value of another type.
+	 */
+
+	/**
+	 * Enables the dictionary compression of small protos in proto_set (disabled by default)
+	 *
+	 * The caller must call train() of the global ProtoDictStore periodically, otherwise the samples are never used.
+	 */
+	void configure_dicts(bool enabled) noexcept;
+	/**
+	 * Enables the sorted hash array of groups that are created afterwards (disabled by default, see GroupSet::set_sorted)
+	 *
+	 * Sorted groups make the group set operations cheaper and every add / remove more expensive.
+	 */
+	void configure_groups(bool sorted) noexcept;
+	/**
+	 * Returns an empty group in the configured mode (see configure_groups)
+	 */
+	datachunk::GroupChunk make_group();
+	/**
+	 * Sets the proto of the key
+	 *
+	 * If dictionaries are enabled (see configure_dicts) and the value only fits inline when it is compressed
+	 * (see ProtoChunk::dict_eligible), the value is sampled for the dictionary training of the key prefix
+	 * and compressed with the trained dictionary of the prefix (if there is one, see ProtoDictStore).
+	 */
+	void proto_set(CoreMap& map, const string& key, const uint8_t* bytes, size_t size);
+	/**
+	 * Adds delta to the count of the key and returns the new count
+	 *
+	 * Missing keys are created with a count of 0.
+	 */
+	uint64_t count_add(CoreMap& map, const string& key, int64_t delta);
+	/**
+	 * Returns the count of the key without modifying it
+	 *
+	 * Missing keys are not created, their count is 0.
+	 */
+	uint64_t count_get(CoreMap& map, const string& key);
+	/**
+	 * Sets the count of the key to desired if it is expected, returns true if it was swapped
+	 *
+	 * Otherwise expected is set to the current count. A missing key has a count of 0 (it is created if expected is 0).
+	 * Throws a runtime_error if the counter is striped (see count_stripe).
+	 */
+	bool count_cas(CoreMap& map, const string& key, uint64_t& expected, uint64_t desired);
+	/**
+	 * Switches the counter of the key to / from the striped representation (see CountChunk::set_striped)
+	 *
+	 * Striped counters spread the increments of many threads over multiple cache lines, reads sum up the stripes.
+	 * Missing keys are created with a count of 0.
+	 */
+	void count_stripe(CoreMap& map, const string& key, bool striped);
+	/**
+	 * Adds the member to the group of the key, returns false if it is already a member
+	 *
+	 * Missing keys are created as empty group.
+	 */
+	bool group_add(CoreMap& map, const string& key, const string& member);
+	/**
+	 * Removes the member from the group of the key, returns false if the key or the member does not exist
+	 */
+	bool group_remove(CoreMap& map, const string& key, string_view member);
+	/**
+	 * Calls the visitor with every member of the group while the group is read locked
+	 *
+	 * Returns false if the key does not exist.
+	 */
+	bool group_members(CoreMap& map, const string& key, const function<void(string_view)>& visitor);
+	/**
+	 * Calls begin with the number of members and then the visitor with every member, while the group is read locked
+	 *
+	 * Returns false if the key does not exist (begin is not called).
+	 */
+	bool group_members(CoreMap& map, const string& key, const function<void(size_t)>& begin, const function<void(string_view)>& visitor);
+
+	/**
+	 * Group set operations
+	 *
+	 * The groups are read under their shared slot locks, all locks are acquired in slot index order
+	 * and held during the operation (so the result is a consistent snapshot of all groups).
+	 * Members are compared by their 64-bit hash on the sorted hash arrays of the groups (see GroupSet / setops.hpp).
+	 *
+	 * Keys that do not exist are treated as empty groups,
+	 * a type_error is thrown if a key is not of type GROUP and an invalid_argument if there are more than max_group_keys keys.
+	 */
+
+	// Maximum number of keys of one group set operation (every distinct key holds a slot lock during the operation)
+	constexpr size_t max_group_keys = 1024;
+
+	/**
+	 * Returns the members that are in all groups
+	 */
+	vector<string> group_inter(CoreMap& map, const vector<string>& keys);
+	/**
+	 * Returns the number of members that are in all groups
+	 *
+	 * If limit is not 0, the count is capped at limit and the intersection stops as soon as it is reached.
+	 */
+	size_t group_intercard(CoreMap& map, const vector<string>& keys, size_t limit = 0);
+	/**
+	 * Returns the members that are in any of the groups
+	 */
+	vector<string> group_union(CoreMap& map, const vector<string>& keys);
+	/**
+	 * Returns the members of the first group that are in none of the other groups
+	 */
+	vector<string> group_diff(CoreMap& map, const vector<string>& keys);
+
+	/**
+	 * Filter of a group query
+	 */
+	struct QueryFilter {
+		// Only members of this type are returned (NONE returns all types)
+		datachunk::DataType type = datachunk::NONE;
+		// Only COUNT members with a count in [count_min, count_max] are returned
+		bool count_range = false;
+		uint64_t count_min = 0;
+		uint64_t count_max = numeric_limits<uint64_t>::max();
+		// Maximum number of returned members (0 = unlimited)
+		size_t limit = 0;
+	};
+
+	/**
+	 * Member returned by a group query
+	 *
+	 * Depending on the type, proto (PROTO) or count (COUNT) contains the value, GROUP members only return the key.
+	 */
+	struct QueryMember {
+		string key;
+		datachunk::DataType type;
+		string proto;
+		uint64_t count = 0;
+	};
+
+	/**
+	 * Resolves the members of a group, filters them and returns their values in one pass
+	 *
+	 * Members are resolved with their SlotHandles in slot order (prefetched ahead, see HyperMap::resolve_all),
+	 * members with a stale handle are looked up by key and their handles are repaired in the group afterwards.
+	 * Members that no longer exist are skipped. The members are returned in slot order.
+	 *
+	 * Throws a runtime_error if the key is not of type GROUP.
+	 */
+	vector<QueryMember> group_query(CoreMap& map, const string& group, const QueryFilter& filter);
+
+	/**
+	 * Pins the proto of the key for a zero copy response
+	 *
+	 * The slot is only read locked while the pin is taken, the pin keeps the value alive until it is destroyed
+	 * (release it after the write of the buffers completed). Returns an empty pin if the key does not exist.
+	 *
+	 * Throws a type_error if the key is not of type PROTO.
+	 */
+	datachunk::ProtoPin pin_proto(CoreMap& map, const string& key);
+	/**
+	 * Pins the stored frames of the proto of the key (compressed segments are not decompressed, see ProtoPin::frames)
+	 *
+	 * Returns an empty pin if the key does not exist, throws a type_error if the key is not of type PROTO.
+	 */
+	datachunk::ProtoPin pin_proto_frames(CoreMap& map, const string& key);
+
+	/**
+	 * Appends the buffers of the pin to out (one buffer per segment, see ProtoPin::buffers)
+	 */
+	void proto_buffers(datachunk::ProtoPin& pin, vector<boost::asio::const_buffer>& out);
+
+	/**
+	 * Snapshots
+	 *
+	 * A snapshot file contains every key of the map with its value and expiry, it is shared by the server
+	 * and the embedded library (lib/embedded/hypercache.hpp), so both can load the snapshots of the other.
+	 * All integers are little endian, str = [u32 size][bytes]:
+	 *
+	 *   header:  "HCSNAP" u16 version
+	 *   record:  u8 type, u64 expiry (unix time in ms, 0 = no expiry), str key, value
+	 *              PROTO  u64 size, raw bytes (uncompressed)
+	 *              COUNT  u64 count
+	 *              GROUP  u32 count, str member...
+	 *   trailer: u8 0xff, u64 record count
+	 */
+
+	/**
+	 * Writes a snapshot of the map to path and returns the number of written keys
+	 *
+	 * The snapshot is written to a temporary file that replaces path once it is complete.
+	 * The slots are read one at a time, keys that are modified during the call may be in any state.
+	 * Throws a runtime_error if the file can not be written.
+	 */
+	size_t snapshot_save(CoreMap& map, const string& path);
+	/**
+	 * Loads the snapshot at path into the map and returns the number of loaded keys
+	 *
+	 * Loaded keys overwrite existing keys, keys that expired since the snapshot was written are skipped.
+	 * Throws a runtime_error if the file can not be read or is not a valid snapshot.
+	 */
+	size_t snapshot_load(CoreMap& map, const string& path);
 
-  
+	// Fraction of tombstones in the map that triggers a compaction
+	constexpr double max_tombstones = 0.125;
+	/**
+	 * Rehashes the map if more than max_tombstones of its slots are tombstones, returns true if the map was rehashed
+	 *
+	 * Deleted and expired keys leave tombstones that lengthen the probe sequences, they are only cleared by a rehash.
+	 * The rehash blocks all operations on the map, call it from a thread that serves no requests.
+	 */
+	bool compact(CoreMap& map);
 
+	/**
+	 * Returns the stats report of the map (served by STATS / INFO)
+	 *
+	 * The report has the sections "keyspace" (keys and slots), "probe" (probe histograms and load gauges, see HYPERMAP_PROBE_STATS)
+	 * and "locks" (slot lock contention and the most contended keys, see HYPERMAP_LOCK_STATS).
+	 * Every section starts with a "# Name" line followed by "name:value" lines (see hypermap::append_info).
+	 * An empty section (or "all") returns all sections, an unknown section returns an empty report.
+	 */
+	string stats(CoreMap& map, string_view section = "");
+}
 
 #endif
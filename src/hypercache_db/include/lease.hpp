@@ -0,0 +1,125 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace server {
+	/**
+	 * Subscriber receives the invalidations of the keys a connection holds a lease on
+	 *
+	 * Writers push the keys from any thread, notify is called on the first key after take() (it must
+	 * hand over to the thread of the connection, which collects the keys with take()).
+	 */
+	class Subscriber {
+	public:
+		explicit Subscriber(function<void()> notify) : notify(std::move(notify)) {};
+
+		/**
+		 * Queues the invalidation of the key
+		 */
+		void push(string_view key);
+		/**
+		 * Moves the queued keys to out (out is cleared)
+		 */
+		void take(vector<string>& out);
+		/**
+		 * Discards all later pushes (the connection was closed)
+		 */
+		void close();
+	private:
+		mutex lock;
+		vector<string> keys;
+		function<void()> notify;
+		bool closed = false;
+	};
+
+	/**
+	 * LeaseTable tracks which connections hold a lease on a key (see protocol LEASE)
+	 *
+	 * The first write of a key after the lease was granted pushes the invalidation to all holders,
+	 * the key is forgotten afterwards (holders renew the lease with the next LEASE read).
+	 * The table is split into stripes with their own lock, each stripe holds at most max_keys / stripe_count keys.
+	 * Expired holders are dropped lazily, a lease is refused if the stripe is still full then.
+	 */
+	class LeaseTable {
+	public:
+		static constexpr size_t stripe_count = 64;
+
+		LeaseTable(size_t max_keys, chrono::milliseconds max_lease);
+		LeaseTable(const LeaseTable&) = delete;
+		LeaseTable& operator=(const LeaseTable&) = delete;
+
+		/**
+		 * Registers the subscriber as holder of the key, returns the granted lease (0 = refused)
+		 *
+		 * The lease is capped to max_lease. It must be granted before the value is read,
+		 * so a write that the read does not observe pushes an invalidation.
+		 */
+		chrono::milliseconds grant(string_view key, const shared_ptr<Subscriber>& subscriber, chrono::milliseconds lease);
+		/**
+		 * Pushes the invalidation of the key to its holders (must be called after the key was written)
+		 */
+		void invalidate(string_view key);
+	private:
+		struct Holder {
+			weak_ptr<Subscriber> subscriber;
+			chrono::steady_clock::time_point expiry;
+		};
+
+		struct KeyHash {
+			using is_transparent = void;
+			size_t operator()(string_view key) const noexcept {
+				return hash<string_view>()(key);
+			};
+		};
+
+		struct alignas(64) Stripe {
+			mutex lock;
+			unordered_map<string, vector<Holder>, KeyHash, equal_to<>> keys;
+		};
+
+		Stripe& stripe(string_view key);
+		// Drops the keys whose holders all expired
+		void sweep(Stripe& stripe, chrono::steady_clock::time_point now);
+
+		array<Stripe, stripe_count> stripes;
+		// Number of tracked keys, writes skip the stripes while it is 0
+		atomic<size_t> active{0};
+		size_t stripe_keys;
+		chrono::milliseconds max_lease;
+	};
+}
+
+#endif
@@ -1,4 +1,29 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "server.hpp"
+
+/**
+ * Options of the hypercache_db process
+ */
+struct Options {
+  // Number of slots of the map
+  size_t slots = 1 << 20;
+  // Snapshot file, loaded on start (if it exists) and written on shutdown (empty = disabled)
+  string snapshot;
+  // Minimum size of bulk protos that are compressed (0 = disabled, see datachunk::ProtoChunk::configure_compression)
+  size_t compress_threshold = 0;
+  // Interval of the proto dictionary training (0 = dictionary compression disabled, see core::configure_dicts)
+  chrono::milliseconds dict_train{10000};
+  // Interval of the tombstone check (0 = tombstones are only cleared by the defensive rehash, see core::compact)
+  chrono::milliseconds compact_interval{1000};
+  // Keeps the sorted hash array in every group (see core::configure_groups)
+  bool group_sorted = false;
+  server::ServerConfig server;
+};
+
 #endif
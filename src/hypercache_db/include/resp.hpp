@@ -0,0 +1,91 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESP_H
+#define RESP_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "core.hpp"
+#include "batch.hpp"
+#include "lease.hpp"
+
+using namespace std;
+
+namespace server {
+	/**
+	 * RespCodec executes Redis protocol (RESP2 / RESP3) commands, so Redis clients and tools can be used
+	 *
+	 * Commands are parsed incrementally and in place: the arguments are views into the receive buffer,
+	 * an incomplete command is left in the buffer until the rest is received.
+	 * Clients start with RESP2, HELLO 3 switches the connection to RESP3.
+	 *
+	 * Supported commands (mapped onto the DataChunk types):
+	 *
+	 *   GET, SET [EX|PX], MGET, DEL            PROTO (GET / MGET return COUNT values as decimal string)
+	 *   INCR, INCRBY, DECR, DECRBY             COUNT
+	 *   SADD, SREM, SMEMBERS                   GROUP
+	 *   EXPIRE, PEXPIRE                        any type
+	 *   INFO [section]                         stats report of the map (see core::stats)
+	 *   PING, ECHO, HELLO, SELECT, QUIT        connection
+	 *   COMMAND, CONFIG GET, CLIENT            answered with empty replies (used by redis-benchmark / memtier_benchmark)
+	 *
+	 * One codec is used per connection, it is not thread safe.
+	 * Writes invalidate the leases of the key if a LeaseTable is passed (leases are only granted by BinaryCodec).
+	 */
+	class RespCodec {
+	public:
+		RespCodec(core::CoreMap& map, size_t max_bulk, LeaseTable* leases = nullptr)
+			: map(map), max_bulk(max_bulk), leases(leases) {};
+
+		/**
+		 * Executes all complete commands in data and appends their replies to the batch
+		 *
+		 * Returns the number of consumed bytes, an incomplete command at the end is not consumed.
+		 * Throws a runtime_error if the input is not valid RESP (the connection must be closed then).
+		 */
+		size_t process(const uint8_t* data, size_t size, ResponseBatch& batch);
+	private:
+		// Maximum number of arguments of a command
+		static constexpr size_t max_args = 1024 * 1024;
+
+		// Parses one command into args, returns the consumed bytes (0 if the command is incomplete)
+		size_t parse(const char* data, size_t size);
+		void execute(ResponseBatch& batch);
+		// Invalidates the leases of the key (after it was written)
+		void written(string_view key) {
+			if (leases) leases->invalidate(key);
+		};
+
+		core::CoreMap& map;
+		size_t max_bulk;
+		LeaseTable* leases;
+		// Protocol version of the connection (2 or 3)
+		int version = 2;
+		// Arguments of the current command (views into the receive buffer)
+		vector<string_view> args;
+		// Scratch buffer for keys (map operations take const string&)
+		string key;
+	};
+}
+
+#endif
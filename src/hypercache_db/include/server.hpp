@@ -0,0 +1,164 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "core.hpp"
+#include "lease.hpp"
+#include "session.hpp"
+
+using namespace std;
+
+namespace server {
+	class UringWorker;
+
+	/**
+	 * Event loop backend of the server
+	 */
+	enum Backend {
+		// asio sessions (epoll on Linux)
+		EPOLL,
+		// io_uring workers (see UringWorker)
+		URING,
+	};
+
+	/**
+	 * Configuration of the server
+	 */
+	struct ServerConfig {
+		string address = "0.0.0.0";
+		// Port of the native protocol (0 = ephemeral port, see Server::port())
+		uint16_t port = 7400;
+		// Enables the Redis protocol listener (see RespCodec)
+		bool resp = true;
+		// Port of the Redis protocol (0 = ephemeral port, see Server::resp_port())
+		uint16_t resp_port = 6379;
+		// Number of event loop threads (0 = number of cores)
+		size_t threads = 0;
+		// Maximum request frame size
+		size_t max_frame = 64 * 1024 * 1024;
+		// Event loop backend, URING falls back to EPOLL if the kernel does not support it (see Server::backend())
+		Backend backend = EPOLL;
+		// Path of the Unix socket of the native protocol (empty = disabled)
+		string unix_path;
+		// Path of the Unix socket that hands out shared memory channels (empty = disabled, see ShmSession)
+		string shm_path;
+		// Size of each ring of a shared memory channel (power of two, multiple of the page size)
+		size_t shm_ring = 1024 * 1024;
+		// Time a shared memory session polls its rings after the last request before it sleeps
+		chrono::microseconds shm_spin{50};
+		// Maximum number of keys with leases (see LeaseTable, only TCP and Unix socket sessions are granted leases)
+		size_t max_leases = 1024 * 1024;
+		// Maximum lease a holder is granted
+		chrono::milliseconds max_lease{10000};
+		SessionConfig session;
+	};
+
+	/**
+	 * Server accepts the connections of the native protocol (see lib/protocol/protocol.hpp) and the Redis protocol (see resp.hpp)
+	 *
+	 * With the EPOLL backend every thread runs its own io_context, connections are assigned round robin to the contexts.
+	 * With the URING backend every thread runs a UringWorker, the kernel balances the connections between their listeners.
+	 * Either way a connection stays on its thread for its whole lifetime.
+	 *
+	 * The Unix socket listeners (native protocol and shared memory channels) always run on the io_contexts,
+	 * with the URING backend the context threads are only started if one of them is enabled.
+	 */
+	class Server {
+	public:
+		Server(core::CoreMap& map, const ServerConfig& config);
+		Server(const Server&) = delete;
+		Server& operator=(const Server&) = delete;
+		~Server();
+
+		/**
+		 * Binds the listener and starts the event loop threads
+		 *
+		 * Throws a boost::system::system_error if the address can not be bound.
+		 */
+		void start();
+		/**
+		 * Stops the event loops and joins the threads
+		 *
+		 * Open connections are closed when the server is destroyed.
+		 */
+		void stop();
+		/**
+		 * Returns the bound port of the native protocol (valid after start())
+		 */
+		uint16_t port() const noexcept;
+		/**
+		 * Returns the bound port of the Redis protocol (valid after start(), 0 if it is disabled)
+		 */
+		uint16_t resp_port() const noexcept;
+		/**
+		 * Returns the backend that runs the connections (valid after start())
+		 */
+		Backend backend() const noexcept;
+
+	private:
+		// Pause of the accept loops if the process is out of descriptors (or memory)
+		static constexpr chrono::milliseconds accept_backoff{10};
+
+		// Runs the connections on asio sessions
+		void start_epoll();
+		// Runs the connections on io_uring workers, each worker binds its own listeners
+		void start_uring();
+		// Binds the Unix socket listeners on the first context
+		void start_local();
+		// Starts one thread per io_context
+		void run_contexts();
+		// Binds a listener on the first context
+		unique_ptr<boost::asio::ip::tcp::acceptor> listen(uint16_t port);
+		// Binds a Unix socket listener on the first context, a stale socket file is replaced
+		unique_ptr<boost::asio::local::stream_protocol::acceptor> listen(const string& path);
+		// Accept loop, make_session creates the session of each connection (it is started on the context of the socket)
+		template <typename Acceptor_T, typename Factory_T>
+		boost::asio::awaitable<void> accept(Acceptor_T& acceptor, Factory_T make_session);
+		// Returns the next context (round robin)
+		boost::asio::io_context& next_context();
+
+		core::CoreMap& map;
+		ServerConfig config;
+		// Declared before the contexts, the sessions are destroyed first
+		LeaseTable leases;
+		vector<unique_ptr<boost::asio::io_context>> contexts;
+		vector<thread> threads;
+		unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+		unique_ptr<boost::asio::ip::tcp::acceptor> resp_acceptor;
+		unique_ptr<boost::asio::local::stream_protocol::acceptor> unix_acceptor;
+		unique_ptr<boost::asio::local::stream_protocol::acceptor> shm_acceptor;
+		vector<unique_ptr<UringWorker>> workers;
+		vector<int> listeners;
+		uint16_t bound_port = 0;
+		uint16_t bound_resp_port = 0;
+		size_t context_index = 0;
+	};
+}
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "batch.hpp"
+#include "lease.hpp"
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+namespace server {
+	/**
+	 * Limits of a session
+	 */
+	struct SessionConfig {
+		// Initial size of the read buffer
+		size_t read_buffer = 64 * 1024;
+		// Maximum size of the read buffer (must hold the largest frame of the protocol)
+		size_t max_read_buffer = 64 * 1024 * 1024 + 64 * 1024;
+		// Responses that are buffered while a write is in flight before reading pauses
+		size_t max_pending = 4 * 1024 * 1024;
+	};
+
+	/**
+	 * Session handles a single connection
+	 *
+	 * The codec parses the received bytes, executes the requests and appends the responses to the pending batch.
+	 * A client can pipeline any number of requests: after every read all complete requests are executed and their
+	 * responses are sent with a single gather write (writev). While a write is in flight, new responses are
+	 * collected in the second batch, which is sent as soon as the write completes.
+	 * If the pending batch exceeds max_pending, reading pauses until the write completed (backpressure).
+	 *
+	 * The session runs two coroutines, the read loop and the write loop, they wake each other through a timer
+	 * that never expires (cancel() resumes the waiting loop). Coroutines are only spawned per connection,
+	 * a request never allocates a frame of its own: the frames of the awaited operations come from the
+	 * per-thread recycling allocator of asio (see BOOST_ASIO_RECYCLING_ALLOCATOR_CACHE_SIZE in the BUILD file).
+	 *
+	 * Both loops run on the io_context of the socket, which is run by a single thread
+	 * (so the session needs no synchronization).
+	 *
+	 * Codec_T must provide: size_t process(const uint8_t* data, size_t size, ResponseBatch& batch)
+	 * If it provides subscribe(shared_ptr<Subscriber>), the session pushes the invalidations of the leases
+	 * of the connection (see LeaseTable): they are posted to the thread of the socket and appended to the pending batch.
+	 */
+	template <typename Codec_T, typename Socket_T>
+	class Session : public enable_shared_from_this<Session<Codec_T, Socket_T>> {
+	public:
+		Session(Socket_T socket, Codec_T codec, const SessionConfig& config)
+			: socket(std::move(socket)), codec(std::move(codec)), config(config), input(config.read_buffer),
+				signal(this->socket.get_executor()) {
+			signal.expires_at(boost::asio::steady_timer::time_point::max());
+		};
+
+		/**
+		 * Spawns the read and write loop (must be called on the thread of the socket)
+		 *
+		 * Each loop holds a reference to the session, it is destroyed when both loops returned.
+		 */
+		void start() {
+			if constexpr (requires(Codec_T& codec) { codec.subscribe(shared_ptr<Subscriber>()); }) {
+				weak_ptr<Session> weak = this->shared_from_this();
+				subscriber = make_shared<Subscriber>([weak, executor = socket.get_executor()] {
+					boost::asio::post(executor, [weak] {
+						if (auto self = weak.lock()) self->deliver();
+					});
+				});
+				codec.subscribe(subscriber);
+			}
+			boost::asio::co_spawn(socket.get_executor(), read_loop(this->shared_from_this()), boost::asio::detached);
+			boost::asio::co_spawn(socket.get_executor(), write_loop(this->shared_from_this()), boost::asio::detached);
+		};
+
+	private:
+		// Minimum free space in the read buffer, below this the buffer is compacted / grown before reading
+		static constexpr size_t min_read = 4096;
+
+		// self is never read, it keeps the session alive while the loop is suspended
+		boost::asio::awaitable<void> read_loop([[maybe_unused]] shared_ptr<Session> self) {
+			boost::system::error_code ec;
+			while (!closed && prepare()) {
+				const size_t size = co_await socket.async_read_some(
+					boost::asio::buffer(input.data() + input_end, input.size() - input_end),
+					boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+				if (ec) break;
+				input_end += size;
+				try {
+					input_begin += codec.process(input.data() + input_begin, input_end - input_begin, batches[pending]);
+				} catch (const exception&) {
+					// Protocol violation, the stream can not be resynchronized
+					break;
+				}
+				if (!batches[pending].empty()) wake();
+				while (!closed && batches[pending].size() >= config.max_pending) co_await wait();
+			}
+			close();
+		};
+
+		// self is never read, it keeps the session alive while the loop is suspended
+		boost::asio::awaitable<void> write_loop([[maybe_unused]] shared_ptr<Session> self) {
+			boost::system::error_code ec;
+			for (;;) {
+				while (!closed && batches[pending].empty()) co_await wait();
+				if (closed) break;
+				ResponseBatch& batch = batches[pending];
+				pending ^= 1;
+				// The new pending batch is empty, resumes a read loop that waits for it to drain
+				wake();
+				co_await boost::asio::async_write(socket, batch.buffers(),
+					boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+				// Releases the pins of the written values
+				batch.clear();
+				if (ec) break;
+			}
+			close();
+		};
+
+		/**
+		 * Makes room for the next read, returns false if the incomplete request exceeds max_read_buffer
+		 */
+		bool prepare() {
+			if (input_begin == input_end) {
+				input_begin = input_end = 0;
+			} else if (input.size() - input_end < min_read) {
+				// Move the incomplete request to the front, grow the buffer if it still does not fit
+				memmove(input.data(), input.data() + input_begin, input_end - input_begin);
+				input_end -= input_begin;
+				input_begin = 0;
+				if (input.size() - input_end < min_read) {
+					if (input.size() >= config.max_read_buffer) return false;
+					input.resize(min(input.size() * 2, config.max_read_buffer));
+				}
+			}
+			return true;
+		};
+
+		/**
+		 * Suspends the loop until the other loop calls wake() or the session is closed
+		 */
+		boost::asio::awaitable<void> wait() {
+			boost::system::error_code ignored;
+			co_await signal.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ignored));
+		};
+
+		void wake() {
+			signal.cancel();
+		};
+
+		/**
+		 * Appends the queued invalidations as push frames to the pending batch
+		 */
+		void deliver() {
+			if (closed) return;
+			subscriber->take(invalidated);
+			if (invalidated.empty()) return;
+			protocol::Writer writer(batches[pending].bytes());
+			for (const string& key : invalidated) {
+				writer.begin(protocol::push_id, protocol::INVALIDATE);
+				writer.raw(key);
+				writer.end();
+			}
+			wake();
+		};
+
+		void close() {
+			if (closed) return;
+			closed = true;
+			boost::system::error_code ignored;
+			socket.close(ignored);
+			signal.cancel();
+			if (subscriber) subscriber->close();
+		};
+
+		Socket_T socket;
+		Codec_T codec;
+		SessionConfig config;
+		// Received bytes, [input_begin, input_end) is not processed yet
+		vector<uint8_t> input;
+		size_t input_begin = 0;
+		size_t input_end = 0;
+		// batches[pending] collects responses, the other batch is written
+		ResponseBatch batches[2];
+		size_t pending = 0;
+		// Wakes the loop that waits in wait()
+		boost::asio::steady_timer signal;
+		bool closed = false;
+		// Receives the invalidations of the leases of the connection (null if the codec does not grant leases)
+		shared_ptr<Subscriber> subscriber;
+		vector<string> invalidated;
+	};
+}
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "batch.hpp"
+#include "codec.hpp"
+#include "lib/hypershm/hypershm.hpp"
+
+using namespace std;
+
+namespace server {
+	/**
+	 * ShmSession serves the native protocol over a shared memory channel (see lib/hypershm/hypershm.hpp)
+	 *
+	 * The session is created for a connection of the channel socket: it creates the channel and passes it to the client,
+	 * the connection is then only watched, the client closes it to end the channel.
+	 *
+	 * The requests are parsed in place from the request ring and the responses of one turn are collected in a batch,
+	 * which is copied into the response ring. New requests are only executed once the batch is copied completely,
+	 * so a client that does not read its responses stops the session (backpressure).
+	 * After the last progress the session keeps polling the rings for "spin" (yielding to the other sessions
+	 * of the io_context between the polls), then it sleeps on its eventfd until the client wakes it.
+	 * On a single core the session never polls (the client can not make progress while the session polls).
+	 *
+	 * The session runs on the io_context of its socket, which is run by a single thread.
+	 */
+	class ShmSession : public enable_shared_from_this<ShmSession> {
+	public:
+		/**
+		 * Creates the channel with rings of ring_size bytes and sends it to the client
+		 *
+		 * Throws a system_error if the channel can not be created or sent.
+		 */
+		ShmSession(boost::asio::local::stream_protocol::socket socket, BinaryCodec codec, size_t ring_size, chrono::microseconds spin);
+
+		/**
+		 * Spawns the poll loop and the watch loop (must be called on the thread of the socket)
+		 */
+		void start();
+
+	private:
+		boost::asio::awaitable<void> poll_loop(shared_ptr<ShmSession> self);
+		boost::asio::awaitable<void> watch_loop(shared_ptr<ShmSession> self);
+		/**
+		 * Copies the batch into the response ring and executes the requests of the request ring, returns true on progress
+		 *
+		 * Throws a runtime_error if a request is invalid or exceeds the ring, or if the ring indices are corrupted.
+		 */
+		bool poll();
+		/**
+		 * Copies the rest of the batch into the response ring, returns true if any byte was copied
+		 *
+		 * Throws a runtime_error if the ring indices are corrupted.
+		 */
+		bool flush();
+		/**
+		 * Returns true if poll() can make progress
+		 */
+		bool ready();
+		void close();
+
+		boost::asio::local::stream_protocol::socket socket;
+		hypershm::Channel channel;
+		// Eventfd the session sleeps on
+		boost::asio::posix::stream_descriptor event;
+		BinaryCodec codec;
+		chrono::microseconds spin;
+		ResponseBatch batch;
+		// Gather list of the batch, [flush_index, flush_offset] is the next byte to copy
+		vector<boost::asio::const_buffer> flush_list;
+		size_t flush_index = 0;
+		size_t flush_offset = 0;
+		// Readable bytes of the request ring that hold no complete request (the session waits for more)
+		size_t stalled = 0;
+		bool closed = false;
+	};
+}
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <linux/io_uring.h>
+
+#include "lib/hyperring/hyperring.hpp"
+#include "server.hpp"
+
+using namespace std;
+
+namespace server {
+	struct UringConnection;
+
+	/**
+	 * UringWorker runs the connections of one thread on an io_uring (see the URING backend of ServerConfig)
+	 *
+	 * Every worker owns a ring, its own listeners (SO_REUSEPORT, the kernel balances the connections between the workers)
+	 * and a sparse table of registered files: connections are accepted with a multishot accept straight into the table,
+	 * so they are never installed in the file table of the process. Every connection has a multishot receive that takes
+	 * its buffers from the provided buffer ring of the worker.
+	 *
+	 * One loop turn submits all queued entries and waits for completions with a single io_uring_enter,
+	 * handles every available completion (the codecs execute the received requests) and then queues one
+	 * gather send (sendmsg) per connection that got responses in this turn.
+	 */
+	class UringWorker {
+	public:
+		// Submission queue entries of the ring
+		static constexpr unsigned ring_entries = 4096;
+		// Receive buffers of the provided buffer ring
+		static constexpr uint16_t buffer_count = 512;
+		static constexpr uint32_t buffer_size = 16 * 1024;
+		// Maximum number of connections of a worker (bounded by RLIMIT_NOFILE)
+		static constexpr unsigned max_files = 1 << 16;
+
+		/**
+		 * Sets up the ring, the listeners must be bound and listening (resp_listener is -1 if it is disabled)
+		 *
+		 * The connections invalidate the leases of the written keys, they do not grant leases themselves.
+		 * Throws a system_error if the ring can not be set up.
+		 */
+		UringWorker(core::CoreMap& map, LeaseTable& leases, const ServerConfig& config, int listener, int resp_listener);
+		UringWorker(const UringWorker&) = delete;
+		UringWorker& operator=(const UringWorker&) = delete;
+		~UringWorker();
+
+		/**
+		 * Runs the event loop until stop() is called
+		 */
+		void run();
+		/**
+		 * Stops the event loop (thread safe)
+		 */
+		void stop();
+
+		/**
+		 * Creates a listening socket with SO_REUSEPORT (every worker binds its own socket to the port)
+		 *
+		 * Throws a system_error if the address can not be bound.
+		 */
+		static int listen(const string& address, uint16_t port);
+		/**
+		 * Returns the bound port of a socket
+		 */
+		static uint16_t port(int socket);
+
+	private:
+		// Tag in the low bits of the user_data (connections are at least 8 byte aligned)
+		enum Tag : uint64_t {
+			RECV = 1,
+			SEND = 2,
+			CLOSE = 3,
+			CANCEL = 4,
+			ACCEPT = 5,
+			ACCEPT_RESP = 6,
+			WAKE = 7,
+		};
+		static constexpr uint64_t tag_mask = 7;
+
+		void handle(const io_uring_cqe& cqe);
+		void accept(int listener, Tag tag);
+		void on_accept(const io_uring_cqe& cqe, Tag tag);
+		void receive(UringConnection* connection);
+		void on_receive(UringConnection* connection, const io_uring_cqe& cqe);
+		void on_data(UringConnection* connection, const uint8_t* data, size_t size);
+		void flush(UringConnection* connection);
+		void send(UringConnection* connection);
+		void on_send(UringConnection* connection, const io_uring_cqe& cqe);
+		void close(UringConnection* connection);
+		// Cancels the multishot receive of the connection
+		void cancel(UringConnection* connection);
+		void release(UringConnection* connection);
+		void wait_wake();
+
+		core::CoreMap& map;
+		LeaseTable& leases;
+		ServerConfig config;
+		int listener;
+		int resp_listener;
+		unique_ptr<hyperring::Ring> ring;
+		unique_ptr<hyperring::BufferRing> buffers;
+		// Stop signal of the loop (read by the ring)
+		int wake_fd;
+		uint64_t wake_value = 0;
+		bool stopped = false;
+		// Connections that got responses in the current turn
+		vector<UringConnection*> dirty;
+		unordered_set<UringConnection*> connections;
+	};
+}
+
+#endif
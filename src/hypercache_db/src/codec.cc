@@ -0,0 +1,320 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <string_view>
+
+#include "codec.hpp"
+
+using namespace std;
+using namespace protocol;
+
+namespace server {
+	namespace {
+		// Writes a member list body (u32 count, str member...)
+		void write_members(Writer& writer, const vector<string>& members) {
+			writer.u32(static_cast<uint32_t>(members.size()));
+			for (const string& member : members) writer.str(member);
+		}
+
+		// Writes an error response, the body contains the message
+		void write_error(ResponseBatch& batch, uint32_t id, Status status, string_view message) {
+			Writer writer(batch.bytes());
+			writer.begin(id, status);
+			writer.raw(message);
+			writer.end();
+		}
+	}
+
+	size_t BinaryCodec::process(const uint8_t* data, size_t size, ResponseBatch& batch) {
+		size_t pos = 0;
+		while (size - pos >= header_size) {
+			const size_t length = get_u32(data + pos);
+			if (length < header_size - length_size || length > max_frame)
+				throw runtime_error("Invalid frame length");
+			if (size - pos < length + length_size) break;
+
+			const uint32_t id = get_u32(data + pos + length_size);
+			const uint8_t op = data[pos + header_size - 1];
+			Reader payload(data + pos + header_size, length + length_size - header_size);
+			pos += length + length_size;
+
+			// The response is rolled back (bytes and pins) if the operation fails, so the error frame is the only response
+			const ResponseBatch::Mark mark = batch.mark();
+			try {
+				execute(id, op, payload, batch);
+			} catch (const core::type_error& e) {
+				batch.truncate(mark);
+				write_error(batch, id, WRONG_TYPE, e.what());
+			} catch (const invalid_argument& e) {
+				batch.truncate(mark);
+				write_error(batch, id, BAD_REQUEST, e.what());
+			} catch (const exception& e) {
+				batch.truncate(mark);
+				write_error(batch, id, ERROR, e.what());
+			}
+		}
+		return pos;
+	}
+
+	void BinaryCodec::execute(uint32_t id, uint8_t op, Reader& payload, ResponseBatch& batch) {
+		// A throwing operation may leave a partial frame behind, process() truncates the batch to the start of the response
+		Writer writer(batch.bytes());
+		switch (op) {
+		case PING: {
+			writer.begin(id, OK);
+			writer.end();
+			return;
+		}
+		case GET: {
+			key.assign(payload.rest());
+			datachunk::ProtoPin pin = core::pin_proto(map, key);
+			if (!pin) {
+				writer.begin(id, NOT_FOUND);
+				writer.end();
+				return;
+			}
+			// The value is sent from the pin (no copy into the batch for large values)
+			writer.begin(id, OK);
+			writer.end(pin.size());
+			batch.append(std::move(pin));
+			return;
+		}
+		case GET_FRAMES: {
+			key.assign(payload.rest());
+			datachunk::ProtoPin pin = core::pin_proto_frames(map, key);
+			if (!pin) {
+				writer.begin(id, NOT_FOUND);
+				writer.end();
+				return;
+			}
+			// The stored bytes are sent from the pin, compressed segments are not decompressed
+			writer.begin(id, OK);
+			const size_t count_pos = batch.bytes().size();
+			writer.u32(0);
+			uint32_t count = 0;
+			pin.for_each_frame([&](bool compressed, size_t raw_size, size_t size) {
+				writer.u8(compressed);
+				writer.u32(static_cast<uint32_t>(raw_size));
+				writer.u32(static_cast<uint32_t>(size));
+				count++;
+			});
+			put_u32(batch.bytes().data() + count_pos, count);
+			writer.end(pin.size());
+			batch.append(std::move(pin));
+			return;
+		}
+		case SET: {
+			key.assign(payload.str());
+			const string_view value = payload.rest();
+			core::proto_set(map, key, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+			written(key);
+			writer.begin(id, OK);
+			writer.end();
+			return;
+		}
+		case DEL: {
+			key.assign(payload.rest());
+			map.del(key);
+			written(key);
+			writer.begin(id, OK);
+			writer.end();
+			return;
+		}
+		case INC: {
+			const int64_t delta = static_cast<int64_t>(payload.u64());
+			key.assign(payload.rest());
+			// A delta of 0 only reads the count, missing keys are not created
+			const uint64_t count = delta ? core::count_add(map, key, delta) : core::count_get(map, key);
+			if (delta) written(key);
+			writer.begin(id, OK);
+			writer.u64(count);
+			writer.end();
+			return;
+		}
+		case COUNT_CAS: {
+			uint64_t expected = payload.u64();
+			const uint64_t desired = payload.u64();
+			key.assign(payload.rest());
+			const bool swapped = core::count_cas(map, key, expected, desired);
+			if (swapped) written(key);
+			writer.begin(id, OK);
+			writer.u8(swapped);
+			writer.u64(swapped ? desired : expected);
+			writer.end();
+			return;
+		}
+		case COUNT_STRIPE: {
+			const bool striped = payload.u8() != 0;
+			key.assign(payload.rest());
+			core::count_stripe(map, key, striped);
+			writer.begin(id, OK);
+			writer.end();
+			return;
+		}
+		case GROUP_ADD: {
+			key.assign(payload.str());
+			member.assign(payload.rest());
+			const bool added = core::group_add(map, key, member);
+			if (added) written(key);
+			writer.begin(id, OK);
+			writer.u8(added);
+			writer.end();
+			return;
+		}
+		case GROUP_DEL: {
+			key.assign(payload.str());
+			const bool removed = core::group_remove(map, key, payload.rest());
+			if (removed) written(key);
+			writer.begin(id, OK);
+			writer.u8(removed);
+			writer.end();
+			return;
+		}
+		case GROUP_GET: {
+			key.assign(payload.rest());
+			// Members are written while the group is locked, the count is patched afterwards
+			const size_t frame = batch.bytes().size();
+			writer.begin(id, OK);
+			const size_t count_pos = batch.bytes().size();
+			writer.u32(0);
+			uint32_t count = 0;
+			bool found = false;
+			try {
+				found = core::group_members(map, key, [&](string_view m) {
+					writer.str(m);
+					count++;
+				});
+			} catch (...) {
+				batch.bytes().resize(frame);
+				throw;
+			}
+			if (!found) {
+				batch.bytes().resize(frame);
+				writer.begin(id, NOT_FOUND);
+				writer.end();
+				return;
+			}
+			put_u32(batch.bytes().data() + count_pos, count);
+			writer.end();
+			return;
+		}
+		case GROUP_INTER:
+		case GROUP_UNION:
+		case GROUP_DIFF:
+		case GROUP_INTERCARD: {
+			const uint64_t limit = op == GROUP_INTERCARD ? payload.u64() : 0;
+			keys.clear();
+			while (!payload.done()) keys.emplace_back(payload.str());
+			if (keys.empty()) throw invalid_argument("At least one key is required");
+
+			if (op == GROUP_INTERCARD) {
+				const size_t count = core::group_intercard(map, keys, static_cast<size_t>(limit));
+				writer.begin(id, OK);
+				writer.u64(count);
+				writer.end();
+				return;
+			}
+			const vector<string> members = op == GROUP_INTER ? core::group_inter(map, keys) :
+				op == GROUP_UNION ? core::group_union(map, keys) : core::group_diff(map, keys);
+			writer.begin(id, OK);
+			write_members(writer, members);
+			writer.end();
+			return;
+		}
+		case MGET: {
+			// The payload is validated first, values are pinned into the batch while the response is written
+			for (Reader check = payload; !check.done();) check.str();
+			const size_t pinned = batch.size() - batch.bytes().size();
+			writer.begin(id, OK);
+			while (!payload.done()) {
+				key.assign(payload.str());
+				datachunk::ProtoPin pin;
+				try {
+					pin = core::pin_proto(map, key);
+				} catch (const core::type_error&) {
+					writer.u8(WRONG_TYPE);
+					continue;
+				} catch (const exception&) {
+					writer.u8(ERROR);
+					continue;
+				}
+				if (!pin) {
+					writer.u8(NOT_FOUND);
+					continue;
+				}
+				writer.u8(OK);
+				writer.u32(static_cast<uint32_t>(pin.size()));
+				batch.append(std::move(pin));
+			}
+			writer.end(batch.size() - batch.bytes().size() - pinned);
+			return;
+		}
+		case MSET: {
+			for (Reader check = payload; !check.done();) {
+				check.str();
+				check.str();
+			}
+			// Every key is set independently, a failed key (e.g. the map is full) does not stop the others
+			writer.begin(id, OK);
+			while (!payload.done()) {
+				key.assign(payload.str());
+				const string_view value = payload.str();
+				try {
+					core::proto_set(map, key, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+				} catch (const exception&) {
+					writer.u8(ERROR);
+					continue;
+				}
+				written(key);
+				writer.u8(OK);
+			}
+			writer.end();
+			return;
+		}
+		case LEASE: {
+			const chrono::milliseconds requested(payload.u32());
+			key.assign(payload.rest());
+			// The holder is registered before the read, a write the read misses pushes an invalidation.
+			// Connections that can not receive pushes read the key without a lease.
+			const chrono::milliseconds lease = subscriber ? leases->grant(key, subscriber, requested) : chrono::milliseconds::zero();
+			datachunk::ProtoPin pin = core::pin_proto(map, key);
+			if (!pin) {
+				writer.begin(id, NOT_FOUND);
+				writer.end();
+				return;
+			}
+			writer.begin(id, OK);
+			writer.u32(static_cast<uint32_t>(lease.count()));
+			writer.end(pin.size());
+			batch.append(std::move(pin));
+			return;
+		}
+		case STATS: {
+			// The key is only used by the proxy to select the shard
+			writer.begin(id, OK);
+			writer.raw(core::stats(map));
+			writer.end();
+			return;
+		}
+		default:
+			throw invalid_argument("Unknown operation");
+		}
+	}
+}
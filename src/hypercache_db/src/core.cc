@@ -15,3 +15,422 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+
+#include "core.hpp"
+#include "lib/datachunk/setops.hpp"
+
+using namespace std;
+using namespace datachunk;
+
+namespace core {
+	namespace {
+		// Number of attempts if a group is moved / deleted while the locks are acquired
+		constexpr size_t lock_attempts = 8;
+		// Dictionary compression of small protos (see configure_dicts)
+		atomic<bool> dicts_enabled = false;
+		// Sorted hash array of new groups (see configure_groups)
+		atomic<bool> sorted_groups = false;
+
+		/**
+		 * Calls func with the GroupSets of the keys while all of them are read locked
+		 *
+		 * The slots are locked in slot index order, the same slot is only locked once.
+		 * Missing keys are passed as nullptr.
+		 */
+		template <typename Func_T>
+		void with_groups(CoreMap& map, const vector<string>& keys, Func_T&& func) {
+			if (keys.size() > max_group_keys) throw invalid_argument("Too many keys for a group operation");
+			for (size_t attempt = 0; attempt < lock_attempts; attempt++) {
+				vector<hypermap::SlotHandle> handles(keys.size());
+				for (size_t i = 0; i < keys.size(); i++) handles[i] = map.get_handle(keys[i]);
+
+				// Lock order: bound handles sorted by slot index (duplicates are locked once)
+				vector<size_t> order;
+				for (size_t i = 0; i < keys.size(); i++) if (handles[i]) order.push_back(i);
+				sort(order.begin(), order.end(), [&](size_t a, size_t b) { return handles[a].index < handles[b].index; });
+
+				vector<const GroupSet*> sets(keys.size(), nullptr);
+				vector<shared_lock<shared_mutex>> locks;
+				locks.reserve(order.size());
+				bool bound = true;
+				for (size_t pos = 0; pos < order.size(); pos++) {
+					const size_t key = order[pos];
+					if (pos > 0 && handles[order[pos - 1]].index == handles[key].index) {
+						sets[key] = sets[order[pos - 1]];
+						continue;
+					}
+					const DataChunk* chunk = nullptr;
+					shared_lock<shared_mutex> lock = map.resolve(handles[key]).read_lock(chunk);
+					if (!chunk) {
+						bound = false;
+						break;
+					}
+					if (chunk->get_type() != GROUP) throw type_error("Key is not of type GROUP");
+					sets[key] = &chunk->get_group();
+					locks.push_back(std::move(lock));
+				}
+				if (bound) {
+					func(sets);
+					return;
+				}
+			}
+			throw runtime_error("Groups were modified concurrently, try again");
+		}
+
+		// Sorted hash arrays of the sets (missing sets are empty)
+		vector<const vector<uint64_t>*> hash_lists(const vector<const GroupSet*>& sets, vector<vector<uint64_t>>& buffers) {
+			static const vector<uint64_t> empty_list;
+			buffers.resize(sets.size());
+			vector<const vector<uint64_t>*> lists(sets.size());
+			for (size_t i = 0; i < sets.size(); i++) {
+				lists[i] = sets[i] ? &sets[i]->sorted_hashes(buffers[i]) : &empty_list;
+			}
+			return lists;
+		}
+
+		// Resolves member hashes to the member keys of the sets
+		vector<string> members_of(const vector<uint64_t>& hashes, const vector<const GroupSet*>& sets) {
+			vector<string> members;
+			members.reserve(hashes.size());
+			for (const uint64_t h : hashes) {
+				string_view key;
+				for (const GroupSet* set : sets) {
+					if (set && set->find_hash(h, key)) {
+						members.emplace_back(key);
+						break;
+					}
+				}
+			}
+			return members;
+		}
+
+		// Intersects all lists (smallest first), the result is written to result
+		void intersect_all(vector<const vector<uint64_t>*> lists, vector<uint64_t>& result) {
+			sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+			result = *lists[0];
+			vector<uint64_t> tmp;
+			for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+				tmp.resize(result.size());
+				tmp.resize(setops::intersect(result.data(), result.size(), lists[i]->data(), lists[i]->size(), tmp.data()));
+				result.swap(tmp);
+			}
+		}
+	}
+
+	void configure_dicts(bool enabled) noexcept {
+		dicts_enabled.store(enabled, memory_order_relaxed);
+	}
+
+	void configure_groups(bool sorted) noexcept {
+		sorted_groups.store(sorted, memory_order_relaxed);
+	}
+
+	GroupChunk make_group() {
+		GroupChunk group;
+		if (sorted_groups.load(memory_order_relaxed)) group.set_group_sorted(true);
+		return group;
+	}
+
+	void proto_set(CoreMap& map, const string& key, const uint8_t* bytes, size_t size) {
+		const ProtoDict* dict = nullptr;
+		if (dicts_enabled.load(memory_order_relaxed) && ProtoChunk::dict_eligible(size)) {
+			ProtoDictStore& dicts = ProtoDictStore::global();
+			dicts.sample(key, bytes, size);
+			dict = dicts.select(key);
+		}
+		ProtoChunk chunk;
+		chunk.set_proto(bytes, size, dict);
+		map.set(key, chunk);
+	}
+
+	uint64_t count_add(CoreMap& map, const string& key, int64_t delta) {
+		while (true) {
+			uint64_t count = 0;
+			bool bound = false;
+			try {
+				// Counters are atomic, the shared lock is sufficient
+				bound = map.emplace(key, CountChunk()).access<CountChunk>([&](CountChunk* chunk) {
+					count = chunk->add(delta);
+				});
+			} catch (const hypermap::type_mismatch&) {
+				throw type_error("Key is not of type COUNT");
+			}
+			// Retry if the key was deleted between emplace and access
+			if (bound) return count;
+		}
+	}
+
+	uint64_t count_get(CoreMap& map, const string& key) {
+		uint64_t count = 0;
+		try {
+			map.get(key).access<CountChunk>([&](CountChunk* chunk) {
+				count = chunk->get_count();
+			});
+		} catch (const hypermap::type_mismatch&) {
+			throw type_error("Key is not of type COUNT");
+		}
+		return count;
+	}
+
+	bool count_cas(CoreMap& map, const string& key, uint64_t& expected, uint64_t desired) {
+		while (true) {
+			// A missing key has a count of 0, it is only created if the swap can succeed
+			const CoreMap::operator_type op = expected ? map.get(key) : map.emplace(key, CountChunk());
+			if (!op) {
+				expected = 0;
+				return false;
+			}
+			bool swapped = false;
+			bool bound = false;
+			try {
+				bound = op.access<CountChunk>([&](CountChunk* chunk) {
+					swapped = chunk->compare_exchange(expected, desired);
+				});
+			} catch (const hypermap::type_mismatch&) {
+				throw type_error("Key is not of type COUNT");
+			}
+			if (bound) return swapped;
+		}
+	}
+
+	void count_stripe(CoreMap& map, const string& key, bool striped) {
+		while (true) {
+			// Changing the representation needs the unique lock
+			const bool bound = map.emplace(key, CountChunk()).write([&](DataChunk* chunk) {
+				if (chunk->get_type() != COUNT) throw type_error("Key is not of type COUNT");
+				static_cast<CountChunk*>(chunk)->set_striped(striped);
+			});
+			if (bound) return;
+		}
+	}
+
+	bool group_add(CoreMap& map, const string& key, const string& member) {
+		// The member handle is bound if the member exists, otherwise it is repaired by the first query
+		const hypermap::SlotHandle handle = map.get_handle(member);
+		while (true) {
+			bool added = false;
+			const bool bound = map.emplace(key, make_group()).write([&](DataChunk* chunk) {
+				if (chunk->get_type() != GROUP) throw type_error("Key is not of type GROUP");
+				added = chunk->push_group(member, handle);
+			});
+			if (bound) return added;
+		}
+	}
+
+	bool group_remove(CoreMap& map, const string& key, string_view member) {
+		bool removed = false;
+		map.get(key).write([&](DataChunk* chunk) {
+			if (chunk->get_type() != GROUP) throw type_error("Key is not of type GROUP");
+			removed = chunk->del_group(member);
+		});
+		return removed;
+	}
+
+	bool group_members(CoreMap& map, const string& key, const function<void(string_view)>& visitor) {
+		return group_members(map, key, [](size_t) {}, visitor);
+	}
+
+	bool group_members(CoreMap& map, const string& key, const function<void(size_t)>& begin, const function<void(string_view)>& visitor) {
+		return map.get(key).read([&](const DataChunk* chunk) {
+			if (chunk->get_type() != GROUP) throw type_error("Key is not of type GROUP");
+			const GroupSet& group = chunk->get_group();
+			begin(group.size());
+			group.for_each(visitor);
+		});
+	}
+
+	vector<string> group_inter(CoreMap& map, const vector<string>& keys) {
+		vector<string> members;
+		if (keys.empty()) return members;
+		with_groups(map, keys, [&](const vector<const GroupSet*>& sets) {
+			vector<vector<uint64_t>> buffers;
+			vector<uint64_t> result;
+			intersect_all(hash_lists(sets, buffers), result);
+			members = members_of(result, sets);
+		});
+		return members;
+	}
+
+	size_t group_intercard(CoreMap& map, const vector<string>& keys, size_t limit) {
+		size_t count = 0;
+		if (keys.empty()) return count;
+		with_groups(map, keys, [&](const vector<const GroupSet*>& sets) {
+			vector<vector<uint64_t>> buffers;
+			auto lists = hash_lists(sets, buffers);
+			if (!limit) {
+				vector<uint64_t> result;
+				intersect_all(lists, result);
+				count = result.size();
+				return;
+			}
+			// With a limit, the smallest list is galloped through all others, so the count can stop early
+			sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+			vector<size_t> cursors(lists.size(), 0);
+			for (const uint64_t h : *lists[0]) {
+				bool found = true;
+				for (size_t i = 1; i < lists.size() && found; i++) {
+					cursors[i] = setops::gallop(lists[i]->data(), cursors[i], lists[i]->size(), h);
+					found = cursors[i] < lists[i]->size() && (*lists[i])[cursors[i]] == h;
+				}
+				if (found && ++count >= limit) return;
+			}
+		});
+		return count;
+	}
+
+	vector<string> group_union(CoreMap& map, const vector<string>& keys) {
+		vector<string> members;
+		if (keys.empty()) return members;
+		with_groups(map, keys, [&](const vector<const GroupSet*>& sets) {
+			vector<vector<uint64_t>> buffers;
+			const auto lists = hash_lists(sets, buffers);
+			vector<uint64_t> result = *lists[0];
+			vector<uint64_t> tmp;
+			for (size_t i = 1; i < lists.size(); i++) {
+				tmp.resize(result.size() + lists[i]->size());
+				tmp.resize(setops::unite(result.data(), result.size(), lists[i]->data(), lists[i]->size(), tmp.data()));
+				result.swap(tmp);
+			}
+			members = members_of(result, sets);
+		});
+		return members;
+	}
+
+	vector<string> group_diff(CoreMap& map, const vector<string>& keys) {
+		vector<string> members;
+		if (keys.empty()) return members;
+		with_groups(map, keys, [&](const vector<const GroupSet*>& sets) {
+			vector<vector<uint64_t>> buffers;
+			const auto lists = hash_lists(sets, buffers);
+			vector<uint64_t> result = *lists[0];
+			vector<uint64_t> tmp;
+			for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+				tmp.resize(result.size());
+				tmp.resize(setops::difference(result.data(), result.size(), lists[i]->data(), lists[i]->size(), tmp.data()));
+				result.swap(tmp);
+			}
+			members = members_of(result, sets);
+		});
+		return members;
+	}
+
+	namespace {
+		// Applies the filter and copies the value of the member, returns false if the member is filtered out
+		bool fetch_member(const DataChunk* chunk, const QueryFilter& filter, QueryMember& member) {
+			member.type = chunk->get_type();
+			if (filter.type != NONE && member.type != filter.type) return false;
+			switch (member.type) {
+			case PROTO: {
+				if (filter.count_range) return false;
+				// Streamed per segment, a bulk value is never decompressed into one contiguous buffer
+				member.proto.clear();
+				member.proto.reserve(chunk->get_proto_size());
+				chunk->read_proto([&](const uint8_t* data, size_t size) {
+					member.proto.append(reinterpret_cast<const char*>(data), size);
+				});
+				return true;
+			}
+			case COUNT:
+				member.count = chunk->get_count();
+				return !filter.count_range || (member.count >= filter.count_min && member.count <= filter.count_max);
+			default:
+				return !filter.count_range;
+			}
+		}
+	}
+
+	vector<QueryMember> group_query(CoreMap& map, const string& group, const QueryFilter& filter) {
+		vector<QueryMember> result;
+
+		// Copy keys and handles of the members, so the group lock is not held while the members are read
+		vector<string> keys;
+		vector<hypermap::SlotHandle> handles;
+		map.get(group).read([&](const DataChunk* chunk) {
+			const GroupSet& set = chunk->get_group();
+			keys.reserve(set.size());
+			handles.reserve(set.size());
+			set.for_each_member([&](string_view key, const hypermap::SlotHandle& handle) {
+				keys.emplace_back(key);
+				handles.push_back(handle);
+			});
+		});
+
+		vector<size_t> stale;
+		map.resolve_all(handles, [&](size_t pos, const CoreMap::operator_type& op) {
+			if (filter.limit && result.size() >= filter.limit) return;
+			QueryMember member{keys[pos], NONE, "", 0};
+			bool matched = false;
+			const bool bound = op.read([&](const DataChunk* chunk) {
+				// Read only succeeds if the slot still holds the member (atom_id unchanged)
+				matched = fetch_member(chunk, filter, member);
+			});
+			if (!bound) {
+				stale.push_back(pos);
+			} else if (matched) {
+				result.push_back(std::move(member));
+			}
+		});
+
+		if (stale.empty()) return result;
+
+		// Stale members are looked up by key, their handles are repaired in one write
+		vector<pair<size_t, hypermap::SlotHandle>> repaired;
+		for (const size_t pos : stale) {
+			const hypermap::SlotHandle handle = map.get_handle(keys[pos]);
+			if (!handle) continue;
+			repaired.emplace_back(pos, handle);
+			if (filter.limit && result.size() >= filter.limit) continue;
+			QueryMember member{keys[pos], NONE, "", 0};
+			bool matched = false;
+			map.resolve(handle).read([&](const DataChunk* chunk) {
+				matched = fetch_member(chunk, filter, member);
+			});
+			if (matched) result.push_back(std::move(member));
+		}
+		if (!repaired.empty()) {
+			map.get(group).write([&](DataChunk* chunk) {
+				if (chunk->get_type() != GROUP) return;
+				for (const auto& [pos, handle] : repaired) chunk->repair_group(keys[pos], handle);
+			});
+		}
+		return result;
+	}
+
+	bool compact(CoreMap& map) {
+		if (map.stats().tombstone_factor <= max_tombstones) return false;
+		map.rehash();
+		return true;
+	}
+
+	datachunk::ProtoPin pin_proto(CoreMap& map, const string& key) {
+		ProtoPin pin;
+		map.get(key).read([&](const DataChunk* chunk) {
+			if (chunk->get_type() != PROTO) throw type_error("Key is not of type PROTO");
+			pin = chunk->pin_proto();
+		});
+		return pin;
+	}
+
+	datachunk::ProtoPin pin_proto_frames(CoreMap& map, const string& key) {
+		ProtoPin pin;
+		map.get(key).read([&](const DataChunk* chunk) {
+			if (chunk->get_type() != PROTO) throw type_error("Key is not of type PROTO");
+			pin = chunk->pin_proto_frames();
+		});
+		return pin;
+	}
+
+	void proto_buffers(datachunk::ProtoPin& pin, vector<boost::asio::const_buffer>& out) {
+		// Views are collected per thread, the pin owns the bytes they point to
+		thread_local vector<iovec> views;
+		views.clear();
+		pin.buffers(views);
+		for (const iovec& view : views) out.emplace_back(view.iov_base, view.iov_len);
+	}
+}
@@ -0,0 +1,125 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+
+#include "lease.hpp"
+
+using namespace std;
+
+namespace server {
+	void Subscriber::push(string_view key) {
+		function<void()> wake;
+		{
+			lock_guard<mutex> guard(lock);
+			if (closed) return;
+			if (keys.empty()) wake = notify;
+			keys.emplace_back(key);
+		}
+		if (wake) wake();
+	}
+
+	void Subscriber::take(vector<string>& out) {
+		out.clear();
+		lock_guard<mutex> guard(lock);
+		out.swap(keys);
+	}
+
+	void Subscriber::close() {
+		lock_guard<mutex> guard(lock);
+		closed = true;
+		keys.clear();
+		// The notify function may hold the connection, it is released here to break the cycle
+		notify = nullptr;
+	}
+
+	LeaseTable::LeaseTable(size_t max_keys, chrono::milliseconds max_lease)
+		: stripe_keys(max(max_keys / stripe_count, size_t(1))), max_lease(max_lease) {}
+
+	LeaseTable::Stripe& LeaseTable::stripe(string_view key) {
+		return stripes[KeyHash()(key) % stripe_count];
+	}
+
+	void LeaseTable::sweep(Stripe& stripe, chrono::steady_clock::time_point now) {
+		for (auto it = stripe.keys.begin(); it != stripe.keys.end();) {
+			const bool expired = all_of(it->second.begin(), it->second.end(), [now](const Holder& holder) {
+				return holder.expiry <= now;
+			});
+			if (!expired) {
+				++it;
+				continue;
+			}
+			it = stripe.keys.erase(it);
+			active.fetch_sub(1, memory_order_relaxed);
+		}
+	}
+
+	chrono::milliseconds LeaseTable::grant(string_view key, const shared_ptr<Subscriber>& subscriber, chrono::milliseconds lease) {
+		lease = min(lease, max_lease);
+		if (lease <= chrono::milliseconds::zero()) return chrono::milliseconds::zero();
+		const auto now = chrono::steady_clock::now();
+		Stripe& stripe = this->stripe(key);
+		lock_guard<mutex> guard(stripe.lock);
+		auto it = stripe.keys.find(key);
+		if (it == stripe.keys.end()) {
+			if (stripe.keys.size() >= stripe_keys) {
+				sweep(stripe, now);
+				if (stripe.keys.size() >= stripe_keys) return chrono::milliseconds::zero();
+			}
+			it = stripe.keys.emplace(string(key), vector<Holder>()).first;
+			// Sequentially consistent with the fence in invalidate(): either the writer sees the key,
+			// or the read after the grant sees the written value
+			active.fetch_add(1, memory_order_seq_cst);
+		}
+		vector<Holder>& holders = it->second;
+		erase_if(holders, [&](const Holder& holder) {
+			return holder.expiry <= now || holder.subscriber.expired();
+		});
+		const auto expiry = now + lease;
+		for (Holder& holder : holders) {
+			if (holder.subscriber.lock() == subscriber) {
+				holder.expiry = expiry;
+				return lease;
+			}
+		}
+		holders.push_back(Holder{subscriber, expiry});
+		return lease;
+	}
+
+	void LeaseTable::invalidate(string_view key) {
+		atomic_thread_fence(memory_order_seq_cst);
+		if (!active.load(memory_order_relaxed)) return;
+		vector<Holder> holders;
+		{
+			Stripe& stripe = this->stripe(key);
+			lock_guard<mutex> guard(stripe.lock);
+			auto it = stripe.keys.find(key);
+			if (it == stripe.keys.end()) return;
+			holders.swap(it->second);
+			stripe.keys.erase(it);
+			active.fetch_sub(1, memory_order_relaxed);
+		}
+		// Pushed outside of the stripe lock, the subscribers take their own lock
+		const auto now = chrono::steady_clock::now();
+		for (const Holder& holder : holders) {
+			if (holder.expiry <= now) continue;
+			if (auto subscriber = holder.subscriber.lock()) subscriber->push(key);
+		}
+	}
+}
@@ -16,16 +16,161 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <csignal>
+#include <filesystem>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 
 #include "main.hpp"
+#include "core.hpp"
+#include "server.hpp"
 
 using namespace std;
 using namespace boost;
 
-int main(void) {
-  boost::asio::io_context io_context;
-  cout << "Hallo From " << endl;
+namespace {
+  /**
+   * Parses the command line (--name=value)
+   *
+   *   --address=0.0.0.0   listen address
+   *   --port=7400         port of the native protocol
+   *   --resp=true         enables the Redis protocol listener
+   *   --resp_port=6379    port of the Redis protocol
+   *   --threads=0         event loop threads (0 = number of cores)
+   *   --backend=epoll     event loop backend (epoll or io_uring, io_uring falls back to epoll if unsupported)
+   *   --unix=             Unix socket path of the native protocol (empty = disabled)
+   *   --shm=              Unix socket path of the shared memory channels (empty = disabled)
+   *   --shm_ring=1048576  ring size of a shared memory channel in bytes
+   *   --shm_spin=50       polling time of a shared memory session before it sleeps in microseconds
+   *   --max_leases=1048576 maximum number of keys with leases (held by hypercache_proxy near caches)
+   *   --max_lease=10000   maximum lease in milliseconds
+   *   --slots=1048576     slots of the map
+   *   --snapshot=         snapshot file, loaded on start and written on shutdown (empty = disabled)
+   *   --compress_threshold=0 minimum size of bulk values that are compressed in bytes (0 = disabled)
+   *   --dict_train=10000  interval of the proto dictionary training in milliseconds (0 = disabled)
+   *   --compact=1000      interval of the tombstone check in milliseconds (0 = disabled, see core::compact)
+   *   --group_sorted=false keeps the member hashes of the groups sorted (faster set operations, slower adds / removes)
+   */
+  Options parse_options(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+      const string arg = argv[i];
+      const size_t eq = arg.find('=');
+      if (arg.rfind("--", 0) != 0 || eq == string::npos)
+        throw invalid_argument("Expected --name=value, got: " + arg);
+      const string name = arg.substr(2, eq - 2);
+      const string val = arg.substr(eq + 1);
+
+      if (name == "address") opts.server.address = val;
+      else if (name == "port") opts.server.port = static_cast<uint16_t>(stoul(val));
+      else if (name == "resp") opts.server.resp = val == "true";
+      else if (name == "resp_port") opts.server.resp_port = static_cast<uint16_t>(stoul(val));
+      else if (name == "threads") opts.server.threads = stoull(val);
+      else if (name == "backend") {
+        if (val == "epoll") opts.server.backend = server::EPOLL;
+        else if (val == "io_uring") opts.server.backend = server::URING;
+        else throw invalid_argument("Unknown backend: " + val);
+      }
+      else if (name == "unix") opts.server.unix_path = val;
+      else if (name == "shm") opts.server.shm_path = val;
+      else if (name == "shm_ring") opts.server.shm_ring = stoull(val);
+      else if (name == "shm_spin") opts.server.shm_spin = chrono::microseconds(stoull(val));
+      else if (name == "max_leases") opts.server.max_leases = stoull(val);
+      else if (name == "max_lease") opts.server.max_lease = chrono::milliseconds(stoull(val));
+      else if (name == "slots") opts.slots = stoull(val);
+      else if (name == "snapshot") opts.snapshot = val;
+      else if (name == "compress_threshold") opts.compress_threshold = stoull(val);
+      else if (name == "dict_train") opts.dict_train = chrono::milliseconds(stoull(val));
+      else if (name == "compact") opts.compact_interval = chrono::milliseconds(stoull(val));
+      else if (name == "group_sorted") opts.group_sorted = val == "true";
+      else throw invalid_argument("Unknown parameter: " + name);
+    }
+    return opts;
+  }
+
+  /**
+   * Clears the tombstones of the map every interval once they reach core::max_tombstones (see core::compact)
+   */
+  void schedule_compaction(asio::steady_timer& timer, core::CoreMap& map, chrono::milliseconds interval) {
+    timer.expires_after(interval);
+    timer.async_wait([&timer, &map, interval](const system::error_code& ec) {
+      if (ec) return;
+      core::compact(map);
+      schedule_compaction(timer, map, interval);
+    });
+  }
+
+  /**
+   * Trains the proto dictionaries of the sampled key prefixes every interval (see datachunk::ProtoDictStore)
+   */
+  void schedule_training(asio::steady_timer& timer, chrono::milliseconds interval) {
+    timer.expires_after(interval);
+    timer.async_wait([&timer, interval](const system::error_code& ec) {
+      if (ec) return;
+      datachunk::ProtoDictStore::global().train();
+      schedule_training(timer, interval);
+    });
+  }
+}
+
+int main(int argc, char** argv) {
+  Options opts;
+  try {
+    opts = parse_options(argc, argv);
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  datachunk::ProtoChunk::configure_compression(opts.compress_threshold);
+  core::configure_dicts(opts.dict_train.count() > 0);
+  core::configure_groups(opts.group_sorted);
+  core::CoreMap map(opts.slots);
+  if (!opts.snapshot.empty() && filesystem::exists(opts.snapshot)) {
+    try {
+      const size_t keys = core::snapshot_load(map, opts.snapshot);
+      cout << "Loaded " << keys << " keys from " << opts.snapshot << endl;
+    } catch (const std::exception& e) {
+      cerr << "Failed to load the snapshot: " << e.what() << endl;
+      return 1;
+    }
+  }
+  server::Server server(map, opts.server);
+  try {
+    server.start();
+  } catch (const std::exception& e) {
+    cerr << "Failed to start the server: " << e.what() << endl;
+    return 1;
+  }
+  if (server.backend() != opts.server.backend) cerr << "io_uring is not supported, falling back to epoll" << endl;
+  cout << "HyperCache listening on " << opts.server.address << ":" << server.port() << endl;
+  if (opts.server.resp) cout << "HyperCache (RESP) listening on " << opts.server.address << ":" << server.resp_port() << endl;
+  if (!opts.server.unix_path.empty()) cout << "HyperCache listening on " << opts.server.unix_path << endl;
+  if (!opts.server.shm_path.empty()) cout << "HyperCache (shared memory) listening on " << opts.server.shm_path << endl;
+
+  // The main thread trains the dictionaries, compacts the map and waits for the termination signal,
+  // the requests are handled by the server threads
+  asio::io_context signal_context;
+  asio::steady_timer train_timer(signal_context);
+  if (opts.dict_train.count() > 0) schedule_training(train_timer, opts.dict_train);
+  asio::steady_timer compact_timer(signal_context);
+  if (opts.compact_interval.count() > 0) schedule_compaction(compact_timer, map, opts.compact_interval);
+  asio::signal_set signals(signal_context, SIGINT, SIGTERM);
+  signals.async_wait([&signal_context](const system::error_code&, int) { signal_context.stop(); });
+  signal_context.run();
+
+  server.stop();
+  if (!opts.snapshot.empty()) {
+    try {
+      const size_t keys = core::snapshot_save(map, opts.snapshot);
+      cout << "Saved " << keys << " keys to " << opts.snapshot << endl;
+    } catch (const std::exception& e) {
+      cerr << "Failed to save the snapshot: " << e.what() << endl;
+      return 1;
+    }
+  }
+  return 0;
 }
@@ -0,0 +1,390 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "resp.hpp"
+
+using namespace std;
+using namespace datachunk;
+
+namespace server {
+	namespace {
+		/**
+		 * Appends RESP replies to the byte arena of a batch
+		 */
+		class Reply {
+		public:
+			Reply(ResponseBatch& batch, int version) : batch(batch), out(batch.bytes()), version(version) {};
+
+			void simple(string_view val) {
+				out.push_back('+');
+				raw(val);
+				crlf();
+			};
+
+			void error(string_view val) {
+				out.push_back('-');
+				raw(val);
+				crlf();
+			};
+
+			void integer(int64_t val) {
+				out.push_back(':');
+				number(val);
+				crlf();
+			};
+
+			void bulk(string_view val) {
+				out.push_back('$');
+				number(static_cast<int64_t>(val.size()));
+				crlf();
+				raw(val);
+				crlf();
+			};
+
+			// Bulk string that is sent from the pin (large values are not copied)
+			void bulk(ProtoPin&& pin) {
+				out.push_back('$');
+				number(static_cast<int64_t>(pin.size()));
+				crlf();
+				batch.append(std::move(pin));
+				crlf();
+			};
+
+			void null() {
+				if (version >= 3) raw("_\r\n");
+				else raw("$-1\r\n");
+			};
+
+			void array(size_t count) {
+				header('*', count);
+			};
+
+			void set(size_t count) {
+				header(version >= 3 ? '~' : '*', count);
+			};
+
+			void map(size_t count) {
+				if (version >= 3) header('%', count);
+				else header('*', count * 2);
+			};
+
+			void raw(string_view val) {
+				out.insert(out.end(), val.begin(), val.end());
+			};
+		private:
+			void header(char type, size_t count) {
+				out.push_back(static_cast<uint8_t>(type));
+				number(static_cast<int64_t>(count));
+				crlf();
+			};
+
+			void number(int64_t val) {
+				char buffer[24];
+				const auto res = to_chars(buffer, buffer + sizeof(buffer), val);
+				out.insert(out.end(), buffer, res.ptr);
+			};
+
+			void crlf() {
+				out.push_back('\r');
+				out.push_back('\n');
+			};
+
+			ResponseBatch& batch;
+			vector<uint8_t>& out;
+			int version;
+		};
+
+		// Case insensitive comparison of a command name with an uppercase name
+		bool is(string_view arg, string_view name) {
+			if (arg.size() != name.size()) return false;
+			for (size_t i = 0; i < arg.size(); i++) {
+				const char c = arg[i] >= 'a' && arg[i] <= 'z' ? static_cast<char>(arg[i] - 32) : arg[i];
+				if (c != name[i]) return false;
+			}
+			return true;
+		}
+
+		// Parses an integer argument, throws an invalid_argument with the Redis error message
+		int64_t integer_arg(string_view arg) {
+			int64_t val = 0;
+			const auto res = from_chars(arg.data(), arg.data() + arg.size(), val);
+			if (res.ec != errc() || res.ptr != arg.data() + arg.size())
+				throw invalid_argument("ERR value is not an integer or out of range");
+			return val;
+		}
+
+		// Parses the integer of a header line (*<n>\r\n / $<n>\r\n) at data, returns the consumed bytes (0 if incomplete)
+		size_t header_line(const char* data, size_t size, int64_t& val) {
+			const char* end = static_cast<const char*>(memchr(data, '\r', size));
+			if (!end || end + 1 >= data + size) {
+				// Headers are short, a long line without CR is not RESP
+				if (size > 32) throw runtime_error("Protocol error: invalid header");
+				return 0;
+			}
+			if (end[1] != '\n') throw runtime_error("Protocol error: expected CRLF");
+			const auto res = from_chars(data + 1, end, val);
+			if (res.ec != errc() || res.ptr != end) throw runtime_error("Protocol error: invalid length");
+			return static_cast<size_t>(end - data) + 2;
+		}
+
+		// Reply of EXPIRE / PEXPIRE
+		template <typename Duration_T>
+		void expire(core::CoreMap& map, const string& key, int64_t amount, Reply& reply) {
+			reply.integer(map.expire(key, chrono::duration_cast<chrono::system_clock::duration>(Duration_T(amount))) ? 1 : 0);
+		}
+	}
+
+	size_t RespCodec::process(const uint8_t* data, size_t size, ResponseBatch& batch) {
+		size_t pos = 0;
+		while (pos < size) {
+			const size_t consumed = parse(reinterpret_cast<const char*>(data) + pos, size - pos);
+			if (!consumed) break;
+			pos += consumed;
+			if (args.empty()) continue;
+
+			// The reply is rolled back if the command fails, so the error is the only reply of the command
+			const ResponseBatch::Mark mark = batch.mark();
+			try {
+				execute(batch);
+			} catch (const core::type_error&) {
+				batch.truncate(mark);
+				Reply(batch, version).error("WRONGTYPE Operation against a key holding the wrong kind of value");
+			} catch (const invalid_argument& e) {
+				batch.truncate(mark);
+				Reply(batch, version).error(e.what());
+			} catch (const exception& e) {
+				batch.truncate(mark);
+				Reply(batch, version).error(string("ERR ") + e.what());
+			}
+		}
+		return pos;
+	}
+
+	size_t RespCodec::parse(const char* data, size_t size) {
+		args.clear();
+		if (data[0] != '*') {
+			// Inline command (e.g. from telnet): arguments are separated by spaces, the line ends with LF
+			const char* end = static_cast<const char*>(memchr(data, '\n', size));
+			if (!end) {
+				if (size > max_bulk) throw runtime_error("Protocol error: inline command too long");
+				return 0;
+			}
+			size_t line = static_cast<size_t>(end - data);
+			if (line > 0 && data[line - 1] == '\r') line--;
+			size_t pos = 0;
+			while (pos < line) {
+				while (pos < line && data[pos] == ' ') pos++;
+				const size_t start = pos;
+				while (pos < line && data[pos] != ' ') pos++;
+				if (pos > start) args.emplace_back(data + start, pos - start);
+			}
+			return static_cast<size_t>(end - data) + 1;
+		}
+
+		int64_t count = 0;
+		size_t pos = header_line(data, size, count);
+		if (!pos) return 0;
+		if (count < 0 || static_cast<size_t>(count) > max_args) throw runtime_error("Protocol error: invalid multibulk length");
+
+		for (int64_t i = 0; i < count; i++) {
+			if (pos >= size) return 0;
+			if (data[pos] != '$') throw runtime_error("Protocol error: expected '$'");
+			int64_t len = 0;
+			const size_t line = header_line(data + pos, size - pos, len);
+			if (!line) return 0;
+			if (len < 0 || static_cast<size_t>(len) > max_bulk) throw runtime_error("Protocol error: invalid bulk length");
+			pos += line;
+			if (size - pos < static_cast<size_t>(len) + 2) return 0;
+			args.emplace_back(data + pos, static_cast<size_t>(len));
+			pos += static_cast<size_t>(len) + 2;
+		}
+		return pos;
+	}
+
+	void RespCodec::execute(ResponseBatch& batch) {
+		Reply reply(batch, version);
+		const string_view cmd = args[0];
+		const size_t argc = args.size();
+		const auto arity = [&](size_t min, size_t max = 0) {
+			if (argc < min || (max && argc > max)) {
+				string name(cmd);
+				for (char& c : name) c = static_cast<char>(tolower(c));
+				throw invalid_argument("ERR wrong number of arguments for '" + name + "' command");
+			}
+		};
+
+		if (is(cmd, "GET")) {
+			arity(2, 2);
+			key.assign(args[1]);
+			ProtoPin pin;
+			const bool found = map.get(key).read([&](const DataChunk* chunk) {
+				switch (chunk->get_type()) {
+				case PROTO:
+					pin = chunk->pin_proto();
+					break;
+				case COUNT: {
+					const string count = to_string(chunk->get_count());
+					pin = ProtoPin(reinterpret_cast<const uint8_t*>(count.data()), count.size());
+					break;
+				}
+				default:
+					throw core::type_error("Key is not of type PROTO");
+				}
+			});
+			if (found) reply.bulk(std::move(pin));
+			else reply.null();
+		} else if (is(cmd, "SET")) {
+			arity(3);
+			key.assign(args[1]);
+			chrono::system_clock::duration ttl{0};
+			for (size_t i = 3; i < argc; i++) {
+				if (is(args[i], "EX") && i + 1 < argc) ttl = chrono::seconds(integer_arg(args[++i]));
+				else if (is(args[i], "PX") && i + 1 < argc) ttl = chrono::milliseconds(integer_arg(args[++i]));
+				else throw invalid_argument("ERR syntax error");
+				if (ttl <= chrono::system_clock::duration::zero()) throw invalid_argument("ERR invalid expire time in 'set' command");
+			}
+			core::proto_set(map, key, reinterpret_cast<const uint8_t*>(args[2].data()), args[2].size());
+			if (ttl.count()) map.expire(key, ttl);
+			written(key);
+			reply.simple("OK");
+		} else if (is(cmd, "MGET")) {
+			arity(2);
+			reply.array(argc - 1);
+			for (size_t i = 1; i < argc; i++) {
+				key.assign(args[i]);
+				ProtoPin pin;
+				map.get(key).read([&](const DataChunk* chunk) {
+					// Keys of other types are returned as null (like Redis)
+					if (chunk->get_type() == PROTO) pin = chunk->pin_proto();
+					else if (chunk->get_type() == COUNT) {
+						const string count = to_string(chunk->get_count());
+						pin = ProtoPin(reinterpret_cast<const uint8_t*>(count.data()), count.size());
+					}
+				});
+				if (pin) reply.bulk(std::move(pin));
+				else reply.null();
+			}
+		} else if (is(cmd, "DEL")) {
+			arity(2);
+			int64_t deleted = 0;
+			for (size_t i = 1; i < argc; i++) {
+				key.assign(args[i]);
+				if (!map.get_handle(key)) continue;
+				map.del(key);
+				written(key);
+				deleted++;
+			}
+			reply.integer(deleted);
+		} else if (is(cmd, "INCR") || is(cmd, "DECR")) {
+			arity(2, 2);
+			key.assign(args[1]);
+			reply.integer(static_cast<int64_t>(core::count_add(map, key, is(cmd, "INCR") ? 1 : -1)));
+			written(key);
+		} else if (is(cmd, "INCRBY") || is(cmd, "DECRBY")) {
+			arity(3, 3);
+			key.assign(args[1]);
+			const int64_t delta = integer_arg(args[2]);
+			reply.integer(static_cast<int64_t>(core::count_add(map, key, is(cmd, "INCRBY") ? delta : -delta)));
+			if (delta) written(key);
+		} else if (is(cmd, "SADD")) {
+			arity(3);
+			key.assign(args[1]);
+			int64_t added = 0;
+			string member;
+			for (size_t i = 2; i < argc; i++) {
+				member.assign(args[i]);
+				added += core::group_add(map, key, member);
+			}
+			if (added) written(key);
+			reply.integer(added);
+		} else if (is(cmd, "SREM")) {
+			arity(3);
+			key.assign(args[1]);
+			int64_t removed = 0;
+			for (size_t i = 2; i < argc; i++) removed += core::group_remove(map, key, args[i]);
+			if (removed) written(key);
+			reply.integer(removed);
+		} else if (is(cmd, "SMEMBERS")) {
+			arity(2, 2);
+			key.assign(args[1]);
+			// The header is written from the member count, the members follow while the group is locked
+			const bool found = core::group_members(map, key, [&](size_t count) { reply.set(count); }, [&](string_view member) {
+				reply.bulk(member);
+			});
+			if (!found) reply.set(0);
+		} else if (is(cmd, "EXPIRE")) {
+			arity(3, 3);
+			key.assign(args[1]);
+			expire<chrono::seconds>(map, key, integer_arg(args[2]), reply);
+			written(key);
+		} else if (is(cmd, "PEXPIRE")) {
+			arity(3, 3);
+			key.assign(args[1]);
+			expire<chrono::milliseconds>(map, key, integer_arg(args[2]), reply);
+			written(key);
+		} else if (is(cmd, "PING")) {
+			arity(1, 2);
+			if (argc == 2) reply.bulk(args[1]);
+			else reply.simple("PONG");
+		} else if (is(cmd, "ECHO")) {
+			arity(2, 2);
+			reply.bulk(args[1]);
+		} else if (is(cmd, "INFO")) {
+			arity(1, 2);
+			reply.bulk(core::stats(map, argc == 2 ? args[1] : string_view()));
+		} else if (is(cmd, "HELLO")) {
+			if (argc >= 2) {
+				const int64_t requested = integer_arg(args[1]);
+				if (requested != 2 && requested != 3) throw invalid_argument("NOPROTO unsupported protocol version");
+				version = static_cast<int>(requested);
+			}
+			Reply hello(batch, version);
+			hello.map(5);
+			hello.bulk("server");
+			hello.bulk("hypercache");
+			hello.bulk("proto");
+			hello.integer(version);
+			hello.bulk("mode");
+			hello.bulk("standalone");
+			hello.bulk("role");
+			hello.bulk("master");
+			hello.bulk("modules");
+			hello.array(0);
+		} else if (is(cmd, "SELECT")) {
+			arity(2, 2);
+			if (integer_arg(args[1]) != 0) throw invalid_argument("ERR DB index is out of range");
+			reply.simple("OK");
+		} else if (is(cmd, "COMMAND")) {
+			reply.array(0);
+		} else if (is(cmd, "CONFIG")) {
+			arity(2);
+			if (!is(args[1], "GET")) throw invalid_argument("ERR CONFIG subcommand is not supported");
+			reply.map(0);
+		} else if (is(cmd, "CLIENT") || is(cmd, "QUIT")) {
+			reply.simple("OK");
+		} else {
+			throw invalid_argument("ERR unknown command '" + string(cmd) + "'");
+		}
+	}
+}
@@ -0,0 +1,195 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include "server.hpp"
+#include "codec.hpp"
+#include "resp.hpp"
+#include "shm.hpp"
+#include "uring.hpp"
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+using asio::local::stream_protocol;
+
+namespace server {
+	Server::Server(core::CoreMap& map, const ServerConfig& config)
+		: map(map), config(config), leases(config.max_leases, config.max_lease) {
+		if (!this->config.threads) this->config.threads = max<size_t>(1, thread::hardware_concurrency());
+		for (size_t i = 0; i < this->config.threads; i++) {
+			// Each context is only run by one thread
+			contexts.push_back(make_unique<asio::io_context>(1));
+		}
+	}
+
+	Server::~Server() {
+		stop();
+		// The workers are destroyed before their listeners are closed
+		workers.clear();
+		for (int listener : listeners) ::close(listener);
+		if (unix_acceptor) ::unlink(config.unix_path.c_str());
+		if (shm_acceptor) ::unlink(config.shm_path.c_str());
+	}
+
+	void Server::start() {
+		if (config.backend == URING && !hyperring::supported()) config.backend = EPOLL;
+		if (config.backend == URING) start_uring();
+		else start_epoll();
+		start_local();
+		if (config.backend == EPOLL || unix_acceptor || shm_acceptor) run_contexts();
+	}
+
+	void Server::start_epoll() {
+		acceptor = listen(config.port);
+		bound_port = acceptor->local_endpoint().port();
+		asio::co_spawn(*contexts[0], accept(*acceptor, [this](tcp::socket socket) {
+			system::error_code ignored;
+			socket.set_option(tcp::no_delay(true), ignored);
+			return make_shared<Session<BinaryCodec, tcp::socket>>(
+				std::move(socket), BinaryCodec(map, config.max_frame, &leases), config.session);
+		}), asio::detached);
+		if (config.resp) {
+			resp_acceptor = listen(config.resp_port);
+			bound_resp_port = resp_acceptor->local_endpoint().port();
+			asio::co_spawn(*contexts[0], accept(*resp_acceptor, [this](tcp::socket socket) {
+				system::error_code ignored;
+				socket.set_option(tcp::no_delay(true), ignored);
+				return make_shared<Session<RespCodec, tcp::socket>>(
+					std::move(socket), RespCodec(map, config.max_frame, &leases), config.session);
+			}), asio::detached);
+		}
+	}
+
+	void Server::start_local() {
+		if (!config.unix_path.empty()) {
+			unix_acceptor = listen(config.unix_path);
+			asio::co_spawn(*contexts[0], accept(*unix_acceptor, [this](stream_protocol::socket socket) {
+				return make_shared<Session<BinaryCodec, stream_protocol::socket>>(
+					std::move(socket), BinaryCodec(map, config.max_frame, &leases), config.session);
+			}), asio::detached);
+		}
+		if (!config.shm_path.empty()) {
+			shm_acceptor = listen(config.shm_path);
+			asio::co_spawn(*contexts[0], accept(*shm_acceptor, [this](stream_protocol::socket socket) {
+				return make_shared<ShmSession>(
+					std::move(socket), BinaryCodec(map, config.max_frame, &leases), config.shm_ring, config.shm_spin);
+			}), asio::detached);
+		}
+	}
+
+	void Server::run_contexts() {
+		for (auto& context : contexts) {
+			threads.emplace_back([&context] {
+				// Keeps the loop running while there is no connection
+				auto guard = asio::make_work_guard(*context);
+				context->run();
+			});
+		}
+	}
+
+	void Server::start_uring() {
+		for (size_t i = 0; i < config.threads; i++) {
+			// The first listener resolves an ephemeral port, the other workers bind the same port
+			const int listener = UringWorker::listen(config.address, i ? bound_port : config.port);
+			listeners.push_back(listener);
+			if (!i) bound_port = UringWorker::port(listener);
+			int resp_listener = -1;
+			if (config.resp) {
+				resp_listener = UringWorker::listen(config.address, i ? bound_resp_port : config.resp_port);
+				listeners.push_back(resp_listener);
+				if (!i) bound_resp_port = UringWorker::port(resp_listener);
+			}
+			workers.push_back(make_unique<UringWorker>(map, leases, config, listener, resp_listener));
+		}
+
+		for (auto& worker : workers) {
+			threads.emplace_back([&worker] {
+				worker->run();
+			});
+		}
+	}
+
+	void Server::stop() {
+		if (threads.empty()) return;
+		for (auto& context : contexts) context->stop();
+		for (auto& worker : workers) worker->stop();
+		for (auto& worker : threads) worker.join();
+		threads.clear();
+	}
+
+	uint16_t Server::port() const noexcept {
+		return bound_port;
+	}
+
+	uint16_t Server::resp_port() const noexcept {
+		return bound_resp_port;
+	}
+
+	Backend Server::backend() const noexcept {
+		return config.backend;
+	}
+
+	unique_ptr<tcp::acceptor> Server::listen(uint16_t port) {
+		const tcp::endpoint endpoint(asio::ip::make_address(config.address), port);
+		auto listener = make_unique<tcp::acceptor>(*contexts[0]);
+		listener->open(endpoint.protocol());
+		listener->set_option(asio::socket_base::reuse_address(true));
+		listener->bind(endpoint);
+		listener->listen();
+		return listener;
+	}
+
+	unique_ptr<stream_protocol::acceptor> Server::listen(const string& path) {
+		// A socket file of a previous process would fail the bind
+		::unlink(path.c_str());
+		return make_unique<stream_protocol::acceptor>(*contexts[0], stream_protocol::endpoint(path));
+	}
+
+	asio::io_context& Server::next_context() {
+		asio::io_context& context = *contexts[context_index];
+		context_index = (context_index + 1) % contexts.size();
+		return context;
+	}
+
+	template <typename Acceptor_T, typename Factory_T>
+	asio::awaitable<void> Server::accept(Acceptor_T& listener, Factory_T make_session) {
+		for (;;) {
+			asio::io_context& context = next_context();
+			system::error_code ec;
+			auto socket = co_await listener.async_accept(context, asio::redirect_error(asio::use_awaitable, ec));
+			if (ec == asio::error::operation_aborted) co_return;
+			if (ec == asio::error::no_descriptors || ec == system::errc::too_many_files_open_in_system
+				|| ec == asio::error::no_buffer_space || ec == asio::error::no_memory) {
+				// The pending connection stays in the backlog, accepting again at once would spin until a descriptor is freed
+				asio::steady_timer backoff(listener.get_executor(), accept_backoff);
+				co_await backoff.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				continue;
+			}
+			if (ec) continue;
+			try {
+				auto session = make_session(std::move(socket));
+				// The session is started on the thread of its context
+				asio::post(context, [session] { session->start(); });
+			} catch (const std::exception&) {
+				// The session could not be set up (e.g. the shared memory channel), the connection is closed
+			}
+		}
+	}
+}
@@ -0,0 +1,150 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include "shm.hpp"
+
+using namespace std;
+using namespace boost;
+
+namespace server {
+	ShmSession::ShmSession(asio::local::stream_protocol::socket socket, BinaryCodec codec, size_t ring_size, chrono::microseconds spin)
+		: socket(std::move(socket)), channel(hypershm::Channel::create(ring_size)), event(this->socket.get_executor()),
+			codec(std::move(codec)), spin(thread::hardware_concurrency() > 1 ? spin : chrono::microseconds(0)) {
+		hypershm::send_channel(this->socket.native_handle(), channel);
+		event.assign(channel.release_event());
+	}
+
+	void ShmSession::start() {
+		asio::co_spawn(socket.get_executor(), poll_loop(shared_from_this()), asio::detached);
+		asio::co_spawn(socket.get_executor(), watch_loop(shared_from_this()), asio::detached);
+	}
+
+	// self is never read, it keeps the session (and its mapping) alive while the loop is suspended
+	asio::awaitable<void> ShmSession::poll_loop([[maybe_unused]] std::shared_ptr<ShmSession> self) {
+		system::error_code ec;
+		auto deadline = chrono::steady_clock::now() + spin;
+		while (!closed) {
+			try {
+				if (poll()) {
+					channel.notify();
+					deadline = chrono::steady_clock::now() + spin;
+				}
+			} catch (const std::exception&) {
+				// Protocol violation, the stream can not be resynchronized
+				break;
+			}
+			if (chrono::steady_clock::now() < deadline) {
+				// Busy polling, yields to the other sessions of the context
+				co_await asio::post(socket.get_executor(), asio::use_awaitable);
+				continue;
+			}
+
+			channel.sleep();
+			if (!ready()) {
+				uint64_t value;
+				co_await event.async_read_some(asio::buffer(&value, sizeof(value)), asio::redirect_error(asio::use_awaitable, ec));
+			}
+			channel.wake();
+			if (ec) break;
+			deadline = chrono::steady_clock::now() + spin;
+		}
+		close();
+	}
+
+	// self is never read, it keeps the session alive while the loop is suspended
+	asio::awaitable<void> ShmSession::watch_loop([[maybe_unused]] std::shared_ptr<ShmSession> self) {
+		system::error_code ec;
+		uint8_t byte;
+		// The client sends nothing on the socket, any byte or the end of the stream closes the channel
+		co_await socket.async_read_some(asio::buffer(&byte, 1), asio::redirect_error(asio::use_awaitable, ec));
+		close();
+	}
+
+	bool ShmSession::poll() {
+		bool progress = flush();
+		if (!batch.empty()) return progress;
+
+		hypershm::Ring& requests = channel.inbound();
+		// The ring indices are written by the client, they are checked before the ring is read
+		const size_t readable = requests.readable();
+		if (readable > requests.capacity()) throw runtime_error("Request ring indices are corrupted");
+		if (readable == stalled) return progress;
+		const size_t consumed = codec.process(requests.read_data(), readable, batch);
+		if (!consumed) {
+			if (readable == requests.capacity()) throw runtime_error("Request exceeds the request ring");
+			stalled = readable;
+			return progress;
+		}
+		requests.consume(consumed);
+		stalled = 0;
+		flush();
+		return true;
+	}
+
+	bool ShmSession::flush() {
+		if (batch.empty()) return false;
+		if (flush_list.empty()) {
+			const vector<asio::const_buffer>& list = batch.buffers();
+			flush_list.assign(list.begin(), list.end());
+			flush_index = flush_offset = 0;
+		}
+		hypershm::Ring& responses = channel.outbound();
+		size_t writable = responses.writable();
+		// A head that is behind the tail by more than the capacity (or ahead of it) underflows writable
+		if (writable > responses.capacity()) throw runtime_error("Response ring indices are corrupted");
+		if (!writable) return false;
+		uint8_t* dst = responses.write_data();
+		size_t written = 0;
+		while (flush_index < flush_list.size() && writable) {
+			const asio::const_buffer& buffer = flush_list[flush_index];
+			const size_t count = min(buffer.size() - flush_offset, writable);
+			memcpy(dst + written, static_cast<const uint8_t*>(buffer.data()) + flush_offset, count);
+			written += count;
+			writable -= count;
+			flush_offset += count;
+			if (flush_offset == buffer.size()) {
+				flush_index++;
+				flush_offset = 0;
+			}
+		}
+		responses.produce(written);
+		if (flush_index == flush_list.size()) {
+			// Releases the pins of the copied values
+			batch.clear();
+			flush_list.clear();
+		}
+		return written > 0;
+	}
+
+	bool ShmSession::ready() {
+		if (!batch.empty()) return channel.outbound().writable() > 0;
+		return channel.inbound().readable() != stalled;
+	}
+
+	void ShmSession::close() {
+		if (closed) return;
+		closed = true;
+		system::error_code ignored;
+		socket.close(ignored);
+		event.cancel(ignored);
+	}
+}
@@ -0,0 +1,218 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+
+#include "core.hpp"
+
+using namespace std;
+using namespace datachunk;
+
+namespace core {
+	namespace {
+		constexpr char snapshot_magic[6] = {'H', 'C', 'S', 'N', 'A', 'P'};
+		constexpr uint16_t snapshot_version = 1;
+		constexpr uint8_t snapshot_end = 0xff;
+
+		class SnapshotWriter {
+		public:
+			explicit SnapshotWriter(const string& path) {
+				// The buffer must be set before the file is opened, libstdc++ ignores it afterwards
+				file.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+				file.open(path, ios::binary | ios::trunc);
+				if (!file) throw runtime_error("Failed to open snapshot file " + path);
+			};
+
+			void bytes(const void* data, size_t size) {
+				file.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+			};
+
+			template <typename Int_T>
+			void integer(Int_T val) {
+				uint8_t out[sizeof(Int_T)];
+				for (size_t i = 0; i < sizeof(Int_T); i++) out[i] = static_cast<uint8_t>(static_cast<uint64_t>(val) >> (8 * i));
+				bytes(out, sizeof(out));
+			};
+
+			void str(string_view val) {
+				integer(static_cast<uint32_t>(val.size()));
+				bytes(val.data(), val.size());
+			};
+
+			void finish() {
+				file.flush();
+				if (!file) throw runtime_error("Failed to write snapshot file");
+				file.close();
+			};
+
+		private:
+			ofstream file;
+			char buffer[1 << 16];
+		};
+
+		class SnapshotReader {
+		public:
+			explicit SnapshotReader(const string& path) : path(path), file(path, ios::binary | ios::ate) {
+				if (!file) throw runtime_error("Failed to open snapshot file " + path);
+				size = static_cast<uint64_t>(file.tellg());
+				file.seekg(0);
+			};
+
+			/**
+			 * Checks a length field against the unread bytes of the file (before anything is allocated for it)
+			 *
+			 * count is the number of elements of at least element_size bytes each.
+			 */
+			uint64_t length(uint64_t count, uint64_t element_size = 1) {
+				const uint64_t remaining = size - static_cast<uint64_t>(file.tellg());
+				if (count > remaining / element_size) throw runtime_error("Snapshot file is corrupted: " + path);
+				return count;
+			};
+
+			void bytes(void* data, size_t size) {
+				if (!file.read(static_cast<char*>(data), static_cast<streamsize>(size)))
+					throw runtime_error("Snapshot file is truncated");
+			};
+
+			template <typename Int_T>
+			Int_T integer() {
+				uint8_t in[sizeof(Int_T)];
+				bytes(in, sizeof(in));
+				uint64_t val = 0;
+				for (size_t i = 0; i < sizeof(Int_T); i++) val |= static_cast<uint64_t>(in[i]) << (8 * i);
+				return static_cast<Int_T>(val);
+			};
+
+			void str(string& out) {
+				out.resize(length(integer<uint32_t>()));
+				bytes(out.data(), out.size());
+			};
+
+		private:
+			string path;
+			ifstream file;
+			uint64_t size = 0;
+		};
+
+		uint64_t to_unix_ms(chrono::system_clock::time_point point) {
+			if (point == chrono::system_clock::time_point::max()) return 0;
+			return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(point.time_since_epoch()).count());
+		}
+	}
+
+	size_t snapshot_save(CoreMap& map, const string& path) {
+		const string temporary = path + ".tmp";
+		size_t records = 0;
+		{
+			SnapshotWriter out(temporary);
+			out.bytes(snapshot_magic, sizeof(snapshot_magic));
+			out.integer(snapshot_version);
+			map.for_each([&](const string& key, const DataChunk* chunk, chrono::system_clock::time_point expiry) {
+				out.integer(static_cast<uint8_t>(chunk->get_type()));
+				out.integer(to_unix_ms(expiry));
+				out.str(key);
+				switch (chunk->get_type()) {
+				case PROTO:
+					out.integer(static_cast<uint64_t>(chunk->get_proto_size()));
+					chunk->read_proto([&](const uint8_t* data, size_t size) { out.bytes(data, size); });
+					break;
+				case COUNT:
+					out.integer(chunk->get_count());
+					break;
+				case GROUP:
+					out.integer(static_cast<uint32_t>(chunk->get_group().size()));
+					chunk->get_group().for_each([&](string_view member) { out.str(member); });
+					break;
+				default:
+					throw runtime_error("DataChunk has an unknown type");
+				}
+				records++;
+			});
+			out.integer(snapshot_end);
+			out.integer(static_cast<uint64_t>(records));
+			out.finish();
+		}
+		if (rename(temporary.c_str(), path.c_str()) != 0) {
+			remove(temporary.c_str());
+			throw runtime_error("Failed to replace snapshot file " + path);
+		}
+		return records;
+	}
+
+	size_t snapshot_load(CoreMap& map, const string& path) {
+		SnapshotReader in(path);
+		char magic[sizeof(snapshot_magic)];
+		in.bytes(magic, sizeof(magic));
+		if (memcmp(magic, snapshot_magic, sizeof(magic)) != 0) throw runtime_error("File is not a snapshot: " + path);
+		if (in.integer<uint16_t>() != snapshot_version) throw runtime_error("Snapshot version is not supported: " + path);
+
+		string key;
+		string member;
+		vector<uint8_t> value;
+		size_t records = 0;
+		size_t loaded = 0;
+		for (;;) {
+			const uint8_t type = in.integer<uint8_t>();
+			if (type == snapshot_end) break;
+			const uint64_t expiry = in.integer<uint64_t>();
+			in.str(key);
+			switch (type) {
+			case PROTO:
+				value.resize(in.length(in.integer<uint64_t>()));
+				in.bytes(value.data(), value.size());
+				proto_set(map, key, value.data(), value.size());
+				break;
+			case COUNT: {
+				CountChunk chunk;
+				chunk.store(in.integer<uint64_t>());
+				map.set(key, chunk);
+				break;
+			}
+			case GROUP: {
+				// The members are added to a new group (an existing key of another type is replaced)
+				map.set(key, make_group());
+				// Every member takes at least its u32 length
+				const uint32_t count = static_cast<uint32_t>(in.length(in.integer<uint32_t>(), sizeof(uint32_t)));
+				for (uint32_t i = 0; i < count; i++) {
+					in.str(member);
+					group_add(map, key, member);
+				}
+				break;
+			}
+			default:
+				throw runtime_error("Snapshot contains an unknown type: " + path);
+			}
+			records++;
+
+			if (expiry) {
+				const auto remaining = chrono::system_clock::time_point(chrono::milliseconds(expiry)) - chrono::system_clock::now();
+				// Keys that expired in the meantime are deleted again (expire deletes keys with a duration <= 0)
+				map.expire(key, remaining);
+				if (remaining <= chrono::system_clock::duration::zero()) continue;
+			}
+			loaded++;
+		}
+		if (in.integer<uint64_t>() != records) throw runtime_error("Snapshot file is corrupted: " + path);
+		return loaded;
+	}
+}
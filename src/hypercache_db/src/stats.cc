@@ -0,0 +1,56 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <string_view>
+
+#include "core.hpp"
+
+using namespace std;
+
+namespace core {
+	namespace {
+		// Case insensitive comparison of the requested section with a lowercase name
+		bool is_section(string_view section, string_view name) {
+			if (section.size() != name.size()) return false;
+			for (size_t i = 0; i < section.size(); i++) {
+				if (tolower(static_cast<unsigned char>(section[i])) != name[i]) return false;
+			}
+			return true;
+		}
+	}
+
+	string stats(CoreMap& map, string_view section) {
+		const bool all = section.empty() || is_section(section, "all");
+		string out;
+		if (all || is_section(section, "keyspace")) {
+			out.append("# Keyspace\r\n");
+			hypermap::info::line(out, "keys", static_cast<uint64_t>(map.load()));
+			hypermap::info::line(out, "slots", static_cast<uint64_t>(map.capacity()));
+		}
+		if (all || is_section(section, "probe")) {
+			out.append("# Probe\r\n");
+			hypermap::append_info(out, map.stats());
+		}
+		if (all || is_section(section, "locks")) {
+			out.append("# Locks\r\n");
+			hypermap::append_info(out, hypermap::lock_stats());
+		}
+		return out;
+	}
+}
@@ -0,0 +1,351 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <system_error>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "uring.hpp"
+#include "codec.hpp"
+#include "resp.hpp"
+
+using namespace std;
+using namespace boost;
+
+namespace server {
+	/**
+	 * Connection of a UringWorker, the codec is provided by CodecConnection
+	 */
+	struct UringConnection {
+		virtual ~UringConnection() = default;
+		virtual size_t process(const uint8_t* data, size_t size, ResponseBatch& batch) = 0;
+
+		// Index of the connection in the registered file table
+		unsigned file = 0;
+		// Incomplete request (received bytes are processed straight from the provided buffer if this is empty)
+		vector<uint8_t> input;
+		// batches[pending] collects responses, the other batch is sent
+		ResponseBatch batches[2];
+		size_t pending = 0;
+		// Gather list of the send in flight, [iov_begin, end) is not sent yet
+		vector<iovec> iov;
+		size_t iov_begin = 0;
+		msghdr message{};
+		bool receiving = false;
+		bool sending = false;
+		// Reading paused until the send completed (backpressure)
+		bool paused = false;
+		bool dirty = false;
+		bool closing = false;
+		bool closed = false;
+	};
+
+	namespace {
+		template <typename Codec_T>
+		struct CodecConnection final : public UringConnection {
+			explicit CodecConnection(Codec_T codec) : codec(std::move(codec)) {};
+
+			size_t process(const uint8_t* data, size_t size, ResponseBatch& batch) override {
+				return codec.process(data, size, batch);
+			};
+
+			Codec_T codec;
+		};
+	}
+
+	UringWorker::UringWorker(core::CoreMap& map, LeaseTable& leases, const ServerConfig& config, int listener, int resp_listener)
+		: map(map), leases(leases), config(config), listener(listener), resp_listener(resp_listener),
+			ring(make_unique<hyperring::Ring>(ring_entries)) {
+		rlimit limit{};
+		getrlimit(RLIMIT_NOFILE, &limit);
+		ring->register_files(static_cast<unsigned>(min<rlim_t>(max_files, limit.rlim_cur)));
+		buffers = make_unique<hyperring::BufferRing>(*ring, 0, buffer_count, buffer_size);
+		wake_fd = eventfd(0, EFD_CLOEXEC);
+		if (wake_fd < 0) throw system_error(errno, system_category(), "eventfd");
+	}
+
+	UringWorker::~UringWorker() {
+		// Closing the ring cancels the requests in flight before the connections are released
+		buffers.reset();
+		ring.reset();
+		for (UringConnection* connection : connections) delete connection;
+		::close(wake_fd);
+	}
+
+	void UringWorker::run() {
+		ring->enable();
+		accept(listener, ACCEPT);
+		if (resp_listener >= 0) accept(resp_listener, ACCEPT_RESP);
+		wait_wake();
+		while (!stopped) {
+			ring->submit(1);
+			ring->drain([this](const io_uring_cqe& cqe) { handle(cqe); });
+			buffers->publish();
+			for (UringConnection* connection : dirty) {
+				connection->dirty = false;
+				flush(connection);
+			}
+			dirty.clear();
+		}
+	}
+
+	void UringWorker::stop() {
+		const uint64_t value = 1;
+		[[maybe_unused]] const ssize_t written = ::write(wake_fd, &value, sizeof(value));
+	}
+
+	int UringWorker::listen(const string& address, uint16_t port) {
+		const asio::ip::tcp::endpoint endpoint(asio::ip::make_address(address), port);
+		const int socket = ::socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (socket < 0) throw system_error(errno, system_category(), "socket");
+		const int one = 1;
+		setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+		// Accepted connections inherit TCP_NODELAY (there is no setsockopt for registered files)
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (::bind(socket, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0 || ::listen(socket, SOMAXCONN) < 0) {
+			const int err = errno;
+			::close(socket);
+			throw system_error(err, system_category(), "bind " + address + ":" + to_string(port));
+		}
+		return socket;
+	}
+
+	uint16_t UringWorker::port(int socket) {
+		asio::ip::tcp::endpoint endpoint;
+		socklen_t size = static_cast<socklen_t>(endpoint.capacity());
+		if (getsockname(socket, endpoint.data(), &size) < 0) throw system_error(errno, system_category(), "getsockname");
+		endpoint.resize(size);
+		return endpoint.port();
+	}
+
+	namespace {
+		uint64_t user_data(UringConnection* connection, uint64_t tag) {
+			return reinterpret_cast<uint64_t>(connection) | tag;
+		}
+	}
+
+	void UringWorker::handle(const io_uring_cqe& cqe) {
+		UringConnection* connection = reinterpret_cast<UringConnection*>(cqe.user_data & ~tag_mask);
+		switch (cqe.user_data & tag_mask) {
+		case RECV:
+			on_receive(connection, cqe);
+			break;
+		case SEND:
+			on_send(connection, cqe);
+			break;
+		case CLOSE:
+			connections.erase(connection);
+			delete connection;
+			break;
+		case ACCEPT:
+			on_accept(cqe, ACCEPT);
+			break;
+		case ACCEPT_RESP:
+			on_accept(cqe, ACCEPT_RESP);
+			break;
+		case WAKE:
+			stopped = true;
+			break;
+		default:
+			// Completion of a cancel request, the canceled request completes on its own
+			break;
+		}
+	}
+
+	void UringWorker::accept(int socket, Tag tag) {
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = socket;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		// The connection is installed in the registered file table
+		sqe->file_index = IORING_FILE_INDEX_ALLOC;
+		sqe->user_data = tag;
+	}
+
+	void UringWorker::on_accept(const io_uring_cqe& cqe, Tag tag) {
+		if (cqe.res >= 0) {
+			UringConnection* connection;
+			if (tag == ACCEPT) connection = new CodecConnection<BinaryCodec>(BinaryCodec(map, config.max_frame, &leases));
+			else connection = new CodecConnection<RespCodec>(RespCodec(map, config.max_frame, &leases));
+			connection->file = static_cast<unsigned>(cqe.res);
+			connections.insert(connection);
+			receive(connection);
+		}
+		// The multishot accept ends on errors (e.g. a full file table), it is rearmed
+		if (!(cqe.flags & IORING_CQE_F_MORE)) accept(tag == ACCEPT ? listener : resp_listener, tag);
+	}
+
+	void UringWorker::receive(UringConnection* connection) {
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = static_cast<int>(connection->file);
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+		sqe->buf_group = buffers->id();
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->user_data = user_data(connection, RECV);
+		connection->receiving = true;
+	}
+
+	void UringWorker::on_receive(UringConnection* connection, const io_uring_cqe& cqe) {
+		if (!(cqe.flags & IORING_CQE_F_MORE)) connection->receiving = false;
+		if (cqe.res > 0) {
+			const uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			on_data(connection, buffers->buffer(id), static_cast<size_t>(cqe.res));
+			buffers->recycle(id);
+		} else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+			// End of stream or error (ENOBUFS is rearmed once the buffers are published, ECANCELED pauses reading)
+			close(connection);
+		}
+		if (connection->closing) release(connection);
+		else if (!connection->receiving && !connection->paused) receive(connection);
+	}
+
+	void UringWorker::on_data(UringConnection* connection, const uint8_t* data, size_t size) {
+		if (connection->closing) return;
+		ResponseBatch& batch = connection->batches[connection->pending];
+		vector<uint8_t>& input = connection->input;
+		try {
+			if (input.empty()) {
+				const size_t used = connection->process(data, size, batch);
+				if (used < size) input.assign(data + used, data + size);
+			} else {
+				input.insert(input.end(), data, data + size);
+				const size_t used = connection->process(input.data(), input.size(), batch);
+				input.erase(input.begin(), input.begin() + static_cast<ptrdiff_t>(used));
+			}
+		} catch (const std::exception&) {
+			// Protocol violation, the stream can not be resynchronized
+			close(connection);
+			return;
+		}
+		if (input.size() > config.session.max_read_buffer) {
+			close(connection);
+			return;
+		}
+		if (input.empty() && input.capacity() > ResponseBatch::keep_capacity) input = vector<uint8_t>();
+
+		if (!batch.empty() && !connection->dirty) {
+			connection->dirty = true;
+			dirty.push_back(connection);
+		}
+		if (connection->sending && connection->receiving && !connection->paused && batch.size() >= config.session.max_pending) {
+			connection->paused = true;
+			cancel(connection);
+		}
+	}
+
+	void UringWorker::flush(UringConnection* connection) {
+		if (connection->sending || connection->closing) return;
+		ResponseBatch& batch = connection->batches[connection->pending];
+		if (batch.empty()) return;
+		connection->pending ^= 1;
+		connection->iov.clear();
+		for (const asio::const_buffer& buffer : batch.buffers())
+			connection->iov.push_back(iovec{const_cast<void*>(buffer.data()), buffer.size()});
+		connection->iov_begin = 0;
+		send(connection);
+	}
+
+	void UringWorker::send(UringConnection* connection) {
+		connection->message = msghdr{};
+		connection->message.msg_iov = connection->iov.data() + connection->iov_begin;
+		connection->message.msg_iovlen = min<size_t>(connection->iov.size() - connection->iov_begin, IOV_MAX);
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = static_cast<int>(connection->file);
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->addr = reinterpret_cast<uint64_t>(&connection->message);
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = user_data(connection, SEND);
+		connection->sending = true;
+	}
+
+	void UringWorker::on_send(UringConnection* connection, const io_uring_cqe& cqe) {
+		connection->sending = false;
+		if (cqe.res < 0) close(connection);
+		if (connection->closing) {
+			release(connection);
+			return;
+		}
+		// Skips the sent bytes, a short send is continued with the rest of the gather list
+		size_t sent = static_cast<size_t>(cqe.res);
+		vector<iovec>& iov = connection->iov;
+		while (sent && connection->iov_begin < iov.size()) {
+			iovec& view = iov[connection->iov_begin];
+			if (sent < view.iov_len) {
+				view.iov_base = static_cast<uint8_t*>(view.iov_base) + sent;
+				view.iov_len -= sent;
+				break;
+			}
+			sent -= view.iov_len;
+			connection->iov_begin++;
+		}
+		if (connection->iov_begin < iov.size()) {
+			send(connection);
+			return;
+		}
+		// Releases the pins of the sent values
+		connection->batches[connection->pending ^ 1].clear();
+		if (connection->paused && connection->batches[connection->pending].size() < config.session.max_pending) {
+			connection->paused = false;
+			if (!connection->receiving) receive(connection);
+		}
+		flush(connection);
+	}
+
+	void UringWorker::close(UringConnection* connection) {
+		if (connection->closing) return;
+		connection->closing = true;
+		if (connection->receiving) cancel(connection);
+	}
+
+	void UringWorker::cancel(UringConnection* connection) {
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = user_data(connection, RECV);
+		sqe->user_data = CANCEL;
+	}
+
+	void UringWorker::release(UringConnection* connection) {
+		if (!connection->closing || connection->receiving || connection->sending || connection->closed) return;
+		connection->closed = true;
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = connection->file + 1;
+		sqe->user_data = user_data(connection, CLOSE);
+	}
+
+	void UringWorker::wait_wake() {
+		io_uring_sqe* sqe = ring->sqe();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = wake_fd;
+		sqe->addr = reinterpret_cast<uint64_t>(&wake_value);
+		sqe->len = sizeof(wake_value);
+		sqe->user_data = WAKE;
+	}
+}
@@ -0,0 +1,46 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace proxy {
+	/**
+	 * Completion receives the replies of the requests that are sent to the shards (see ShardPool)
+	 */
+	class Completion {
+	public:
+		/**
+		 * Called with the reply frame of the request tag (the frame carries the connection id, not the request id)
+		 *
+		 * The frame is only valid during the call. The completion must stay alive until all its requests are completed
+		 * or cancelled.
+		 */
+		virtual void complete(size_t tag, const uint8_t* frame, size_t size) = 0;
+
+	protected:
+		~Completion() = default;
+	};
+}
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "completion.h"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * FlightTable coalesces identical reads that are in flight (singleflight)
+	 *
+	 * A read joins the flight of its key if one is in flight, only the first read of a key is sent to the shard
+	 * and its reply is passed to every requester that joined. The flights are found through an open addressing index
+	 * of the keyed SipHash-1-3 of the key (linear probing, backward shift deletion), flights and waiters live in
+	 * reused vectors, so joining a flight allocates nothing. The hash is seeded per process: clients can not
+	 * precompute keys that probe into long chains (shard routing stays unseeded, it must agree across proxies).
+	 *
+	 * A write of a key must detach its flight before the write is sent: the flight still completes its requesters,
+	 * but later reads start a new flight and can not observe a value that is older than the write.
+	 *
+	 * The table belongs to one event loop (see ShardPool), it is never shared between threads and needs no lock.
+	 */
+	class FlightTable : public Completion {
+	public:
+		// Returned by join() if the read joined a flight
+		static constexpr size_t joined = SIZE_MAX;
+
+		FlightTable();
+		FlightTable(const FlightTable&) = delete;
+		FlightTable& operator=(const FlightTable&) = delete;
+
+		/**
+		 * Attaches the requester to the flight of the key in the group (reads of different groups are never coalesced)
+		 *
+		 * Returns joined if a flight was in progress. Otherwise a flight is started and its id is returned,
+		 * the caller sends the read with this table as completion and the id as tag.
+		 */
+		size_t join(size_t group, string_view key, Completion& completion, size_t tag);
+
+		/**
+		 * Detaches the flight of the key, later reads start a new flight
+		 */
+		void detach(size_t group, string_view key);
+
+		/**
+		 * Removes the requests of the completion from all flights
+		 */
+		void cancel(Completion& completion);
+
+		/**
+		 * Passes the reply of the flight to all its requesters and ends the flight
+		 */
+		void complete(size_t tag, const uint8_t* frame, size_t size) override;
+
+		/**
+		 * Returns the number of flights in progress
+		 */
+		size_t size() const noexcept {
+			return flights.size() - free_flights.size();
+		};
+
+	private:
+		static constexpr uint32_t none = UINT32_MAX;
+
+		struct Flight {
+			uint64_t hash = 0;
+			size_t group = 0;
+			string key;
+			// Waiter list (in join order)
+			uint32_t head = none;
+			uint32_t tail = none;
+			// Flight is in the index (joinable)
+			bool indexed = false;
+		};
+
+		struct Waiter {
+			Completion* completion;
+			size_t tag;
+			uint32_t next;
+		};
+
+		// Hash of the key in the group
+		static uint64_t hash_of(size_t group, string_view key) noexcept;
+		// Returns the index position of the joinable flight of the key, or none
+		size_t find(uint64_t hash, size_t group, string_view key) const noexcept;
+		// Inserts the flight into the index
+		void insert(uint32_t flight);
+		// Removes the flight at the index position (shifts the following entries back)
+		void erase(size_t pos) noexcept;
+
+		vector<Flight> flights;
+		vector<uint32_t> free_flights;
+		vector<Waiter> waiters;
+		uint32_t free_waiters = none;
+		// Index slots hold the flight id + 1 (0 = empty), the capacity is a power of two
+		vector<uint32_t> index;
+		size_t indexed = 0;
+	};
+}
+
+#endif
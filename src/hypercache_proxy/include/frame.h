@@ -0,0 +1,126 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * FrameBuffer buffers the bytes of a stream of protocol frames
+	 *
+	 * Bytes are received into the free space returned by prepare() and committed with commit(),
+	 * complete frames are taken from the front with frame() and consume().
+	 */
+	class FrameBuffer {
+	public:
+		// Minimum free space that is prepared for a read
+		static constexpr size_t min_read = 4096;
+		// Buffer capacity that is kept once the buffer is drained
+		static constexpr size_t keep_capacity = 1 << 20;
+
+		explicit FrameBuffer(size_t initial = 64 * 1024) : bytes(initial), initial(initial) {};
+
+		/**
+		 * Returns the buffered bytes
+		 */
+		const uint8_t* data() const noexcept {
+			return bytes.data() + begin;
+		};
+
+		size_t size() const noexcept {
+			return end - begin;
+		};
+
+		/**
+		 * Returns the size of the complete frame at the front (including the length field), 0 if it is incomplete
+		 *
+		 * Throws an invalid_argument if the frame length is invalid or exceeds max_frame.
+		 */
+		size_t frame(size_t max_frame) const {
+			if (size() < protocol::header_size) return 0;
+			const size_t length = protocol::get_u32(data());
+			if (length < protocol::header_size - protocol::length_size || length > max_frame)
+				throw invalid_argument("Invalid frame length");
+			return size() >= length + protocol::length_size ? length + protocol::length_size : 0;
+		};
+
+		/**
+		 * Removes size bytes from the front
+		 */
+		void consume(size_t size) noexcept {
+			begin += size;
+			if (begin == end) begin = end = 0;
+		};
+
+		/**
+		 * Returns the free space for the next read
+		 *
+		 * The space holds at least min_read bytes and the rest of the incomplete frame at the front
+		 * (the buffer is compacted / grown if required).
+		 */
+		boost::asio::mutable_buffer prepare() {
+			size_t need = min_read;
+			if (size() >= protocol::length_size) {
+				const size_t length = protocol::get_u32(data()) + protocol::length_size;
+				if (length > size() && length - size() > need) need = length - size();
+			}
+			if (begin == end && bytes.size() > keep_capacity) {
+				bytes = vector<uint8_t>(initial);
+				begin = end = 0;
+			}
+			if (bytes.size() - end < need) {
+				memmove(bytes.data(), bytes.data() + begin, end - begin);
+				end -= begin;
+				begin = 0;
+				if (bytes.size() - end < need) bytes.resize(max(bytes.size() * 2, end + need));
+			}
+			return boost::asio::buffer(bytes.data() + end, bytes.size() - end);
+		};
+
+		/**
+		 * Appends size received bytes (written to the space returned by prepare())
+		 */
+		void commit(size_t size) noexcept {
+			end += size;
+		};
+
+		void clear() noexcept {
+			begin = end = 0;
+		};
+
+	private:
+		vector<uint8_t> bytes;
+		size_t initial;
+		// [begin, end) holds the buffered bytes
+		size_t begin = 0;
+		size_t end = 0;
+	};
+}
+
+#endif
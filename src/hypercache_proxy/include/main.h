@@ -1,6 +1,17 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#define TEST "DB"
+#include <string>
+
+#include "proxy.h"
+
+/**
+ * Options of the hypercache_proxy process
+ */
+struct Options {
+  proxy::ProxyConfig proxy;
+  // File with one shard address per line, re-read on SIGHUP (replaces --shards)
+  string shards_file;
+};
 
 #endif
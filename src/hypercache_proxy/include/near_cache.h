@@ -0,0 +1,131 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef NEAR_CACHE_H
+#define NEAR_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lib/hypermap/hypermap.hpp"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * NearCache holds the values of hot keys in the proxy, so their reads never leave the proxy tier
+	 *
+	 * A key is cached after it was read threshold times on one event loop thread (see hot()). Its value is then read
+	 * with LEASE instead of GET: the shard registers the shard connection as holder of the key and pushes an invalidation
+	 * on the first write (see protocol LEASE), the value is cached until the lease expires. The lease bounds the staleness
+	 * if an invalidation is lost, the cache is flushed if a shard connection fails (its leases are gone with it).
+	 *
+	 * Writes through the proxy invalidate the key when they are sent and again when the shard acknowledged them, so a
+	 * client always reads its own writes. Every key maps to a write stamp that is bumped by each invalidation, a value
+	 * is only served if the stamp did not change since its lease was requested (a read that raced with a write is never cached).
+	 *
+	 * The cache is shared by all threads, values live in a preallocated HyperMap (slots must be a power of two).
+	 * If it holds max_keys keys, the key with the soonest expiry out of a few sampled slots is evicted (like hypercache_embedded).
+	 */
+	class NearCache {
+	public:
+		// Values above this size are not cached
+		static constexpr size_t max_value = 64 * 1024;
+		// Write stamps (keys share a stamp if their hashes collide, a write then invalidates both)
+		static constexpr size_t stamp_count = 1 << 16;
+
+		NearCache(size_t slots, size_t threshold);
+		NearCache(const NearCache&) = delete;
+		NearCache& operator=(const NearCache&) = delete;
+
+		/**
+		 * Appends the value of the key to out, returns false if it is not cached or its lease expired
+		 *
+		 * The value is copied under the read lock of its slot, so a hit touches no shared reference count.
+		 */
+		bool get(string_view key, vector<uint8_t>& out);
+		/**
+		 * Counts a read of the key on the calling thread, returns true if the key is hot
+		 *
+		 * The counters are per thread and decay (they are halved periodically), so a key must stay hot to be cached.
+		 */
+		bool hot(string_view key);
+		/**
+		 * Returns the write stamp of the key, it is taken before the lease is requested
+		 */
+		uint64_t stamp(string_view key) const;
+		/**
+		 * Caches the value until expiry, unless the key was invalidated since stamp was taken
+		 */
+		void insert(string_view key, string_view value, uint64_t stamp, chrono::steady_clock::time_point expiry);
+		/**
+		 * Drops the key (written through the proxy or invalidated by its shard)
+		 */
+		void invalidate(string_view key);
+		/**
+		 * Drops all keys
+		 */
+		void flush();
+		/**
+		 * Clears the tombstones of evicted keys once they exceed max_tombstones (rehash of the map)
+		 *
+		 * The rehash locks every slot, it must be called off the event loop threads (see Proxy::compact).
+		 */
+		void compact();
+		/**
+		 * Returns the stats report of the cache map ("# NearCache" section, see hypermap::append_info)
+		 */
+		string stats();
+
+	private:
+		// Number of sampled slots per eviction
+		static constexpr size_t eviction_samples = 5;
+		// Tombstone factor that triggers a rehash
+		static constexpr double max_tombstones = 0.125;
+
+		/**
+		 * Cached value, it is only served if stamp and generation are still current
+		 */
+		struct Value {
+			string bytes;
+			chrono::steady_clock::time_point expiry;
+			uint64_t stamp = 0;
+			uint64_t generation = 0;
+		};
+
+		// Evicts keys until the map holds less than max_keys keys
+		void reserve();
+
+		hypermap::HyperMap<Value, Value> map;
+		size_t max_keys;
+		size_t threshold;
+		array<atomic<uint64_t>, stamp_count> stamps{};
+		// Incremented by flush(), values of older generations are not served
+		atomic<uint64_t> generation{0};
+	};
+}
+
+#endif
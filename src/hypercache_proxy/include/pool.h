@@ -0,0 +1,168 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "completion.h"
+#include "flight.h"
+#include "frame.h"
+#include "near_cache.h"
+#include "route_map.h"
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * ShardPool multiplexes the requests of all sessions of one event loop onto a few persistent shard connections
+	 *
+	 * Every shard has a fixed number of connections (lanes), a session sends all its requests through one lane.
+	 * The pool replaces the id of a forwarded request with an id of the connection that indexes its in-flight slot,
+	 * replies are matched to their requester by that id, so they complete independently of each other.
+	 * Requests appended during one event loop turn are written with a single write per connection (a flush is posted
+	 * with the first append and picks up the frames of all sessions that follow).
+	 *
+	 * Reads sent with read() are coalesced per shard and lane (see FlightTable), a hot key is read once
+	 * per event loop no matter how many sessions wait for it.
+	 *
+	 * Invalidations that the shards push for the leases of the near cache are applied to it (see NearCache),
+	 * the near cache is flushed if a connection that may hold leases fails.
+	 *
+	 * The pool belongs to one io_context and is only used by its thread. Connections are opened on first use,
+	 * if a connection fails its in-flight requests are completed with an ERROR reply and it is reopened by the next send.
+	 */
+	class ShardPool {
+	public:
+		ShardPool(boost::asio::io_context& context, size_t lanes, size_t max_frame, NearCache* near = nullptr);
+		ShardPool(const ShardPool&) = delete;
+		ShardPool& operator=(const ShardPool&) = delete;
+		~ShardPool();
+
+		/**
+		 * Adapts the shards to the table, in-flight requests of shards whose endpoint changed are failed
+		 */
+		void reconcile(const RouteTable& table);
+
+		/**
+		 * Returns the version of the table the shards were reconciled with (0 before the first reconcile)
+		 */
+		uint64_t version() const noexcept {
+			return table_version;
+		};
+
+		/**
+		 * Returns the next lane (round robin), sessions keep their lane for their lifetime
+		 */
+		size_t lane() noexcept {
+			return lane_index++ % lanes;
+		};
+
+		/**
+		 * Sends the request frame to the shard, the reply is passed to completion.complete(tag, ...)
+		 *
+		 * The frame is copied, the completion is never invoked during send().
+		 */
+		void send(size_t shard, size_t lane, const uint8_t* frame, size_t size, Completion& completion, size_t tag);
+
+		/**
+		 * Sends the read request frame of the key like send(), unless an identical read is in flight
+		 * on the same shard and lane: then the request joins it and is completed with its reply
+		 *
+		 * Reads with different ops (GET / LEASE) are never coalesced.
+		 */
+		void read(size_t shard, size_t lane, string_view key, const uint8_t* frame, size_t size, Completion& completion, size_t tag);
+
+		/**
+		 * Detaches the read of the key that is in flight, must be called before a write of the key is sent
+		 */
+		void write(size_t shard, size_t lane, string_view key);
+
+		/**
+		 * Detaches the in-flight requests of the completion, their replies are discarded when they arrive
+		 */
+		void cancel(Completion& completion);
+
+	private:
+		// In-flight request of a connection
+		struct Pending {
+			Completion* completion = nullptr;
+			size_t tag = 0;
+			// The id stays reserved until the reply of a cancelled request arrived
+			bool cancelled = false;
+		};
+
+		/**
+		 * Persistent connection to a shard
+		 */
+		struct Connection {
+			explicit Connection(boost::asio::io_context& context, const boost::asio::ip::tcp::endpoint& endpoint)
+				: socket(context), endpoint(endpoint) {};
+
+			boost::asio::ip::tcp::socket socket;
+			boost::asio::ip::tcp::endpoint endpoint;
+			FrameBuffer input{64 * 1024};
+			// Frames appended since the last flush
+			vector<uint8_t> output;
+			// Frames of the write in progress
+			vector<uint8_t> writing;
+			// In-flight requests, indexed by the connection id of the request
+			vector<Pending> inflight;
+			vector<uint32_t> free_ids;
+			// Incremented when the connection fails, coroutines of an older generation exit
+			uint64_t generation = 0;
+			bool connecting = false;
+			bool connected = false;
+			bool flushing = false;
+		};
+
+		// Connects the connection and starts its receive loop
+		boost::asio::awaitable<void> connect(shared_ptr<Connection> connection, uint64_t generation);
+		// Writes the output of the connection until it is drained
+		boost::asio::awaitable<void> flush(shared_ptr<Connection> connection, uint64_t generation);
+		// Reads the replies of the connection and completes their requests
+		boost::asio::awaitable<void> receive(shared_ptr<Connection> connection, uint64_t generation);
+		// Closes the connection and completes its in-flight requests with an ERROR reply
+		void fail(Connection& connection, const char* message);
+		// Returns the flight group of a read (shard, lane and op)
+		size_t group(size_t shard, size_t lane, uint8_t op) const noexcept {
+			return ((shard * lanes + lane % lanes) << 1) | (op == protocol::LEASE);
+		};
+
+		boost::asio::io_context& context;
+		size_t lanes;
+		size_t max_frame;
+		NearCache* near;
+		size_t lane_index = 0;
+		uint64_t table_version = 0;
+		// Connections of every shard (one per lane)
+		vector<vector<shared_ptr<Connection>>> shards;
+		// Reads in flight (see group())
+		FlightTable flights;
+	};
+}
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "near_cache.h"
+#include "pool.h"
+#include "route_map.h"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * Configuration of the proxy
+	 */
+	struct ProxyConfig {
+		string address = "0.0.0.0";
+		// Port of the native protocol (0 = ephemeral port, see Proxy::port())
+		uint16_t port = 7500;
+		// Addresses of the db shards (host:port), the order defines the routing
+		vector<string> shards;
+		// Number of event loop threads (0 = number of cores)
+		size_t threads = 0;
+		// Persistent connections per shard and event loop thread, the sessions of a thread are multiplexed onto them
+		size_t shard_connections = 1;
+		// Maximum frame size (requests and replies)
+		size_t max_frame = 64 * 1024 * 1024;
+		// Coalesces identical GETs that are in flight on the same shard connection
+		bool coalesce_reads = true;
+		// Deadline of a batch with multi-key requests, keys of shards that did not reply are answered with ERROR
+		chrono::milliseconds fanout_timeout{100};
+		// Deadline of every other batch, requests of shards that did not reply are answered with ERROR
+		chrono::milliseconds request_timeout{1000};
+		// Slots of the near cache of hot keys (power of two, 0 = disabled, see NearCache)
+		size_t near_cache = 0;
+		// Reads of a key on one thread before it is cached (at most 255)
+		size_t near_cache_threshold = 8;
+		// Lease that is requested for a cached key, it bounds the staleness if an invalidation is lost
+		chrono::milliseconds near_cache_lease{1000};
+		// Interval of the near cache compaction in milliseconds (see Proxy::compact)
+		chrono::milliseconds near_cache_compact{1000};
+	};
+
+	/**
+	 * Proxy accepts the connections of the native protocol (see lib/protocol/protocol.hpp)
+	 * and forwards the requests to the shard that owns the key (see RouteMap and Session)
+	 *
+	 * Every thread runs its own io_context, connections are assigned round robin to the contexts
+	 * and stay on their thread for their whole lifetime. Every context owns a ShardPool, so a proxy holds
+	 * threads * shard_connections connections per shard regardless of the number of clients.
+	 */
+	class Proxy {
+	public:
+		explicit Proxy(const ProxyConfig& config);
+		Proxy(const Proxy&) = delete;
+		Proxy& operator=(const Proxy&) = delete;
+		~Proxy();
+
+		/**
+		 * Resolves the shards, binds the listener and starts the event loop threads
+		 *
+		 * Throws an invalid_argument if no shard is configured or there are more threads than RouteMap::max_readers,
+		 * and a boost::system::system_error
+		 * if a shard can not be resolved or the address can not be bound.
+		 */
+		void start();
+		/**
+		 * Resolves the shards and publishes them as the new route table (valid after start())
+		 *
+		 * Sessions pick up the table with their next batch, the connections to shards that were replaced are closed.
+		 * Throws like start(), the current table is kept in that case.
+		 */
+		void reroute(const vector<string>& shards);
+		/**
+		 * Stops the event loops and joins the threads
+		 */
+		void stop();
+		/**
+		 * Clears the tombstones of the near cache (see NearCache::compact)
+		 *
+		 * The rehash blocks all readers of the cache for its duration, it is called by a thread that runs no event loop.
+		 */
+		void compact();
+		/**
+		 * Returns the bound port (valid after start())
+		 */
+		uint16_t port() const noexcept;
+
+	private:
+		// Pause of the accept loop if the process is out of descriptors (or memory)
+		static constexpr chrono::milliseconds accept_backoff{10};
+
+		// Accept loop, every connection is served by a Session coroutine on the next context
+		boost::asio::awaitable<void> accept();
+		// Resolves the host:port addresses of the shards
+		vector<boost::asio::ip::tcp::endpoint> resolve(const vector<string>& shards);
+		// Returns the index of the next context (round robin)
+		size_t next_context();
+
+		ProxyConfig config;
+		unique_ptr<RouteMap> routes;
+		// Shared by all contexts (null if disabled)
+		unique_ptr<NearCache> near;
+		vector<unique_ptr<boost::asio::io_context>> contexts;
+		// Shard pool of every context (destroyed before the contexts)
+		vector<unique_ptr<ShardPool>> pools;
+		vector<thread> threads;
+		unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+		size_t context_index = 0;
+	};
+}
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ROUTE_MAP_H
+#define ROUTE_MAP_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "lib/hypermap/hyperhash.hpp"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * RouteTable maps keys to the db shards
+	 *
+	 * The table is a fixed array of slots that hold a shard index, a key is routed to the slot selected by the top bits
+	 * of its unseeded hyperhash::hash64, so the lookup is a shift and a load without a branch and every proxy with the same
+	 * shard list routes a key to the same shard. The slots are assigned with jump consistent hash: appending a shard to the list
+	 * only moves the slots that the new shard takes over (1/n of the keys), all other keys keep their shard.
+	 *
+	 * A table is immutable once it is built, tables are replaced as a whole (see RouteMap).
+	 */
+	class RouteTable {
+	public:
+		static constexpr size_t slot_bits = 13;
+		// 8192 slots of 2 bytes (16 KiB) stay resident in the L1/L2 cache
+		static constexpr size_t slot_count = size_t(1) << slot_bits;
+		static constexpr size_t max_shards = UINT16_MAX;
+
+		RouteTable(vector<boost::asio::ip::tcp::endpoint> shards, uint64_t version);
+
+		/**
+		 * Returns the shard index of the key
+		 */
+		size_t route(string_view key) const noexcept {
+			return slots[hyperhash::hash64(key) >> (64 - slot_bits)];
+		};
+
+		/**
+		 * Returns the endpoint of the shard
+		 */
+		const boost::asio::ip::tcp::endpoint& endpoint(size_t shard) const {
+			return shards.at(shard);
+		};
+
+		size_t size() const noexcept {
+			return shards.size();
+		};
+
+		/**
+		 * Returns the version of the table (incremented by every RouteMap::update())
+		 */
+		uint64_t version() const noexcept {
+			return ver;
+		};
+
+	private:
+		array<uint16_t, slot_count> slots;
+		vector<boost::asio::ip::tcp::endpoint> shards;
+		uint64_t ver;
+	};
+
+	/**
+	 * RouteMap publishes the current RouteTable to the proxy threads (read-copy-update)
+	 *
+	 * Readers enter a read section with read(), it announces the current epoch in the reader slot of the thread
+	 * and loads the table pointer, no lock is taken and no reference count is touched. update() swaps in a new table,
+	 * advances the epoch and frees the old table once every reader slot has left the sections of the older epochs.
+	 *
+	 * A read section must not span a suspension point (co_await), the reader slot is shared by all coroutines of the thread.
+	 * Read sections of one thread may be nested.
+	 */
+	class RouteMap {
+	public:
+		// Maximum number of threads that read from route maps at the same time (slots of exited threads are reused)
+		static constexpr size_t max_readers = 256;
+
+		/**
+		 * Guard holds a read section, the table stays valid until the guard is destroyed
+		 */
+		class Guard {
+		public:
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+			~Guard() {
+				slot.store(previous, memory_order_release);
+			};
+
+			const RouteTable& table() const noexcept {
+				return *current;
+			};
+
+			const RouteTable* operator->() const noexcept {
+				return current;
+			};
+
+		private:
+			friend class RouteMap;
+			explicit Guard(const RouteMap& map);
+
+			atomic<uint64_t>& slot;
+			uint64_t previous;
+			const RouteTable* current;
+		};
+
+		explicit RouteMap(vector<boost::asio::ip::tcp::endpoint> shards);
+		RouteMap(const RouteMap&) = delete;
+		RouteMap& operator=(const RouteMap&) = delete;
+		~RouteMap();
+
+		/**
+		 * Enters a read section
+		 */
+		[[nodiscard]] Guard read() const {
+			return Guard(*this);
+		};
+
+		/**
+		 * Publishes a table for the shards and frees the previous table
+		 *
+		 * Blocks until the read sections that can still see the previous table are left, updates are serialized.
+		 */
+		void update(vector<boost::asio::ip::tcp::endpoint> shards);
+
+	private:
+		struct alignas(64) ReaderSlot {
+			// Epoch of the open read section (0 = outside of a read section)
+			atomic<uint64_t> epoch{0};
+		};
+
+		// Returns the reader slot index of the calling thread
+		static size_t reader_index();
+
+		alignas(64) atomic<const RouteTable*> current;
+		atomic<uint64_t> epoch{1};
+		mutable array<ReaderSlot, max_readers> readers;
+		mutex update_lock;
+	};
+
+	inline RouteMap::Guard::Guard(const RouteMap& map) : slot(map.readers[reader_index()].epoch) {
+		previous = slot.load(memory_order_relaxed);
+		if (!previous) slot.store(map.epoch.load(memory_order_acquire), memory_order_relaxed);
+		// Orders the announcement before the pointer load (pairs with the sequentially consistent operations of update())
+		atomic_thread_fence(memory_order_seq_cst);
+		current = map.current.load(memory_order_acquire);
+	}
+}
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "completion.h"
+#include "frame.h"
+#include "near_cache.h"
+#include "pool.h"
+#include "proxy.h"
+#include "route_map.h"
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+namespace proxy {
+	/**
+	 * Session forwards the requests of one client connection to the db shards
+	 *
+	 * The session is a single straight-line coroutine: it reads the pipelined request frames of the client,
+	 * routes each frame by its key and sends it through the ShardPool of its event loop, waits until every reply
+	 * of the batch arrived and writes them back to the client in request order with a single gather write.
+	 * The session lives in the coroutine frame (see serve()), replies are collected in a reused arena,
+	 * so forwarding a request allocates neither a handler nor a shared_ptr.
+	 *
+	 * Multi-key requests (MGET / MSET) are split by shard into one sub-request per shard, the sub-requests are sent
+	 * at once and their replies are merged in key order. A batch with a multi-key request waits at most fanout_timeout,
+	 * any other batch at most request_timeout. Keys of shards that did not reply in time are answered with ERROR
+	 * (and single-key requests with an ERROR reply).
+	 * The splitting bookkeeping lives in reused vectors, so a key costs no allocation.
+	 *
+	 * GETs are coalesced with identical reads of other sessions of the event loop (see ShardPool::read), writes detach
+	 * the reads of their key that are in flight, so a session always reads its own writes.
+	 *
+	 * If the proxy has a near cache, GETs of cached keys are answered locally and GETs of hot keys are sent as LEASE
+	 * (their values are cached when the reply arrives). Writes invalidate the near cache when they are sent and again
+	 * after the batch was answered by the shards (see NearCache).
+	 *
+	 * Each batch is routed with the current RouteTable, the pool is reconciled first if its version is older.
+	 * If a shard can not be reached, the requests of the batch that are routed to it are answered with ERROR.
+	 */
+	class Session : public Completion {
+	public:
+		Session(boost::asio::ip::tcp::socket socket, const RouteMap& routes, ShardPool& pool, const ProxyConfig& config, NearCache* near);
+		Session(const Session&) = delete;
+		Session& operator=(const Session&) = delete;
+
+		/**
+		 * Serves the client until it disconnects or violates the protocol
+		 */
+		boost::asio::awaitable<void> run();
+
+		/**
+		 * Creates a session in the coroutine frame and runs it
+		 */
+		static boost::asio::awaitable<void> serve(boost::asio::ip::tcp::socket socket, const RouteMap& routes, ShardPool& pool,
+			const ProxyConfig& config, NearCache* near) {
+			Session session(std::move(socket), routes, pool, config, near);
+			co_await session.run();
+		};
+
+		void complete(size_t tag, const uint8_t* frame, size_t size) override;
+
+	private:
+		// Reply arena capacity that is kept after a batch
+		static constexpr size_t keep_capacity = 1 << 20;
+		// Tag bit of sub-requests (the rest of the tag is the part index)
+		static constexpr size_t part_tag = size_t(1) << 63;
+		static constexpr uint32_t no_part = UINT32_MAX;
+
+		/**
+		 * Request of the current batch, in client order
+		 */
+		struct Entry {
+			uint32_t id = 0;
+			// MGET / MSET if the request was split, 0 otherwise
+			uint8_t op = 0;
+			bool done = false;
+			// Reply frame in the arena
+			size_t offset = 0;
+			size_t size = 0;
+			// Sub-requests and keys of a split request
+			size_t first_part = 0;
+			size_t part_count = 0;
+			size_t first_key = 0;
+			size_t key_count = 0;
+			// GET that was sent as LEASE: its key in the key arena and the write stamp before the lease was requested
+			bool lease = false;
+			size_t key_offset = 0;
+			size_t key_size = 0;
+			uint64_t stamp = 0;
+			chrono::steady_clock::time_point sent{};
+		};
+
+		/**
+		 * Sub-request of a split request (all keys of one shard)
+		 */
+		struct Part {
+			size_t shard = 0;
+			// Size of the sub-request frame
+			size_t bytes = protocol::header_size;
+			// Write position in the sub-request frame, read position in the reply while merging
+			size_t cursor = 0;
+			// Reply frame in the arena
+			size_t offset = 0;
+			size_t size = 0;
+			bool done = false;
+		};
+
+		// Routes the request frame to its shard (or answers it locally)
+		void route(const RouteTable& table, const uint8_t* frame, size_t size);
+		// Reads the key with LEASE, its value is cached in the near cache when the reply arrives
+		void lease(size_t shard, string_view key);
+		// Converts the LEASE reply into the GET reply of the entry, the value is cached if the lease was granted
+		void leased(Entry& entry, const uint8_t* frame, size_t size);
+		// Invalidates the key in the near cache, and again after the batch was answered
+		void written(string_view key);
+		// Splits a multi-key request by shard and sends the sub-requests
+		void split(const RouteTable& table, uint8_t op, const uint8_t* frame, size_t size);
+		// Merges the sub-replies of a split request into its reply (in key order)
+		void merge(Entry& entry);
+		// Stats report of the proxy (near cache map and slot locks), answers STATS without key
+		string stats();
+		// Answers the last request of the batch locally
+		void answer(protocol::Status status, string_view body);
+		// Waits for the replies of the batch (at most fanout_timeout if the batch contains a split request)
+		boost::asio::awaitable<void> wait();
+		// Writes the replies of the batch to the client in request order
+		boost::asio::awaitable<void> reply(boost::system::error_code& ec);
+
+		boost::asio::ip::tcp::socket client;
+		const RouteMap& routes;
+		ShardPool& pool;
+		const ProxyConfig& config;
+		NearCache* near;
+		size_t lane;
+		FrameBuffer input;
+		vector<Entry> batch;
+		vector<uint8_t> replies;
+		vector<boost::asio::const_buffer> gather;
+		// Split bookkeeping: sub-requests, part of each key (relative to the first part of its request)
+		// and part of each shard while a request is split
+		vector<Part> parts;
+		vector<uint32_t> key_parts;
+		vector<uint32_t> shard_parts;
+		// Sub-request frames of the request that is split (and LEASE frames)
+		vector<uint8_t> scratch;
+		// Keys of the leases and writes of the batch, written keys are invalidated again after the batch
+		string keys;
+		vector<pair<size_t, size_t>> writes;
+		// Requests of the batch that wait for a shard reply
+		size_t outstanding = 0;
+		// Cancelled when the last reply of the batch arrived
+		boost::asio::steady_timer wakeup;
+	};
+}
+
+#endif
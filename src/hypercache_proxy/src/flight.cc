@@ -0,0 +1,159 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flight.h"
+#include "lib/hypermap/hyperhash.hpp"
+
+using namespace std;
+
+namespace proxy {
+	FlightTable::FlightTable() : index(64, 0) {}
+
+	size_t FlightTable::join(size_t group, string_view key, Completion& completion, size_t tag) {
+		uint32_t waiter = free_waiters;
+		if (waiter == none) {
+			waiter = static_cast<uint32_t>(waiters.size());
+			waiters.push_back(Waiter{});
+		} else {
+			free_waiters = waiters[waiter].next;
+		}
+		waiters[waiter] = Waiter{&completion, tag, none};
+
+		const uint64_t hash = hash_of(group, key);
+		const size_t pos = find(hash, group, key);
+		if (pos != none) {
+			Flight& flight = flights[index[pos] - 1];
+			// cancel() may have removed every waiter, the read is still in flight and serves the new one
+			if (flight.head == none) flight.head = waiter;
+			else waiters[flight.tail].next = waiter;
+			flight.tail = waiter;
+			return joined;
+		}
+
+		uint32_t id;
+		if (free_flights.empty()) {
+			id = static_cast<uint32_t>(flights.size());
+			flights.emplace_back();
+		} else {
+			id = free_flights.back();
+			free_flights.pop_back();
+		}
+		Flight& flight = flights[id];
+		flight.hash = hash;
+		flight.group = group;
+		// The key keeps the capacity of the previous flight of the slot
+		flight.key.assign(key);
+		flight.head = flight.tail = waiter;
+		insert(id);
+		return id;
+	}
+
+	void FlightTable::detach(size_t group, string_view key) {
+		const size_t pos = find(hash_of(group, key), group, key);
+		if (pos != none) erase(pos);
+	}
+
+	void FlightTable::cancel(Completion& completion) {
+		for (Flight& flight : flights) {
+			uint32_t* link = &flight.head;
+			uint32_t last = none;
+			while (*link != none) {
+				const uint32_t waiter = *link;
+				if (waiters[waiter].completion != &completion) {
+					last = waiter;
+					link = &waiters[waiter].next;
+					continue;
+				}
+				*link = waiters[waiter].next;
+				waiters[waiter].next = free_waiters;
+				free_waiters = waiter;
+			}
+			flight.tail = last;
+		}
+	}
+
+	void FlightTable::complete(size_t tag, const uint8_t* frame, size_t size) {
+		const uint32_t id = static_cast<uint32_t>(tag);
+		Flight& flight = flights[id];
+		if (flight.indexed) {
+			size_t pos = flight.hash & (index.size() - 1);
+			while (index[pos] != id + 1) pos = (pos + 1) & (index.size() - 1);
+			erase(pos);
+		}
+		uint32_t waiter = flight.head;
+		flight.head = flight.tail = none;
+		free_flights.push_back(id);
+		// The waiters are released before they are completed, a completion may start new flights
+		while (waiter != none) {
+			const Waiter current = waiters[waiter];
+			waiters[waiter].next = free_waiters;
+			free_waiters = waiter;
+			current.completion->complete(current.tag, frame, size);
+			waiter = current.next;
+		}
+	}
+
+	uint64_t FlightTable::hash_of(size_t group, string_view key) noexcept {
+		const uint64_t seed = hyperhash::process_seed() ^ (static_cast<uint64_t>(group) * 0x9e3779b97f4a7c15ULL);
+		return hyperhash::siphash<1, 3>(key.data(), key.size(), seed, hyperhash::process_key());
+	}
+
+	size_t FlightTable::find(uint64_t hash, size_t group, string_view key) const noexcept {
+		const size_t mask = index.size() - 1;
+		for (size_t pos = hash & mask; index[pos]; pos = (pos + 1) & mask) {
+			const Flight& flight = flights[index[pos] - 1];
+			if (flight.hash == hash && flight.group == group && flight.key == key) return pos;
+		}
+		return none;
+	}
+
+	void FlightTable::insert(uint32_t flight) {
+		if ((indexed + 1) * 2 > index.size()) {
+			// The index is rebuilt at twice the capacity (load factor <= 0.5)
+			vector<uint32_t> previous(index.size() * 2, 0);
+			previous.swap(index);
+			for (const uint32_t slot : previous) {
+				if (!slot) continue;
+				size_t pos = flights[slot - 1].hash & (index.size() - 1);
+				while (index[pos]) pos = (pos + 1) & (index.size() - 1);
+				index[pos] = slot;
+			}
+		}
+		size_t pos = flights[flight].hash & (index.size() - 1);
+		while (index[pos]) pos = (pos + 1) & (index.size() - 1);
+		index[pos] = flight + 1;
+		flights[flight].indexed = true;
+		indexed++;
+	}
+
+	void FlightTable::erase(size_t pos) noexcept {
+		const size_t mask = index.size() - 1;
+		flights[index[pos] - 1].indexed = false;
+		indexed--;
+		size_t hole = pos;
+		for (size_t next = (hole + 1) & mask; index[next]; next = (next + 1) & mask) {
+			// The entry moves into the hole if the hole lies between its home slot and its slot
+			const size_t home = flights[index[next] - 1].hash & mask;
+			if (((next - home) & mask) >= ((next - hole) & mask)) {
+				index[hole] = index[next];
+				hole = next;
+			}
+		}
+		index[hole] = 0;
+	}
+}
@@ -1,9 +1,169 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
 
 #include "main.h"
-
+#include "proxy.h"
 
 using namespace std;
-int main(void) {
-  cout << "Hallo From " << TEST << endl;
+using namespace boost;
+
+namespace {
+  /**
+   * Reads the shard addresses of the file (one host:port per line, empty lines and # comments are skipped)
+   */
+  vector<string> read_shards(const string& path) {
+    ifstream file(path);
+    if (!file) throw runtime_error("Failed to open the shards file: " + path);
+    vector<string> shards;
+    for (string line; getline(file, line);) {
+      line = line.substr(0, line.find('#'));
+      const size_t begin = line.find_first_not_of(" \t\r");
+      if (begin == string::npos) continue;
+      shards.push_back(line.substr(begin, line.find_last_not_of(" \t\r") - begin + 1));
+    }
+    return shards;
+  }
+
+  /**
+   * Parses the command line (--name=value)
+   *
+   *   --address=0.0.0.0          listen address
+   *   --port=7500                port of the native protocol
+   *   --shards=host:port,...     db shards (required unless --shards_file is set)
+   *   --shards_file=PATH         file with one shard per line, re-read on SIGHUP
+   *   --threads=0                event loop threads (0 = number of cores)
+   *   --shard_connections=1      connections per shard and thread
+   *   --fanout_timeout=100       deadline of multi-key requests in milliseconds
+   *   --request_timeout=1000     deadline of all other requests in milliseconds
+   *   --coalesce_reads=true      coalesce identical GETs that are in flight
+   *   --near_cache=0             slots of the near cache of hot keys (power of two, 0 = disabled)
+   *   --near_cache_threshold=8   reads of a key on one thread before it is cached
+   *   --near_cache_lease=1000    lease of a cached key in milliseconds
+   *   --near_cache_compact=1000  interval of the near cache compaction in milliseconds (0 = disabled)
+   */
+  Options parse_options(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+      const string arg = argv[i];
+      const size_t eq = arg.find('=');
+      if (arg.rfind("--", 0) != 0 || eq == string::npos)
+        throw invalid_argument("Expected --name=value, got: " + arg);
+      const string name = arg.substr(2, eq - 2);
+      const string val = arg.substr(eq + 1);
+
+      if (name == "address") opts.proxy.address = val;
+      else if (name == "port") opts.proxy.port = static_cast<uint16_t>(stoul(val));
+      else if (name == "threads") opts.proxy.threads = stoull(val);
+      else if (name == "shard_connections") opts.proxy.shard_connections = stoull(val);
+      else if (name == "coalesce_reads") opts.proxy.coalesce_reads = val == "true";
+      else if (name == "fanout_timeout") opts.proxy.fanout_timeout = chrono::milliseconds(stoull(val));
+      else if (name == "request_timeout") opts.proxy.request_timeout = chrono::milliseconds(stoull(val));
+      else if (name == "near_cache") opts.proxy.near_cache = stoull(val);
+      else if (name == "near_cache_threshold") opts.proxy.near_cache_threshold = stoull(val);
+      else if (name == "near_cache_lease") opts.proxy.near_cache_lease = chrono::milliseconds(stoull(val));
+      else if (name == "near_cache_compact") opts.proxy.near_cache_compact = chrono::milliseconds(stoull(val));
+      else if (name == "shards_file") opts.shards_file = val;
+      else if (name == "shards") {
+        opts.proxy.shards.clear();
+        for (size_t pos = 0; pos <= val.size();) {
+          const size_t comma = min(val.find(',', pos), val.size());
+          if (comma > pos) opts.proxy.shards.push_back(val.substr(pos, comma - pos));
+          pos = comma + 1;
+        }
+      }
+      else throw invalid_argument("Unknown parameter: " + name);
+    }
+    if (!opts.shards_file.empty()) opts.proxy.shards = read_shards(opts.shards_file);
+    if (opts.proxy.near_cache & (opts.proxy.near_cache - 1))
+      throw invalid_argument("near_cache must be a power of two");
+    return opts;
+  }
+
+  /**
+   * Clears the tombstones of the near cache every interval (see proxy::Proxy::compact)
+   */
+  void schedule_compaction(asio::steady_timer& timer, proxy::Proxy& proxy, chrono::milliseconds interval) {
+    timer.expires_after(interval);
+    timer.async_wait([&timer, &proxy, interval](const system::error_code& ec) {
+      if (ec) return;
+      proxy.compact();
+      schedule_compaction(timer, proxy, interval);
+    });
+  }
+}
+
+int main(int argc, char** argv) {
+  Options opts;
+  try {
+    opts = parse_options(argc, argv);
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  proxy::Proxy proxy(opts.proxy);
+  try {
+    proxy.start();
+  } catch (const std::exception& e) {
+    cerr << "Failed to start the proxy: " << e.what() << endl;
+    return 1;
+  }
+  cout << "HyperCache proxy listening on " << opts.proxy.address << ":" << proxy.port()
+       << " (" << opts.proxy.shards.size() << " shards)" << endl;
+
+  // The main thread waits for the termination signal, the requests are handled by the proxy threads
+  asio::io_context signal_context;
+  // The near cache is compacted on the main thread, a rehash would stall an event loop
+  asio::steady_timer compact_timer(signal_context);
+  if (opts.proxy.near_cache && opts.proxy.near_cache_compact.count() > 0)
+    schedule_compaction(compact_timer, proxy, opts.proxy.near_cache_compact);
+  asio::signal_set signals(signal_context, SIGINT, SIGTERM, SIGHUP);
+  function<void(const system::error_code&, int)> on_signal = [&](const system::error_code& ec, int signal) {
+    if (ec) return;
+    if (signal != SIGHUP) {
+      signal_context.stop();
+      return;
+    }
+    // SIGHUP publishes the shards of the file as a new route table
+    if (!opts.shards_file.empty()) {
+      try {
+        const vector<string> shards = read_shards(opts.shards_file);
+        proxy.reroute(shards);
+        cout << "Routing to " << shards.size() << " shards" << endl;
+      } catch (const std::exception& e) {
+        cerr << "Failed to reload the shards: " << e.what() << endl;
+      }
+    }
+    signals.async_wait(on_signal);
+  };
+  signals.async_wait(on_signal);
+  signal_context.run();
+
+  proxy.stop();
+  return 0;
 }
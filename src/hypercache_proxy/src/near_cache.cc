@@ -0,0 +1,131 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <random>
+
+#include "near_cache.h"
+#include "lib/hypermap/hyperhash.hpp"
+
+using namespace std;
+
+namespace proxy {
+	namespace {
+		// Read counters of the keys of one thread (indexed by the hash of the key)
+		struct HotCounters {
+			static constexpr size_t size = 4096;
+			// Reads after which all counters are halved
+			static constexpr size_t decay = size * 4;
+
+			array<uint8_t, size> counts{};
+			size_t reads = 0;
+		};
+
+		// Keys are converted once per call (the map takes const string&)
+		const string& scratch(string_view key) {
+			thread_local string buffer;
+			buffer.assign(key);
+			return buffer;
+		}
+	}
+
+	NearCache::NearCache(size_t slots, size_t threshold)
+		: map(slots), max_keys(slots - slots / 4), threshold(min<size_t>(threshold, UINT8_MAX)) {}
+
+	bool NearCache::get(string_view key, vector<uint8_t>& out) {
+		const uint64_t current = generation.load(memory_order_acquire);
+		const uint64_t stamp = stamps[hyperhash::hash64(key) % stamp_count].load(memory_order_acquire);
+		const auto now = chrono::steady_clock::now();
+		bool served = false;
+		map.get(scratch(key)).read([&](const Value* cached) {
+			if (cached->generation != current || cached->expiry <= now || cached->stamp != stamp) return;
+			out.insert(out.end(), cached->bytes.begin(), cached->bytes.end());
+			served = true;
+		});
+		return served;
+	}
+
+	bool NearCache::hot(string_view key) {
+		thread_local HotCounters counters;
+		if (++counters.reads == HotCounters::decay) {
+			counters.reads = 0;
+			for (uint8_t& count : counters.counts) count >>= 1;
+		}
+		uint8_t& count = counters.counts[hyperhash::hash64(key) % HotCounters::size];
+		if (count < UINT8_MAX) count++;
+		return count >= threshold;
+	}
+
+	uint64_t NearCache::stamp(string_view key) const {
+		return stamps[hyperhash::hash64(key) % stamp_count].load(memory_order_acquire);
+	}
+
+	void NearCache::insert(string_view key, string_view value, uint64_t stamp, chrono::steady_clock::time_point expiry) {
+		if (value.size() > max_value || stamp != this->stamp(key)) return;
+		reserve();
+		try {
+			map.set(scratch(key), Value{string(value), expiry, stamp, generation.load(memory_order_acquire)});
+		} catch (const runtime_error&) {
+			// The map is full, the value is read from the shard
+		}
+	}
+
+	void NearCache::invalidate(string_view key) {
+		// The stamp is bumped first, a value that is inserted after the delete is already stale
+		stamps[hyperhash::hash64(key) % stamp_count].fetch_add(1, memory_order_acq_rel);
+		map.del(scratch(key));
+	}
+
+	void NearCache::flush() {
+		generation.fetch_add(1, memory_order_acq_rel);
+	}
+
+	string NearCache::stats() {
+		string out = "# NearCache\r\n";
+		hypermap::info::line(out, "keys", static_cast<uint64_t>(map.load()));
+		hypermap::info::line(out, "slots", static_cast<uint64_t>(map.capacity()));
+		hypermap::append_info(out, map.stats());
+		return out;
+	}
+
+	void NearCache::reserve() {
+		for (size_t round = 0; map.load() >= max_keys && round < 2; round++) {
+			thread_local mt19937_64 rng(random_device{}());
+			string victim;
+			auto victim_expiry = chrono::steady_clock::time_point::max();
+			bool found = false;
+			const uint64_t current = generation.load(memory_order_acquire);
+			for (size_t i = 0; i < eviction_samples; i++) {
+				map.visit_slot(rng() & (map.capacity() - 1), [&](const string& key, const Value* value, chrono::system_clock::time_point) {
+					// Values of a flushed generation are evicted first
+					const auto expiry = value->generation == current ? value->expiry : chrono::steady_clock::time_point::min();
+					if (found && expiry >= victim_expiry) return;
+					victim = key;
+					victim_expiry = expiry;
+					found = true;
+				});
+			}
+			if (found) map.del(victim);
+		}
+	}
+
+	void NearCache::compact() {
+		// Evicted keys leave tombstones that lengthen the probe sequences of misses, they are cleared by a rehash
+		if (map.stats().tombstone_factor > max_tombstones) map.rehash();
+	}
+}
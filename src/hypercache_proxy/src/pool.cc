@@ -0,0 +1,205 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pool.h"
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+
+namespace proxy {
+	ShardPool::ShardPool(asio::io_context& context, size_t lanes, size_t max_frame, NearCache* near)
+		: context(context), lanes(max<size_t>(1, lanes)), max_frame(max_frame), near(near) {}
+
+	ShardPool::~ShardPool() {
+		system::error_code ignored;
+		for (auto& shard : shards) {
+			for (auto& connection : shard) connection->socket.close(ignored);
+		}
+	}
+
+	void ShardPool::reconcile(const RouteTable& table) {
+		while (shards.size() > table.size()) {
+			for (auto& connection : shards.back()) fail(*connection, "Shard was removed");
+			shards.pop_back();
+		}
+		for (size_t shard = 0; shard < table.size(); shard++) {
+			if (shard == shards.size()) shards.emplace_back();
+			vector<std::shared_ptr<Connection>>& connections = shards[shard];
+			if (!connections.empty() && connections.front()->endpoint == table.endpoint(shard)) continue;
+			for (auto& connection : connections) fail(*connection, "Shard was replaced");
+			connections.clear();
+			for (size_t lane = 0; lane < lanes; lane++)
+				connections.push_back(std::make_shared<Connection>(context, table.endpoint(shard)));
+		}
+		table_version = table.version();
+	}
+
+	void ShardPool::send(size_t shard, size_t lane, const uint8_t* frame, size_t size, Completion& completion, size_t tag) {
+		const std::shared_ptr<Connection>& connection = shards[shard][lane % lanes];
+		uint32_t id;
+		if (connection->free_ids.empty()) {
+			id = static_cast<uint32_t>(connection->inflight.size());
+			connection->inflight.emplace_back();
+		} else {
+			id = connection->free_ids.back();
+			connection->free_ids.pop_back();
+		}
+		connection->inflight[id] = Pending{&completion, tag};
+
+		vector<uint8_t>& output = connection->output;
+		const size_t offset = output.size();
+		output.insert(output.end(), frame, frame + size);
+		protocol::put_u32(output.data() + offset + protocol::length_size, id);
+
+		if (!connection->connected) {
+			if (connection->connecting) return;
+			connection->connecting = true;
+			asio::co_spawn(context, connect(connection, connection->generation), asio::detached);
+		} else if (!connection->flushing) {
+			// The flush runs after the current handler, the frames that other sessions append until then are written with it
+			connection->flushing = true;
+			asio::co_spawn(context, flush(connection, connection->generation), asio::detached);
+		}
+	}
+
+	void ShardPool::read(size_t shard, size_t lane, string_view key, const uint8_t* frame, size_t size, Completion& completion, size_t tag) {
+		const size_t flight = flights.join(group(shard, lane, frame[protocol::header_size - 1]), key, completion, tag);
+		if (flight != FlightTable::joined) send(shard, lane, frame, size, flights, flight);
+	}
+
+	void ShardPool::write(size_t shard, size_t lane, string_view key) {
+		if (!flights.size()) return;
+		flights.detach(group(shard, lane, protocol::GET), key);
+		flights.detach(group(shard, lane, protocol::LEASE), key);
+	}
+
+	void ShardPool::cancel(Completion& completion) {
+		flights.cancel(completion);
+		for (auto& shard : shards) {
+			for (auto& connection : shard) {
+				for (Pending& pending : connection->inflight) {
+					if (pending.completion == &completion) pending = Pending{nullptr, 0, true};
+				}
+			}
+		}
+	}
+
+	asio::awaitable<void> ShardPool::connect(std::shared_ptr<Connection> connection, uint64_t generation) {
+		system::error_code ec;
+		co_await connection->socket.async_connect(connection->endpoint, asio::redirect_error(asio::use_awaitable, ec));
+		if (generation != connection->generation) co_return;
+		connection->connecting = false;
+		if (ec) {
+			fail(*connection, "Shard unavailable");
+			co_return;
+		}
+		connection->connected = true;
+		connection->socket.set_option(tcp::no_delay(true), ec);
+		asio::co_spawn(context, receive(connection, generation), asio::detached);
+		if (!connection->output.empty() && !connection->flushing) {
+			connection->flushing = true;
+			co_await flush(connection, generation);
+		}
+	}
+
+	asio::awaitable<void> ShardPool::flush(std::shared_ptr<Connection> connection, uint64_t generation) {
+		system::error_code ec;
+		while (!connection->output.empty()) {
+			swap(connection->output, connection->writing);
+			co_await asio::async_write(connection->socket, asio::buffer(connection->writing), asio::redirect_error(asio::use_awaitable, ec));
+			if (generation != connection->generation) co_return;
+			connection->writing.clear();
+			if (ec) {
+				fail(*connection, "Shard unavailable");
+				co_return;
+			}
+		}
+		connection->flushing = false;
+	}
+
+	asio::awaitable<void> ShardPool::receive(std::shared_ptr<Connection> connection, uint64_t generation) {
+		system::error_code ec;
+		FrameBuffer& input = connection->input;
+		for (;;) {
+			size_t frame;
+			try {
+				frame = input.frame(max_frame);
+			} catch (const invalid_argument&) {
+				fail(*connection, "Shard sent an invalid reply");
+				co_return;
+			}
+			if (!frame) {
+				const size_t size = co_await connection->socket.async_read_some(input.prepare(), asio::redirect_error(asio::use_awaitable, ec));
+				if (generation != connection->generation) co_return;
+				if (ec) {
+					fail(*connection, "Shard unavailable");
+					co_return;
+				}
+				input.commit(size);
+				continue;
+			}
+			const uint32_t id = protocol::get_u32(input.data() + protocol::length_size);
+			if (id == protocol::push_id) {
+				// Invalidation of a lease (pushed between the replies)
+				if (near && input.data()[protocol::header_size - 1] == protocol::INVALIDATE) near->invalidate(string_view(
+					reinterpret_cast<const char*>(input.data() + protocol::header_size), frame - protocol::header_size));
+				input.consume(frame);
+				continue;
+			}
+			if (id >= connection->inflight.size() || (!connection->inflight[id].completion && !connection->inflight[id].cancelled)) {
+				fail(*connection, "Shard sent an unexpected reply");
+				co_return;
+			}
+			const Pending pending = connection->inflight[id];
+			connection->inflight[id] = Pending{};
+			connection->free_ids.push_back(id);
+			if (pending.completion) pending.completion->complete(pending.tag, input.data(), frame);
+			input.consume(frame);
+		}
+	}
+
+	void ShardPool::fail(Connection& connection, const char* message) {
+		system::error_code ignored;
+		// The leases of the connection are lost, their invalidations would never arrive
+		if (near && connection.connected) near->flush();
+		connection.generation++;
+		// The socket is closed first, the write in progress no longer references the buffers
+		connection.socket.close(ignored);
+		connection.connecting = false;
+		connection.connected = false;
+		connection.flushing = false;
+		connection.input.clear();
+		connection.output.clear();
+		connection.writing.clear();
+
+		vector<Pending> inflight;
+		inflight.swap(connection.inflight);
+		connection.free_ids.clear();
+		vector<uint8_t> reply;
+		for (const Pending& pending : inflight) {
+			if (!pending.completion) continue;
+			reply.clear();
+			protocol::Writer writer(reply);
+			writer.begin(0, protocol::ERROR);
+			writer.raw(message);
+			writer.end();
+			pending.completion->complete(pending.tag, reply.data(), reply.size());
+		}
+	}
+}
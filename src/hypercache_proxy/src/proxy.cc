@@ -0,0 +1,126 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include "proxy.h"
+#include "session.h"
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+
+namespace proxy {
+	Proxy::Proxy(const ProxyConfig& config) : config(config) {
+		if (!this->config.threads) this->config.threads = max<size_t>(1, thread::hardware_concurrency());
+		if (this->config.near_cache) near = make_unique<NearCache>(this->config.near_cache, this->config.near_cache_threshold);
+		for (size_t i = 0; i < this->config.threads; i++) {
+			// Each context is only run by one thread
+			contexts.push_back(make_unique<asio::io_context>(1));
+			pools.push_back(make_unique<ShardPool>(*contexts.back(), this->config.shard_connections, this->config.max_frame, near.get()));
+		}
+	}
+
+	Proxy::~Proxy() {
+		stop();
+	}
+
+	void Proxy::start() {
+		// Every event loop thread holds a reader slot of the route map
+		if (config.threads > RouteMap::max_readers) throw invalid_argument("The proxy supports at most 256 threads");
+		routes = make_unique<RouteMap>(resolve(config.shards));
+
+		const tcp::endpoint endpoint(asio::ip::make_address(config.address), config.port);
+		acceptor = make_unique<tcp::acceptor>(*contexts[0]);
+		acceptor->open(endpoint.protocol());
+		acceptor->set_option(asio::socket_base::reuse_address(true));
+		acceptor->bind(endpoint);
+		acceptor->listen();
+		asio::co_spawn(*contexts[0], accept(), asio::detached);
+
+		for (auto& context : contexts) {
+			threads.emplace_back([&context] {
+				// Keeps the loop running while there is no connection
+				auto guard = asio::make_work_guard(*context);
+				context->run();
+			});
+		}
+	}
+
+	void Proxy::stop() {
+		if (threads.empty()) return;
+		for (auto& context : contexts) context->stop();
+		for (auto& worker : threads) worker.join();
+		threads.clear();
+	}
+
+	void Proxy::reroute(const vector<string>& shards) {
+		if (!routes) throw logic_error("Proxy is not started");
+		routes->update(resolve(shards));
+		config.shards = shards;
+	}
+
+	void Proxy::compact() {
+		if (near) near->compact();
+	}
+
+	uint16_t Proxy::port() const noexcept {
+		return acceptor ? acceptor->local_endpoint().port() : 0;
+	}
+
+	vector<tcp::endpoint> Proxy::resolve(const vector<string>& shards) {
+		if (shards.empty()) throw invalid_argument("No shard is configured");
+		// The resolver is not bound to a running context, the lookups are synchronous
+		asio::io_context context;
+		tcp::resolver resolver(context);
+		vector<tcp::endpoint> endpoints;
+		for (const string& shard : shards) {
+			const size_t colon = shard.rfind(':');
+			if (colon == string::npos) throw invalid_argument("Expected host:port, got: " + shard);
+			endpoints.push_back(resolver.resolve(shard.substr(0, colon), shard.substr(colon + 1))->endpoint());
+		}
+		return endpoints;
+	}
+
+	size_t Proxy::next_context() {
+		const size_t index = context_index;
+		context_index = (context_index + 1) % contexts.size();
+		return index;
+	}
+
+	asio::awaitable<void> Proxy::accept() {
+		for (;;) {
+			const size_t index = next_context();
+			asio::io_context& context = *contexts[index];
+			system::error_code ec;
+			tcp::socket socket = co_await acceptor->async_accept(context, asio::redirect_error(asio::use_awaitable, ec));
+			if (ec == asio::error::operation_aborted) co_return;
+			if (ec == asio::error::no_descriptors || ec == system::errc::too_many_files_open_in_system
+				|| ec == asio::error::no_buffer_space || ec == asio::error::no_memory) {
+				// The pending connection stays in the backlog, accepting again at once would spin until a descriptor is freed
+				asio::steady_timer backoff(acceptor->get_executor(), accept_backoff);
+				co_await backoff.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				continue;
+			}
+			if (ec) continue;
+			socket.set_option(tcp::no_delay(true), ec);
+			// co_spawn resumes the session on its own context
+			asio::co_spawn(context, Session::serve(std::move(socket), *routes, *pools[index], config, near.get()), asio::detached);
+		}
+	}
+}
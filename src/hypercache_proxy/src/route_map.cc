@@ -0,0 +1,106 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+
+#include "route_map.h"
+
+using namespace std;
+using boost::asio::ip::tcp;
+
+namespace {
+	/**
+	 * Jump consistent hash (Lamping, Veach), returns the bucket of the key in [0, buckets)
+	 */
+	int32_t jump_hash(uint64_t key, int32_t buckets) noexcept {
+		int64_t bucket = -1, next = 0;
+		while (next < buckets) {
+			bucket = next;
+			key = key * 2862933555777941757ULL + 1;
+			next = int64_t(double(bucket + 1) * (double(int64_t(1) << 31) / double((key >> 33) + 1)));
+		}
+		return int32_t(bucket);
+	}
+
+	// Slot indices are spread with a 64-bit mix before they are jumped, consecutive slots would otherwise be correlated
+	uint64_t mix(uint64_t x) noexcept {
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	// Claimed reader slot indices (shared by all route maps, a thread has the same index in every map)
+	array<atomic<bool>, proxy::RouteMap::max_readers> claimed{};
+
+	/**
+	 * ReaderLease holds the reader slot index of a thread, the index is released when the thread exits
+	 *
+	 * A thread leaves its read sections before it exits, so a released slot is outside of any read section.
+	 */
+	struct ReaderLease {
+		size_t index;
+
+		ReaderLease() : index(claim()) {};
+		ReaderLease(const ReaderLease&) = delete;
+		ReaderLease& operator=(const ReaderLease&) = delete;
+		~ReaderLease() {
+			claimed[index].store(false, memory_order_release);
+		};
+
+		static size_t claim() {
+			for (size_t i = 0; i < claimed.size(); i++) {
+				if (!claimed[i].load(memory_order_relaxed) && !claimed[i].exchange(true, memory_order_acquire)) return i;
+			}
+			throw runtime_error("RouteMap supports at most 256 concurrent reader threads");
+		}
+	};
+}
+
+namespace proxy {
+	RouteTable::RouteTable(vector<tcp::endpoint> shards, uint64_t version) : shards(std::move(shards)), ver(version) {
+		if (this->shards.empty()) throw invalid_argument("RouteTable requires at least one shard");
+		if (this->shards.size() > max_shards) throw invalid_argument("RouteTable supports at most 65535 shards");
+		for (size_t slot = 0; slot < slot_count; slot++)
+			slots[slot] = uint16_t(jump_hash(mix(slot), int32_t(this->shards.size())));
+	}
+
+	RouteMap::RouteMap(vector<tcp::endpoint> shards) : current(new RouteTable(std::move(shards), 1)) {}
+
+	RouteMap::~RouteMap() {
+		delete current.load();
+	}
+
+	void RouteMap::update(vector<tcp::endpoint> shards) {
+		lock_guard<mutex> lock(update_lock);
+		const RouteTable* table = new RouteTable(std::move(shards), current.load()->version() + 1);
+		const RouteTable* retired = current.exchange(table);
+		const uint64_t next = epoch.fetch_add(1) + 1;
+		// Readers that announced an older epoch may still hold the retired table
+		for (ReaderSlot& reader : readers) {
+			for (uint64_t announced = reader.epoch.load(); announced && announced < next; announced = reader.epoch.load())
+				this_thread::yield();
+		}
+		delete retired;
+	}
+
+	size_t RouteMap::reader_index() {
+		thread_local const ReaderLease lease;
+		return lease.index;
+	}
+}
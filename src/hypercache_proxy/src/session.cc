@@ -0,0 +1,427 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "session.h"
+
+using namespace std;
+using namespace boost;
+using asio::ip::tcp;
+
+namespace proxy {
+	Session::Session(tcp::socket socket, const RouteMap& routes, ShardPool& pool, const ProxyConfig& config, NearCache* near)
+		: client(std::move(socket)), routes(routes), pool(pool), config(config), near(near), lane(pool.lane()),
+			wakeup(client.get_executor()) {}
+
+	asio::awaitable<void> Session::run() {
+		system::error_code ec;
+		try {
+			for (;;) {
+				const size_t size = co_await client.async_read_some(input.prepare(), asio::redirect_error(asio::use_awaitable, ec));
+				if (ec) break;
+				input.commit(size);
+
+				{
+					// The read section ends before the first suspension point
+					const RouteMap::Guard guard = routes.read();
+					if (guard->version() != pool.version()) pool.reconcile(guard.table());
+					for (size_t frame = input.frame(config.max_frame); frame; frame = input.frame(config.max_frame)) {
+						route(guard.table(), input.data(), frame);
+						input.consume(frame);
+					}
+				}
+				if (batch.empty()) continue;
+
+				co_await wait();
+				co_await reply(ec);
+				if (ec) break;
+			}
+		} catch (const invalid_argument&) {
+			// Invalid frame length, the stream can not be resynchronized
+		}
+		// The frames routed before an invalid one are still in flight, the pool must not complete them
+		// after the session is gone
+		if (outstanding) pool.cancel(*this);
+		client.close(ec);
+	}
+
+	void Session::complete(size_t tag, const uint8_t* frame, size_t size) {
+		if (tag & part_tag) {
+			Part& part = parts[tag & ~part_tag];
+			part.offset = replies.size();
+			part.size = size;
+			part.done = true;
+			replies.insert(replies.end(), frame, frame + size);
+		} else if (batch[tag].lease) {
+			leased(batch[tag], frame, size);
+		} else {
+			Entry& entry = batch[tag];
+			entry.offset = replies.size();
+			entry.size = size;
+			entry.done = true;
+			replies.insert(replies.end(), frame, frame + size);
+			protocol::put_u32(replies.data() + entry.offset + protocol::length_size, entry.id);
+		}
+		if (!--outstanding) wakeup.cancel();
+	}
+
+	void Session::route(const RouteTable& table, const uint8_t* frame, size_t size) {
+		const uint32_t id = protocol::get_u32(frame + protocol::length_size);
+		const uint8_t op = frame[protocol::header_size - 1];
+		batch.push_back(Entry{id});
+		protocol::Reader reader(frame + protocol::header_size, size - protocol::header_size);
+		size_t shard;
+		string_view key;
+		try {
+			switch (op) {
+			case protocol::PING:
+				answer(protocol::OK, "");
+				return;
+			case protocol::GET:
+			case protocol::GET_FRAMES:
+			case protocol::DEL:
+			case protocol::GROUP_GET:
+				key = reader.rest();
+				break;
+			case protocol::INC:
+				reader.u64();
+				key = reader.rest();
+				break;
+			case protocol::COUNT_CAS:
+				reader.u64();
+				reader.u64();
+				key = reader.rest();
+				break;
+			case protocol::COUNT_STRIPE:
+				reader.u8();
+				key = reader.rest();
+				break;
+			case protocol::SET:
+			case protocol::GROUP_ADD:
+			case protocol::GROUP_DEL:
+				key = reader.str();
+				break;
+			case protocol::GROUP_INTERCARD:
+				reader.u64();
+				[[fallthrough]];
+			case protocol::GROUP_INTER:
+			case protocol::GROUP_UNION:
+			case protocol::GROUP_DIFF: {
+				// The set operations are executed by one shard, so all keys must be owned by it
+				shard = table.route(reader.str());
+				while (!reader.done()) {
+					if (table.route(reader.str()) != shard) {
+						answer(protocol::BAD_REQUEST, "Keys span multiple shards");
+						return;
+					}
+				}
+				outstanding++;
+				pool.send(shard, lane, frame, size, *this, batch.size() - 1);
+				return;
+			}
+			case protocol::MGET:
+			case protocol::MSET:
+				split(table, op, frame, size);
+				return;
+			case protocol::STATS:
+				key = reader.rest();
+				if (key.empty()) {
+					answer(protocol::OK, stats());
+					return;
+				}
+				// Forwarded to the shard of the key
+				break;
+			default:
+				answer(protocol::BAD_REQUEST, "Unknown operation");
+				return;
+			}
+		} catch (const invalid_argument&) {
+			answer(protocol::BAD_REQUEST, "Payload is truncated");
+			return;
+		}
+		shard = table.route(key);
+		if (op == protocol::GET && near) {
+			// The value is copied straight into the reply
+			Entry& entry = batch.back();
+			entry.offset = replies.size();
+			protocol::Writer writer(replies);
+			writer.begin(entry.id, protocol::OK);
+			if (near->get(key, replies)) {
+				writer.end();
+				entry.size = replies.size() - entry.offset;
+				entry.done = true;
+				return;
+			}
+			replies.resize(entry.offset);
+			if (near->hot(key)) {
+				lease(shard, key);
+				return;
+			}
+		}
+		outstanding++;
+		if (op == protocol::GET && config.coalesce_reads) {
+			pool.read(shard, lane, key, frame, size, *this, batch.size() - 1);
+			return;
+		}
+		if (op != protocol::GET && op != protocol::GET_FRAMES && op != protocol::GROUP_GET && op != protocol::STATS) {
+			pool.write(shard, lane, key);
+			written(key);
+		}
+		pool.send(shard, lane, frame, size, *this, batch.size() - 1);
+	}
+
+	void Session::lease(size_t shard, string_view key) {
+		Entry& entry = batch.back();
+		entry.lease = true;
+		entry.key_offset = keys.size();
+		entry.key_size = key.size();
+		entry.stamp = near->stamp(key);
+		// The cached value expires with the lease that the shard started after this point
+		entry.sent = chrono::steady_clock::now();
+		keys.append(key);
+
+		scratch.clear();
+		protocol::Writer writer(scratch);
+		writer.begin(0, protocol::LEASE);
+		writer.u32(static_cast<uint32_t>(config.near_cache_lease.count()));
+		writer.raw(key);
+		writer.end();
+		outstanding++;
+		if (config.coalesce_reads) pool.read(shard, lane, key, scratch.data(), scratch.size(), *this, batch.size() - 1);
+		else pool.send(shard, lane, scratch.data(), scratch.size(), *this, batch.size() - 1);
+	}
+
+	void Session::leased(Entry& entry, const uint8_t* frame, size_t size) {
+		entry.offset = replies.size();
+		entry.done = true;
+		if (size < protocol::header_size + sizeof(uint32_t) || frame[protocol::header_size - 1] != protocol::OK) {
+			// NOT_FOUND and errors have the same body as the GET reply
+			replies.insert(replies.end(), frame, frame + size);
+			protocol::put_u32(replies.data() + entry.offset + protocol::length_size, entry.id);
+			entry.size = size;
+			return;
+		}
+		const chrono::milliseconds granted(protocol::get_u32(frame + protocol::header_size));
+		const string_view value(reinterpret_cast<const char*>(frame + protocol::header_size + sizeof(uint32_t)),
+			size - protocol::header_size - sizeof(uint32_t));
+		if (granted.count()) near->insert(string_view(keys).substr(entry.key_offset, entry.key_size), value, entry.stamp, entry.sent + granted);
+		protocol::Writer writer(replies);
+		writer.begin(entry.id, protocol::OK);
+		writer.raw(value);
+		writer.end();
+		entry.size = replies.size() - entry.offset;
+	}
+
+	void Session::written(string_view key) {
+		if (!near) return;
+		near->invalidate(key);
+		writes.emplace_back(keys.size(), key.size());
+		keys.append(key);
+	}
+
+	void Session::split(const RouteTable& table, uint8_t op, const uint8_t* frame, size_t size) {
+		const uint8_t* payload = frame + protocol::header_size;
+		const size_t payload_size = size - protocol::header_size;
+		// The payload is validated first, so the bookkeeping is never left half-built
+		for (protocol::Reader check(payload, payload_size); !check.done();) {
+			check.str();
+			if (op == protocol::MSET) check.str();
+		}
+
+		Entry& entry = batch.back();
+		entry.op = op;
+		entry.first_part = parts.size();
+		entry.first_key = key_parts.size();
+		if (shard_parts.size() < table.size()) shard_parts.resize(table.size(), no_part);
+		for (protocol::Reader reader(payload, payload_size); !reader.done();) {
+			const string_view key = reader.str();
+			size_t bytes = sizeof(uint32_t) + key.size();
+			if (op == protocol::MSET) bytes += sizeof(uint32_t) + reader.str().size();
+			const size_t shard = table.route(key);
+			if (op == protocol::MSET) {
+				pool.write(shard, lane, key);
+				written(key);
+			}
+			uint32_t& part = shard_parts[shard];
+			if (part == no_part) {
+				part = static_cast<uint32_t>(parts.size() - entry.first_part);
+				parts.push_back(Part{shard});
+			}
+			parts[entry.first_part + part].bytes += bytes;
+			key_parts.push_back(part);
+		}
+		entry.part_count = parts.size() - entry.first_part;
+		entry.key_count = key_parts.size() - entry.first_key;
+		for (size_t part = entry.first_part; part < parts.size(); part++) shard_parts[parts[part].shard] = no_part;
+
+		if (entry.part_count <= 1) {
+			// All keys are owned by one shard, the request is forwarded unchanged
+			const size_t shard = entry.part_count ? parts.back().shard : 0;
+			parts.resize(entry.first_part);
+			key_parts.resize(entry.first_key);
+			entry = Entry{entry.id};
+			outstanding++;
+			pool.send(shard, lane, frame, size, *this, batch.size() - 1);
+			return;
+		}
+
+		// The sub-request frames are laid out back to back, every key is copied to the cursor of its part
+		scratch.clear();
+		for (size_t index = entry.first_part; index < parts.size(); index++) {
+			Part& part = parts[index];
+			part.cursor = scratch.size();
+			scratch.resize(scratch.size() + part.bytes);
+			protocol::put_u32(scratch.data() + part.cursor, static_cast<uint32_t>(part.bytes - protocol::length_size));
+			protocol::put_u32(scratch.data() + part.cursor + protocol::length_size, 0);
+			scratch[part.cursor + protocol::header_size - 1] = op;
+			part.cursor += protocol::header_size;
+		}
+		size_t key = entry.first_key;
+		for (protocol::Reader reader(payload, payload_size); !reader.done(); key++) {
+			Part& part = parts[entry.first_part + key_parts[key]];
+			for (size_t field = 0; field < (op == protocol::MSET ? 2 : 1); field++) {
+				const string_view val = reader.str();
+				protocol::put_u32(scratch.data() + part.cursor, static_cast<uint32_t>(val.size()));
+				memcpy(scratch.data() + part.cursor + sizeof(uint32_t), val.data(), val.size());
+				part.cursor += sizeof(uint32_t) + val.size();
+			}
+		}
+		for (size_t index = entry.first_part; index < parts.size(); index++) {
+			const Part& part = parts[index];
+			outstanding++;
+			pool.send(part.shard, lane, scratch.data() + part.cursor - part.bytes, part.bytes, *this, part_tag | index);
+		}
+	}
+
+	void Session::merge(Entry& entry) {
+		// Every key takes at most the bytes of its item in the sub-reply or one status byte,
+		// the arena is reserved up front so the sub-replies stay in place while they are copied
+		size_t bound = protocol::header_size + entry.key_count;
+		for (size_t index = entry.first_part; index < entry.first_part + entry.part_count; index++) {
+			Part& part = parts[index];
+			bound += part.size;
+			// Only successful sub-replies are read, the keys of the others are answered with ERROR
+			const bool ok = part.done && part.size >= protocol::header_size && replies[part.offset + protocol::header_size - 1] == protocol::OK;
+			part.cursor = ok ? part.offset + protocol::header_size : part.offset + part.size;
+		}
+		replies.reserve(replies.size() + bound);
+
+		entry.offset = replies.size();
+		protocol::Writer writer(replies);
+		writer.begin(entry.id, protocol::OK);
+		for (size_t key = entry.first_key; key < entry.first_key + entry.key_count; key++) {
+			Part& part = parts[entry.first_part + key_parts[key]];
+			const size_t end = part.offset + part.size;
+			if (part.cursor >= end) {
+				writer.u8(protocol::ERROR);
+				continue;
+			}
+			const uint8_t status = replies[part.cursor];
+			size_t item = 1;
+			if (entry.op == protocol::MGET && status == protocol::OK) {
+				if (end - part.cursor < 1 + sizeof(uint32_t) ||
+					protocol::get_u32(replies.data() + part.cursor + 1) > end - part.cursor - 1 - sizeof(uint32_t)) {
+					// Truncated sub-reply, the remaining keys of the shard are lost
+					part.cursor = end;
+					writer.u8(protocol::ERROR);
+					continue;
+				}
+				item += sizeof(uint32_t) + protocol::get_u32(replies.data() + part.cursor + 1);
+			}
+			const size_t pos = replies.size();
+			replies.resize(pos + item);
+			memcpy(replies.data() + pos, replies.data() + part.cursor, item);
+			part.cursor += item;
+		}
+		writer.end();
+		entry.size = replies.size() - entry.offset;
+		entry.done = true;
+	}
+
+	string Session::stats() {
+		string out;
+		if (near) out = near->stats();
+		out.append("# Locks\r\n");
+		hypermap::append_info(out, hypermap::lock_stats());
+		return out;
+	}
+
+	void Session::answer(protocol::Status status, string_view body) {
+		Entry& entry = batch.back();
+		entry.offset = replies.size();
+		protocol::Writer writer(replies);
+		writer.begin(entry.id, status);
+		writer.raw(body);
+		writer.end();
+		entry.size = replies.size() - entry.offset;
+		entry.done = true;
+	}
+
+	asio::awaitable<void> Session::wait() {
+		system::error_code ec;
+		// A shard that hangs must not stall the pipeline of the client, every batch has a deadline
+		const auto timeout = parts.empty() ? config.request_timeout : min(config.fanout_timeout, config.request_timeout);
+		const auto deadline = chrono::steady_clock::now() + timeout;
+		while (outstanding) {
+			wakeup.expires_at(deadline);
+			co_await wakeup.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+			if (outstanding && chrono::steady_clock::now() >= deadline) {
+				// Partial result: late replies are discarded by the pool
+				pool.cancel(*this);
+				outstanding = 0;
+			}
+		}
+		for (Entry& entry : batch) {
+			if (entry.op) merge(entry);
+			else if (!entry.done) {
+				protocol::Writer writer(replies);
+				entry.offset = replies.size();
+				writer.begin(entry.id, protocol::ERROR);
+				writer.raw("Shard timed out");
+				writer.end();
+				entry.size = replies.size() - entry.offset;
+			}
+		}
+		// The shards applied the writes, leases that read an older value in the meantime are invalidated
+		for (const auto& [offset, size] : writes) near->invalidate(string_view(keys).substr(offset, size));
+	}
+
+	asio::awaitable<void> Session::reply(system::error_code& ec) {
+		// Replies that arrived in request order are adjacent in the arena and share one buffer
+		gather.clear();
+		size_t begin = batch.front().offset, end = begin;
+		for (const Entry& entry : batch) {
+			if (entry.offset != end) {
+				gather.emplace_back(replies.data() + begin, end - begin);
+				begin = entry.offset;
+			}
+			end = entry.offset + entry.size;
+		}
+		gather.emplace_back(replies.data() + begin, end - begin);
+		co_await asio::async_write(client, gather, asio::redirect_error(asio::use_awaitable, ec));
+
+		batch.clear();
+		parts.clear();
+		key_parts.clear();
+		keys.clear();
+		writes.clear();
+		if (replies.capacity() > keep_capacity) replies = vector<uint8_t>();
+		else replies.clear();
+	}
+}
@@ -30,6 +30,23 @@
 #include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <atomic>
+#include <functional>
+
+#include "lib/hyperlz/hyperlz.hpp"
+#include "protodict.hpp"
+#include "protoblob.hpp"
+#include "groupset.hpp"
+
+// Capacity of the inlined ProtoChunk quick_bytes (max 255)
+// With dictionary compression enabled, small values take less space, so the capacity (and by this the slot size) can be reduced:
+// values up to 254 bytes stay inline if they compress with the dictionary of their prefix.
+// The capacity sets the layout of ProtoChunk, so it is defined here only (every target that includes the header sees the same layout).
+#ifdef DATACHUNK_QUICK_CAP
+#error "DATACHUNK_QUICK_CAP is defined by datachunk.hpp, do not override it per target"
+#endif
+#define DATACHUNK_QUICK_CAP 128
 
 using namespace std;
 
@@ -49,6 +66,24 @@ namespace datachunk {
 	class CountChunk;
 	class GroupChunk;
 
+	/**
+	 * ProtoFrame describes the bytes of a ProtoChunk as they are stored
+	 *
+	 * If compressed is set, data contains a hyperlz (LZ4 block format) block that decompresses to raw_size bytes.
+	 * If dict is not 0, the block was compressed against the ProtoDict with this id.
+	 * The frame can be passed to clients that accept compressed frames without any decompression.
+	 *
+	 * Large values are stored in multiple segments (see ProtoBlob), every segment is a separate frame.
+	 * A frame that describes multiple segments (returned by set_proto()) has no data, size is the total stored size.
+	 */
+	struct ProtoFrame {
+		const uint8_t* data;
+		size_t size;
+		size_t raw_size;
+		bool compressed;
+		uint16_t dict;
+	};
+
 	/**
 	 * DataChunk is a BaseClass for the different datatypes in HyperCache.
 	 *
@@ -71,7 +106,39 @@ namespace datachunk {
 		 *
 		 * Throws a runtime_error if the derived type is not ProtoChunk
 		 */
-		virtual pair<const uint8_t*, const uint8_t> get_proto() const {
+		virtual pair<const uint8_t*, size_t> get_proto() const {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Get stored ProtoChunk frame without decompressing it (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual ProtoFrame get_proto_frame() const {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Get the uncompressed size of the ProtoChunk data (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual size_t get_proto_size() const {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Stream the uncompressed ProtoChunk data segment by segment (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual void read_proto(const function<void(const uint8_t*, size_t)>& visitor) const {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Stream the stored ProtoChunk frames (one per segment) without decompressing them (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual void read_proto_frames(const function<void(const ProtoFrame&)>& visitor) const {
 			throw runtime_error("DataChunk is not of type PROTO");
 		};
 		/**
@@ -79,7 +146,31 @@ namespace datachunk {
 		 *
 		 * Throws a runtime_error if the derived type is not ProtoChunk
 		 */
-		virtual pair<const uint8_t*, const uint8_t> set_proto(uint8_t* new_bytes, uint8_t size) {
+		virtual ProtoFrame set_proto(const uint8_t* new_bytes, size_t size, const ProtoDict* dict = nullptr) {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Set ProtoChunk data to a prebuilt ProtoBlob (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual void set_proto_blob(shared_ptr<const ProtoBlob> blob) {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Pin the ProtoChunk data, so it can be read after the lock is released (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual ProtoPin pin_proto() const {
+			throw runtime_error("DataChunk is not of type PROTO");
+		};
+		/**
+		 * Pin the stored frames of the ProtoChunk data (for informations check ProtoChunk)
+		 *
+		 * Throws a runtime_error if the derived type is not ProtoChunk
+		 */
+		virtual ProtoPin pin_proto_frames() const {
 			throw runtime_error("DataChunk is not of type PROTO");
 		};
 
@@ -111,30 +202,52 @@ namespace datachunk {
 		/**
 		 * Get GroupChunk data (for informations check GroupChunk)
 		 *
+		 * The returned reference must only be used while the slot lock is held (like the DataChunk pointer).
+		 *
 		 * Throws a runtime_error if the derived type is not GroupChunk
 		 */
-		virtual unordered_set<string> get_group() const {
+		virtual const GroupSet& get_group() const {
 			throw runtime_error("DataChunk is not of type GROUP");
 		};
 		/**
 		 * Push to GroupChunk data (for informations check GroupChunk)
 		 *
+		 * Returns true if the key was added (false if it was already a member)
+		 *
 		 * Throws a runtime_error if the derived type is not GroupChunk
 		 */
-		virtual unordered_set<string> push_group(string& key) {
+		virtual bool push_group(string_view key, hypermap::SlotHandle handle = hypermap::SlotHandle()) {
+			throw runtime_error("DataChunk is not of type GROUP");
+		};
+		/**
+		 * Update the SlotHandle of a GroupChunk member (for informations check GroupChunk)
+		 *
+		 * Returns false if the key is not a member
+		 *
+		 * Throws a runtime_error if the derived type is not GroupChunk
+		 */
+		virtual bool repair_group(string_view key, hypermap::SlotHandle handle) {
 			throw runtime_error("DataChunk is not of type GROUP");
 		};
 		/**
 		 * Delete from GroupChunk data (for informations check GroupChunk)
 		 *
+		 * Returns true if the key was removed (false if it was not a member)
+		 *
 		 * Throws a runtime_error if the derived type is not GroupChunk
 		 */
-		virtual unordered_set<string> del_group(string& key) {
+		virtual bool del_group(string_view key) {
 			throw runtime_error("DataChunk is not of type GROUP");
 		};
-		
-	private:
-		// TODO: Figure out a way for this problem
+		/**
+		 * Enable / disable the sorted hash array of the GroupChunk (for informations check GroupSet)
+		 *
+		 * Throws a runtime_error if the derived type is not GroupChunk
+		 */
+		virtual void set_group_sorted(bool enabled) {
+			throw runtime_error("DataChunk is not of type GROUP");
+		};
+
 		/*
 		  How is memory managed in HyperCache:
 			Hyperslots return raw DataChunk pointers, this is not safe! This is why when doing something,
@@ -142,19 +255,11 @@ namespace datachunk {
 			lock is most likely like a mutex lock, and allows consistent data without smart_ptrs, as long as the
 			hyperslot locks are locked, NOTHING will access / delete the memory, after the lock is released, the PTR shall not be used anymore.
 
-			Now the problem is this: I can not persistently store ptrs to datachunks, this is dumb for the group
-			type, there we have the option to just store raw "strings", but this would require on every read of the group
-			bzw. on every query etc. to the group, we would need multiple hashes multiple hypermap accesses.
-			It would be far more clean to have something like a ptr list and a group_assignment list on every
-			datachunk, that can directly on destruction remove its assignment on the group and vise-verca.
-			This unfortunaly dont work, the behaviour we need is what weak_ptrs provide
-			(allows check if the ptr is still existent). For pretty logical reasons this doesnt work in my scenario
-			(with inlined allocations).
-			The problem essentially is that the HyperSlot determines the livetime of the DataChunk.
-			
-		 */
-		// Group assignments is a set of weak_ptrs to all groups that the datachunk is assigned to
-		// unordered_set<weak_ptr<GroupChunk>> group_assignments;
+			Because the HyperSlot determines the livetime of the DataChunk, groups can not persistently store ptrs to datachunks.
+			Instead, groups store the key together with a SlotHandle (slot index + atom_id). The handle resolves in O(1)
+			without hashing / probing and is detected as stale once the slot is deleted or moved (the atom_id changed),
+			the key is then used to look up the slot again and repair the handle.
+		 */
 	};
 
 	/**
@@ -169,61 +274,222 @@ namespace datachunk {
 	 * The quick_bytes slot is fixed allocated in the class metadata,
 	 * this allows reading/writing with 0 runtime heap operations (making it very fast).
 	 *
-	 * If the data does not fit, it is automatically allocated in a regular vector object. 
+	 * If the data does not fit, it is stored in a ProtoBlob, that splits the bytes into segments of
+	 * ProtoBlob::segment_size (64KiB), so values of several MB never need one contiguous allocation.
+	 * The blob is immutable and shared between copies of the chunk (copying a ProtoChunk does not copy the bulk bytes).
+	 * Large values can be streamed in (ProtoBlob::Builder + set_proto_blob) and out (read_proto / read_proto_frames).
+	 * pin_proto() pins the current value, readers can write it to a socket without holding the lock or copying the blob.
+	 *
+	 * Bulk data can optionally be compressed (see configure_compression()), every segment is compressed independently.
+	 * Small values can be compressed against a ProtoDict trained for the key prefix (see ProtoDictStore),
+	 * this allows values larger than the quick_bytes to be stored inline.
+	 * Compressed bytes are only decompressed if get_proto() is called,
+	 * get_proto_frame() returns the stored bytes as they are, so they can be passed through without any decompression.
 	 */
 	class ProtoChunk : public DataChunk {
 	public:
+		ProtoChunk() = default;
 		ProtoChunk(const ProtoChunk& other) = default;
 		ProtoChunk(ProtoChunk&& other) = default;
 		ProtoChunk& operator=(const ProtoChunk&) = default;
 		ProtoChunk& operator=(ProtoChunk&&) = default;
 
 		DataType get_type() const noexcept override { return PROTO; };
-	
-		pair<const uint8_t*, const uint8_t> get_proto() const override {
-			// If quick_mode is enabled, return quick bytes
-			if (quick_mode) return make_pair(quick_bytes, quick_size);
-			// If not, return the bytes from vector
-			else return make_pair(bulk_bytes.data(), bulk_bytes.size());
+
+		/**
+		 * Enables compression of bulk data with a size of at least "threshold" bytes
+		 *
+		 * A threshold of 0 disables compression. The setting only affects subsequent set_proto() calls.
+		 */
+		static void configure_compression(size_t threshold) noexcept {
+			compress_threshold.store(threshold, memory_order_relaxed);
 		};
-		
-		pair<const uint8_t*, const uint8_t> set_proto(uint8_t* new_bytes, uint8_t size) override {
-			if (size < quick_cap) {
+
+		/**
+		 * Returns the minimum bulk size that is compressed (0 = disabled)
+		 */
+		static size_t compression_threshold() noexcept {
+			return compress_threshold.load(memory_order_relaxed);
+		};
+
+		/**
+		 * Returns true if a value of this size is only stored inline when it is compressed with a ProtoDict
+		 *
+		 * Smaller values fit raw into the quick_bytes, larger values are never dictionary compressed.
+		 * Callers can skip sampling / selecting a dictionary for all other sizes.
+		 */
+		static constexpr bool dict_eligible(size_t size) noexcept {
+			return size >= quick_cap && size < ProtoDictStore::value_cap;
+		};
+
+		/**
+		 * Returns the uncompressed proto as contiguous bytes
+		 *
+		 * If the bulk data is compressed or consists of multiple segments, it is copied into a thread local buffer.
+		 * In this case the returned ptr is only valid until the next get_proto() call on the same thread.
+		 * Prefer read_proto() for large values, it does not need a contiguous copy.
+		 */
+		pair<const uint8_t*, size_t> get_proto() const override {
+			// Lazy decompression to a thread local buffer, this is only done when the client wants the raw bytes
+			thread_local vector<uint8_t> raw_buffer;
+
+			if (quick_mode) {
+				// If quick_mode is enabled, return quick bytes
+				if (!quick_dict) return make_pair(quick_bytes, quick_size);
+
+				const ProtoDict* dict = ProtoDictStore::global().find(quick_dict);
+				if (!dict) throw runtime_error("ProtoChunk dictionary is not registered");
+				if (raw_buffer.size() < quick_raw_size) raw_buffer.resize(quick_raw_size);
+				dict->decompress(quick_bytes, quick_size, raw_buffer.data(), quick_raw_size);
+				return make_pair(raw_buffer.data(), quick_raw_size);
+			}
+			// A single uncompressed segment is returned directly
+			const auto& segments = bulk->segments();
+			if (segments.size() == 1 && !segments[0].compressed) return make_pair(segments[0].bytes.data(), segments[0].bytes.size());
+
+			if (raw_buffer.size() < bulk->size()) raw_buffer.resize(bulk->size());
+			bulk->copy_to(raw_buffer.data());
+			return make_pair(raw_buffer.data(), bulk->size());
+		};
+
+		/**
+		 * Returns the stored frame of the proto
+		 *
+		 * Values with multiple segments can not be described by a single frame, use read_proto_frames() for them
+		 * (a runtime_error is thrown).
+		 */
+		ProtoFrame get_proto_frame() const override {
+			if (quick_mode) return ProtoFrame{quick_bytes, quick_size, quick_raw_size, quick_dict != 0, quick_dict};
+			const auto& segments = bulk->segments();
+			if (segments.empty()) return ProtoFrame{nullptr, 0, 0, false, 0};
+			if (segments.size() > 1) throw runtime_error("ProtoChunk consists of multiple segments");
+			return segment_frame(segments[0]);
+		};
+
+		size_t get_proto_size() const override {
+			return quick_mode ? quick_raw_size : bulk->size();
+		};
+
+		/**
+		 * Streams the uncompressed proto, the visitor is called once per segment
+		 *
+		 * Uncompressed segments are passed without copying, compressed segments are decompressed
+		 * into a thread local buffer of one segment.
+		 */
+		void read_proto(const function<void(const uint8_t*, size_t)>& visitor) const override {
+			if (quick_mode) {
+				const auto proto = get_proto();
+				visitor(proto.first, proto.second);
+				return;
+			}
+			bulk->for_each(visitor);
+		};
+
+		/**
+		 * Streams the stored frames of the proto (one per segment) without decompressing them
+		 */
+		void read_proto_frames(const function<void(const ProtoFrame&)>& visitor) const override {
+			if (quick_mode) {
+				visitor(get_proto_frame());
+				return;
+			}
+			for (const ProtoSegment& segment : bulk->segments()) visitor(segment_frame(segment));
+		};
+
+		ProtoFrame set_proto(const uint8_t* new_bytes, size_t size, const ProtoDict* dict = nullptr) override {
+			// Small values that do not fit into the quick_bytes are compressed against the dictionary,
+			// the result is only kept if it fits into the quick_bytes (values that fit raw are not compressed, as this saves no memory)
+			uint8_t dict_bytes[quick_cap];
+			size_t dict_size = 0;
+			if (dict && dict_eligible(size))
+				dict_size = dict->compress(new_bytes, size, dict_bytes, quick_cap);
+
+			if (size < quick_cap || dict_size) {
 				// Proto fits into the quick_bytes
 				
 				if (!quick_mode) {
-					// If bulk was enabled before, deallocate bulk_bytes
-					bulk_bytes = vector<uint8_t>();
+					// If bulk was enabled before, release the bulk blob
+					bulk.reset();
 					quick_mode = true;
 				}
 				// Update size
-				quick_size = size;
-				// Raw copy to the quick_bytes 
-				memcpy(quick_bytes, new_bytes, quick_size);
-				// Return byte ptr + size
-				return make_pair(quick_bytes, quick_size);
-			} else {
-				// Proto does not fit into quick_bytes
-				
-				quick_mode = false;
-				// Assign bytes to vector (basically reinitializes vector)
-				bulk_bytes.assign(new_bytes, new_bytes + size);
-				// Return byte ptr + size
-				return make_pair(bulk_bytes.data(), bulk_bytes.size());
+				quick_raw_size = static_cast<uint8_t>(size);
+				if (dict_size) {
+					quick_dict = dict->get_id();
+					quick_size = static_cast<uint8_t>(dict_size);
+					memcpy(quick_bytes, dict_bytes, quick_size);
+				} else {
+					quick_dict = 0;
+					quick_size = static_cast<uint8_t>(size);
+					// Raw copy to the quick_bytes 
+					if (quick_size) memcpy(quick_bytes, new_bytes, quick_size);
+				}
+				return get_proto_frame();
 			}
+			// Proto does not fit into quick_bytes, it is split into segments (compressed if it reaches the threshold)
+			set_proto_blob(ProtoBlob::from(new_bytes, size, compress_threshold.load(memory_order_relaxed)));
+			const auto& segments = bulk->segments();
+			return segments.size() == 1 ? segment_frame(segments[0]) : ProtoFrame{nullptr, bulk->stored(), size, false, 0};
+		};
+
+		/**
+		 * Pins the proto, the pin stays valid after the slot lock is released (see ProtoPin)
+		 *
+		 * Bulk values only pin the shared blob, quick values are copied (and decompressed if stored with a dictionary).
+		 */
+		ProtoPin pin_proto() const override {
+			if (!quick_mode) return ProtoPin(bulk);
+			if (!quick_dict) return ProtoPin(quick_bytes, quick_size);
+			const auto proto = get_proto();
+			return ProtoPin(proto.first, proto.second);
+		};
+
+		/**
+		 * Pins the stored frames of the proto, compressed segments are passed through without decompression
+		 *
+		 * Quick values are pinned raw (dictionary compressed values are decompressed, clients do not know the dictionaries).
+		 */
+		ProtoPin pin_proto_frames() const override {
+			if (!quick_mode) return ProtoPin::frames(bulk);
+			return pin_proto();
+		};
+
+		/**
+		 * Sets the proto to a prebuilt blob (e.g. streamed in with ProtoBlob::Builder)
+		 *
+		 * The blob is always stored as bulk, even if it would fit into the quick_bytes.
+		 */
+		void set_proto_blob(shared_ptr<const ProtoBlob> blob) override {
+			if (!blob) throw invalid_argument("ProtoBlob must not be null");
+			quick_mode = false;
+			quick_size = 0;
+			quick_raw_size = 0;
+			quick_dict = 0;
+			bulk = std::move(blob);
 		};
 	private:
+		static ProtoFrame segment_frame(const ProtoSegment& segment) {
+			return ProtoFrame{segment.bytes.data(), segment.bytes.size(), segment.raw_size, segment.compressed, 0};
+		};
+
 		// Capacity of quick field using uint8_t (255) bytes, with a 16K map, runtime overhead is at around 5MB
 		// This seems much, but is a fine tradeoff regarding that most proto requests will fit into this.
-		static constexpr uint_fast8_t quick_cap = numeric_limits<uint8_t>::max();
+		static constexpr uint_fast8_t quick_cap = DATACHUNK_QUICK_CAP;
+		static_assert(DATACHUNK_QUICK_CAP > 0 && DATACHUNK_QUICK_CAP <= 255, "DATACHUNK_QUICK_CAP must be in range 1-255");
+		// Minimum bulk size that is compressed (0 = disabled)
+		inline static atomic<size_t> compress_threshold = 0;
 		// State of quick_mode
 		bool quick_mode = true;
 		// Size of the quick field
 		uint8_t quick_size = 0;
+		// Original (uncompressed) size of the quick field
+		uint8_t quick_raw_size = 0;
+		// Id of the ProtoDict the quick field is compressed with (0 = uncompressed)
+		uint16_t quick_dict = 0;
 		// quick_bytes array
 		uint8_t quick_bytes[quick_cap];
-		// bulk_bytes array
-		vector<uint8_t> bulk_bytes;
+		// Segmented bulk bytes (only set if quick_mode is disabled)
+		shared_ptr<const ProtoBlob> bulk;
 	};
 
 	/**
@@ -233,29 +499,128 @@ namespace datachunk {
 	 *
 	 * If the counter overflows (unsigned 64bit), expected modulo arithmetics come into force.
 	 * (e.g. 2^64+1 = 1 || 0-1 = 2^64-1)
+	 *
+	 * The counter is atomic, the non virtual operations (load, store, add, compare_exchange) are safe to call
+	 * while only the shared val_lock of the slot is held (see SlotOperator::access), so concurrent increments
+	 * on the same key do not serialize on the slot lock.
+	 *
+	 * For extremely hot counters the chunk can be switched to striped mode (set_striped),
+	 * increments then go to one of multiple cacheline aligned stripes (selected per thread) and reads sum up all stripes.
+	 * In striped mode store is not atomic in respect to concurrent adds and compare_exchange is not supported.
+	 * Copies of a CountChunk are never striped.
 	 */
 	class CountChunk : public DataChunk {
 	public:
-		CountChunk(const CountChunk& other) = default;
-		CountChunk(CountChunk&& other) = default;
-		CountChunk& operator=(const CountChunk&) = default;
-		CountChunk& operator=(CountChunk&&) = default;
+		CountChunk() = default;
+		CountChunk(const CountChunk& other) : count(other.load()) {};
+		CountChunk(CountChunk&& other) noexcept : count(other.count.load(memory_order_relaxed)), stripes(std::move(other.stripes)) {};
+		CountChunk& operator=(const CountChunk& other) {
+			if (this != &other) {
+				count.store(other.load(), memory_order_relaxed);
+				stripes.reset();
+			}
+			return *this;
+		};
+		CountChunk& operator=(CountChunk&& other) noexcept {
+			if (this != &other) {
+				count.store(other.count.load(memory_order_relaxed), memory_order_relaxed);
+				stripes = std::move(other.stripes);
+			}
+			return *this;
+		};
 		
 		DataType get_type() const noexcept override { return COUNT; };
 	
 		uint64_t get_count() const override {
-			return count;
+			return load();
 		};
 		uint64_t set_count(uint64_t& new_count) override {
-			count = new_count;
-			return count;
+			store(new_count);
+			return new_count;
 		};
 		uint64_t inc_count(int64_t& inc_count) override {
-			count += inc_count;
-			return count;
+			return add(inc_count);
+		};
+
+		/**
+		 * Returns the counter value (sum of all stripes in striped mode)
+		 */
+		uint64_t load() const noexcept {
+			uint64_t val = count.load(memory_order_relaxed);
+			if (stripes) {
+				for (size_t i = 0; i < stripe_count; i++) val += stripes[i].val.load(memory_order_relaxed);
+			}
+			return val;
+		};
+		/**
+		 * Sets the counter value
+		 */
+		void store(uint64_t new_count) noexcept {
+			count.store(new_count, memory_order_relaxed);
+			if (stripes) {
+				for (size_t i = 0; i < stripe_count; i++) stripes[i].val.store(0, memory_order_relaxed);
+			}
+		};
+		/**
+		 * Adds the delta to the counter and returns the new value
+		 *
+		 * In striped mode the returned value is the sum of all stripes after the add.
+		 */
+		uint64_t add(int64_t delta) noexcept {
+			if (stripes) {
+				stripes[stripe_index()].val.fetch_add(static_cast<uint64_t>(delta), memory_order_relaxed);
+				return load();
+			}
+			return count.fetch_add(static_cast<uint64_t>(delta), memory_order_relaxed) + static_cast<uint64_t>(delta);
+		};
+		/**
+		 * Sets the counter to desired if it equals expected, otherwise expected is updated to the current value
+		 *
+		 * Throws a runtime_error in striped mode.
+		 */
+		bool compare_exchange(uint64_t& expected, uint64_t desired) {
+			if (stripes) throw runtime_error("CountChunk compare_exchange is not supported in striped mode");
+			return count.compare_exchange_strong(expected, desired, memory_order_relaxed);
+		};
+
+		/**
+		 * Enables / disables the striped mode, the current value is kept
+		 *
+		 * Changes the representation of the counter, must only be called while the unique val_lock is held.
+		 */
+		void set_striped(bool striped) {
+			if (striped == static_cast<bool>(stripes)) return;
+			if (striped) {
+				stripes = make_unique<Stripe[]>(stripe_count);
+			} else {
+				count.store(load(), memory_order_relaxed);
+				stripes.reset();
+			}
+		};
+		/**
+		 * Returns true if the counter is in striped mode
+		 */
+		bool is_striped() const noexcept {
+			return static_cast<bool>(stripes);
 		};
 	private:
-		uint64_t count = 0;
+		// Number of stripes in striped mode (power of two)
+		static constexpr size_t stripe_count = 16;
+
+		struct alignas(64) Stripe {
+			atomic<uint64_t> val = 0;
+		};
+
+		// Stripe of the calling thread (assigned round robin on first use)
+		static size_t stripe_index() noexcept {
+			static atomic<size_t> next_stripe = 0;
+			thread_local const size_t idx = next_stripe.fetch_add(1, memory_order_relaxed) & (stripe_count - 1);
+			return idx;
+		};
+
+		atomic<uint64_t> count = 0;
+		// Stripes are only allocated in striped mode, the value is count + sum of all stripes
+		unique_ptr<Stripe[]> stripes;
 	};
 
 	/**
@@ -264,9 +629,16 @@ namespace datachunk {
 	 * This datatype just groups multiple string keys.
 	 *
 	 * It is used to perform query operations.
+	 *
+	 * The members are stored in a GroupSet, mutations only return a status and
+	 * members are iterated in place with get_group().for_each(...) while the slot lock is held.
+	 *
+	 * Members should be pushed with the SlotHandle of their key (HyperMap::get_handle), queries then resolve
+	 * the members with HyperMap::resolve_all. Members with a stale handle are looked up by key and repaired (repair_group).
 	 */
 	class GroupChunk : public DataChunk {
 	public:
+		GroupChunk() = default;
 		GroupChunk(const GroupChunk& other) = default;
 		GroupChunk(GroupChunk&& other) = default;
 		GroupChunk& operator=(const GroupChunk&) = default;
@@ -274,19 +646,23 @@ namespace datachunk {
 		
 		DataType get_type() const noexcept override { return GROUP; };
 	
-		unordered_set<string> get_group() const override {
+		const GroupSet& get_group() const override {
 			return group;
 		};
-		unordered_set<string> push_group(string& key) override {
-			group.insert(key);
-			return group;
+		bool push_group(string_view key, hypermap::SlotHandle handle = hypermap::SlotHandle()) override {
+			return group.insert(key, handle);
 		};
-		unordered_set<string> del_group(string& key) override {
-			group.erase(key);
-			return group;
+		bool repair_group(string_view key, hypermap::SlotHandle handle) override {
+			return group.repair(key, handle);
+		};
+		void set_group_sorted(bool enabled) override {
+			group.set_sorted(enabled);
+		};
+		bool del_group(string_view key) override {
+			return group.erase(key);
 		};
 	private:
-		unordered_set<string> group;
+		GroupSet group;
 	};
 
 };
@@ -0,0 +1,360 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GROUPSET_H
+#define GROUPSET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lib/hypermap/hyperhash.hpp"
+#include "lib/hypermap/hypermap.hpp"
+
+using namespace std;
+
+namespace datachunk {
+	/**
+	 * GroupSet is the member storage of the GroupChunk
+	 *
+	 * Flat open addressing set of strings:
+	 * - Member strings are appended to a single arena, erased strings are reclaimed by compacting the arena
+	 *   once more than half of it is unused.
+	 * - Members are kept in a dense array (erase moves the last member into the gap), iteration is a linear scan.
+	 * - The table contains member indices and uses linear probing with backward shift deletion, so no tombstones are left.
+	 *
+	 * Every member carries a SlotHandle of its slot in the HyperMap, so queries can resolve the members
+	 * without hashing / probing the keys (see HyperMap::resolve_all). Stale handles are repaired lazily by the caller.
+	 *
+	 * Optionally the set keeps a sorted array of the member hashes (set_sorted), set operations between groups
+	 * then run directly on the contiguous arrays (see setops.hpp). Members are identified by their 64-bit hash there,
+	 * collisions between two members are ignored (the hash is seeded per process, see hyperhash::process_seed).
+	 *
+	 * Member strings are exposed as string_view, views are invalidated by the next mutation.
+	 */
+	class GroupSet {
+	public:
+		GroupSet() = default;
+
+		/**
+		 * Inserts the key, returns false if it is already a member
+		 *
+		 * If the key is already a member and the handle is bound, the handle of the member is updated.
+		 */
+		bool insert(string_view key, hypermap::SlotHandle handle = hypermap::SlotHandle()) {
+			if (key.size() > numeric_limits<uint32_t>::max())
+				throw invalid_argument("Group member exceeds the maximum size");
+			if ((members.size() + 1) * 4 > table.size() * 3) grow();
+
+			const uint64_t h = hash(key);
+			size_t idx = h & (table.size() - 1);
+			while (table[idx] != free_entry) {
+				if (equals(members[table[idx]], h, key)) {
+					if (handle) members[table[idx]].handle = handle;
+					return false;
+				}
+				idx = (idx + 1) & (table.size() - 1);
+			}
+
+			if (arena.size() + key.size() > numeric_limits<uint32_t>::max()) {
+				compact();
+				if (arena.size() + key.size() > numeric_limits<uint32_t>::max())
+					throw runtime_error("Group exceeds the maximum size");
+			}
+			if (sorted) sorted_list.insert(lower_bound(sorted_list.begin(), sorted_list.end(), h), h);
+			table[idx] = static_cast<uint32_t>(members.size());
+			members.push_back(Member{h, static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(key.size()), handle});
+			arena.insert(arena.end(), key.begin(), key.end());
+			return true;
+		};
+
+		/**
+		 * Erases the key, returns false if it is not a member
+		 */
+		bool erase(string_view key) {
+			if (members.empty()) return false;
+			const uint64_t h = hash(key);
+			size_t idx = find(h, key);
+			if (idx == npos) return false;
+
+			const uint32_t removed = table[idx];
+			garbage += members[removed].size;
+			if (sorted) sorted_list.erase(lower_bound(sorted_list.begin(), sorted_list.end(), h));
+
+			// Backward shift deletion, entries are moved into the gap until an entry is at its home slot
+			const size_t mask = table.size() - 1;
+			size_t next = (idx + 1) & mask;
+			while (table[next] != free_entry) {
+				const size_t home = members[table[next]].hash & mask;
+				// Entry can be moved if the gap lies between its home slot and its current slot (cyclic)
+				if (((next - home) & mask) >= ((next - idx) & mask)) {
+					table[idx] = table[next];
+					idx = next;
+				}
+				next = (next + 1) & mask;
+			}
+			table[idx] = free_entry;
+
+			// Move the last member into the gap of the dense array
+			const uint32_t last = static_cast<uint32_t>(members.size() - 1);
+			if (removed != last) {
+				const Member& moved = members[last];
+				const size_t moved_idx = find(moved.hash, view(moved));
+				table[moved_idx] = removed;
+				members[removed] = moved;
+			}
+			members.pop_back();
+
+			if (members.empty()) {
+				clear();
+			} else if (garbage * 2 > arena.size()) {
+				compact();
+			}
+			return true;
+		};
+
+		/**
+		 * Sets the handle of a member, returns false if the key is not a member
+		 */
+		bool repair(string_view key, hypermap::SlotHandle handle) {
+			if (members.empty()) return false;
+			const size_t idx = find(hash(key), key);
+			if (idx == npos) return false;
+			members[table[idx]].handle = handle;
+			return true;
+		};
+
+		/**
+		 * Returns true if the key is a member
+		 */
+		bool contains(string_view key) const {
+			if (members.empty()) return false;
+			return find(hash(key), key) != npos;
+		};
+
+		/**
+		 * Removes all members and releases the memory
+		 */
+		void clear() {
+			members = vector<Member>();
+			table = vector<uint32_t>();
+			arena = vector<char>();
+			sorted_list = vector<uint64_t>();
+			garbage = 0;
+		};
+
+		/**
+		 * Calls the visitor with every member (as string_view)
+		 *
+		 * If the visitor returns a bool, iteration stops as soon as it returns false.
+		 */
+		template <typename Visitor_T>
+		void for_each(Visitor_T&& visitor) const {
+			for (const Member& member : members) {
+				if constexpr (is_same_v<decltype(visitor(string_view())), bool>) {
+					if (!visitor(view(member))) return;
+				} else {
+					visitor(view(member));
+				}
+			}
+		};
+
+		/**
+		 * Calls the visitor with every member and its handle (string_view, const SlotHandle&)
+		 *
+		 * If the visitor returns a bool, iteration stops as soon as it returns false.
+		 */
+		template <typename Visitor_T>
+		void for_each_member(Visitor_T&& visitor) const {
+			for (const Member& member : members) {
+				if constexpr (is_same_v<decltype(visitor(string_view(), member.handle)), bool>) {
+					if (!visitor(view(member), member.handle)) return;
+				} else {
+					visitor(view(member), member.handle);
+				}
+			}
+		};
+
+		/**
+		 * Enables / disables the sorted hash array
+		 *
+		 * While enabled, inserts and erases also update the sorted array (O(n) memmove),
+		 * in exchange set operations do not need to sort the member hashes.
+		 */
+		void set_sorted(bool enabled) {
+			if (enabled == sorted) return;
+			sorted = enabled;
+			sorted_list = vector<uint64_t>();
+			if (sorted) collect_hashes(sorted_list);
+		};
+
+		/**
+		 * Returns true if the sorted hash array is kept
+		 */
+		bool is_sorted() const noexcept {
+			return sorted;
+		};
+
+		/**
+		 * Returns the sorted member hashes
+		 *
+		 * If the sorted array is not kept, the hashes are collected and sorted into buffer.
+		 */
+		const vector<uint64_t>& sorted_hashes(vector<uint64_t>& buffer) const {
+			if (sorted) return sorted_list;
+			collect_hashes(buffer);
+			return buffer;
+		};
+
+		/**
+		 * Finds the member with the given hash, returns false if no member has this hash
+		 */
+		bool find_hash(uint64_t h, string_view& key, hypermap::SlotHandle* handle = nullptr) const {
+			if (members.empty()) return false;
+			size_t idx = h & (table.size() - 1);
+			while (table[idx] != free_entry) {
+				const Member& member = members[table[idx]];
+				if (member.hash == h) {
+					key = view(member);
+					if (handle) *handle = member.handle;
+					return true;
+				}
+				idx = (idx + 1) & (table.size() - 1);
+			}
+			return false;
+		};
+
+		/**
+		 * Returns the handles of all members (in member order)
+		 */
+		vector<hypermap::SlotHandle> handles() const {
+			vector<hypermap::SlotHandle> list;
+			list.reserve(members.size());
+			for (const Member& member : members) list.push_back(member.handle);
+			return list;
+		};
+
+		/**
+		 * Returns the number of members
+		 */
+		size_t size() const noexcept {
+			return members.size();
+		};
+
+		/**
+		 * Returns true if the set has no members
+		 */
+		bool empty() const noexcept {
+			return members.empty();
+		};
+
+		/**
+		 * Returns the heap memory used by the set
+		 */
+		size_t memory() const noexcept {
+			return members.capacity() * sizeof(Member) + table.capacity() * sizeof(uint32_t) + arena.capacity() +
+				sorted_list.capacity() * sizeof(uint64_t);
+		};
+
+	private:
+		struct Member {
+			uint64_t hash;
+			uint32_t offset;
+			uint32_t size;
+			hypermap::SlotHandle handle;
+		};
+
+		static constexpr uint32_t free_entry = numeric_limits<uint32_t>::max();
+		static constexpr size_t npos = numeric_limits<size_t>::max();
+		static constexpr size_t min_table = 8;
+
+		static uint64_t hash(string_view key) {
+			return hyperhash::hash64(key, hyperhash::process_seed());
+		};
+
+		string_view view(const Member& member) const {
+			return string_view(arena.data() + member.offset, member.size);
+		};
+
+		bool equals(const Member& member, uint64_t h, string_view key) const {
+			return member.hash == h && member.size == key.size() &&
+				memcmp(arena.data() + member.offset, key.data(), key.size()) == 0;
+		};
+
+		// Returns the table index of the key or npos
+		size_t find(uint64_t h, string_view key) const {
+			size_t idx = h & (table.size() - 1);
+			while (table[idx] != free_entry) {
+				if (equals(members[table[idx]], h, key)) return idx;
+				idx = (idx + 1) & (table.size() - 1);
+			}
+			return npos;
+		};
+
+		// Doubles the table and reinserts all member indices (the stored hashes are reused)
+		void grow() {
+			const size_t new_size = table.empty() ? min_table : table.size() * 2;
+			table.assign(new_size, free_entry);
+			for (uint32_t i = 0; i < members.size(); i++) {
+				size_t idx = members[i].hash & (new_size - 1);
+				while (table[idx] != free_entry) idx = (idx + 1) & (new_size - 1);
+				table[idx] = i;
+			}
+		};
+
+		// Writes the sorted member hashes into list
+		void collect_hashes(vector<uint64_t>& list) const {
+			list.resize(members.size());
+			for (size_t i = 0; i < members.size(); i++) list[i] = members[i].hash;
+			sort(list.begin(), list.end());
+		};
+
+		// Rewrites the arena without the erased strings
+		void compact() {
+			vector<char> compacted;
+			compacted.reserve(arena.size() - garbage);
+			for (Member& member : members) {
+				const uint32_t offset = static_cast<uint32_t>(compacted.size());
+				compacted.insert(compacted.end(), arena.begin() + member.offset, arena.begin() + member.offset + member.size);
+				member.offset = offset;
+			}
+			arena = std::move(compacted);
+			garbage = 0;
+		};
+
+		// Dense member array
+		vector<Member> members;
+		// Open addressing table with member indices (size is a power of two)
+		vector<uint32_t> table;
+		// Arena containing the member strings
+		vector<char> arena;
+		// Bytes in the arena that belong to erased members
+		size_t garbage = 0;
+		// Sorted member hashes (only kept if sorted is set)
+		bool sorted = false;
+		vector<uint64_t> sorted_list;
+	};
+}
+
+#endif
@@ -0,0 +1,323 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROTOBLOB_H
+#define PROTOBLOB_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <sys/uio.h>
+
+#include "lib/hyperlz/hyperlz.hpp"
+
+#ifndef DATACHUNK_SEGMENT_SIZE
+#define DATACHUNK_SEGMENT_SIZE 65536
+#endif
+
+using namespace std;
+
+namespace datachunk {
+	/**
+	 * Segment of a ProtoBlob
+	 *
+	 * If compressed is set, bytes contains a hyperlz block that decompresses to raw_size bytes.
+	 */
+	struct ProtoSegment {
+		vector<uint8_t> bytes;
+		size_t raw_size;
+		bool compressed;
+	};
+
+	/**
+	 * ProtoBlob holds the bulk bytes of a ProtoChunk
+	 *
+	 * The bytes are split into segments of at most segment_size bytes, each segment is allocated
+	 * (and optionally compressed) independently. Large values therefore never need one contiguous allocation,
+	 * neither when they are written (see Builder) nor when they are read (see for_each).
+	 *
+	 * A ProtoBlob is immutable once built, so it is shared between ProtoChunk copies with a shared_ptr
+	 * and readers can keep a reference after the slot lock is released.
+	 */
+	class ProtoBlob {
+	public:
+		// Maximum raw size of a segment
+		static constexpr size_t segment_size = DATACHUNK_SEGMENT_SIZE;
+		static_assert(DATACHUNK_SEGMENT_SIZE >= 1024, "DATACHUNK_SEGMENT_SIZE must be at least 1024");
+
+		/**
+		 * Builder appends bytes to a new ProtoBlob, full segments are flushed (and compressed) immediately
+		 */
+		class Builder {
+		public:
+			/**
+			 * Segments are compressed if the value is at least compress_threshold bytes (0 = disabled)
+			 *
+			 * The total size must be passed if it is known, otherwise compression only starts
+			 * once the appended bytes reach the threshold.
+			 */
+			explicit Builder(size_t compress_threshold = 0, size_t total_size = 0)
+				: threshold(compress_threshold), blob(new ProtoBlob()) {
+				if (total_size) blob->segment_list.reserve((total_size + segment_size - 1) / segment_size);
+				expected = total_size;
+			};
+
+			/**
+			 * Appends bytes to the blob
+			 */
+			void append(const uint8_t* data, size_t size) {
+				if (!blob) throw runtime_error("ProtoBlob::Builder was already finished");
+				while (size) {
+					if (pending.capacity() < segment_size) pending.reserve(segment_size);
+					const size_t take = size < segment_size - pending.size() ? size : segment_size - pending.size();
+					pending.insert(pending.end(), data, data + take);
+					data += take;
+					size -= take;
+					if (pending.size() == segment_size) flush();
+				}
+			};
+
+			/**
+			 * Flushes the last segment and returns the blob
+			 */
+			shared_ptr<const ProtoBlob> finish() {
+				if (!blob) throw runtime_error("ProtoBlob::Builder was already finished");
+				if (!pending.empty()) flush();
+				return shared_ptr<const ProtoBlob>(std::move(blob));
+			};
+		private:
+			void flush() {
+				ProtoSegment segment{vector<uint8_t>(), pending.size(), false};
+				const size_t total = (expected > blob->raw_size ? expected : blob->raw_size + pending.size());
+				if (threshold && total >= threshold) {
+					// Only keep the compressed block if it saves at least 1/8 of the size
+					thread_local vector<uint8_t> compress_buffer;
+					const size_t limit = pending.size() - (pending.size() >> 3);
+					if (compress_buffer.size() < limit) compress_buffer.resize(limit);
+					const size_t compressed_size = hyperlz::compress(pending.data(), pending.size(), compress_buffer.data(), limit);
+					if (compressed_size) {
+						segment.compressed = true;
+						segment.bytes.assign(compress_buffer.data(), compress_buffer.data() + compressed_size);
+					}
+				}
+				if (!segment.compressed) {
+					// Exact allocation for the stored segment, pending keeps its capacity for the next one
+					segment.bytes.assign(pending.begin(), pending.end());
+				}
+				blob->raw_size += segment.raw_size;
+				blob->stored_size += segment.bytes.size();
+				blob->segment_list.push_back(std::move(segment));
+				pending.clear();
+			};
+
+			size_t threshold;
+			size_t expected;
+			unique_ptr<ProtoBlob> blob;
+			vector<uint8_t> pending;
+		};
+
+		/**
+		 * Builds a blob from contiguous bytes
+		 */
+		static shared_ptr<const ProtoBlob> from(const uint8_t* data, size_t size, size_t compress_threshold = 0) {
+			Builder builder(compress_threshold, size);
+			builder.append(data, size);
+			return builder.finish();
+		};
+
+		/**
+		 * Returns the raw (uncompressed) size of the blob
+		 */
+		size_t size() const noexcept {
+			return raw_size;
+		};
+
+		/**
+		 * Returns the stored size of the blob (after compression)
+		 */
+		size_t stored() const noexcept {
+			return stored_size;
+		};
+
+		/**
+		 * Returns the stored segments
+		 */
+		const vector<ProtoSegment>& segments() const noexcept {
+			return segment_list;
+		};
+
+		/**
+		 * Calls the visitor with the raw bytes of every segment (const uint8_t*, size_t)
+		 *
+		 * Compressed segments are decompressed into a thread local buffer of one segment,
+		 * the bytes are only valid during the visitor call.
+		 */
+		template <typename Visitor_T>
+		void for_each(Visitor_T&& visitor) const {
+			thread_local vector<uint8_t> raw_buffer;
+			for (const ProtoSegment& segment : segment_list) {
+				if (!segment.compressed) {
+					visitor(segment.bytes.data(), segment.bytes.size());
+					continue;
+				}
+				if (raw_buffer.size() < segment.raw_size) raw_buffer.resize(segment.raw_size);
+				hyperlz::decompress(segment.bytes.data(), segment.bytes.size(), raw_buffer.data(), segment.raw_size);
+				visitor(static_cast<const uint8_t*>(raw_buffer.data()), segment.raw_size);
+			}
+		};
+
+		/**
+		 * Copies the raw bytes into dst (dst must hold size() bytes)
+		 */
+		void copy_to(uint8_t* dst) const {
+			for_each([&](const uint8_t* data, size_t size) {
+				memcpy(dst, data, size);
+				dst += size;
+			});
+		};
+
+	private:
+		ProtoBlob() = default;
+
+		vector<ProtoSegment> segment_list;
+		size_t raw_size = 0;
+		size_t stored_size = 0;
+	};
+
+	/**
+	 * ProtoPin keeps the bytes of a proto alive after the slot lock is released
+	 *
+	 * Bulk values pin the immutable ProtoBlob (a reference, no bytes are copied), writers replace the blob
+	 * of the chunk and never wait for a pin to be released. Small values are copied into the pin (at most inline_cap bytes).
+	 * The pin hands out iovec views over the raw bytes, so they can be written to a socket without an intermediate buffer.
+	 *
+	 * Compressed segments can not be viewed raw, each of them is decompressed into its own buffer of the pin
+	 * on the first buffers() call (the value is never copied into one contiguous allocation).
+	 */
+	class ProtoPin {
+	public:
+		// Maximum size of a value that is copied into the pin
+		static constexpr size_t inline_cap = 255;
+
+		ProtoPin() = default;
+
+		/**
+		 * Copies a small value into the pin
+		 */
+		ProtoPin(const uint8_t* data, size_t size) : inline_size(size), raw_size(size), pinned(true) {
+			if (size > inline_cap) throw invalid_argument("ProtoPin inline value exceeds the maximum size");
+			if (size) memcpy(inline_bytes, data, size);
+		};
+
+		/**
+		 * Pins a blob
+		 */
+		explicit ProtoPin(shared_ptr<const ProtoBlob> blob) : blob(std::move(blob)), pinned(true) {
+			if (!this->blob) throw invalid_argument("ProtoBlob must not be null");
+			raw_size = this->blob->size();
+		};
+
+		/**
+		 * Pins the stored frames of a blob, buffers() then returns the segments as they are stored (no decompression)
+		 *
+		 * size() is the stored size, the frames are described by for_each_frame().
+		 */
+		static ProtoPin frames(shared_ptr<const ProtoBlob> blob) {
+			ProtoPin pin(std::move(blob));
+			pin.stored = true;
+			pin.raw_size = pin.blob->stored();
+			return pin;
+		};
+
+		/**
+		 * Returns true if the pin holds a value
+		 */
+		explicit operator bool() const noexcept {
+			return pinned;
+		};
+
+		/**
+		 * Returns the size of the bytes returned by buffers() (the stored size if the frames are pinned)
+		 */
+		size_t size() const noexcept {
+			return raw_size;
+		};
+
+		/**
+		 * Calls the visitor with every frame of buffers() (bool compressed, size_t raw_size, size_t size)
+		 *
+		 * Frames are only compressed if the stored frames are pinned (see frames()).
+		 */
+		template <typename Visitor_T>
+		void for_each_frame(Visitor_T&& visitor) const {
+			if (!blob) {
+				if (inline_size) visitor(false, inline_size, inline_size);
+				return;
+			}
+			for (const ProtoSegment& segment : blob->segments()) {
+				if (stored) visitor(segment.compressed, segment.raw_size, segment.bytes.size());
+				else visitor(false, segment.raw_size, segment.raw_size);
+			}
+		};
+
+		/**
+		 * Appends the views over the raw bytes to out (one view per segment)
+		 *
+		 * The views are valid as long as the pin is alive and not moved.
+		 */
+		void buffers(vector<iovec>& out) {
+			if (!blob) {
+				if (inline_size) out.push_back(iovec{inline_bytes, inline_size});
+				return;
+			}
+			const vector<ProtoSegment>& segments = blob->segments();
+			for (size_t i = 0; i < segments.size(); i++) {
+				const ProtoSegment& segment = segments[i];
+				if (!segment.compressed || stored) {
+					out.push_back(iovec{const_cast<uint8_t*>(segment.bytes.data()), segment.bytes.size()});
+					continue;
+				}
+				// Compressed segments are decompressed once, each into its own buffer of the segment size
+				if (raw.empty()) raw.resize(segments.size());
+				if (raw[i].empty()) {
+					raw[i].resize(segment.raw_size);
+					hyperlz::decompress(segment.bytes.data(), segment.bytes.size(), raw[i].data(), segment.raw_size);
+				}
+				out.push_back(iovec{raw[i].data(), raw[i].size()});
+			}
+		};
+
+	private:
+		// Pinned blob (bulk values)
+		shared_ptr<const ProtoBlob> blob;
+		// Decompressed copies of the compressed segments (indexed like the segments, uncompressed segments stay empty)
+		vector<vector<uint8_t>> raw;
+		// Copy of a small value
+		uint8_t inline_bytes[inline_cap];
+		size_t inline_size = 0;
+		size_t raw_size = 0;
+		bool pinned = false;
+		// The stored frames are pinned (see frames())
+		bool stored = false;
+	};
+}
+
+#endif
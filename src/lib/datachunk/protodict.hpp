@@ -0,0 +1,364 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROTO_DICT_H
+#define PROTO_DICT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "lib/hyperlz/hyperlz.hpp"
+
+using namespace std;
+
+namespace datachunk {
+
+	/**
+	 * ProtoDict is a trained, immutable dictionary used to compress small proto values.
+	 *
+	 * Small values do not compress on their own, but values under the same key prefix usually share
+	 * their structure (same schema, same field tags). The dictionary contains those shared bytes,
+	 * so that matches in the value can reference into the dictionary.
+	 *
+	 * Dictionaries are registered in the ProtoDictStore and identified by their id,
+	 * they are never deallocated, because ProtoChunks only store the id and resolve it on every read.
+	 */
+	class ProtoDict {
+	public:
+		// Maximum size of the dictionary content
+		static constexpr size_t dict_cap = 4096;
+		// Hashtable bits used for the dictionary matchfinder (smaller table, as values are small)
+		static constexpr unsigned table_bits = 10;
+
+		ProtoDict(uint16_t dict_id, vector<uint8_t> content) : id(dict_id), bytes(std::move(content)) {
+			if (bytes.size() > dict_cap)
+				throw invalid_argument("Dictionary exceeds the dictionary capacity");
+			// Prehash the dictionary, the table is copied on every compression
+			memset(table, 0, sizeof(table));
+			for (size_t i = 0; i + hyperlz::MIN_MATCH <= bytes.size(); i++)
+				table[hyperlz::HashSeq(hyperlz::Read32(bytes.data() + i), table_bits)] = static_cast<uint32_t>(i);
+		};
+		ProtoDict(const ProtoDict&) = delete;
+		ProtoDict& operator=(const ProtoDict&) = delete;
+
+		/**
+		 * Compresses src against the dictionary
+		 *
+		 * Returns the compressed size or 0 if the block does not fit into dcap bytes.
+		 */
+		size_t compress(const uint8_t* src, size_t size, uint8_t* dst, size_t dcap) const {
+			// Window with the dictionary followed by the value, the dictionary is only copied when the thread switches dictionaries
+			thread_local vector<uint8_t> window;
+			thread_local const ProtoDict* window_dict = nullptr;
+			if (window_dict != this || window.size() < bytes.size() + size) {
+				window.resize(bytes.size() + size);
+				memcpy(window.data(), bytes.data(), bytes.size());
+				window_dict = this;
+			}
+			memcpy(window.data() + bytes.size(), src, size);
+
+			uint32_t work_table[1 << table_bits];
+			memcpy(work_table, table, sizeof(work_table));
+			return hyperlz::compress_window(window.data(), bytes.size(), bytes.size() + size, dst, dcap, work_table, table_bits);
+		};
+
+		/**
+		 * Decompresses src (compressed with this dictionary) into dst
+		 *
+		 * Returns the decompressed size. Throws a runtime_error if the block is malformed.
+		 */
+		size_t decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dcap) const {
+			return hyperlz::decompress(src, size, dst, dcap, bytes.data(), bytes.size());
+		};
+
+		/**
+		 * Returns the dictionary id
+		 */
+		uint16_t get_id() const noexcept { return id; };
+
+		/**
+		 * Returns the dictionary content (e.g. to ship it to clients that decompress by themself)
+		 */
+		const vector<uint8_t>& get_bytes() const noexcept { return bytes; };
+
+	private:
+		uint16_t id;
+		vector<uint8_t> bytes;
+		uint32_t table[1 << table_bits];
+	};
+
+	/**
+	 * ProtoDictStore samples small values per key prefix and trains dictionaries from them.
+	 *
+	 * The key prefix is the part of the key before the first delimiter (e.g. "user" for "user:1234"),
+	 * keys without delimiter share the "" prefix.
+	 *
+	 * Usage:
+	 *
+	 * Call sample() on writes, call train() periodically (e.g. from a maintenance thread)
+	 * and use select() to obtain the dictionary for a key before calling ProtoChunk::set_proto().
+	 * ProtoChunks resolve dictionaries with find(), this is a lock free array lookup.
+	 *
+	 * The store can hold max_dicts dictionaries over the lifetime of the process,
+	 * after that train() does not produce new dictionaries anymore.
+	 */
+	class ProtoDictStore {
+	public:
+		// Maximum number of dictionaries (ids are 1 based, 0 = no dictionary)
+		static constexpr size_t max_dicts = 4096;
+		// Samples kept per prefix
+		static constexpr size_t sample_cap = 512;
+		// Maximum number of sampled prefixes, values of further prefixes are not sampled
+		static constexpr size_t max_prefixes = 256;
+		// Samples required to train a prefix
+		static constexpr size_t sample_min = 64;
+		// Every n-th sample() call is actually sampled
+		static constexpr uint32_t sample_rate = 16;
+		// Only values smaller than this are sampled / dictionary compressed
+		static constexpr size_t value_cap = numeric_limits<uint8_t>::max();
+
+		ProtoDictStore(char prefix_delimiter = ':') : delimiter(prefix_delimiter) {
+			for (auto& dict : dicts) dict.store(nullptr, memory_order_relaxed);
+		};
+		ProtoDictStore(const ProtoDictStore&) = delete;
+		ProtoDictStore& operator=(const ProtoDictStore&) = delete;
+		~ProtoDictStore() {
+			for (auto& dict : dicts) delete dict.load(memory_order_relaxed);
+		};
+
+		/**
+		 * Process wide store, used by ProtoChunks to resolve their dictionary
+		 */
+		static ProtoDictStore& global() {
+			static ProtoDictStore store;
+			return store;
+		};
+
+		/**
+		 * Returns the dictionary with the specified id or nullptr
+		 */
+		const ProtoDict* find(uint16_t id) const noexcept {
+			if (id == 0 || id > max_dicts) return nullptr;
+			return dicts[id - 1].load(memory_order_acquire);
+		};
+
+		/**
+		 * Returns the current dictionary for the prefix of key or nullptr if the prefix is not trained
+		 */
+		const ProtoDict* select(const string& key) const {
+			// No prefix can have a dictionary before the first one is trained
+			if (next_id.load(memory_order_relaxed) == 1) return nullptr;
+			const shared_lock<shared_mutex> lock(prefix_lock);
+			auto it = prefixes.find(prefix(key));
+			return it != prefixes.end() ? it->second.dict : nullptr;
+		};
+
+		/**
+		 * Samples a value written to key
+		 *
+		 * Only every sample_rate'th call per thread is recorded, the rest returns without locking.
+		 * Once max_prefixes prefixes are sampled, values of new prefixes are ignored.
+		 */
+		void sample(const string& key, const uint8_t* bytes, size_t size) {
+			thread_local uint32_t counter = 0;
+			if (size == 0 || size >= value_cap || ++counter % sample_rate != 0) return;
+
+			const unique_lock<shared_mutex> lock(prefix_lock);
+			auto it = prefixes.find(prefix(key));
+			if (it == prefixes.end()) {
+				if (prefixes.size() >= max_prefixes) return;
+				it = prefixes.emplace(string(prefix(key)), PrefixState()).first;
+			}
+			PrefixState& state = it->second;
+			state.seen++;
+			if (state.samples.size() < sample_cap) {
+				state.samples.emplace_back(bytes, bytes + size);
+			} else {
+				// Reservoir sampling, keeps a uniform sample over all seen values
+				const size_t idx = state.rng() % state.seen;
+				if (idx < sample_cap) state.samples[idx].assign(bytes, bytes + size);
+			}
+		};
+
+		/**
+		 * Trains dictionaries for all prefixes that collected enough samples
+		 *
+		 * Consumes the samples of trained prefixes. Returns the number of trained dictionaries.
+		 */
+		size_t train() {
+			// Take samples out of the store, training runs without holding the lock
+			vector<pair<string, vector<vector<uint8_t>>>> jobs;
+			{
+				const unique_lock<shared_mutex> lock(prefix_lock);
+				for (auto& [name, state] : prefixes) {
+					if (state.samples.size() < sample_min) continue;
+					jobs.emplace_back(name, std::move(state.samples));
+					state.samples.clear();
+					state.seen = 0;
+				}
+			}
+
+			size_t trained = 0;
+			for (auto& [name, samples] : jobs) {
+				vector<uint8_t> content = build(samples);
+				if (content.empty()) continue;
+
+				// Reserve the next id, the counter stops at max_dicts + 1 once the store is full
+				uint32_t id = next_id.load(memory_order_relaxed);
+				do {
+					if (id == 0 || id > max_dicts) return trained;
+				} while (!next_id.compare_exchange_weak(id, id + 1, memory_order_relaxed));
+				ProtoDict* dict = new ProtoDict(static_cast<uint16_t>(id), std::move(content));
+				dicts[id - 1].store(dict, memory_order_release);
+
+				const unique_lock<shared_mutex> lock(prefix_lock);
+				prefixes[name].dict = dict;
+				trained++;
+			}
+			return trained;
+		};
+
+	private:
+		struct PrefixState {
+			const ProtoDict* dict = nullptr;
+			vector<vector<uint8_t>> samples;
+			size_t seen = 0;
+			minstd_rand rng;
+		};
+
+		// Length of the substrings that are counted
+		static constexpr size_t kmer_len = 8;
+		// Length of the segments that are copied into the dictionary
+		static constexpr size_t segment_len = 32;
+
+		string_view prefix(const string& key) const noexcept {
+			const size_t pos = key.find(delimiter);
+			return pos == string::npos ? string_view() : string_view(key).substr(0, pos);
+		};
+
+		static uint64_t kmer_at(const uint8_t* p) noexcept {
+			uint64_t kmer;
+			memcpy(&kmer, p, sizeof(kmer));
+			return kmer;
+		};
+
+		/**
+		 * Builds the dictionary content from samples
+		 *
+		 * Every kmer is scored with the number of samples it occurs in, segments with the highest score
+		 * are then greedily added to the dictionary. Kmers of selected segments are removed from the score,
+		 * so that the dictionary does not contain the same content multiple times.
+		 * Scores only decrease, so candidates are lazily rescored when they reach the top of the queue.
+		 * The best segments are placed at the end of the dictionary (closest to the value).
+		 */
+		static vector<uint8_t> build(const vector<vector<uint8_t>>& samples) {
+			unordered_map<uint64_t, uint32_t> freq;
+			unordered_set<uint64_t> local;
+			for (const auto& sample : samples) {
+				local.clear();
+				for (size_t i = 0; i + kmer_len <= sample.size(); i++) {
+					const uint64_t kmer = kmer_at(sample.data() + i);
+					if (local.insert(kmer).second) freq[kmer]++;
+				}
+			}
+
+			struct Candidate {
+				uint64_t score;
+				const vector<uint8_t>* sample;
+				size_t pos;
+				size_t len;
+				bool operator<(const Candidate& other) const { return score < other.score; };
+			};
+			const auto score = [&freq](const Candidate& c) {
+				uint64_t sum = 0;
+				for (size_t i = c.pos; i + kmer_len <= c.pos + c.len; i++) {
+					auto it = freq.find(kmer_at(c.sample->data() + i));
+					// Kmers that occur in a single sample are not shared structure
+					if (it != freq.end() && it->second > 1) sum += it->second;
+				}
+				return sum;
+			};
+
+			priority_queue<Candidate> queue;
+			for (const auto& sample : samples) {
+				if (sample.size() < kmer_len) continue;
+				const size_t len = min(segment_len, sample.size());
+				for (size_t pos = 0; pos + len <= sample.size(); pos += kmer_len) {
+					Candidate c{0, &sample, pos, len};
+					c.score = score(c);
+					if (c.score) queue.push(c);
+				}
+			}
+
+			vector<Candidate> segments;
+			size_t total = 0;
+			while (total < ProtoDict::dict_cap && !queue.empty()) {
+				Candidate top = queue.top();
+				queue.pop();
+				top.score = score(top);
+				if (!top.score) continue;
+				if (!queue.empty() && top.score < queue.top().score) {
+					queue.push(top);
+					continue;
+				}
+
+				top.len = min(top.len, ProtoDict::dict_cap - total);
+				total += top.len;
+				segments.push_back(top);
+				for (size_t i = top.pos; i + kmer_len <= top.pos + top.len; i++)
+					freq.erase(kmer_at(top.sample->data() + i));
+			}
+
+			vector<uint8_t> content;
+			content.reserve(total);
+			for (auto it = segments.rbegin(); it != segments.rend(); ++it)
+				content.insert(content.end(), it->sample->begin() + it->pos, it->sample->begin() + it->pos + it->len);
+			return content;
+		};
+
+		// Hasher that allows prefix lookups with string_view
+		struct PrefixHash {
+			using is_transparent = void;
+			size_t operator()(string_view str) const noexcept { return hash<string_view>{}(str); };
+		};
+
+		const char delimiter;
+		mutable shared_mutex prefix_lock;
+		unordered_map<string, PrefixState, PrefixHash, equal_to<>> prefixes;
+		atomic<uint32_t> next_id = 1;
+		atomic<const ProtoDict*> dicts[max_dicts];
+	};
+
+};
+
+#endif
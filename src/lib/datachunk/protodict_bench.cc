@@ -0,0 +1,186 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark for ProtoDict compression of small ProtoChunk values.
+ *
+ * Generates protobuf encoded values for a few key prefixes, trains dictionaries and compares
+ * the memory used by ProtoChunks (inline + heap) and the CPU time per set/get with and without dictionary.
+ *
+ * The DATACHUNK_QUICK_CAP of datachunk.hpp is below the size of most generated values, values that only fit
+ * into the quick_bytes after compression are the ones that save memory.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lib/datachunk/datachunk.hpp"
+
+using namespace std;
+using namespace datachunk;
+
+namespace {
+	// Protobuf wire format helpers
+	void put_varint(vector<uint8_t>& out, uint64_t val) {
+		while (val >= 0x80) {
+			out.push_back(static_cast<uint8_t>(val) | 0x80);
+			val >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(val));
+	}
+
+	void put_string(vector<uint8_t>& out, uint32_t field, const string& str) {
+		put_varint(out, (field << 3) | 2);
+		put_varint(out, str.size());
+		out.insert(out.end(), str.begin(), str.end());
+	}
+
+	void put_uint(vector<uint8_t>& out, uint32_t field, uint64_t val) {
+		put_varint(out, field << 3);
+		put_varint(out, val);
+	}
+
+	// Generates a value following the schema of the prefix
+	vector<uint8_t> make_value(size_t schema, mt19937_64& rng) {
+		static const char* domains[] = {"example.com", "mail.example.org", "corp.example.net"};
+		static const char* states[] = {"ACTIVE", "SUSPENDED", "PENDING_VERIFICATION"};
+		vector<uint8_t> out;
+		switch (schema) {
+		case 0:
+			put_uint(out, 1, rng() % 10000000);
+			put_string(out, 2, "user" + to_string(rng() % 100000) + "@" + domains[rng() % 3]);
+			put_string(out, 3, states[rng() % 3]);
+			put_string(out, 4, "https://cdn.example.com/avatars/default/" + to_string(rng() % 1000) + ".png");
+			put_string(out, 5, "Europe/Zurich");
+			put_string(out, 6, "de-CH,de;q=0.9,en-US;q=0.8,en;q=0.7");
+			put_uint(out, 7, 1700000000 + rng() % 10000000);
+			break;
+		case 1:
+			put_string(out, 1, "sess_" + to_string(rng()));
+			put_uint(out, 2, rng() % 10000000);
+			put_string(out, 3, "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36");
+			put_string(out, 4, "10.0." + to_string(rng() % 256) + "." + to_string(rng() % 256));
+			put_uint(out, 5, 1700000000 + rng() % 10000000);
+			break;
+		default:
+			put_uint(out, 1, rng() % 100000);
+			put_string(out, 2, "product-category-" + to_string(rng() % 20));
+			put_uint(out, 3, rng() % 100000);
+			put_string(out, 4, "CHF");
+			put_string(out, 5, "warehouse-eu-central-" + to_string(rng() % 4));
+			put_string(out, 6, "{\"color\":\"black\",\"size\":\"M\",\"material\":\"cotton\"}");
+			break;
+		}
+		return out;
+	}
+
+	// Heap + inline bytes used by a chunk
+	size_t chunk_memory(const ProtoChunk& chunk) {
+		const ProtoFrame frame = chunk.get_proto_frame();
+		const bool inline_frame = frame.data >= reinterpret_cast<const uint8_t*>(&chunk) &&
+			frame.data < reinterpret_cast<const uint8_t*>(&chunk) + sizeof(chunk);
+		return sizeof(ProtoChunk) + (inline_frame ? 0 : frame.size);
+	}
+}
+
+int main() {
+	static const char* prefixes[] = {"user", "session", "item"};
+	constexpr size_t value_count = 60000;
+
+	mt19937_64 rng(42);
+	vector<string> keys;
+	vector<vector<uint8_t>> values;
+	for (size_t i = 0; i < value_count; i++) {
+		const size_t schema = i % 3;
+		keys.push_back(string(prefixes[schema]) + ":" + to_string(i));
+		values.push_back(make_value(schema, rng));
+	}
+
+	ProtoDictStore& store = ProtoDictStore::global();
+	for (size_t i = 0; i < value_count; i++)
+		store.sample(keys[i], values[i].data(), values[i].size());
+	const size_t trained = store.train();
+
+	vector<const ProtoDict*> dicts(value_count);
+	for (size_t i = 0; i < value_count; i++) dicts[i] = store.select(keys[i]);
+
+	vector<ProtoChunk> raw_chunks(value_count);
+	vector<ProtoChunk> dict_chunks(value_count);
+
+	using clock = chrono::steady_clock;
+	const auto ns_per_op = [](clock::time_point start) {
+		return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count()) / value_count;
+	};
+
+	auto start = clock::now();
+	for (size_t i = 0; i < value_count; i++) raw_chunks[i].set_proto(values[i].data(), values[i].size());
+	const double raw_set = ns_per_op(start);
+
+	start = clock::now();
+	for (size_t i = 0; i < value_count; i++) dict_chunks[i].set_proto(values[i].data(), values[i].size(), dicts[i]);
+	const double dict_set = ns_per_op(start);
+
+	uint64_t checksum = 0;
+	start = clock::now();
+	for (size_t i = 0; i < value_count; i++) checksum += raw_chunks[i].get_proto().first[0];
+	const double raw_get = ns_per_op(start);
+
+	start = clock::now();
+	for (size_t i = 0; i < value_count; i++) checksum += dict_chunks[i].get_proto().first[0];
+	const double dict_get = ns_per_op(start);
+
+	for (size_t i = 0; i < value_count; i++) {
+		const auto proto = dict_chunks[i].get_proto();
+		if (proto.second != values[i].size() || memcmp(proto.first, values[i].data(), proto.second)) {
+			fprintf(stderr, "roundtrip mismatch at value %zu\n", i);
+			return 1;
+		}
+	}
+
+	size_t raw_bytes = 0, raw_memory = 0, dict_memory = 0, raw_inline = 0, dict_inline = 0;
+	for (size_t i = 0; i < value_count; i++) {
+		raw_bytes += values[i].size();
+		raw_memory += chunk_memory(raw_chunks[i]);
+		dict_memory += chunk_memory(dict_chunks[i]);
+		raw_inline += chunk_memory(raw_chunks[i]) == sizeof(ProtoChunk);
+		dict_inline += chunk_memory(dict_chunks[i]) == sizeof(ProtoChunk);
+	}
+
+	printf("quick_cap: %d\n", DATACHUNK_QUICK_CAP);
+	printf("chunk_size: %zu\n", sizeof(ProtoChunk));
+	printf("values: %zu\n", value_count);
+	printf("dictionaries: %zu\n", trained);
+	printf("avg_value_bytes: %.1f\n", static_cast<double>(raw_bytes) / value_count);
+	printf("inline_raw: %.1f%%\n", 100.0 * raw_inline / value_count);
+	printf("inline_dict: %.1f%%\n", 100.0 * dict_inline / value_count);
+	printf("memory_raw: %zu\n", raw_memory);
+	printf("memory_dict: %zu\n", dict_memory);
+	printf("memory_saved: %.1f%%\n", 100.0 * (1.0 - static_cast<double>(dict_memory) / raw_memory));
+	printf("set_ns_raw: %.1f\n", raw_set);
+	printf("set_ns_dict: %.1f\n", dict_set);
+	printf("get_ns_raw: %.1f\n", raw_get);
+	printf("get_ns_dict: %.1f\n", dict_get);
+	printf("checksum: %lu\n", checksum);
+	return 0;
+}
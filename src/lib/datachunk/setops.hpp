@@ -0,0 +1,186 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SETOPS_H
+#define SETOPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * Set operations on sorted arrays of 64-bit member hashes (used by the GroupChunk queries)
+ *
+ * All inputs must be sorted ascending and free of duplicates, outputs are sorted as well.
+ */
+namespace setops {
+	// Size ratio from which the intersection gallops through the larger array
+	inline static constexpr size_t GALLOP_RATIO = 32;
+
+	/**
+	 * Returns the first position in [lo, size) with data[pos] >= val (exponential + binary search)
+	 */
+	inline size_t gallop(const uint64_t* data, size_t lo, size_t size, uint64_t val) {
+		size_t step = 1;
+		size_t hi = lo;
+		while (hi < size && data[hi] < val) {
+			lo = hi + 1;
+			hi += step;
+			step <<= 1;
+		}
+		if (hi > size) hi = size;
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+			if (data[mid] < val) lo = mid + 1;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	/**
+	 * Intersection by galloping the elements of small through large
+	 */
+	inline size_t intersect_gallop(const uint64_t* small, size_t ns, const uint64_t* large, size_t nl, uint64_t* out) {
+		size_t count = 0;
+		size_t pos = 0;
+		for (size_t i = 0; i < ns && pos < nl; i++) {
+			pos = gallop(large, pos, nl, small[i]);
+			if (pos < nl && large[pos] == small[i]) out[count++] = small[i];
+		}
+		return count;
+	}
+
+	/**
+	 * Scalar (branchless) merge intersection
+	 */
+	inline size_t intersect_scalar(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, uint64_t* out,
+																 size_t i = 0, size_t j = 0, size_t count = 0) {
+		while (i < na && j < nb) {
+			const uint64_t x = a[i];
+			const uint64_t y = b[j];
+			out[count] = x;
+			count += x == y;
+			i += x <= y;
+			j += y <= x;
+		}
+		return count;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	/**
+	 * AVX2 block merge intersection
+	 *
+	 * Compares blocks of 4 elements all-against-all (the b block is rotated 3 times),
+	 * then advances the block with the smaller maximum. The tail is merged with the scalar kernel.
+	 */
+	__attribute__((target("avx2")))
+	inline size_t intersect_avx2(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, uint64_t* out) {
+		size_t i = 0, j = 0, count = 0;
+		while (i + 4 <= na && j + 4 <= nb) {
+			const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+			const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+			__m256i eq = _mm256_cmpeq_epi64(va, vb);
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+			unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(eq)));
+			while (mask) {
+				out[count++] = a[i + __builtin_ctz(mask)];
+				mask &= mask - 1;
+			}
+			const uint64_t amax = a[i + 3];
+			const uint64_t bmax = b[j + 3];
+			i += amax <= bmax ? 4 : 0;
+			j += bmax <= amax ? 4 : 0;
+		}
+		return intersect_scalar(a, na, b, nb, out, i, j, count);
+	}
+
+	inline bool has_avx2() {
+		static const bool supported = __builtin_cpu_supports("avx2");
+		return supported;
+	}
+#endif
+
+	/**
+	 * Intersects a and b into out (out must hold min(na, nb) elements), returns the result size
+	 *
+	 * Gallops if the sizes differ by more than GALLOP_RATIO, otherwise merges (with AVX2 if supported).
+	 */
+	inline size_t intersect(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, uint64_t* out) {
+		if (na > nb) return intersect(b, nb, a, na, out);
+		if (na == 0) return 0;
+		if (nb / na >= GALLOP_RATIO) return intersect_gallop(a, na, b, nb, out);
+#if defined(__x86_64__) || defined(__i386__)
+		if (has_avx2()) return intersect_avx2(a, na, b, nb, out);
+#endif
+		return intersect_scalar(a, na, b, nb, out);
+	}
+
+	/**
+	 * Merges a and b into out (out must hold na + nb elements), returns the result size
+	 */
+	inline size_t unite(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, uint64_t* out) {
+		size_t i = 0, j = 0, count = 0;
+		while (i < na && j < nb) {
+			const uint64_t x = a[i];
+			const uint64_t y = b[j];
+			out[count++] = x <= y ? x : y;
+			i += x <= y;
+			j += y <= x;
+		}
+		while (i < na) out[count++] = a[i++];
+		while (j < nb) out[count++] = b[j++];
+		return count;
+	}
+
+	/**
+	 * Writes the elements of a that are not in b to out (out must hold na elements), returns the result size
+	 */
+	inline size_t difference(const uint64_t* a, size_t na, const uint64_t* b, size_t nb, uint64_t* out) {
+		size_t count = 0;
+		if (nb / (na ? na : 1) >= GALLOP_RATIO) {
+			size_t pos = 0;
+			for (size_t i = 0; i < na; i++) {
+				pos = gallop(b, pos, nb, a[i]);
+				if (pos >= nb || b[pos] != a[i]) out[count++] = a[i];
+			}
+			return count;
+		}
+		size_t i = 0, j = 0;
+		while (i < na && j < nb) {
+			const uint64_t x = a[i];
+			const uint64_t y = b[j];
+			out[count] = x;
+			count += x < y;
+			i += x <= y;
+			j += y <= x;
+		}
+		while (i < na) out[count++] = a[i++];
+		return count;
+	}
+}
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ * HyperCache System
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <sys/uio.h>
+
+#include "lib/embedded/hypercache.hpp"
+#include "lib/embedded/hypercache.h"
+#include "core.hpp"
+
+using namespace std;
+
+namespace hypercache {
+	namespace {
+		// Eviction rounds before an insert gives up (the sampled slots were all empty)
+		constexpr size_t eviction_rounds = 8;
+		// Fraction of tombstones in the map that triggers a rehash
+		constexpr double max_tombstones = 0.125;
+
+		/**
+		 * Translates the errors of the engine to the errors of the API
+		 */
+		template <typename Func_T>
+		auto guarded(Func_T&& func) {
+			try {
+				return func();
+			} catch (const core::type_error& e) {
+				throw type_error(e.what());
+			}
+		}
+
+		// Keys are converted once per call (the engine takes const string&)
+		string& scratch(string_view val) {
+			thread_local string buffer;
+			buffer.assign(val);
+			return buffer;
+		}
+
+		vector<string> names(const vector<string_view>& keys) {
+			return vector<string>(keys.begin(), keys.end());
+		}
+	}
+
+	struct Cache::Engine {
+		explicit Engine(const CacheConfig& config)
+			: map(config.slots), max_keys(config.max_keys ? config.max_keys : config.slots - config.slots / 4),
+				samples(max<size_t>(1, config.eviction_samples)) {};
+
+		/**
+		 * Evicts keys until the map holds less than max_keys keys
+		 */
+		void reserve() {
+			for (size_t round = 0; map.load() >= max_keys && round < eviction_rounds; round++) {
+				thread_local mt19937_64 rng(random_device{}());
+				string victim;
+				auto victim_expiry = chrono::system_clock::time_point::max();
+				bool found = false;
+				for (size_t i = 0; i < samples; i++) {
+					map.visit_slot(rng() & (map.capacity() - 1), [&](const string& key, const datachunk::DataChunk*,
+						chrono::system_clock::time_point expiry) {
+						if (found && expiry >= victim_expiry) return;
+						victim = key;
+						victim_expiry = expiry;
+						found = true;
+					});
+				}
+				if (!found) continue;
+				map.del(victim);
+				evicted.fetch_add(1, memory_order_relaxed);
+			}
+			// Evicted keys leave tombstones that lengthen the probe sequences of misses, they are cleared by a rehash
+			if (map.stats().tombstone_factor > max_tombstones && !compacting.exchange(true, memory_order_acquire)) {
+				map.rehash();
+				compacting.store(false, memory_order_release);
+			}
+		};
+
+		core::CoreMap map;
+		size_t max_keys;
+		size_t samples;
+		atomic<uint64_t> evicted = 0;
+		atomic<bool> compacting = false;
+	};
+
+	Cache::Cache(const CacheConfig& config) : engine(make_unique<Engine>(config)) {}
+
+	Cache::Cache(Cache&&) noexcept = default;
+
+	Cache& Cache::operator=(Cache&&) noexcept = default;
+
+	Cache::~Cache() = default;
+
+	optional<string> Cache::get(string_view key) {
+		optional<string> value;
+		get(key, [&](const uint8_t* data, size_t size) {
+			if (!value) value.emplace();
+			value->append(reinterpret_cast<const char*>(data), size);
+		});
+		return value;
+	}
+
+	bool Cache::get(string_view key, const function<void(const uint8_t*, size_t)>& visitor) {
+		datachunk::ProtoPin pin = guarded([&] { return core::pin_proto(engine->map, scratch(key)); });
+		if (!pin) return false;
+		thread_local vector<iovec> views;
+		views.clear();
+		pin.buffers(views);
+		if (views.empty()) visitor(nullptr, 0);
+		for (const iovec& view : views) visitor(static_cast<const uint8_t*>(view.iov_base), view.iov_len);
+		return true;
+	}
+
+	void Cache::set(string_view key, string_view value, chrono::milliseconds ttl) {
+		engine->reserve();
+		const string& name = scratch(key);
+		core::proto_set(engine->map, name, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+		if (ttl.count()) engine->map.expire(name, ttl);
+	}
+
+	void Cache::del(string_view key) {
+		engine->map.del(scratch(key));
+	}
+
+	bool Cache::expire(string_view key, chrono::milliseconds ttl) {
+		return engine->map.expire(scratch(key), ttl);
+	}
+
+	uint64_t Cache::incr(string_view key, int64_t delta) {
+		engine->reserve();
+		return guarded([&] { return core::count_add(engine->map, scratch(key), delta); });
+	}
+
+	bool Cache::group_add(string_view key, string_view member) {
+		engine->reserve();
+		const string name(key);
+		return guarded([&] { return core::group_add(engine->map, name, scratch(member)); });
+	}
+
+	bool Cache::group_remove(string_view key, string_view member) {
+		return guarded([&] { return core::group_remove(engine->map, scratch(key), member); });
+	}
+
+	vector<string> Cache::group_members(string_view key) {
+		vector<string> members;
+		group_members(key, [&](string_view member) { members.emplace_back(member); });
+		return members;
+	}
+
+	bool Cache::group_members(string_view key, const function<void(string_view)>& visitor) {
+		return guarded([&] { return core::group_members(engine->map, scratch(key), visitor); });
+	}
+
+	vector<string> Cache::group_inter(const vector<string_view>& keys) {
+		return guarded([&] { return core::group_inter(engine->map, names(keys)); });
+	}
+
+	size_t Cache::group_intercard(const vector<string_view>& keys, size_t limit) {
+		return guarded([&] { return core::group_intercard(engine->map, names(keys), limit); });
+	}
+
+	vector<string> Cache::group_union(const vector<string_view>& keys) {
+		return guarded([&] { return core::group_union(engine->map, names(keys)); });
+	}
+
+	vector<string> Cache::group_diff(const vector<string_view>& keys) {
+		return guarded([&] { return core::group_diff(engine->map, names(keys)); });
+	}
+
+	size_t Cache::size() const {
+		return engine->map.load();
+	}
+
+	uint64_t Cache::evictions() const {
+		return engine->evicted.load(memory_order_relaxed);
+	}
+
+	size_t Cache::save(const string& path) {
+		return core::snapshot_save(engine->map, path);
+	}
+
+	size_t Cache::load(const string& path) {
+		return guarded([&] { return core::snapshot_load(engine->map, path); });
+	}
+}
+
+struct hypercache_cache {
+	hypercache::Cache cache;
+};
+
+namespace {
+	thread_local string last_error;
+
+	/**
+	 * Runs the call and translates its exceptions to a status
+	 */
+	template <typename Func_T>
+	hypercache_status call(Func_T&& func) noexcept {
+		try {
+			return func();
+		} catch (const hypercache::type_error& e) {
+			last_error = e.what();
+			return HYPERCACHE_WRONG_TYPE;
+		} catch (const std::exception& e) {
+			last_error = e.what();
+			return HYPERCACHE_ERROR;
+		}
+	}
+
+	vector<string_view> key_list(const char* const* keys, const size_t* key_sizes, size_t count) {
+		vector<string_view> list;
+		list.reserve(count);
+		for (size_t i = 0; i < count; i++) list.emplace_back(keys[i], key_sizes[i]);
+		return list;
+	}
+
+	hypercache_status visit_all(const vector<string>& members, hypercache_member_visitor visitor, void* context) {
+		for (const string& member : members) visitor(member.data(), member.size(), context);
+		return HYPERCACHE_OK;
+	}
+}
+
+extern "C" {
+	hypercache_cache* hypercache_open(size_t slots, size_t max_keys) {
+		try {
+			hypercache::CacheConfig config;
+			config.slots = slots;
+			config.max_keys = max_keys;
+			return new hypercache_cache{hypercache::Cache(config)};
+		} catch (const std::exception& e) {
+			last_error = e.what();
+			return nullptr;
+		}
+	}
+
+	void hypercache_close(hypercache_cache* cache) {
+		delete cache;
+	}
+
+	hypercache_status hypercache_get(hypercache_cache* cache, const char* key, size_t key_size, void* buffer, size_t capacity, size_t* size) {
+		return call([&] {
+			size_t total = 0;
+			const bool found = cache->cache.get(string_view(key, key_size), [&](const uint8_t* data, size_t count) {
+				if (count && total < capacity) memcpy(static_cast<uint8_t*>(buffer) + total, data, min(count, capacity - total));
+				total += count;
+			});
+			if (!found) return HYPERCACHE_NOT_FOUND;
+			if (size) *size = total;
+			return total > capacity ? HYPERCACHE_TRUNCATED : HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_set(hypercache_cache* cache, const char* key, size_t key_size, const void* value, size_t size, uint64_t ttl_ms) {
+		return call([&] {
+			cache->cache.set(string_view(key, key_size), string_view(static_cast<const char*>(value), size), chrono::milliseconds(ttl_ms));
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_del(hypercache_cache* cache, const char* key, size_t key_size) {
+		return call([&] {
+			cache->cache.del(string_view(key, key_size));
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_expire(hypercache_cache* cache, const char* key, size_t key_size, uint64_t ttl_ms) {
+		return call([&] {
+			return cache->cache.expire(string_view(key, key_size), chrono::milliseconds(ttl_ms)) ? HYPERCACHE_OK : HYPERCACHE_NOT_FOUND;
+		});
+	}
+
+	hypercache_status hypercache_incr(hypercache_cache* cache, const char* key, size_t key_size, int64_t delta, uint64_t* count) {
+		return call([&] {
+			const uint64_t result = cache->cache.incr(string_view(key, key_size), delta);
+			if (count) *count = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_group_add(hypercache_cache* cache, const char* key, size_t key_size, const char* member, size_t member_size, int* added) {
+		return call([&] {
+			const bool result = cache->cache.group_add(string_view(key, key_size), string_view(member, member_size));
+			if (added) *added = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_group_remove(hypercache_cache* cache, const char* key, size_t key_size, const char* member, size_t member_size, int* removed) {
+		return call([&] {
+			const bool result = cache->cache.group_remove(string_view(key, key_size), string_view(member, member_size));
+			if (removed) *removed = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_group_members(hypercache_cache* cache, const char* key, size_t key_size, hypercache_member_visitor visitor, void* context) {
+		return call([&] {
+			const bool found = cache->cache.group_members(string_view(key, key_size), [&](string_view member) {
+				visitor(member.data(), member.size(), context);
+			});
+			return found ? HYPERCACHE_OK : HYPERCACHE_NOT_FOUND;
+		});
+	}
+
+	hypercache_status hypercache_group_inter(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+		hypercache_member_visitor visitor, void* context) {
+		return call([&] { return visit_all(cache->cache.group_inter(key_list(keys, key_sizes, count)), visitor, context); });
+	}
+
+	hypercache_status hypercache_group_intercard(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+		size_t limit, size_t* cardinality) {
+		return call([&] {
+			const size_t result = cache->cache.group_intercard(key_list(keys, key_sizes, count), limit);
+			if (cardinality) *cardinality = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_group_union(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+		hypercache_member_visitor visitor, void* context) {
+		return call([&] { return visit_all(cache->cache.group_union(key_list(keys, key_sizes, count)), visitor, context); });
+	}
+
+	hypercache_status hypercache_group_diff(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+		hypercache_member_visitor visitor, void* context) {
+		return call([&] { return visit_all(cache->cache.group_diff(key_list(keys, key_sizes, count)), visitor, context); });
+	}
+
+	hypercache_status hypercache_save(hypercache_cache* cache, const char* path, size_t* keys) {
+		return call([&] {
+			const size_t result = cache->cache.save(path);
+			if (keys) *keys = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	hypercache_status hypercache_load(hypercache_cache* cache, const char* path, size_t* keys) {
+		return call([&] {
+			const size_t result = cache->cache.load(path);
+			if (keys) *keys = result;
+			return HYPERCACHE_OK;
+		});
+	}
+
+	const char* hypercache_error(void) {
+		return last_error.c_str();
+	}
+}
@@ -0,0 +1,150 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERCACHE_EMBEDDED_C_H
+#define HYPERCACHE_EMBEDDED_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * C ABI of HyperCache Embedded (see hypercache.hpp)
+ *
+ * Every function returns a hypercache_status, the message of the last failed call of the calling thread
+ * is returned by hypercache_error(). Keys and values are byte strings with an explicit size.
+ */
+
+typedef struct hypercache_cache hypercache_cache;
+
+typedef enum hypercache_status {
+	HYPERCACHE_OK = 0,
+	// The key does not exist
+	HYPERCACHE_NOT_FOUND = 1,
+	// The key holds a value of another type
+	HYPERCACHE_WRONG_TYPE = 2,
+	// The value does not fit into the buffer (the required size is returned)
+	HYPERCACHE_TRUNCATED = 3,
+	HYPERCACHE_ERROR = 4,
+} hypercache_status;
+
+/**
+ * Creates a cache with slots slots (power of two), inserts evict above max_keys keys (0 = 3/4 of the slots)
+ *
+ * Returns NULL on failure (see hypercache_error()).
+ */
+hypercache_cache* hypercache_open(size_t slots, size_t max_keys);
+
+/**
+ * Destroys the cache, no other call on the cache may be running
+ */
+void hypercache_close(hypercache_cache* cache);
+
+/**
+ * Copies the value of the key into buffer and sets size to the size of the value
+ *
+ * If the value is larger than capacity, the first capacity bytes are copied and HYPERCACHE_TRUNCATED is returned.
+ */
+hypercache_status hypercache_get(hypercache_cache* cache, const char* key, size_t key_size, void* buffer, size_t capacity, size_t* size);
+
+/**
+ * Sets the value of the key, the key expires after ttl_ms milliseconds (0 = never)
+ */
+hypercache_status hypercache_set(hypercache_cache* cache, const char* key, size_t key_size, const void* value, size_t size, uint64_t ttl_ms);
+
+hypercache_status hypercache_del(hypercache_cache* cache, const char* key, size_t key_size);
+
+/**
+ * Sets the key to expire after ttl_ms milliseconds (0 deletes the key)
+ */
+hypercache_status hypercache_expire(hypercache_cache* cache, const char* key, size_t key_size, uint64_t ttl_ms);
+
+/**
+ * Adds delta to the counter of the key and stores the new count in count (may be NULL)
+ */
+hypercache_status hypercache_incr(hypercache_cache* cache, const char* key, size_t key_size, int64_t delta, uint64_t* count);
+
+/**
+ * Receives a member of a group, the member is not NUL terminated and only valid during the call
+ */
+typedef void (*hypercache_member_visitor)(const char* member, size_t size, void* context);
+
+/**
+ * Adds the member to the group of the key, added is set to 1 if it was not a member yet (may be NULL)
+ */
+hypercache_status hypercache_group_add(hypercache_cache* cache, const char* key, size_t key_size, const char* member, size_t member_size, int* added);
+
+/**
+ * Removes the member from the group of the key, removed is set to 1 if it was a member (may be NULL)
+ */
+hypercache_status hypercache_group_remove(hypercache_cache* cache, const char* key, size_t key_size, const char* member, size_t member_size, int* removed);
+
+/**
+ * Calls visitor with every member of the group of the key
+ *
+ * The visitor runs while the group is locked, it must not call the cache.
+ */
+hypercache_status hypercache_group_members(hypercache_cache* cache, const char* key, size_t key_size, hypercache_member_visitor visitor, void* context);
+
+/**
+ * Group set operations on count keys (keys[i] has key_sizes[i] bytes), keys that do not exist are empty groups
+ *
+ * The visitor is called with every member of the result after the groups were unlocked.
+ */
+hypercache_status hypercache_group_inter(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+	hypercache_member_visitor visitor, void* context);
+
+/**
+ * Stores the number of members that are in all groups in cardinality, capped at limit (0 = no limit)
+ */
+hypercache_status hypercache_group_intercard(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+	size_t limit, size_t* cardinality);
+
+hypercache_status hypercache_group_union(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+	hypercache_member_visitor visitor, void* context);
+
+/**
+ * Visits the members of the first group that are in none of the other groups
+ */
+hypercache_status hypercache_group_diff(hypercache_cache* cache, const char* const* keys, const size_t* key_sizes, size_t count,
+	hypercache_member_visitor visitor, void* context);
+
+/**
+ * Writes a snapshot of the cache to path, the number of written keys is stored in keys (may be NULL)
+ */
+hypercache_status hypercache_save(hypercache_cache* cache, const char* path, size_t* keys);
+
+/**
+ * Loads the snapshot at path, the number of loaded keys is stored in keys (may be NULL)
+ */
+hypercache_status hypercache_load(hypercache_cache* cache, const char* path, size_t* keys);
+
+/**
+ * Returns the message of the last failed call of the calling thread (valid until the next call of the thread)
+ */
+const char* hypercache_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
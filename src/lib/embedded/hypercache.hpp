@@ -0,0 +1,172 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERCACHE_EMBEDDED_H
+#define HYPERCACHE_EMBEDDED_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/**
+ * HyperCache Embedded
+ *
+ * In-process cache with the storage engine of hypercache_db (HyperMap, DataChunks, expiry),
+ * for services that can not afford a network round trip per lookup. The C ABI of the same cache is in hypercache.h.
+ *
+ * The header only exposes standard types (the engine is hidden behind a pointer), so the API stays stable
+ * across changes of the engine. All operations are thread safe.
+ *
+ * The map has a fixed number of slots: once it holds max_keys keys, inserting a key evicts another one.
+ * Eviction samples a few random slots and removes the key that expires first (keys without expiry are removed last).
+ * Snapshots have the format of the server snapshots (see hypercache_db --snapshot), so they can be exchanged with server nodes.
+ */
+namespace hypercache {
+	/**
+	 * Configuration of a cache
+	 */
+	struct CacheConfig {
+		// Slots of the map (power of two), the map never grows
+		size_t slots = 1 << 20;
+		// Number of keys above which inserts evict (0 = 3/4 of the slots)
+		size_t max_keys = 0;
+		// Number of slots sampled per eviction
+		size_t eviction_samples = 5;
+	};
+
+	/**
+	 * Thrown if a key holds a value of another type than the operation expects
+	 */
+	class type_error : public runtime_error {
+	public:
+		using runtime_error::runtime_error;
+	};
+
+	/**
+	 * Cache holds the keys of one in-process map
+	 *
+	 * Values are byte strings (PROTO), counters (COUNT) or groups of keys (GROUP).
+	 * Operations throw a type_error if the key holds another type and a runtime_error on any other failure.
+	 */
+	class Cache {
+	public:
+		/**
+		 * Creates an empty cache, throws an invalid_argument if the slots are not a power of two
+		 */
+		explicit Cache(const CacheConfig& config = CacheConfig());
+		Cache(Cache&&) noexcept;
+		Cache& operator=(Cache&&) noexcept;
+		Cache(const Cache&) = delete;
+		Cache& operator=(const Cache&) = delete;
+		~Cache();
+
+		/**
+		 * Returns the value of the key (nullopt if the key does not exist)
+		 */
+		optional<string> get(string_view key);
+		/**
+		 * Streams the value of the key to the visitor (once per segment of the value), returns false if the key does not exist
+		 *
+		 * The value is pinned before the visitor is called, the visitor runs without any lock held.
+		 */
+		bool get(string_view key, const function<void(const uint8_t*, size_t)>& visitor);
+		/**
+		 * Sets the value of the key, the key expires after ttl (0 = never)
+		 */
+		void set(string_view key, string_view value, chrono::milliseconds ttl = chrono::milliseconds(0));
+		/**
+		 * Deletes the key
+		 */
+		void del(string_view key);
+		/**
+		 * Sets the key to expire after ttl, returns false if the key does not exist (a ttl <= 0 deletes the key)
+		 */
+		bool expire(string_view key, chrono::milliseconds ttl);
+		/**
+		 * Adds delta to the counter of the key and returns the new count (missing keys start at 0)
+		 */
+		uint64_t incr(string_view key, int64_t delta);
+		/**
+		 * Adds the member to the group of the key, returns false if it already is a member
+		 */
+		bool group_add(string_view key, string_view member);
+		/**
+		 * Removes the member from the group of the key, returns false if it is not a member
+		 */
+		bool group_remove(string_view key, string_view member);
+		/**
+		 * Returns the members of the group of the key (empty if the key does not exist)
+		 */
+		vector<string> group_members(string_view key);
+		/**
+		 * Calls the visitor with every member of the group of the key, returns false if the key does not exist
+		 *
+		 * The visitor runs while the group is read locked, it must not call the cache.
+		 */
+		bool group_members(string_view key, const function<void(string_view)>& visitor);
+		/**
+		 * Returns the members that are in all groups of the keys (keys that do not exist are empty groups)
+		 */
+		vector<string> group_inter(const vector<string_view>& keys);
+		/**
+		 * Returns the number of members that are in all groups of the keys, capped at limit (0 = no limit)
+		 */
+		size_t group_intercard(const vector<string_view>& keys, size_t limit = 0);
+		/**
+		 * Returns the members that are in any of the groups of the keys
+		 */
+		vector<string> group_union(const vector<string_view>& keys);
+		/**
+		 * Returns the members of the first group that are in none of the other groups
+		 */
+		vector<string> group_diff(const vector<string_view>& keys);
+
+		/**
+		 * Returns the number of keys (including expired keys that were not removed yet)
+		 */
+		size_t size() const;
+		/**
+		 * Returns the number of keys that were evicted
+		 */
+		uint64_t evictions() const;
+
+		/**
+		 * Writes a snapshot of the cache to path and returns the number of written keys
+		 */
+		size_t save(const string& path);
+		/**
+		 * Loads the snapshot at path and returns the number of loaded keys (existing keys are overwritten)
+		 */
+		size_t load(const string& path);
+
+	private:
+		struct Engine;
+		unique_ptr<Engine> engine;
+	};
+}
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERLZ_H
+#define HYPERLZ_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * HyperLZ
+ *
+ * Small LZ77 block codec used to compress DataChunk payloads.
+ *
+ * The produced blocks follow the LZ4 block format (token, literals, 16bit offset, matchlength),
+ * this allows clients to decompress passed through frames with any LZ4 block decoder.
+ * The compressor is a greedy single-pass matcher with a small hashtable, it trades ratio for speed.
+ *
+ * Blocks can optionally be compressed against a dictionary,
+ * the dictionary then logically precedes the block and matches can reference into it.
+ * The same dictionary must be provided on decompression.
+ */
+namespace hyperlz {
+	// Minimum length of a match
+	inline static constexpr size_t MIN_MATCH = 4;
+	// The last bytes of a block are always emitted as literals
+	inline static constexpr size_t LAST_LITERALS = 5;
+	// The last match must start at least this many bytes before the end of the block
+	inline static constexpr size_t MF_LIMIT = 12;
+	// Maximum distance a match can reference back
+	inline static constexpr size_t MAX_OFFSET = 65535;
+	// Number of bits used for the match finder hashtable
+	inline static constexpr unsigned TABLE_BITS = 12;
+
+	inline static uint32_t Read32(const uint8_t* p) {
+		uint32_t result;
+		memcpy(&result, p, sizeof(result));
+		return result;
+	}
+
+	inline static uint32_t HashSeq(uint32_t seq, unsigned bits) {
+		// Multiplicative hash (Knuth), takes the upper bits
+		return (seq * 2654435761U) >> (32 - bits);
+	}
+
+	/**
+	 * Returns the maximum compressed size of a block with "size" bytes
+	 */
+	inline size_t compress_bound(size_t size) {
+		return size + size / 255 + 16;
+	}
+
+	// Writes a literal or matchlength overflow (>= 15) in 255 byte steps
+	inline static uint8_t* WriteLen(uint8_t* op, size_t len) {
+		while (len >= 255) {
+			*op++ = 255;
+			len -= 255;
+		}
+		*op++ = static_cast<uint8_t>(len);
+		return op;
+	}
+
+	/**
+	 * Compresses the bytes base[start, end) into dst, bytes before start are used as dictionary
+	 *
+	 * The table must contain 1 << bits entries, already hashed dictionary positions must be inserted.
+	 *
+	 * Returns the compressed size or 0 if the block does not fit into dcap bytes.
+	 */
+	inline size_t compress_window(const uint8_t* base, size_t start, size_t end,
+																uint8_t* dst, size_t dcap, uint32_t* table, unsigned bits) {
+		uint8_t* op = dst;
+		uint8_t* const oend = dst + dcap;
+		size_t ip = start;
+		size_t anchor = start;
+
+		if (end - start >= MF_LIMIT + 1) {
+			const size_t mflimit = end - MF_LIMIT;
+			const size_t matchlimit = end - LAST_LITERALS;
+
+			while (ip < mflimit) {
+				const uint32_t seq = Read32(base + ip);
+				const uint32_t h = HashSeq(seq, bits);
+				const size_t ref_pos = table[h];
+				table[h] = static_cast<uint32_t>(ip);
+
+				if (ref_pos >= ip || ip - ref_pos > MAX_OFFSET || Read32(base + ref_pos) != seq) {
+					// Skip faster through incompressible data
+					ip += 1 + ((ip - anchor) >> 6);
+					continue;
+				}
+
+				size_t ref = ref_pos;
+				// Extend match backwards (never past the anchor)
+				while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1]) {
+					ip--;
+					ref--;
+				}
+				// Extend match forwards
+				size_t len = MIN_MATCH;
+				while (ip + len < matchlimit && base[ip + len] == base[ref + len]) len++;
+
+				const size_t lit = ip - anchor;
+				const size_t ml = len - MIN_MATCH;
+				// Token + literal overflow + literals + offset + matchlength overflow
+				if (static_cast<size_t>(oend - op) < 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1) return 0;
+
+				uint8_t* token = op++;
+				*token = static_cast<uint8_t>((lit < 15 ? lit : 15) << 4);
+				if (lit >= 15) op = WriteLen(op, lit - 15);
+				memcpy(op, base + anchor, lit);
+				op += lit;
+
+				const size_t off = ip - ref;
+				*op++ = static_cast<uint8_t>(off);
+				*op++ = static_cast<uint8_t>(off >> 8);
+
+				*token |= static_cast<uint8_t>(ml < 15 ? ml : 15);
+				if (ml >= 15) op = WriteLen(op, ml - 15);
+
+				ip += len;
+				anchor = ip;
+				// Insert a position inside the match, this improves the ratio of repetitive data
+				if (ip < mflimit) table[HashSeq(Read32(base + ip - 2), bits)] = static_cast<uint32_t>(ip - 2);
+			}
+		}
+
+		// Emit the remaining literals
+		const size_t lit = end - anchor;
+		if (static_cast<size_t>(oend - op) < 1 + lit / 255 + 1 + lit) return 0;
+		*op++ = static_cast<uint8_t>((lit < 15 ? lit : 15) << 4);
+		if (lit >= 15) op = WriteLen(op, lit - 15);
+		memcpy(op, base + anchor, lit);
+		op += lit;
+
+		return op - dst;
+	}
+
+	/**
+	 * Compresses src into dst
+	 *
+	 * Returns the compressed size or 0 if the block does not fit into dcap bytes.
+	 * Use compress_bound() to allocate a dst that is always large enough.
+	 */
+	inline size_t compress(const uint8_t* src, size_t size, uint8_t* dst, size_t dcap) {
+		uint32_t table[1 << TABLE_BITS] = {};
+		return compress_window(src, 0, size, dst, dcap, table, TABLE_BITS);
+	}
+
+	/**
+	 * Decompresses src into dst, dict must be the dictionary the block was compressed with (if any)
+	 *
+	 * Returns the decompressed size.
+	 *
+	 * Throws a runtime_error if the block is malformed or does not fit into dcap bytes.
+	 */
+	inline size_t decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dcap,
+													 const uint8_t* dict = nullptr, size_t dict_size = 0) {
+		size_t ip = 0;
+		size_t op = 0;
+
+		const auto read_len = [&](size_t len) {
+			uint8_t b;
+			do {
+				if (ip >= size) throw std::runtime_error("Malformed block: truncated length");
+				b = src[ip++];
+				len += b;
+			} while (b == 255);
+			return len;
+		};
+
+		while (true) {
+			if (ip >= size) throw std::runtime_error("Malformed block: missing token");
+			const uint8_t token = src[ip++];
+
+			size_t lit = token >> 4;
+			if (lit == 15) lit = read_len(lit);
+			if (lit > size - ip || lit > dcap - op) throw std::runtime_error("Malformed block: literal overflow");
+			memcpy(dst + op, src + ip, lit);
+			ip += lit;
+			op += lit;
+
+			// Last sequence only contains literals
+			if (ip == size) break;
+
+			if (size - ip < 2) throw std::runtime_error("Malformed block: truncated offset");
+			const size_t off = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+			ip += 2;
+			if (off == 0) throw std::runtime_error("Malformed block: zero offset");
+
+			size_t ml = token & 15;
+			if (ml == 15) ml = read_len(ml);
+			ml += MIN_MATCH;
+			if (ml > dcap - op) throw std::runtime_error("Malformed block: match overflow");
+
+			if (off > op) {
+				// Match starts inside the dictionary
+				const size_t back = off - op;
+				if (back > dict_size) throw std::runtime_error("Malformed block: offset out of range");
+				const size_t from_dict = ml < back ? ml : back;
+				memcpy(dst + op, dict + dict_size - back, from_dict);
+				op += from_dict;
+				ml -= from_dict;
+				if (ml == 0) continue;
+			}
+
+			const size_t ref = op - off;
+			if (off >= ml) {
+				memcpy(dst + op, dst + ref, ml);
+			} else {
+				// Overlapping match (e.g. runs), copy bytewise
+				for (size_t i = 0; i < ml; i++) dst[op + i] = dst[ref + i];
+			}
+			op += ml;
+		}
+		return op;
+	}
+}
+
+#endif
@@ -26,10 +26,17 @@
 
 #include <cstdint>
 #include <cstring>
+#include <random>
 #include <string>
+#include <string_view>
+#include <utility>
 
 #include <byteswap.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
 #undef PERMUTE3
 #define PERMUTE3(a, b, c) do { std::swap(a, b); std::swap(a, c); } while (0)
 
@@ -70,21 +77,21 @@ namespace hyperhash {
 		return h * 5 + 0xe6546b64;
 	}
 
-	inline static uint32_t Hash32Len13to24(const char *s, size_t len) {
+	inline static uint32_t Hash32Len13to24(const char *s, size_t len, uint32_t seed) {
 		uint32_t a = Fetch32(s - 4 + (len >> 1));
 		uint32_t b = Fetch32(s + 4);
 		uint32_t c = Fetch32(s + len - 8);
 		uint32_t d = Fetch32(s + (len >> 1));
 		uint32_t e = Fetch32(s);
 		uint32_t f = Fetch32(s + len - 4);
-		uint32_t h = static_cast<uint32_t>(len);
+		uint32_t h = static_cast<uint32_t>(len) ^ seed;
 
 		return fmix(Mur(f, Mur(e, Mur(d, Mur(c, Mur(b, Mur(a, h)))))));
 	}
 
-	inline static uint32_t Hash32Len0to4(const char *s, size_t len) {
+	inline static uint32_t Hash32Len0to4(const char *s, size_t len, uint32_t seed) {
 		uint32_t b = 0;
-		uint32_t c = 9;
+		uint32_t c = 9 ^ seed;
 		for (size_t i = 0; i < len; i++) {
 			signed char v = static_cast<signed char>(s[i]);
 			b = b * c1 + static_cast<uint32_t>(v);
@@ -93,26 +100,32 @@ namespace hyperhash {
 		return fmix(Mur(b, Mur(static_cast<uint32_t>(len), c)));
 	}
 
-	inline static uint32_t Hash32Len5to12(const char *s, size_t len) {
-		uint32_t a = static_cast<uint32_t>(len), b = a * 5, c = 9, d = b;
+	inline static uint32_t Hash32Len5to12(const char *s, size_t len, uint32_t seed) {
+		uint32_t a = static_cast<uint32_t>(len), b = a * 5, c = 9, d = b ^ seed;
 		a += Fetch32(s);
 		b += Fetch32(s + len - 4);
 		c += Fetch32(s + ((len >> 1) & 4));
 		return fmix(Mur(c, Mur(b, Mur(a, d))));
 	}
 	
-	inline uint32_t hash(const std::string& key) {
+	/**
+	 * 32-bit CityHash
+	 *
+	 * The seed is folded into the initial state, a seed of 0 produces the plain CityHash32 value.
+	 * This makes precomputed collisions seed dependent, but it is not a keyed hash (see SipHash13 for untrusted keys).
+	 */
+	inline uint32_t hash(const std::string& key, uint32_t seed) {
 		const char* s = key.c_str();
 		const size_t len = key.length();
 		
 		if (len <= 24) {
     return len <= 12 ?
-        (len <= 4 ? Hash32Len0to4(s, len) : Hash32Len5to12(s, len)) :
-        Hash32Len13to24(s, len);
+        (len <= 4 ? Hash32Len0to4(s, len, seed) : Hash32Len5to12(s, len, seed)) :
+        Hash32Len13to24(s, len, seed);
 		}
 
 		// len > 24
-		uint32_t h = static_cast<uint32_t>(len), g = c1 * h, f = g;
+		uint32_t h = static_cast<uint32_t>(len) ^ seed, g = c1 * h, f = g;
 		uint32_t a0 = Rotate32(Fetch32(s + len - 4) * c1, 17) * c2;
 		uint32_t a1 = Rotate32(Fetch32(s + len - 8) * c1, 17) * c2;
 		uint32_t a2 = Rotate32(Fetch32(s + len - 16) * c1, 17) * c2;
@@ -172,6 +185,393 @@ namespace hyperhash {
 		h = Rotate32(h, 17) * c1;
 		return h;
 	};
+
+	inline uint32_t hash(const std::string& key) {
+		return hash(key, 0);
+	};
+
+	// Some primes between 2^63 and 2^64 for 64-bit hashing.
+	inline static const uint64_t k0 = 0xc3a5c85c97cb3127ULL;
+	inline static const uint64_t k1 = 0xb492b66fbe98f273ULL;
+	inline static const uint64_t k2 = 0x9ae16a3b2f90404fULL;
+
+	inline static uint64_t Rotate64(uint64_t val, int shift) {
+		// Avoid shifting by 64: doing so yields an undefined result.
+		return shift == 0 ? val : ((val >> shift) | (val << (64 - shift)));
+	}
+
+	inline static uint64_t Fetch64(const char *p) {
+		uint64_t result;
+		memcpy(&result, p, sizeof(result));
+		return result;
+	}
+
+	inline static uint64_t ShiftMix(uint64_t val) {
+		return val ^ (val >> 47);
+	}
+
+	inline static uint64_t HashLen16(uint64_t u, uint64_t v, uint64_t mul) {
+		// Murmur-inspired hashing.
+		uint64_t a = (u ^ v) * mul;
+		a ^= (a >> 47);
+		uint64_t b = (v ^ a) * mul;
+		b ^= (b >> 47);
+		b *= mul;
+		return b;
+	}
+
+	inline static uint64_t HashLen16(uint64_t u, uint64_t v) {
+		return HashLen16(u, v, 0x9ddfea08eb382d69ULL);
+	}
+
+	inline static uint64_t Hash64Len0to16(const char *s, size_t len) {
+		if (len >= 8) {
+			uint64_t mul = k2 + len * 2;
+			uint64_t a = Fetch64(s) + k2;
+			uint64_t b = Fetch64(s + len - 8);
+			uint64_t c = Rotate64(b, 37) * mul + a;
+			uint64_t d = (Rotate64(a, 25) + b) * mul;
+			return HashLen16(c, d, mul);
+		}
+		if (len >= 4) {
+			uint64_t mul = k2 + len * 2;
+			uint64_t a = Fetch32(s);
+			return HashLen16(len + (a << 3), Fetch32(s + len - 4), mul);
+		}
+		if (len > 0) {
+			uint8_t a = static_cast<uint8_t>(s[0]);
+			uint8_t b = static_cast<uint8_t>(s[len >> 1]);
+			uint8_t c = static_cast<uint8_t>(s[len - 1]);
+			uint32_t y = static_cast<uint32_t>(a) + (static_cast<uint32_t>(b) << 8);
+			uint32_t z = static_cast<uint32_t>(len) + (static_cast<uint32_t>(c) << 2);
+			return ShiftMix(y * k2 ^ z * k0) * k2;
+		}
+		return k2;
+	}
+
+	inline static uint64_t Hash64Len17to32(const char *s, size_t len) {
+		uint64_t mul = k2 + len * 2;
+		uint64_t a = Fetch64(s) * k1;
+		uint64_t b = Fetch64(s + 8);
+		uint64_t c = Fetch64(s + len - 8) * mul;
+		uint64_t d = Fetch64(s + len - 16) * k2;
+		return HashLen16(Rotate64(a + b, 43) + Rotate64(c, 30) + d,
+										 a + Rotate64(b + k2, 18) + c, mul);
+	}
+
+	// Return a 16-byte hash for 48 bytes.  Quick and dirty.
+	inline static std::pair<uint64_t, uint64_t> WeakHashLen32WithSeeds(uint64_t w, uint64_t x, uint64_t y, uint64_t z, uint64_t a, uint64_t b) {
+		a += w;
+		b = Rotate64(b + a + z, 21);
+		uint64_t c = a;
+		a += x;
+		a += y;
+		b += Rotate64(a, 44);
+		return std::make_pair(a + z, b + c);
+	}
+
+	// Return a 16-byte hash for s[0] ... s[31], a, and b.  Quick and dirty.
+	inline static std::pair<uint64_t, uint64_t> WeakHashLen32WithSeeds(const char* s, uint64_t a, uint64_t b) {
+		return WeakHashLen32WithSeeds(Fetch64(s), Fetch64(s + 8), Fetch64(s + 16), Fetch64(s + 24), a, b);
+	}
+
+	inline static uint64_t Hash64Len33to64(const char *s, size_t len) {
+		uint64_t mul = k2 + len * 2;
+		uint64_t a = Fetch64(s) * k2;
+		uint64_t b = Fetch64(s + 8);
+		uint64_t c = Fetch64(s + len - 24);
+		uint64_t d = Fetch64(s + len - 32);
+		uint64_t e = Fetch64(s + 16) * k2;
+		uint64_t f = Fetch64(s + 24) * 9;
+		uint64_t g = Fetch64(s + len - 8);
+		uint64_t h = Fetch64(s + len - 16) * mul;
+		uint64_t u = Rotate64(a + g, 43) + (Rotate64(b, 30) + c) * 9;
+		uint64_t v = ((a + g) ^ d) + f + 1;
+		uint64_t w = bswap_64((u + v) * mul) + h;
+		uint64_t x = Rotate64(e + f, 42) + c;
+		uint64_t y = (bswap_64((v + w) * mul) + g) * mul;
+		uint64_t z = e + f + c;
+		a = bswap_64((x + z) * mul + y) + b;
+		b = ShiftMix((z + a) * mul + d + h) * mul;
+		return b + x;
+	}
+
+	/**
+	 * 64-bit CityHash
+	 *
+	 * Used by maps that exceed 2^32 buckets or derive shards from the high bits of the hash.
+	 */
+	inline uint64_t hash64(std::string_view key) {
+		const char* s = key.data();
+		size_t len = key.length();
+
+		if (len <= 32) {
+			if (len <= 16) {
+				return Hash64Len0to16(s, len);
+			} else {
+				return Hash64Len17to32(s, len);
+			}
+		} else if (len <= 64) {
+			return Hash64Len33to64(s, len);
+		}
+
+		// For strings over 64 bytes we hash the end first, and then as we
+		// loop we keep 56 bytes of state: v, w, x, y, and z.
+		uint64_t x = Fetch64(s + len - 40);
+		uint64_t y = Fetch64(s + len - 16) + Fetch64(s + len - 56);
+		uint64_t z = HashLen16(Fetch64(s + len - 48) + len, Fetch64(s + len - 24));
+		std::pair<uint64_t, uint64_t> v = WeakHashLen32WithSeeds(s + len - 64, len, z);
+		std::pair<uint64_t, uint64_t> w = WeakHashLen32WithSeeds(s + len - 32, y + k1, x);
+		x = x * k1 + Fetch64(s);
+
+		// Decrease len to the nearest multiple of 64, and operate on 64-byte chunks.
+		len = (len - 1) & ~static_cast<size_t>(63);
+		do {
+			x = Rotate64(x + y + v.first + Fetch64(s + 8), 37) * k1;
+			y = Rotate64(y + v.second + Fetch64(s + 48), 42) * k1;
+			x ^= w.second;
+			y += v.first + Fetch64(s + 40);
+			z = Rotate64(z + w.first, 33) * k1;
+			v = WeakHashLen32WithSeeds(s, v.second * k1, x + w.first);
+			w = WeakHashLen32WithSeeds(s + 32, z + y, y + Fetch64(s + 16));
+			std::swap(z, x);
+			s += 64;
+			len -= 64;
+		} while (len != 0);
+		return HashLen16(HashLen16(v.first, w.first) + ShiftMix(y) * k1 + z,
+										 HashLen16(v.second, w.second) + x);
+	};
+
+	/**
+	 * 64-bit CityHash with seed (CityHash64WithSeed)
+	 */
+	inline uint64_t hash64(std::string_view key, uint64_t seed) {
+		return HashLen16(hash64(key) - k2, seed);
+	};
+
+	// A 64-bit to 64-bit integer hash copied from Murmur3.
+	inline static uint64_t fmix64(uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// CRC32C (Castagnoli) lookup table for the software fallback.
+	struct Crc32cTable {
+		uint32_t t[256];
+		constexpr Crc32cTable() : t() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t crc = i;
+				for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+				t[i] = crc;
+			}
+		}
+	};
+	inline static constexpr Crc32cTable crc32c_table{};
+
+	inline static uint32_t Crc32cSoft(uint32_t crc, const char *s, size_t len) {
+		for (size_t i = 0; i < len; i++)
+			crc = crc32c_table.t[(crc ^ static_cast<uint8_t>(s[i])) & 0xff] ^ (crc >> 8);
+		return crc;
+	}
+
+	inline static uint32_t Crc32cSoft32(uint32_t crc, uint32_t val) {
+		char bytes[sizeof(val)];
+		memcpy(bytes, &val, sizeof(val));
+		return Crc32cSoft(crc, bytes, sizeof(bytes));
+	}
+
+	// Both CRC lanes are combined with the length and finalized with fmix64, CRC alone does not mix high bits.
+	inline static uint64_t Crc32cFinalize(uint32_t a, uint32_t b, size_t len) {
+		return fmix64(((static_cast<uint64_t>(a) << 32) | b) ^ (len * k2));
+	}
+
+	// Packs the first, middle and last byte of short keys (like Hash64Len0to16)
+	inline static uint32_t Crc32cShortKey(const char *s, size_t len) {
+		return static_cast<uint32_t>(static_cast<uint8_t>(s[0])) |
+			static_cast<uint32_t>(static_cast<uint8_t>(s[len >> 1])) << 8 |
+			static_cast<uint32_t>(static_cast<uint8_t>(s[len - 1])) << 16;
+	}
+
+	/**
+	 * The key is processed in two 8 byte lanes, the remaining 1-16 bytes are read with overlapping loads.
+	 * Software and hardware variants process exactly the same bytes.
+	 */
+	inline static uint64_t HashCrc32cSoft(const char *s, size_t len, uint64_t seed) {
+		const size_t total = len;
+		uint32_t a = static_cast<uint32_t>(k0 ^ seed);
+		uint32_t b = static_cast<uint32_t>(k1 ^ (seed >> 32));
+		while (len > 16) {
+			a = Crc32cSoft(a, s, 8);
+			b = Crc32cSoft(b, s + 8, 8);
+			s += 16;
+			len -= 16;
+		}
+		if (len >= 8) {
+			a = Crc32cSoft(a, s, 8);
+			b = Crc32cSoft(b, s + len - 8, 8);
+		} else if (len >= 4) {
+			a = Crc32cSoft(a, s, 4);
+			b = Crc32cSoft(b, s + len - 4, 4);
+		} else if (len > 0) {
+			b = Crc32cSoft32(b, Crc32cShortKey(s, len));
+		}
+		return Crc32cFinalize(a, b, total);
+	}
+
+#if defined(__x86_64__)
+	// Hardware CRC32C (SSE4.2), produces the same value as the software fallback.
+	__attribute__((target("sse4.2")))
+	inline static uint64_t HashCrc32cHard(const char *s, size_t len, uint64_t seed) {
+		const size_t total = len;
+		uint64_t a = static_cast<uint32_t>(k0 ^ seed);
+		uint64_t b = static_cast<uint32_t>(k1 ^ (seed >> 32));
+		while (len > 16) {
+			a = _mm_crc32_u64(a, Fetch64(s));
+			b = _mm_crc32_u64(b, Fetch64(s + 8));
+			s += 16;
+			len -= 16;
+		}
+		if (len >= 8) {
+			a = _mm_crc32_u64(a, Fetch64(s));
+			b = _mm_crc32_u64(b, Fetch64(s + len - 8));
+		} else if (len >= 4) {
+			a = _mm_crc32_u32(static_cast<uint32_t>(a), Fetch32(s));
+			b = _mm_crc32_u32(static_cast<uint32_t>(b), Fetch32(s + len - 4));
+		} else if (len > 0) {
+			b = _mm_crc32_u32(static_cast<uint32_t>(b), Crc32cShortKey(s, len));
+		}
+		return Crc32cFinalize(static_cast<uint32_t>(a), static_cast<uint32_t>(b), total);
+	}
+#endif
+
+	/**
+	 * Returns true if the CPU supports hardware CRC32C, detected once at startup
+	 */
+	inline bool has_hw_crc32c() noexcept {
+#if defined(__x86_64__)
+		static const bool supported = __builtin_cpu_supports("sse4.2");
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * CRC32C based 64-bit hash
+	 *
+	 * Uses the hardware CRC32C instruction if the CPU supports it (runtime detected), else a table based fallback.
+	 * Both paths produce the same values.
+	 *
+	 * The seed initializes the CRC lanes. CRC is linear, so collisions are easy to construct regardless of the seed,
+	 * do not use this hash for untrusted keys.
+	 */
+	inline uint64_t hash_crc32c(const std::string& key, uint64_t seed = 0) {
+#if defined(__x86_64__)
+		if (has_hw_crc32c()) return HashCrc32cHard(key.c_str(), key.length(), seed);
+#endif
+		return HashCrc32cSoft(key.c_str(), key.length(), seed);
+	}
+
+	inline static void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+		v0 += v1; v1 = Rotate64(v1, 64 - 13); v1 ^= v0; v0 = Rotate64(v0, 64 - 32);
+		v2 += v3; v3 = Rotate64(v3, 64 - 16); v3 ^= v2;
+		v0 += v3; v3 = Rotate64(v3, 64 - 21); v3 ^= v0;
+		v2 += v1; v1 = Rotate64(v1, 64 - 17); v1 ^= v2; v2 = Rotate64(v2, 64 - 32);
+	}
+
+	/**
+	 * SipHash with C compression and D finalization rounds, keyed with k0 and k1
+	 */
+	template <int C, int D>
+	inline uint64_t siphash(const char *s, size_t len, uint64_t k0, uint64_t k1) {
+		uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+		uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+		uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+		uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+		const char* end = s + (len & ~static_cast<size_t>(7));
+		for (; s != end; s += 8) {
+			const uint64_t m = Fetch64(s);
+			v3 ^= m;
+			for (int i = 0; i < C; i++) SipRound(v0, v1, v2, v3);
+			v0 ^= m;
+		}
+
+		uint64_t b = static_cast<uint64_t>(len) << 56;
+		for (size_t i = 0; i < (len & 7); i++)
+			b |= static_cast<uint64_t>(static_cast<uint8_t>(s[i])) << (8 * i);
+		v3 ^= b;
+		for (int i = 0; i < C; i++) SipRound(v0, v1, v2, v3);
+		v0 ^= b;
+
+		v2 ^= 0xff;
+		for (int i = 0; i < D; i++) SipRound(v0, v1, v2, v3);
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+
+	/**
+	 * Returns a new random 64-bit seed
+	 */
+	inline uint64_t random_seed() {
+		std::random_device rd;
+		return (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+
+	/**
+	 * Per-process random seed, generated once on first use
+	 */
+	inline uint64_t process_seed() {
+		static const uint64_t seed = random_seed();
+		return seed;
+	}
+
+	/**
+	 * Per-process secret key half used for keyed hashing, generated once on first use
+	 */
+	inline uint64_t process_key() {
+		static const uint64_t key = random_seed();
+		return key;
+	}
+
+	/**
+	 * Hash policies for HyperMap
+	 *
+	 * A policy provides the hash_type and a static hash() function that folds the seed of the map into the hash.
+	 * The hash_type determines the maximum amount of buckets the map can address.
+	 */
+	struct City32 {
+		using hash_type = uint32_t;
+		static hash_type hash(const std::string& key, uint64_t seed) {
+			return hyperhash::hash(key, static_cast<uint32_t>(seed ^ (seed >> 32)));
+		};
+	};
+
+	struct City64 {
+		using hash_type = uint64_t;
+		static hash_type hash(const std::string& key, uint64_t seed) { return hyperhash::hash64(key, seed); };
+	};
+
+	struct Crc32c {
+		using hash_type = uint64_t;
+		static hash_type hash(const std::string& key, uint64_t seed) { return hyperhash::hash_crc32c(key, seed); };
+	};
+
+	/**
+	 * Keyed hash policy (SipHash-1-3)
+	 *
+	 * The key consists of the map seed and the secret process_key(), collisions can not be precomputed
+	 * without knowing both. Use this policy for maps with keys controlled by untrusted clients.
+	 */
+	struct SipHash13 {
+		using hash_type = uint64_t;
+		static hash_type hash(const std::string& key, uint64_t seed) {
+			return hyperhash::siphash<1, 3>(key.c_str(), key.length(), seed, process_key());
+		};
+	};
 }
 
 #endif
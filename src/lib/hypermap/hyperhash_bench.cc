@@ -0,0 +1,93 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark for the HyperMap hash policies.
+ *
+ * Measures the hash throughput per key length bucket, the buckets match the branches of the 32-bit hash
+ * (Hash32Len0to4, Hash32Len5to12, Hash32Len13to24 and the loop for longer keys).
+ *
+ * Policies are run with the process seed, the sip13 policy is the keyed hash recommended for untrusted keys.
+ *
+ * Output is CSV: policy,min_len,max_len,ns_per_hash,mb_per_s
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lib/hypermap/hyperhash.hpp"
+
+using namespace std;
+
+namespace {
+	struct Bucket {
+		size_t min_len;
+		size_t max_len;
+	};
+
+	constexpr Bucket buckets[] = {{0, 4}, {5, 12}, {13, 24}, {25, 128}};
+	constexpr size_t key_count = 4096;
+	constexpr size_t rounds = 512;
+
+	vector<string> make_keys(const Bucket& bucket, mt19937_64& rng) {
+		vector<string> keys(key_count);
+		for (auto& key : keys) {
+			const size_t len = bucket.min_len + rng() % (bucket.max_len - bucket.min_len + 1);
+			for (size_t i = 0; i < len; i++) key.push_back(static_cast<char>('!' + rng() % 94));
+		}
+		return keys;
+	}
+
+	template <typename Hash_T>
+	void run(const char* name, const Bucket& bucket, const vector<string>& keys) {
+		size_t bytes = 0;
+		for (const auto& key : keys) bytes += key.size();
+
+		const uint64_t seed = hyperhash::process_seed();
+		// Results are accumulated, so that the compiler can not drop the hash calls
+		uint64_t sink = 0;
+		const auto start = chrono::steady_clock::now();
+		for (size_t r = 0; r < rounds; r++) {
+			for (const auto& key : keys) sink += Hash_T::hash(key, seed);
+		}
+		const double ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+
+		const double hashes = static_cast<double>(keys.size() * rounds);
+		printf("%s,%zu,%zu,%.2f,%.1f\n", name, bucket.min_len, bucket.max_len,
+					 ns / hashes, (bytes * rounds) / (ns / 1e9) / 1e6);
+		if (sink == 42) fprintf(stderr, "\n");
+	}
+}
+
+int main() {
+	mt19937_64 rng(42);
+	printf("policy,min_len,max_len,ns_per_hash,mb_per_s\n");
+	for (const auto& bucket : buckets) {
+		const vector<string> keys = make_keys(bucket, rng);
+		run<hyperhash::City32>("city32", bucket, keys);
+		run<hyperhash::City64>("city64", bucket, keys);
+		run<hyperhash::Crc32c>(hyperhash::has_hw_crc32c() ? "crc32c_hw" : "crc32c_sw", bucket, keys);
+		run<hyperhash::SipHash13>("sip13", bucket, keys);
+	}
+	return 0;
+}
@@ -22,19 +22,34 @@
 
 #include <chrono>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <variant>
+#include <vector>
 #include <functional>
 #include <atomic>
+#include <limits>
+#include <bit>
 
 #include "hyperhash.hpp"
+#include "hyperstats.hpp"
 
 using namespace std;
 
 namespace hypermap {
+	/**
+	 * Thrown by SlotOperator::access if the slot value is not of the requested type
+	 */
+	class type_mismatch : public runtime_error {
+	public:
+		using runtime_error::runtime_error;
+	};
+
 	/**
 	 * Visitor to return the basepointer from the derived variant
 	 */
@@ -45,31 +60,98 @@ namespace hypermap {
 			return static_cast<Base_T*>(&t);
 		}
 	};
-	
+
+	/**
+	 * Acquires a slot lock, the lock must be constructed with defer_lock
+	 *
+	 * If HYPERMAP_LOCK_STATS is defined, contended acquisitions are recorded by the LockProfiler.
+	 * The key is only read after the lock is acquired.
+	 */
+	template <typename Lock_T>
+	inline void lock_slot(Lock_T& lock, [[maybe_unused]] LockKind kind, [[maybe_unused]] const string& key) {
+#ifdef HYPERMAP_LOCK_STATS
+		LockProfiler::global().acquire(lock, kind, key);
+#else
+		lock.lock();
+#endif
+	}
+
+	/**
+	 * Returns the slot lock statistics of all maps in the process
+	 *
+	 * Only recorded if HYPERMAP_LOCK_STATS is defined, otherwise the snapshot is empty (enabled = false).
+	 */
+	inline LockSnapshot lock_stats() {
+#ifdef HYPERMAP_LOCK_STATS
+		return LockProfiler::global().snapshot();
+#else
+		return LockSnapshot();
+#endif
+	}
+
+	/**
+	 * State of a HyperSlot
+	 *
+	 * Deleted slots are kept as tombstones, so that probe sequences running over them are not interrupted.
+	 * Tombstones are reused by inserts and cleared on rehash.
+	 */
+	enum SlotState : uint8_t {
+		EMPTY = 0,
+		USED = 1,
+		DELETED = 2
+	};
+
 	/**
 	 * Key-Value datastructure for each slot
 	 */
 	template <typename T>
 	class HyperSlot {
 	public:
+		HyperSlot() = default;
 		/**
-		 * Atom_Id indicating the state of the slot, if the slot is deleted / updated the id is incremented
+		 * Copies the data of the slot, locks and the atom_id are not copied
+		 */
+		HyperSlot& operator=(const HyperSlot& other) {
+			if (this != &other) {
+				state.store(other.state.load(memory_order_relaxed), memory_order_relaxed);
+				tag.store(other.tag.load(memory_order_relaxed), memory_order_relaxed);
+				key = other.key;
+				val = other.val;
+				time_point = other.time_point;
+				time_duration = other.time_duration;
+			}
+			return *this;
+		};
+
+		/**
+		 * Atom_Id indicating the state of the slot, if the slot is deleted / moved the id is incremented
 		 * this will invalidate all SlotOperators that were bound to the state before.
 		 *
-		 * This is a atomic value.
+		 * This is a atomic value. It is 64 bit wide, so it can not wrap around
+		 * and a stale SlotOperator / SlotHandle can never match a reused slot again.
 		 */
-		atomic<uint_fast16_t> atom_id = 0;
+		atomic<uint64_t> atom_id = 0;
 		/**
 		 * Val_Lock is a shared_lock that is used for operations on the value (val) of this Slot.
 		 *
 		 * It is also a crucial part of the memory management strategy, as the val is only changed
 		 * when this lock is fully (uniquely) locked.
 		 */
-		const shared_mutex val_lock;
+		mutable shared_mutex val_lock;
 		/**
 		 * Meta_Lock is a shared_lock that is used for metadata (all others then val) operations at this Slot.
 		 */
-		const shared_mutex meta_lock;
+		mutable shared_mutex meta_lock;
+		/**
+		 * State of the slot (empty, used or deleted)
+		 *
+		 * State and tag are only written while the meta_lock is unique, but they are read without lock by probe.
+		 */
+		atomic<SlotState> state = EMPTY;
+		/**
+		 * Tag of the key hash (see BasicHyperMap::tag_of), probe only compares keys of slots with a matching tag
+		 */
+		atomic<uint32_t> tag = 0;
 		/**
 		 * Key is the primary identifier of the slot
 		 */
@@ -79,18 +161,37 @@ namespace hypermap {
 		 */
 		T val;
 		/**
-		 * Time_Point is a timestamp of the last update to the slot
+		 * Time_Point is the timestamp the expiry of the slot was set at (see BasicHyperMap::expire)
 		 *
-		 * TODO: I'm still not really sure how to implement this,
-		 * I could just set the timestamp on Slot updates, but then it will be hard to
-		 * reorganize data between Shards/Replicas.
-		 * Setting the time on every write is very inefficient so I dont really know.
+		 * Time_Point and Time_Duration are metadata, they are protected by the meta_lock.
 		 */
 		chrono::system_clock::time_point time_point;
 		/**
-		 * Time_Duration is the duration until the slot is deleted
+		 * Time_Duration is the duration after time_point until the slot is deleted (0 = the slot does not expire)
 		 */
-		chrono::system_clock::duration time_duration;
+		chrono::system_clock::duration time_duration{0};
+	};
+
+	/**
+	 * Handle that identifies a slot state without the key
+	 *
+	 * The handle consists of the slot index and the atom_id of the slot at the time the handle was created.
+	 * It can be resolved without hashing / probing (see BasicHyperMap::resolve), once the slot is deleted
+	 * or moved by a rehash, the atom_id no longer matches and the resolved SlotOperator is invalid.
+	 * Overwriting the value of the key (set) keeps the handle valid.
+	 */
+	struct SlotHandle {
+		static constexpr uint64_t npos = numeric_limits<uint64_t>::max();
+
+		uint64_t index = npos;
+		uint64_t atom_id = 0;
+
+		/**
+		 * Returns true if the handle was bound to a slot (it may be stale)
+		 */
+		explicit operator bool() const noexcept {
+			return index != npos;
+		};
 	};
 
 	/**
@@ -101,13 +202,18 @@ namespace hypermap {
 	 * First argument of the read and write functions can be used to access the base_ptr to the datachunk.
 	 *
 	 * The DataChunk pointer may not be used outside the implemented and controlled functions, this is a crucial part of the memory management strategy.
+	 *
+	 * A SlotOperator that was returned for a missing key is not bound to a slot, read and write will always return false.
 	 */
 	template <typename Base_T, typename Slot_T>
 	class SlotOperator {
 	public:
-		SlotOperator<Base_T, Slot_T>(const HyperSlot<Slot_T>* slot) {
-			slot_ptr = slot;
-			operator_id = slot_ptr->atom_id;
+		SlotOperator(HyperSlot<Slot_T>* slot, uint64_t id) : slot_ptr(slot), operator_id(id) {};
+		/**
+		 * Returns true if the operator is bound to a slot
+		 */
+		explicit operator bool() const noexcept {
+			return slot_ptr != nullptr;
 		};
 		/**
 		 * Call read, to read the value from Slot
@@ -118,16 +224,36 @@ namespace hypermap {
 		 *
 		 * IMPORTANT: DO NOT USE THE BASE_PTR OUTSIDE OF THIS CALLBACK
 		 */
-		bool read(function<void(const Base_T*)> callback) {
-			// Only execute if slot_id == operator_id
+		bool read(function<void(const Base_T*)> callback) const {
+			if (!slot_ptr) return false;
+
+			shared_lock<shared_mutex> lock(slot_ptr->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot_ptr->key);
+			// Only execute if slot_id == operator_id (checked under the lock, the id is only changed while the lock is unique)
 			if (slot_ptr->atom_id!=operator_id) return false;
-			
-			const shared_lock<shared_mutex> lock(*slot_ptr->lock);
 			// Ptr is safe, because when mutating, unique lock is enabled (which blocks the shared locks)
 			const Base_T* data_ptr = visit(BaseVisitor<const Base_T>{}, slot_ptr->val);
 			callback(data_ptr);
 			return true;
 		};
+		/**
+		 * Call read_lock, to hold the shared val_lock beyond a callback (e.g. to lock several slots in a loop)
+		 *
+		 * Returns the held lock and sets data to the value of the slot,
+		 * if the SlotOperator is invalid an empty lock is returned and data is set to nullptr.
+		 *
+		 * IMPORTANT: DO NOT USE THE BASE_PTR AFTER THE LOCK IS RELEASED
+		 */
+		shared_lock<shared_mutex> read_lock(const Base_T*& data) const {
+			data = nullptr;
+			if (!slot_ptr) return {};
+
+			shared_lock<shared_mutex> lock(slot_ptr->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot_ptr->key);
+			if (slot_ptr->atom_id!=operator_id) return {};
+			data = visit(BaseVisitor<const Base_T>{}, slot_ptr->val);
+			return lock;
+		};
 		/**
 		 * Call write, to write to the value from Slot
 		 *
@@ -137,19 +263,46 @@ namespace hypermap {
 		 *
 		 * IMPORTANT: DO NOT USE THE BASE_PTR OUTSIDE OF THIS CALLBACK
 		 */
-		bool write(function<void(Base_T*)> callback) {
+		bool write(function<void(Base_T*)> callback) const {
+			if (!slot_ptr) return false;
+
+			unique_lock<shared_mutex> lock(slot_ptr->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot_ptr->key);
 			// Only execute if slot_id == operator_id
-			if (slot_ptr->id!=operator_id) return false;
-			
-			const unique_lock<shared_mutex> lock(*slot_ptr);
+			if (slot_ptr->atom_id!=operator_id) return false;
 			// Ptr is safe, because unique lock is enabled
 			Base_T* data_ptr = visit(BaseVisitor<Base_T>{}, slot_ptr->val);
 			callback(data_ptr);
 			return true;
 		};
+		/**
+		 * Call access, to operate on the value as "Derived_T" while only the shared val_lock is held
+		 *
+		 * This is intended for types that synchronize their operations internally (e.g. the atomic CountChunk),
+		 * operations on the same slot run in parallel. The callback is called directly (no function wrapper / virtual dispatch).
+		 *
+		 * Function will return false if the SlotOperator is invalid (Slot has been changed)
+		 *
+		 * Throws a type_mismatch if the slot value is not of type "Derived_T"
+		 *
+		 * IMPORTANT: DO NOT USE THE PTR OUTSIDE OF THIS CALLBACK
+		 */
+		template <typename Derived_T, typename Func_T>
+		bool access(Func_T&& callback) const {
+			if (!slot_ptr) return false;
+
+			shared_lock<shared_mutex> lock(slot_ptr->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot_ptr->key);
+			if (slot_ptr->atom_id!=operator_id) return false;
+			// The variant is only reassigned while the lock is unique, so the alternative can not change here
+			Derived_T* data_ptr = get_if<Derived_T>(&slot_ptr->val);
+			if (!data_ptr) throw type_mismatch("DataChunk is not of the requested type");
+			callback(data_ptr);
+			return true;
+		};
 	private:
-		const HyperSlot<Slot_T>* slot_ptr;
-		const uint32_t operator_id;
+		HyperSlot<Slot_T>* slot_ptr;
+		uint64_t operator_id;
 	};
 
 	/**
@@ -161,13 +314,15 @@ namespace hypermap {
 	 *
 	 * Usage:
 	 *
-	 * HyperMap template requires a "Base_T" type as first template argument and a list of "Derived_T" types as second argument.
+	 * BasicHyperMap template requires a hash policy "Hash_T" as first template argument (see hyperhash.hpp),
+	 * a "Base_T" type as second template argument and a list of "Derived_T" types as third argument.
+	 * HyperMap is an alias that uses the CityHash32 policy (hyperhash::City32).
 	 * The "Base_T" type must be the base class for the "Derived_T" types.
 	 * System works like this: Every HyperSlot (bucket) can be set to one of the derived types, you can change the types in the slot
 	 * at runtime by calling hypermap.set("key", ...).
 	 *
 	 * The hypermap.get("key") function will return a SlotOperator. SlotOperators allow safe access to the HyperSlots value.
-	 * If a HyperSlot value type is changed, the SlotOperator will automatically invalidate to ensure memory safety.
+	 * If a HyperSlot is deleted or moved, the SlotOperator will automatically invalidate to ensure memory safety.
 	 *
 	 * SlotOperator operations are memory and threadsafe as long as the Map exists.
 	 *
@@ -182,14 +337,30 @@ namespace hypermap {
 	 * HyperSlots are allocated in a continuous block of memory, values are stored directly inlined to the HyperSlot block,
 	 * this allows operations without any memory allocation call. The continuous memory block can also highly improve CPU cache hits.
 	 *
+	 * Probing reads the state and the hash tag of the slots without locking, keys are only compared under the shared meta_lock
+	 * of slots with a matching tag (usually only the slot of the key). Inserts of new keys are serialized per hash stripe,
+	 * so that the same key can not be claimed in two slots.
+	 *
 	 * The HyperMap may not be destructed or moved while operations from other threads still access the old map; this is unsafe and will result in undefined behavior.
 	 *
 	 * HyperMap takes the dangerous memory strategy, in order to provide high performance.
 	 *
 	 *
+	 * Hash flooding protection:
+	 *
+	 * Every map folds a seed into the hash (by default the random hyperhash::process_seed()),
+	 * use the hyperhash::SipHash13 policy if the keys are controlled by untrusted clients.
+	 * If an insert has to probe over more then "max_probe" slots of other keys while the map is less then 3/4 loaded,
+	 * the map assumes that the keys were crafted to collide and rehashes all slots with a new random seed
+	 * (at most once per second). Rehashing invalidates all SlotOperators of moved slots.
+	 * Tombstones are not counted (they are caused by churn, not by collisions), the owner of the map clears them
+	 * with rehash() once stats().tombstone_factor gets too high.
+	 *
+	 *
 	 * Considerations:
 	 *
 	 * - The "mapsize" MUST be a power of two, this is required for correct hash-trimming. Initialization will throw an invalid_argument error if it's not.
+	 * - The "mapsize" can not exceed the range of the policies hash_type (e.g. 2^32 buckets for hyperhash::City32).
 	 * - HyperMap will preallocate "mapsize" buckets that are all sized like the largest type in "Derived_T".
 	 * - The size of the map is immutable, the performance of the map will starve if the load is too high.
 	 * - Map synchronisation and memory management heavily relies on the fact that the map and the slots are immutable and exist over the lifetime of the app.
@@ -197,123 +368,137 @@ namespace hypermap {
 	 * - All "Derived_T" types / their members must implement correct copy/move semantics (just so that the type can be deep copied and moved with "=")
 	 *
 	 */
-	template <typename Base_T, typename... Derived_T>
-	class HyperMap {
+	template <typename Hash_T, typename Base_T, typename... Derived_T>
+	class BasicHyperMap {
 	public:
-		HyperMap(uint16_t mapsize) {
+		using hash_type = typename Hash_T::hash_type;
+		using slot_type = HyperSlot<variant<Derived_T...>>;
+		using operator_type = SlotOperator<Base_T, variant<Derived_T...>>;
+
+		// Default number of probed slots of other keys that triggers the defensive rehash
+		static constexpr size_t default_max_probe = 64;
+
+		BasicHyperMap(size_t mapsize, uint64_t hash_seed = hyperhash::process_seed()) {
 			// Check if map is power of 2
 			if (!(mapsize > 0 && (mapsize & (mapsize-1)) == 0))
 				throw invalid_argument("Mapsize must be a power of two!");
+			// Check if the hash can address every slot
+			if (sizeof(hash_type) < sizeof(size_t) && mapsize - 1 > numeric_limits<hash_type>::max())
+				throw invalid_argument("Mapsize exceeds the range of the hash policy!");
 			// Initialize map
 			size = mapsize;
-			occupied = 0;
-			map = new HyperSlot<variant<Derived_T...>>[size];
+			seed = hash_seed;
+			map = new slot_type[size];
 		};
-		virtual ~HyperMap() {
+		virtual ~BasicHyperMap() {
 			delete[] map;
 		};
-		HyperMap(HyperMap&& other) noexcept : size(other.size), occupied(other.occupied), map(other.map) {
-			// Skip if same
-			if (this != &other) {
-				// Clear up resources on other
-				other.size = 0;
-				other.occupied = 0;
-				other.map = nullptr;
-			};
+		BasicHyperMap(BasicHyperMap&& other) noexcept
+			: size(other.size), occupied(other.occupied.load()), tombstones(other.tombstones.load()),
+				seed(other.seed.load()), max_probe(other.max_probe.load()), map(other.map) {
+			// Clear up resources on other
+			other.size = 0;
+			other.occupied = 0;
+			other.tombstones = 0;
+			other.map = nullptr;
 		};
-		HyperMap(const HyperMap& other) : size(other.size), occupied(other.occupied) {
-			if (this != &other) {
-				try {
-					// Copy constructor in this case uses default initialization and assignment instead of the copy constructor of the elements.
-					// Technically it is feasible to use "operator new[] / delete[]"; This would allow direct construction of elements (e.g. direct copy construction).
-					// But for performance reasons, the memory management of the HyperMap is handled with high-level "new[] and delete[]" functions (which can be quite more efficient then manual management).
-					// HyperMap is primarly specified for fast access times and not for memory optimizations; it is usually not necessary to COPY the HyperMap.
-					
-					// Allocate block
-					map = new HyperSlot<variant<Derived_T...>>[other.size];
-					// Initialize every field with assignment overloader
-					for (size_t i = 0; i < other.size; ++i) {
-						map[i] = other.map[i];
-					}
-				} catch (...) {
-					// Clean up resources on error
-					size = 0;
-					occupied = 0;
-					delete[] map;
-					throw;
-				}
-			};
+		BasicHyperMap(const BasicHyperMap& other)
+			: size(other.size), occupied(other.occupied.load()), tombstones(other.tombstones.load()),
+				seed(other.seed.load()), max_probe(other.max_probe.load()) {
+			// Copy constructor in this case uses default initialization and assignment instead of the copy constructor of the elements.
+			// Technically it is feasible to use "operator new[] / delete[]"; This would allow direct construction of elements (e.g. direct copy construction).
+			// But for performance reasons, the memory management of the HyperMap is handled with high-level "new[] and delete[]" functions (which can be quite more efficient then manual management).
+			// HyperMap is primarly specified for fast access times and not for memory optimizations; it is usually not necessary to COPY the HyperMap.
+
+			// Allocate block (deallocated automatically if an assignment throws)
+			unique_ptr<slot_type[]> block(new slot_type[other.size]);
+			// Initialize every field with assignment overloader
+			for (size_t i = 0; i < other.size; ++i) {
+				block[i] = other.map[i];
+			}
+			map = block.release();
 		};
-		HyperMap& operator=(HyperMap&& other) noexcept {
+		BasicHyperMap& operator=(BasicHyperMap&& other) noexcept {
 			// Skip if same
 			if (this != &other) {
 				// Clear map before moving
 				delete[] map;
 				// Shallow copy
-				occupied = other.occupied;
+				occupied = other.occupied.load();
+				tombstones = other.tombstones.load();
+				seed = other.seed.load();
+				max_probe = other.max_probe.load();
 				size = other.size;
 				map = other.map;
 				// Clear up resources on other
 				other.occupied = 0;
+				other.tombstones = 0;
 				other.size = 0;
 				other.map = nullptr;
 			}
 			return *this;
 		};
-		HyperMap& operator=(const HyperMap& other) {
+		BasicHyperMap& operator=(const BasicHyperMap& other) {
 			// Skip if same
 			if (this != &other) {
-				// Clean up old map
+				// Allocate new block before cleaning up the old map
+				unique_ptr<slot_type[]> block(new slot_type[other.size]);
+				for (size_t i = 0; i < other.size; ++i) {
+					block[i] = other.map[i];
+				}
 				delete[] map;
+				map = block.release();
 				// Update every field with copy semantics
-				occupied = other.occupied;
+				occupied = other.occupied.load();
+				tombstones = other.tombstones.load();
+				seed = other.seed.load();
+				max_probe = other.max_probe.load();
 				size = other.size;
-				for (size_t i = 0; i < other.size; ++i) {
-					map[i] = other.map[i];
-				}
 			};
 			return *this;
 		};
 
 		class HyperMapIterator {
 		public:
-			HyperMapIterator(uint16_t index, HyperMap& map) : idx(index), hypermap(map) {};
+			HyperMapIterator(size_t index, BasicHyperMap& map) : idx(index), hypermap(map) {};
 
 			HyperMapIterator& operator++() {
-				// Skip all empty elements (key=="")
+				// Skip all unused elements
 				do {
 					idx++;
-				} while (idx < hypermap.size && hypermap.map[idx].key=="");
+				} while (idx < hypermap.size && !hypermap.is_used(idx));
 				// Return Mapiterator
 				return *this;
 			};
 
-			auto& operator*() const {
+			operator_type operator*() const {
 				// Return SlotOperator
-				return SlotOperator<Base_T, variant<Derived_T...>>(&hypermap.map[idx]);
+				slot_type* slot = &hypermap.map[idx];
+				const shared_lock<shared_mutex> lock(slot->meta_lock);
+				return operator_type(slot->state == USED ? slot : nullptr, slot->atom_id);
 			};
 
 			bool operator==(const HyperMapIterator& other) {
 				return this->idx == other.idx;
 			};
-			
+
 			bool operator!=(const HyperMapIterator& other) {
 				return !(*this==other);
 			};
 
-			
+
 		private:
-			uint16_t idx;
-			HyperMap& hypermap;
+			size_t idx;
+			BasicHyperMap& hypermap;
 		};
 
 		/**
 		 * Returns the first iterator of the map
 		 */
 		HyperMapIterator begin() {
-			// Skip all empty elements (key=="")
-			uint16_t idx = 0;
-			while (idx < size && map[idx].key=="") {
+			// Skip all unused elements
+			size_t idx = 0;
+			while (idx < size && !is_used(idx)) {
 				idx++;
 			}
 			return HyperMapIterator(idx, *this);
@@ -323,23 +508,180 @@ namespace hypermap {
 		 * Returns the last+1 iterator of the map
 		 */
 		HyperMapIterator end() {
-			return HyperMapIterator(size, *this); 
+			return HyperMapIterator(size, *this);
 		};
 
 		/**
 		 * Returns the occupied slots
 		 */
-		uint16_t load() {
+		size_t load() {
 			return occupied;
 		}
 
+		/**
+		 * Returns the number of slots of the map
+		 */
+		size_t capacity() const noexcept {
+			return size;
+		}
+
+		/**
+		 * Calls the visitor with the key, the value and the expiry of the slot at index (if it holds a key)
+		 *
+		 * The visitor is called as visitor(const string& key, const Base_T* val, chrono::system_clock::time_point expiry)
+		 * while the slot is read locked, expiry is time_point::max() if the slot does not expire.
+		 * Returns false if the slot is empty or expired.
+		 *
+		 * IMPORTANT: DO NOT USE THE BASE_PTR OUTSIDE OF THIS CALLBACK
+		 */
+		template <typename Visitor_T>
+		bool visit_slot(size_t index, Visitor_T&& visitor) {
+			if (index >= size) return false;
+			slot_type& slot = map[index];
+			// Same lock order as del (meta before val)
+			shared_lock<shared_mutex> meta(slot.meta_lock, defer_lock);
+			lock_slot(meta, META_LOCK, slot.key);
+			if (slot.state != USED) return false;
+			auto expiry = chrono::system_clock::time_point::max();
+			if (slot.time_duration.count()) {
+				expiry = slot.time_point + slot.time_duration;
+				if (chrono::system_clock::now() >= expiry) return false;
+			}
+			shared_lock<shared_mutex> lock(slot.val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot.key);
+			visitor(static_cast<const string&>(slot.key), std::visit(BaseVisitor<const Base_T>{}, slot.val), expiry);
+			return true;
+		}
+
+		/**
+		 * Calls visit_slot for every slot of the map
+		 *
+		 * Only one slot is locked at a time, so the visited keys are not a consistent snapshot of the map
+		 * (keys that are inserted / deleted during the call may or may not be visited).
+		 */
+		template <typename Visitor_T>
+		void for_each(Visitor_T&& visitor) {
+			for (size_t i = 0; i < size; i++) visit_slot(i, visitor);
+		}
+
+		/**
+		 * Returns the probe statistics of the map
+		 *
+		 * The histograms and counters are only recorded if HYPERMAP_PROBE_STATS is defined,
+		 * the load gauges are always set.
+		 */
+		ProbeSnapshot stats() const {
+			ProbeSnapshot snapshot;
+#ifdef HYPERMAP_PROBE_STATS
+			probe_stats.collect(snapshot);
+#endif
+			snapshot.load_factor = size ? static_cast<double>(occupied.load(memory_order_relaxed)) / size : 0;
+			snapshot.tombstone_factor = size ? static_cast<double>(tombstones.load(memory_order_relaxed)) / size : 0;
+			return snapshot;
+		}
+
+		/**
+		 * Resets the probe statistics of the map
+		 */
+		void reset_stats() noexcept {
+#ifdef HYPERMAP_PROBE_STATS
+			probe_stats.reset();
+#endif
+		}
+
+		/**
+		 * Sets the number of probed slots of other keys that triggers the defensive rehash (0 disables the guard)
+		 */
+		void set_max_probe(size_t probe_length) noexcept {
+			max_probe = probe_length;
+		}
+
 		/**
 		 * Gets a SlotOperator from Slot
 		 *
-		 * If the slot is not found it will return nullptr
+		 * If the slot is not found, the returned SlotOperator is not bound (evaluates to false)
+		 */
+		operator_type get(const string& key) {
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					continue;
+				}
+				// A miss is only valid if no rehash moved the slots in the meantime
+				if (res.slot || rehash_seq.load(memory_order_acquire) == seq)
+					return operator_type(res.slot, res.atom_id);
+			}
+		};
+
+		/**
+		 * Gets a SlotHandle for the key
+		 *
+		 * If the slot is not found, the returned SlotHandle is not bound (evaluates to false)
+		 */
+		SlotHandle get_handle(const string& key) {
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					continue;
+				}
+				if (res.slot) return SlotHandle{static_cast<uint64_t>(res.slot - map), res.atom_id};
+				if (rehash_seq.load(memory_order_acquire) == seq) return SlotHandle();
+			}
+		};
+
+		/**
+		 * Resolves a SlotHandle to a SlotOperator in O(1) (no hashing / probing)
+		 *
+		 * If the handle is stale (slot deleted / moved), read and write of the returned SlotOperator return false,
+		 * the caller can then repair the handle with get_handle(key).
+		 */
+		operator_type resolve(const SlotHandle& handle) {
+			if (handle.index >= size) return operator_type(nullptr, 0);
+			return operator_type(&map[handle.index], handle.atom_id);
+		};
+
+		/**
+		 * Resolves multiple SlotHandles in a single pass over the slots
+		 *
+		 * The handles are visited in ascending slot order (so the slots are accessed sequentially) and prefetched ahead,
+		 * the visitor is called with the position of the handle in "handles" and the resolved SlotOperator.
+		 * Unbound handles are visited last.
+		 */
+		template <typename Visitor_T>
+		void resolve_all(const vector<SlotHandle>& handles, Visitor_T&& visitor) {
+			// Bucket sort by slot index, with about one bucket per handle this is O(n) (order inside a bucket is not sorted)
+			const size_t shift = bit_width(size) > bit_width(handles.size()) ? bit_width(size) - bit_width(handles.size()) : 0;
+			const size_t buckets = (size >> shift) + 1;
+			vector<size_t> offsets(buckets + 1, 0);
+			for (const SlotHandle& handle : handles) {
+				offsets[(handle.index < size ? handle.index >> shift : buckets - 1) + 1]++;
+			}
+			for (size_t b = 1; b <= buckets; b++) offsets[b] += offsets[b - 1];
+
+			vector<size_t> order(handles.size());
+			for (size_t pos = 0; pos < handles.size(); pos++) {
+				const SlotHandle& handle = handles[pos];
+				order[offsets[handle.index < size ? handle.index >> shift : buckets - 1]++] = pos;
+			}
+			// Slots are prefetched a few handles ahead, so the cache misses of consecutive members overlap
+			for (size_t i = 0; i < order.size(); i++) {
+				if (i + prefetch_distance < order.size()) prefetch(handles[order[i + prefetch_distance]]);
+				visitor(order[i], resolve(handles[order[i]]));
+			}
+		};
+
+		/**
+		 * Prefetches the slot of the handle into the cache (locks and value)
 		 */
-		SlotOperator<Base_T, variant<Derived_T...>> get(const string& key) {
-			return SlotOperator<Base_T, variant<Derived_T...>>(probe(key, size, map));
+		void prefetch(const SlotHandle& handle) const noexcept {
+			if (handle.index >= size) return;
+			const slot_type* slot = &map[handle.index];
+			__builtin_prefetch(slot, 0, 1);
+			__builtin_prefetch(&slot->val, 0, 1);
 		};
 
 		/**
@@ -347,70 +689,415 @@ namespace hypermap {
 		 *
 		 * Throws a runtime error if no slot in the map is free.
 		 */
-		SlotOperator<Base_T, variant<Derived_T...>> set(const string& key, const variant<Derived_T...>& val) {
-			HyperSlot<variant<Derived_T...>>* slot = probe(key, size, map);
+		operator_type set(const string& key, const variant<Derived_T...>& val) {
+			// Fast path: key exists, the value is updated in place
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					continue;
+				}
+				if (res.slot) {
+					// Update slot values
+					// (assignment operator must deallocate old resources if type is correctly implemented)
+					if (!overwrite(res, val)) continue;
+					return operator_type(res.slot, res.atom_id);
+				}
+				if (rehash_seq.load(memory_order_acquire) == seq) break;
+			}
+
+			// Slow path: key is inserted, inserts are serialized per stripe (this also blocks rehashing)
+			size_t probe_length = 0;
+			operator_type op = insert(key, val, probe_length);
+			guard(probe_length);
+			return op;
+		};
 
-			// Update slot values
-			// (assignment operator must deallocate old resources if type is correctly implemented)
-			{
-				unique_lock<shared_mutex> lock(slot->lock);
-				slot->key = key;
-				slot->val = val;
+		/**
+		 * Inserts the value if the key does not exist and returns a SlotOperator to the slot of the key
+		 *
+		 * If the key exists, its value is left unchanged. Use this to create a value that is then modified
+		 * with write() (e.g. counters), so concurrent creators do not overwrite each other.
+		 *
+		 * Throws a runtime error if no slot in the map is free.
+		 */
+		operator_type emplace(const string& key, const variant<Derived_T...>& val) {
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					continue;
+				}
+				if (res.slot) return operator_type(res.slot, res.atom_id);
+				if (rehash_seq.load(memory_order_acquire) == seq) break;
 			}
-			occupied+=slot->key=="" ? 1 : 0;
 
-			return SlotOperator<Base_T, variant<Derived_T...>>(slot);
+			size_t probe_length = 0;
+			operator_type op = insert(key, val, probe_length, false);
+			guard(probe_length);
+			return op;
 		};
 
 		/**
 		 * Sets the slot to unoccupied and default initializes the value of the slot (by this it removes the old data)
 		 */
 		void del(const string& key) {
-			HyperSlot<variant<Derived_T...>>* slot = probe(key, size, map);
-			if (!slot) return;
-
-			// Update slot values
-			// (assignment operator must deallocate old resources if type is correctly implemented)
-			{
-				unique_lock<shared_mutex> lock(slot->lock);
-				slot->key = "";
-				slot->val = HyperSlot<variant<Derived_T...>>();
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					return;
+				}
+				if (!res.slot) {
+					if (rehash_seq.load(memory_order_acquire) == seq) return;
+					continue;
+				}
+
+				// Update slot values
+				// (assignment operator must deallocate old resources if type is correctly implemented)
+				unique_lock<shared_mutex> meta(res.slot->meta_lock, defer_lock);
+				lock_slot(meta, META_LOCK, res.slot->key);
+				unique_lock<shared_mutex> lock(res.slot->val_lock, defer_lock);
+				lock_slot(lock, VAL_LOCK, res.slot->key);
+				// Slot was deleted / moved in the meantime
+				if (res.slot->atom_id != res.atom_id) continue;
+				erase(res.slot);
+				return;
+			}
+		};
+
+		/**
+		 * Sets the slot of the key to expire after duration, returns false if the key does not exist
+		 *
+		 * Expired slots are deleted lazily, the next operation that probes the key deletes the slot.
+		 * The expiry is cleared if the value is overwritten with set(), a duration <= 0 deletes the key immediately.
+		 */
+		bool expire(const string& key, chrono::system_clock::duration duration) {
+			while (true) {
+				const uint64_t seq = wait_rehash();
+				const ProbeResult res = probe(key, hash(key));
+				if (res.expired) {
+					reap(res);
+					return false;
+				}
+				if (!res.slot) {
+					if (rehash_seq.load(memory_order_acquire) == seq) return false;
+					continue;
+				}
+				unique_lock<shared_mutex> meta(res.slot->meta_lock, defer_lock);
+				lock_slot(meta, META_LOCK, res.slot->key);
+				if (res.slot->atom_id != res.atom_id) continue;
+				if (duration <= chrono::system_clock::duration::zero()) {
+					unique_lock<shared_mutex> lock(res.slot->val_lock, defer_lock);
+					lock_slot(lock, VAL_LOCK, res.slot->key);
+					erase(res.slot);
+					return true;
+				}
+				res.slot->time_point = chrono::system_clock::now();
+				res.slot->time_duration = duration;
+				return true;
+			}
+		};
+
+		/**
+		 * Rehashes all slots with a new seed
+		 *
+		 * Blocks all operations on the map, all SlotOperators of moved slots are invalidated.
+		 * Tombstones are cleared by the rehash.
+		 */
+		void rehash(uint64_t new_seed = hyperhash::random_seed()) {
+			// Block inserts, then all slots (same lock order as insert)
+			vector<unique_lock<mutex>> stripes;
+			stripes.reserve(insert_stripes);
+			for (auto& stripe : insert_locks) stripes.emplace_back(stripe);
+
+			rehash_seq.fetch_add(1, memory_order_acq_rel);
+			for (size_t i = 0; i < size; i++) {
+				map[i].meta_lock.lock();
+				map[i].val_lock.lock();
+			}
+
+			// Move all entries out of the slots
+			struct Entry {
+				string key;
+				variant<Derived_T...> val;
+				chrono::system_clock::time_point time_point;
+				chrono::system_clock::duration time_duration;
+			};
+			vector<Entry> entries;
+			entries.reserve(occupied);
+			for (size_t i = 0; i < size; i++) {
+				slot_type& slot = map[i];
+				if (slot.state == USED) {
+					entries.push_back(Entry{std::move(slot.key), std::move(slot.val), slot.time_point, slot.time_duration});
+					slot.key = "";
+					slot.val = variant<Derived_T...>();
+					slot.atom_id++;
+				}
+				slot.state.store(EMPTY, memory_order_relaxed);
+			}
+
+			// Reinsert with the new seed (all locks are held, so the slots are accessed directly)
+			seed = new_seed;
+			for (Entry& entry : entries) {
+				const hash_type h = hash(entry.key);
+				size_t idx = h & (size-1);
+				for (size_t att = 1; map[idx].state != EMPTY; att++) {
+					idx = (idx + att) & (size-1);
+				}
+				slot_type& slot = map[idx];
+				slot.key = std::move(entry.key);
+				slot.tag.store(tag_of(h), memory_order_relaxed);
+				slot.val = std::move(entry.val);
+				slot.time_point = entry.time_point;
+				slot.time_duration = entry.time_duration;
+				slot.state.store(USED, memory_order_release);
+				slot.atom_id++;
+			}
+			tombstones = 0;
+
+			rehash_seq.fetch_add(1, memory_order_acq_rel);
+			for (size_t i = 0; i < size; i++) {
+				map[i].val_lock.unlock();
+				map[i].meta_lock.unlock();
 			}
-			occupied--;
 		};
-		
+
 	private:
-		// Constants for quadratic probing
-		inline static const uint8_t c1 = 1;
-		inline static const uint8_t c2 = 3;
+		// Number of handles resolve_all prefetches ahead
+		static constexpr size_t prefetch_distance = 8;
+		// Number of stripes used to serialize inserts
+		static constexpr size_t insert_stripes = 64;
+		// Minimum time between two defensive rehashes
+		static constexpr chrono::seconds rehash_cooldown{1};
+
+		struct ProbeResult {
+			// Slot of the key (nullptr if not found)
+			slot_type* slot;
+			// Atom_id of the slot at the time the key was compared
+			uint64_t atom_id;
+			// First empty / deleted slot on the probe sequence (nullptr if none was found)
+			slot_type* free;
+			// Number of probed slots
+			size_t length;
+			// Number of probed slots of other keys (tombstones and the slot of the key are not counted, see guard)
+			size_t collisions = 0;
+			// Slot of the key if it is expired (slot is nullptr then)
+			slot_type* expired = nullptr;
+			// Slot of the key has an expiry
+			bool expires = false;
+		};
+
+		hash_type hash(const string& key) const {
+			return Hash_T::hash(key, seed.load(memory_order_relaxed));
+		};
+
+		// Folds the hash into the 32 bit tag of the slot
+		static uint32_t tag_of(hash_type hash) noexcept {
+			const uint64_t h = static_cast<uint64_t>(hash);
+			return static_cast<uint32_t>(h ^ (h >> 32));
+		};
+
+		bool is_used(size_t idx) const {
+			const shared_lock<shared_mutex> lock(map[idx].meta_lock);
+			return map[idx].state == USED;
+		};
+
+		// Waits until no rehash is running, returns the rehash sequence
+		uint64_t wait_rehash() const {
+			uint64_t seq = rehash_seq.load(memory_order_acquire);
+			while (seq & 1) {
+				this_thread::yield();
+				seq = rehash_seq.load(memory_order_acquire);
+			}
+			return seq;
+		};
 
 		// Function for probing / finding the requested key
-		inline static HyperSlot<variant<Derived_T...>>* probe(const string& key, const uint16_t& size, const HyperSlot<variant<Derived_T...>>* map) {
-			// Calculate initial hash
-			uint32_t hash = hyperhash::hash(key);
+		//
+		// Quadratic probing with triangular numbers (hash + att*(att+1)/2), on a power of two map this visits every slot.
+		ProbeResult probe(const string& key, const hash_type hash) const {
 			// Trimm down hash to index
-			uint32_t idx = hash & (size-1);
-			// Set attempt to 0
-			uint32_t att = 0;
+			size_t idx = hash & (size-1);
+			const uint32_t key_tag = tag_of(hash);
+			ProbeResult res{nullptr, 0, nullptr, 0};
 
-			// Initial slot
-			HyperSlot<variant<Derived_T...>>* slot = &map[idx];
-
-			// Probe until slot is uninitialized || the correct slot
-			while (slot->key!="" && slot->key!=key) {
+			// Probe until slot is empty || the correct slot (if every field was probed -> return)
+			for (size_t att = 1; att <= size; att++) {
+				slot_type* slot = &map[idx];
+				// Slots of other keys are skipped without locking, a concurrent change of the slot is validated
+				// under the lock (hits) or by the caller (misses are retried if a rehash moved the slots)
+				const SlotState state = slot->state.load(memory_order_acquire);
+				if (state == USED) {
+					if (slot->tag.load(memory_order_relaxed) != key_tag) {
+						res.collisions++;
+					} else {
+						shared_lock<shared_mutex> lock(slot->meta_lock, defer_lock);
+						lock_slot(lock, META_LOCK, slot->key);
+						if (slot->state.load(memory_order_relaxed) == USED && slot->key == key) {
+							res.atom_id = slot->atom_id;
+							res.length = att;
+							// The clock is only read for slots with an expiry
+							res.expires = slot->time_duration.count() != 0;
+							if (res.expires && chrono::system_clock::now() >= slot->time_point + slot->time_duration) {
+								res.expired = slot;
+								return res;
+							}
+							res.slot = slot;
+#ifdef HYPERMAP_PROBE_STATS
+							probe_stats.record_hit(att);
+#endif
+							return res;
+						}
+						res.collisions++;
+					}
+				} else {
+					if (!res.free) res.free = slot;
+					if (state == EMPTY) {
+						res.length = att;
+#ifdef HYPERMAP_PROBE_STATS
+						probe_stats.record_miss(att);
+#endif
+						return res;
+					}
+				}
 				// Quadratic probing function
-				idx = (hash + c1 * att + c2 * (att * att)) & (size-1);
-				// Update slot
-				slot = &map[idx];
-				// Increment attempt (if every field was probed -> return)
-				if (++att>size) return nullptr;
+				idx = (idx + att) & (size-1);
+			}
+			res.length = size;
+#ifdef HYPERMAP_PROBE_STATS
+			probe_stats.record_miss(size);
+#endif
+			return res;
+		};
+
+		// Inserts a new key (or updates it if it was inserted concurrently and overwrite is set)
+		operator_type insert(const string& key, const variant<Derived_T...>& val, size_t& probe_length, bool overwrite = true) {
+			// The seed can not change while an insert stripe is held
+			const hash_type h = hash(key);
+			unique_lock<mutex> stripe(insert_locks[static_cast<size_t>(h) & (insert_stripes-1)]);
+			const hash_type stripe_hash = hash(key);
+			if (stripe_hash != h) {
+				// Rehash happened between hashing and locking, retry with the new seed
+				// (the stripe is released first, the retry may need another stripe)
+				stripe.unlock();
+				return insert(key, val, probe_length, overwrite);
 			}
+
+			while (true) {
+				const ProbeResult res = probe(key, h);
+				probe_length = res.collisions;
+				if (res.expired) {
+					reap(res);
+					continue;
+				}
+				if (res.slot) {
+					if (!overwrite) return operator_type(res.slot, res.atom_id);
+					if (!this->overwrite(res, val)) continue;
+					return operator_type(res.slot, res.atom_id);
+				}
+				if (!res.free) {
+#ifdef HYPERMAP_PROBE_STATS
+					probe_stats.record_insert_failure();
+#endif
+					throw runtime_error("HyperMap is full!");
+				}
+
+				// Claim the free slot, it can be claimed by an insert of another stripe in the meantime
+				unique_lock<shared_mutex> meta(res.free->meta_lock, defer_lock);
+				lock_slot(meta, META_LOCK, res.free->key);
+				if (res.free->state == USED) continue;
+				const bool reused = res.free->state == DELETED;
+				{
+					unique_lock<shared_mutex> lock(res.free->val_lock, defer_lock);
+					lock_slot(lock, VAL_LOCK, res.free->key);
+					res.free->key = key;
+					res.free->val = val;
+					res.free->tag.store(tag_of(h), memory_order_relaxed);
+					res.free->state.store(USED, memory_order_release);
+					res.free->time_duration = chrono::system_clock::duration::zero();
+				}
+				occupied++;
+				if (reused) tombstones--;
+				return operator_type(res.free, res.free->atom_id);
+			}
+		};
+
+		// Overwrites the value of a probed slot, the expiry of the slot is cleared (returns false if the slot changed)
+		bool overwrite(const ProbeResult& res, const variant<Derived_T...>& val) {
+			// The meta_lock is only needed to clear the expiry (lock order: meta before val)
+			unique_lock<shared_mutex> meta(res.slot->meta_lock, defer_lock);
+			if (res.expires) lock_slot(meta, META_LOCK, res.slot->key);
+			unique_lock<shared_mutex> lock(res.slot->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, res.slot->key);
+			if (res.slot->atom_id != res.atom_id) return false;
+			res.slot->val = val;
+			if (res.expires) res.slot->time_duration = chrono::system_clock::duration::zero();
+			return true;
+		};
+
+		// Deletes the slot (meta_lock and val_lock must be held uniquely)
+		void erase(slot_type* slot) {
+			slot->key = "";
+			slot->val = variant<Derived_T...>();
+			slot->state.store(DELETED, memory_order_release);
+			slot->time_duration = chrono::system_clock::duration::zero();
+			slot->atom_id++;
+			occupied--;
+			tombstones++;
 		};
-		
-		uint16_t size;
-		uint16_t occupied;
-		HyperSlot<variant<Derived_T...>>* map;
+
+		// Deletes an expired slot that was found by probe (nothing happens if the slot changed in the meantime)
+		void reap(const ProbeResult& res) {
+			slot_type* slot = res.expired;
+			unique_lock<shared_mutex> meta(slot->meta_lock, defer_lock);
+			lock_slot(meta, META_LOCK, slot->key);
+			unique_lock<shared_mutex> lock(slot->val_lock, defer_lock);
+			lock_slot(lock, VAL_LOCK, slot->key);
+			if (slot->atom_id != res.atom_id) return;
+			if (chrono::system_clock::now() < slot->time_point + slot->time_duration) return;
+			erase(slot);
+		};
+
+		// Triggers the defensive rehash if the probe sequence ran over suspiciously many slots of other keys
+		void guard(size_t probe_length) {
+			const size_t limit = max_probe.load(memory_order_relaxed);
+			if (!limit || probe_length <= limit) return;
+			// Long probe sequences on a highly loaded map are expected
+			if (occupied.load(memory_order_relaxed) * 4 >= size * 3) return;
+
+			const int64_t now = chrono::steady_clock::now().time_since_epoch().count();
+			int64_t last = last_rehash.load(memory_order_relaxed);
+			if (last && now - last < chrono::duration_cast<chrono::steady_clock::duration>(rehash_cooldown).count()) return;
+			if (!last_rehash.compare_exchange_strong(last, now)) return;
+			rehash();
+		};
+
+		size_t size;
+		atomic<size_t> occupied = 0;
+		atomic<size_t> tombstones = 0;
+		atomic<uint64_t> seed;
+		atomic<size_t> max_probe = default_max_probe;
+		// Sequence that is odd while a rehash is running
+		atomic<uint64_t> rehash_seq = 0;
+		// Steady clock ticks of the last defensive rehash
+		atomic<int64_t> last_rehash = 0;
+		mutex insert_locks[insert_stripes];
+#ifdef HYPERMAP_PROBE_STATS
+		// Probe counters (not copied / moved with the map)
+		mutable ProbeStats probe_stats;
+#endif
+		slot_type* map;
 	};
+
+	/**
+	 * HyperMap using the default hash policy (hyperhash::City32)
+	 */
+	template <typename Base_T, typename... Derived_T>
+	using HyperMap = BasicHyperMap<hyperhash::City32, Base_T, Derived_T...>;
 }
 
 #endif
@@ -0,0 +1,327 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark for the HyperMap operations.
+ *
+ * Runs every combination of the given workload parameters, each run preloads a fresh map
+ * to the load factor and then executes a get/set/del mix from multiple threads.
+ *
+ * Parameters are passed as --name=value, lists are comma separated:
+ *   --hash=city32,city64,crc32c,sip13   hash policies
+ *   --mix=90:10:0                       get:set:del ratios (in percent)
+ *   --dist=uniform,zipf                 key distribution (zipf uses theta 0.99)
+ *   --load=0.25,0.5,0.75,0.9,0.95       load factor of the map
+ *   --key_len=16                        key length in bytes
+ *   --value_size=64                     ProtoChunk value size in bytes
+ *   --threads=1,2,4,8,16,32,64          number of worker threads
+ *   --slots=65536                       map size (power of two)
+ *   --ops=1000000                       operations per run (split over the threads)
+ *   --format=csv                        output format (csv or json, one object per line)
+ *
+ * Output columns: hash,dist,mix,load,key_len,value_size,threads,ops,ns_per_op,mops,hit_rate,end_load
+ * (ns_per_op is the wall time per operation over all threads, hit_rate the share of gets that found the key)
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/hypermap/hypermap.hpp"
+#include "lib/datachunk/datachunk.hpp"
+
+using namespace std;
+using namespace datachunk;
+
+namespace {
+	struct Mix {
+		unsigned get;
+		unsigned set;
+		unsigned del;
+	};
+
+	struct Options {
+		vector<string> hash = {"city32"};
+		vector<Mix> mix = {{90, 10, 0}, {50, 50, 0}, {80, 10, 10}};
+		vector<string> dist = {"uniform", "zipf"};
+		vector<double> load = {0.25, 0.5, 0.75, 0.9, 0.95};
+		vector<size_t> key_len = {16};
+		vector<size_t> value_size = {64};
+		vector<size_t> threads = {1, 2, 4, 8, 16, 32, 64};
+		size_t slots = 1 << 16;
+		size_t ops = 1000000;
+		string format = "csv";
+	};
+
+	struct Workload {
+		string hash;
+		Mix mix;
+		string dist;
+		double load;
+		size_t key_len;
+		size_t value_size;
+		size_t threads;
+	};
+
+	struct Result {
+		double ns_per_op;
+		double hit_rate;
+		size_t end_load;
+	};
+
+	enum Op : uint8_t {
+		GET = 0,
+		SET = 1,
+		DEL = 2
+	};
+
+	// Number of pregenerated operations per thread, threads cycle through their stream
+	constexpr size_t stream_size = 1 << 16;
+
+	/**
+	 * Zipfian generator (Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+	 *
+	 * Rank 0 is the most frequent key.
+	 */
+	class Zipf {
+	public:
+		Zipf(size_t n, double theta) : items(n), theta(theta) {
+			for (size_t i = 1; i <= n; i++) zetan += 1.0 / pow(static_cast<double>(i), theta);
+			const double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+			alpha = 1.0 / (1.0 - theta);
+			eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+		};
+
+		size_t operator()(mt19937_64& rng) const {
+			const double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+			const double uz = u * zetan;
+			if (uz < 1.0) return 0;
+			if (uz < 1.0 + pow(0.5, theta)) return items > 1 ? 1 : 0;
+			const size_t rank = static_cast<size_t>(items * pow(eta * u - eta + 1.0, alpha));
+			return rank < items ? rank : items - 1;
+		};
+	private:
+		size_t items;
+		double theta;
+		double zetan = 0;
+		double alpha;
+		double eta;
+	};
+
+	template <typename T>
+	vector<T> parse_list(const string& val, T (*parse)(const string&)) {
+		vector<T> list;
+		size_t pos = 0;
+		while (pos <= val.size()) {
+			size_t next = val.find(',', pos);
+			if (next == string::npos) next = val.size();
+			list.push_back(parse(val.substr(pos, next - pos)));
+			pos = next + 1;
+		}
+		return list;
+	}
+
+	Mix parse_mix(const string& val) {
+		Mix mix{};
+		if (sscanf(val.c_str(), "%u:%u:%u", &mix.get, &mix.set, &mix.del) != 3 || mix.get + mix.set + mix.del != 100)
+			throw invalid_argument("Mix must be get:set:del with a sum of 100: " + val);
+		return mix;
+	}
+
+	Options parse_options(int argc, char** argv) {
+		const auto to_string_val = [](const string& s) { return s; };
+		const auto to_size = [](const string& s) { return static_cast<size_t>(stoull(s)); };
+		const auto to_double = [](const string& s) { return stod(s); };
+
+		Options opts;
+		for (int i = 1; i < argc; i++) {
+			const string arg = argv[i];
+			const size_t eq = arg.find('=');
+			if (arg.rfind("--", 0) != 0 || eq == string::npos)
+				throw invalid_argument("Expected --name=value, got: " + arg);
+			const string name = arg.substr(2, eq - 2);
+			const string val = arg.substr(eq + 1);
+
+			if (name == "hash") opts.hash = parse_list<string>(val, to_string_val);
+			else if (name == "mix") opts.mix = parse_list<Mix>(val, parse_mix);
+			else if (name == "dist") opts.dist = parse_list<string>(val, to_string_val);
+			else if (name == "load") opts.load = parse_list<double>(val, to_double);
+			else if (name == "key_len") opts.key_len = parse_list<size_t>(val, to_size);
+			else if (name == "value_size") opts.value_size = parse_list<size_t>(val, to_size);
+			else if (name == "threads") opts.threads = parse_list<size_t>(val, to_size);
+			else if (name == "slots") opts.slots = stoull(val);
+			else if (name == "ops") opts.ops = stoull(val);
+			else if (name == "format") opts.format = val;
+			else throw invalid_argument("Unknown parameter: " + name);
+		}
+		for (const double load : opts.load)
+			if (load <= 0.0 || load >= 1.0) throw invalid_argument("Load factor must be in (0, 1)");
+		for (const string& dist : opts.dist)
+			if (dist != "uniform" && dist != "zipf") throw invalid_argument("Unknown distribution: " + dist);
+		if (opts.format != "csv" && opts.format != "json") throw invalid_argument("Unknown format: " + opts.format);
+		return opts;
+	}
+
+	// Key of the given index, padded to key_len (keys are never shorter than the index digits)
+	string make_key(size_t index, size_t key_len) {
+		string key = "k" + to_string(index);
+		if (key.size() < key_len) key.append(key_len - key.size(), '_');
+		return key;
+	}
+
+	template <typename Hash_T>
+	Result run(const Workload& w, const Options& opts) {
+		using Map = hypermap::BasicHyperMap<Hash_T, DataChunk, ProtoChunk, CountChunk>;
+		Map map(opts.slots);
+
+		const size_t keyspace = max<size_t>(1, static_cast<size_t>(opts.slots * w.load));
+		vector<string> keys(keyspace);
+		for (size_t i = 0; i < keyspace; i++) keys[i] = make_key(i, w.key_len);
+
+		vector<uint8_t> bytes(w.value_size, 0x2a);
+		ProtoChunk value;
+		value.set_proto(bytes.data(), bytes.size());
+		for (const auto& key : keys) map.set(key, value);
+
+		// Pregenerate the operation streams, so that the generators are not measured
+		const Zipf zipf(keyspace, 0.99);
+		vector<vector<pair<Op, uint32_t>>> streams(w.threads, vector<pair<Op, uint32_t>>(stream_size));
+		for (size_t t = 0; t < w.threads; t++) {
+			mt19937_64 rng(t + 1);
+			for (auto& [op, index] : streams[t]) {
+				const unsigned roll = rng() % 100;
+				op = roll < w.mix.get ? GET : roll < w.mix.get + w.mix.set ? SET : DEL;
+				index = static_cast<uint32_t>(w.dist == "zipf" ? zipf(rng) : rng() % keyspace);
+			}
+		}
+
+		const size_t ops_per_thread = max<size_t>(1, opts.ops / w.threads);
+		atomic<size_t> ready = 0;
+		atomic<bool> start = false;
+		atomic<size_t> gets = 0;
+		atomic<size_t> hits = 0;
+
+		vector<thread> workers;
+		for (size_t t = 0; t < w.threads; t++) {
+			workers.emplace_back([&, t] {
+				const auto& stream = streams[t];
+				size_t local_gets = 0, local_hits = 0;
+				ready++;
+				while (!start.load(memory_order_acquire)) this_thread::yield();
+
+				for (size_t i = 0; i < ops_per_thread; i++) {
+					const auto& [op, index] = stream[i & (stream_size - 1)];
+					const string& key = keys[index];
+					switch (op) {
+					case GET: {
+						local_gets++;
+						local_hits += map.get(key).read([&](const DataChunk* chunk) {
+							if (chunk->get_proto().second != w.value_size) abort();
+						});
+						break;
+					}
+					case SET:
+						map.set(key, value);
+						break;
+					case DEL:
+						map.del(key);
+						break;
+					}
+				}
+				gets += local_gets;
+				hits += local_hits;
+			});
+		}
+
+		while (ready.load() < w.threads) this_thread::yield();
+		const auto begin = chrono::steady_clock::now();
+		start.store(true, memory_order_release);
+		for (auto& worker : workers) worker.join();
+		const double ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+
+		return Result{
+			ns / static_cast<double>(ops_per_thread * w.threads),
+			gets ? static_cast<double>(hits) / gets : 0.0,
+			map.load()
+		};
+	}
+
+	Result dispatch(const Workload& w, const Options& opts) {
+		if (w.hash == "city32") return run<hyperhash::City32>(w, opts);
+		if (w.hash == "city64") return run<hyperhash::City64>(w, opts);
+		if (w.hash == "crc32c") return run<hyperhash::Crc32c>(w, opts);
+		if (w.hash == "sip13") return run<hyperhash::SipHash13>(w, opts);
+		throw invalid_argument("Unknown hash policy: " + w.hash);
+	}
+
+	void print(const Workload& w, const Options& opts, const Result& r) {
+		const size_t ops = max<size_t>(1, opts.ops / w.threads) * w.threads;
+		const double mops = 1e3 / r.ns_per_op;
+		if (opts.format == "json") {
+			printf("{\"hash\":\"%s\",\"dist\":\"%s\",\"mix\":\"%u:%u:%u\",\"load\":%.2f,\"key_len\":%zu,\"value_size\":%zu,"
+						 "\"threads\":%zu,\"ops\":%zu,\"ns_per_op\":%.2f,\"mops\":%.3f,\"hit_rate\":%.4f,\"end_load\":%zu}\n",
+						 w.hash.c_str(), w.dist.c_str(), w.mix.get, w.mix.set, w.mix.del, w.load, w.key_len, w.value_size,
+						 w.threads, ops, r.ns_per_op, mops, r.hit_rate, r.end_load);
+		} else {
+			printf("%s,%s,%u:%u:%u,%.2f,%zu,%zu,%zu,%zu,%.2f,%.3f,%.4f,%zu\n",
+						 w.hash.c_str(), w.dist.c_str(), w.mix.get, w.mix.set, w.mix.del, w.load, w.key_len, w.value_size,
+						 w.threads, ops, r.ns_per_op, mops, r.hit_rate, r.end_load);
+		}
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options opts;
+	try {
+		opts = parse_options(argc, argv);
+	} catch (const exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	if (opts.format == "csv")
+		printf("hash,dist,mix,load,key_len,value_size,threads,ops,ns_per_op,mops,hit_rate,end_load\n");
+
+	for (const auto& hash : opts.hash)
+		for (const auto& mix : opts.mix)
+			for (const auto& dist : opts.dist)
+				for (const double load : opts.load)
+					for (const size_t key_len : opts.key_len)
+						for (const size_t value_size : opts.value_size)
+							for (const size_t threads : opts.threads) {
+								const Workload w{hash, mix, dist, load, key_len, value_size, threads};
+								try {
+									print(w, opts, dispatch(w, opts));
+								} catch (const exception& e) {
+									fprintf(stderr, "%s\n", e.what());
+									return 1;
+								}
+							}
+	return 0;
+}
@@ -0,0 +1,476 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERSTATS_H
+#define HYPERSTATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * Probe and lock statistics of the HyperMap
+ *
+ * Probe recording is only compiled in if HYPERMAP_PROBE_STATS is defined (e.g. copts = ["-DHYPERMAP_PROBE_STATS"]),
+ * lock profiling only if HYPERMAP_LOCK_STATS is defined.
+ * Otherwise the HyperMap contains no counters and the recording calls are removed.
+ */
+namespace hypermap {
+	/**
+	 * Aggregated probe statistics of a HyperMap
+	 *
+	 * Histogram bucket i counts the probe sequences with a length in [2^i, 2^(i+1)),
+	 * the last bucket contains all longer sequences.
+	 */
+	struct ProbeSnapshot {
+		static constexpr size_t buckets = 16;
+
+		// False if the map was compiled without HYPERMAP_PROBE_STATS (only the gauges are set)
+		bool enabled = false;
+		// Probe length histogram of lookups that found the key
+		uint64_t hit_hist[buckets] = {};
+		// Probe length histogram of lookups that did not find the key
+		uint64_t miss_hist[buckets] = {};
+		// Longest probe sequence that was recorded
+		uint64_t max_probe = 0;
+		// Inserts that failed because no slot was free
+		uint64_t insert_failures = 0;
+		// Occupied slots / size
+		double load_factor = 0;
+		// Deleted slots (tombstones) / size, tombstones lengthen the probe sequences like occupied slots
+		double tombstone_factor = 0;
+
+		uint64_t hits() const {
+			uint64_t sum = 0;
+			for (const uint64_t count : hit_hist) sum += count;
+			return sum;
+		};
+
+		uint64_t misses() const {
+			uint64_t sum = 0;
+			for (const uint64_t count : miss_hist) sum += count;
+			return sum;
+		};
+	};
+
+	/**
+	 * Sharded probe counters
+	 *
+	 * Every thread records into one of the shards (assigned round robin on first use),
+	 * so that threads do not contend on the same cache lines. The shards are aggregated on read.
+	 */
+	class ProbeStats {
+	public:
+		static constexpr size_t shards = 32;
+		static constexpr size_t buckets = ProbeSnapshot::buckets;
+
+		void record_hit(size_t length) noexcept {
+			Shard& shard = local();
+			shard.hit_hist[bucket(length)].fetch_add(1, memory_order_relaxed);
+			update_max(shard, length);
+		};
+
+		void record_miss(size_t length) noexcept {
+			Shard& shard = local();
+			shard.miss_hist[bucket(length)].fetch_add(1, memory_order_relaxed);
+			update_max(shard, length);
+		};
+
+		void record_insert_failure() noexcept {
+			local().insert_failures.fetch_add(1, memory_order_relaxed);
+		};
+
+		/**
+		 * Adds the counters of all shards to the snapshot
+		 */
+		void collect(ProbeSnapshot& snapshot) const noexcept {
+			snapshot.enabled = true;
+			for (const Shard& shard : shard_list) {
+				for (size_t i = 0; i < buckets; i++) {
+					snapshot.hit_hist[i] += shard.hit_hist[i].load(memory_order_relaxed);
+					snapshot.miss_hist[i] += shard.miss_hist[i].load(memory_order_relaxed);
+				}
+				const uint64_t max = shard.max_probe.load(memory_order_relaxed);
+				if (max > snapshot.max_probe) snapshot.max_probe = max;
+				snapshot.insert_failures += shard.insert_failures.load(memory_order_relaxed);
+			}
+		};
+
+		/**
+		 * Resets all counters (concurrent recordings may be lost)
+		 */
+		void reset() noexcept {
+			for (Shard& shard : shard_list) {
+				for (size_t i = 0; i < buckets; i++) {
+					shard.hit_hist[i].store(0, memory_order_relaxed);
+					shard.miss_hist[i].store(0, memory_order_relaxed);
+				}
+				shard.max_probe.store(0, memory_order_relaxed);
+				shard.insert_failures.store(0, memory_order_relaxed);
+			}
+		};
+
+	private:
+		struct alignas(64) Shard {
+			atomic<uint64_t> hit_hist[buckets] = {};
+			atomic<uint64_t> miss_hist[buckets] = {};
+			atomic<uint64_t> max_probe = 0;
+			atomic<uint64_t> insert_failures = 0;
+		};
+
+		static size_t bucket(size_t length) noexcept {
+			const size_t idx = bit_width(length | 1) - 1;
+			return idx < buckets ? idx : buckets - 1;
+		};
+
+		static void update_max(Shard& shard, size_t length) noexcept {
+			// Plain load first, the max only changes rarely
+			uint64_t max = shard.max_probe.load(memory_order_relaxed);
+			while (length > max && !shard.max_probe.compare_exchange_weak(max, length, memory_order_relaxed));
+		};
+
+		Shard& local() noexcept {
+			static atomic<size_t> next_shard = 0;
+			thread_local const size_t idx = next_shard.fetch_add(1, memory_order_relaxed) & (shards - 1);
+			return shard_list[idx];
+		};
+
+		Shard shard_list[shards];
+	};
+
+	/**
+	 * Slot lock that was acquired
+	 */
+	enum LockKind : uint8_t {
+		VAL_LOCK = 0,
+		META_LOCK = 1
+	};
+
+	/**
+	 * Contention of a single key on a slot lock
+	 *
+	 * Counts are estimated (SpaceSaving), the true count is between count - error and count.
+	 */
+	struct LockHotspot {
+		string key;
+		LockKind kind;
+		uint64_t count;
+		uint64_t error;
+		// Sampled wait time, scaled by the sample rate
+		uint64_t wait_ns;
+	};
+
+	/**
+	 * Aggregated lock statistics
+	 */
+	struct LockSnapshot {
+		// False if the map was compiled without HYPERMAP_LOCK_STATS
+		bool enabled = false;
+		// Acquisitions that had to wait for the lock (per LockKind)
+		uint64_t contended[2] = {};
+		// Total time spent waiting for the lock (per LockKind)
+		uint64_t wait_ns[2] = {};
+		// Longest single wait (per LockKind)
+		uint64_t max_wait_ns[2] = {};
+		// Most contended keys, ordered by count (an empty key is a free slot passed by a probe)
+		vector<LockHotspot> hotspots;
+	};
+
+	/**
+	 * Profiler for the slot locks of all HyperMaps in the process
+	 *
+	 * Locks are acquired with try_lock first, only if that fails the wait is timed with the TSC.
+	 * Uncontended acquisitions therefore cost nothing extra.
+	 * Every sample_rate'th contended acquisition of a thread is added to a SpaceSaving top-K of keys,
+	 * the totals are recorded for every contended acquisition in sharded counters.
+	 */
+	class LockProfiler {
+	public:
+		static constexpr size_t shards = 32;
+		static constexpr size_t top_k = 32;
+
+		/**
+		 * Returns the process wide profiler
+		 */
+		static LockProfiler& global() {
+			static LockProfiler profiler;
+			return profiler;
+		};
+
+		/**
+		 * Sets how many contended acquisitions are counted per top-K sample (1 samples every acquisition)
+		 */
+		void set_sample_rate(uint32_t rate) noexcept {
+			sample_rate.store(rate ? rate : 1, memory_order_relaxed);
+		};
+
+		/**
+		 * Acquires the lock, the key must only be read when the lock is held
+		 */
+		template <typename Lock_T>
+		void acquire(Lock_T& lock, LockKind kind, const string& key) {
+			if (lock.try_lock()) return;
+
+			const uint64_t start = ticks();
+			lock.lock();
+			const uint64_t wait = ticks() - start;
+
+			Shard& shard = local();
+			shard.contended[kind].fetch_add(1, memory_order_relaxed);
+			shard.wait_ticks[kind].fetch_add(wait, memory_order_relaxed);
+			uint64_t max = shard.max_wait_ticks[kind].load(memory_order_relaxed);
+			while (wait > max && !shard.max_wait_ticks[kind].compare_exchange_weak(max, wait, memory_order_relaxed));
+
+			thread_local uint32_t sample_counter = 0;
+			const uint32_t rate = sample_rate.load(memory_order_relaxed);
+			if (++sample_counter >= rate) {
+				sample_counter = 0;
+				record_hotspot(kind, key, rate, wait * rate);
+			}
+		};
+
+		/**
+		 * Aggregates all counters and returns the hotspots ordered by count
+		 */
+		LockSnapshot snapshot() const {
+			LockSnapshot snap;
+			snap.enabled = true;
+			const double ns_per_tick = tick_ns();
+			for (const Shard& shard : shard_list) {
+				for (size_t k = 0; k < 2; k++) {
+					snap.contended[k] += shard.contended[k].load(memory_order_relaxed);
+					snap.wait_ns[k] += static_cast<uint64_t>(shard.wait_ticks[k].load(memory_order_relaxed) * ns_per_tick);
+					snap.max_wait_ns[k] = std::max(snap.max_wait_ns[k],
+						static_cast<uint64_t>(shard.max_wait_ticks[k].load(memory_order_relaxed) * ns_per_tick));
+				}
+			}
+			{
+				const lock_guard<mutex> lock(top_lock);
+				for (const Entry& entry : top) {
+					snap.hotspots.push_back(LockHotspot{entry.key, entry.kind, entry.count, entry.error,
+						static_cast<uint64_t>(entry.wait_ticks * ns_per_tick)});
+				}
+			}
+			sort(snap.hotspots.begin(), snap.hotspots.end(), [](const LockHotspot& a, const LockHotspot& b) {
+				return a.count > b.count;
+			});
+			return snap;
+		};
+
+		/**
+		 * Resets all counters and hotspots (concurrent recordings may be lost)
+		 */
+		void reset() {
+			for (Shard& shard : shard_list) {
+				for (size_t k = 0; k < 2; k++) {
+					shard.contended[k].store(0, memory_order_relaxed);
+					shard.wait_ticks[k].store(0, memory_order_relaxed);
+					shard.max_wait_ticks[k].store(0, memory_order_relaxed);
+				}
+			}
+			const lock_guard<mutex> lock(top_lock);
+			top.clear();
+		};
+
+	private:
+		struct alignas(64) Shard {
+			atomic<uint64_t> contended[2] = {};
+			atomic<uint64_t> wait_ticks[2] = {};
+			atomic<uint64_t> max_wait_ticks[2] = {};
+		};
+
+		struct Entry {
+			string key;
+			LockKind kind;
+			uint64_t count;
+			uint64_t error;
+			uint64_t wait_ticks;
+		};
+
+		LockProfiler() = default;
+
+		static uint64_t ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#else
+			return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+		};
+
+		// Nanoseconds per tick, the TSC is calibrated once against the steady clock
+		static double tick_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+			static const double ns_per_tick = [] {
+				const auto start = chrono::steady_clock::now();
+				const uint64_t start_ticks = ticks();
+				this_thread::sleep_for(chrono::milliseconds(10));
+				const double ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+				return ns / static_cast<double>(ticks() - start_ticks);
+			}();
+			return ns_per_tick;
+#else
+			return 1e9 * chrono::steady_clock::period::num / chrono::steady_clock::period::den;
+#endif
+		};
+
+		Shard& local() noexcept {
+			static atomic<size_t> next_shard = 0;
+			thread_local const size_t idx = next_shard.fetch_add(1, memory_order_relaxed) & (shards - 1);
+			return shard_list[idx];
+		};
+
+		// SpaceSaving update: an unknown key replaces the entry with the lowest count and inherits it as error
+		void record_hotspot(LockKind kind, const string& key, uint64_t weight, uint64_t wait) {
+			const lock_guard<mutex> lock(top_lock);
+			Entry* min = nullptr;
+			for (Entry& entry : top) {
+				if (entry.kind == kind && entry.key == key) {
+					entry.count += weight;
+					entry.wait_ticks += wait;
+					return;
+				}
+				if (!min || entry.count < min->count) min = &entry;
+			}
+			if (top.size() < top_k) {
+				top.push_back(Entry{key, kind, weight, 0, wait});
+				return;
+			}
+			*min = Entry{key, kind, min->count + weight, min->count, wait};
+		};
+
+		atomic<uint32_t> sample_rate = 16;
+		Shard shard_list[shards];
+		mutable mutex top_lock;
+		vector<Entry> top;
+	};
+
+	/**
+	 * Stats report
+	 *
+	 * The snapshots are appended as "name:value" lines (CRLF terminated, like the sections of Redis INFO),
+	 * so they can be returned to clients and parsed line by line.
+	 */
+	namespace info {
+		inline void line(string& out, const char* name, uint64_t val) {
+			char buffer[96];
+			const int len = snprintf(buffer, sizeof(buffer), "%s:%llu\r\n", name, static_cast<unsigned long long>(val));
+			out.append(buffer, static_cast<size_t>(len));
+		}
+
+		inline void line(string& out, const char* name, double val) {
+			char buffer[96];
+			const int len = snprintf(buffer, sizeof(buffer), "%s:%.6f\r\n", name, val);
+			out.append(buffer, static_cast<size_t>(len));
+		}
+
+		// Histogram as comma separated "lower bound=count" pairs of the non empty buckets
+		inline void histogram(string& out, const char* name, const uint64_t (&hist)[ProbeSnapshot::buckets]) {
+			out.append(name);
+			out.push_back(':');
+			bool first = true;
+			for (size_t i = 0; i < ProbeSnapshot::buckets; i++) {
+				if (!hist[i]) continue;
+				if (!first) out.push_back(',');
+				first = false;
+				out.append(to_string(uint64_t(1) << i) + "=" + to_string(hist[i]));
+			}
+			out.append("\r\n");
+		}
+
+		// Keys are escaped, bytes outside of the printable range, ',' and backslash are written as \xHH
+		inline void key(string& out, string_view key) {
+			static constexpr char hex[] = "0123456789abcdef";
+			for (const char c : key) {
+				const unsigned char b = static_cast<unsigned char>(c);
+				if (b >= 0x20 && b < 0x7f && c != ',' && c != '\\') {
+					out.push_back(c);
+					continue;
+				}
+				out.append("\\x");
+				out.push_back(hex[b >> 4]);
+				out.push_back(hex[b & 0xf]);
+			}
+		}
+	}
+
+	/**
+	 * Appends the probe statistics to the report
+	 *
+	 *   probe_stats:1  load_factor:0.5  tombstone_factor:0.01  max_probe:12  insert_failures:0
+	 *   probe_hits:N  probe_misses:N  probe_hit_hist:1=N,2=N,...  probe_miss_hist:1=N,...
+	 *
+	 * The histogram keys are the lower bounds of the buckets. Without HYPERMAP_PROBE_STATS only the gauges are appended.
+	 */
+	inline void append_info(string& out, const ProbeSnapshot& snap) {
+		info::line(out, "probe_stats", static_cast<uint64_t>(snap.enabled));
+		info::line(out, "load_factor", snap.load_factor);
+		info::line(out, "tombstone_factor", snap.tombstone_factor);
+		if (!snap.enabled) return;
+		info::line(out, "max_probe", snap.max_probe);
+		info::line(out, "insert_failures", snap.insert_failures);
+		info::line(out, "probe_hits", snap.hits());
+		info::line(out, "probe_misses", snap.misses());
+		info::histogram(out, "probe_hit_hist", snap.hit_hist);
+		info::histogram(out, "probe_miss_hist", snap.miss_hist);
+	}
+
+	/**
+	 * Appends the lock statistics to the report
+	 *
+	 *   lock_stats:1  val_contended:N  val_wait_ns:N  val_max_wait_ns:N  meta_contended:N ...
+	 *   hotspot_<i>:lock=val,count=N,error=N,wait_ns=N,key=<escaped key>   (ordered by count)
+	 *
+	 * Without HYPERMAP_LOCK_STATS only lock_stats:0 is appended.
+	 */
+	inline void append_info(string& out, const LockSnapshot& snap) {
+		info::line(out, "lock_stats", static_cast<uint64_t>(snap.enabled));
+		if (!snap.enabled) return;
+		static constexpr const char* kinds[2] = {"val", "meta"};
+		for (size_t k = 0; k < 2; k++) {
+			const string kind = kinds[k];
+			info::line(out, (kind + "_contended").c_str(), snap.contended[k]);
+			info::line(out, (kind + "_wait_ns").c_str(), snap.wait_ns[k]);
+			info::line(out, (kind + "_max_wait_ns").c_str(), snap.max_wait_ns[k]);
+		}
+		for (size_t i = 0; i < snap.hotspots.size(); i++) {
+			const LockHotspot& spot = snap.hotspots[i];
+			out.append("hotspot_" + to_string(i) + ":lock=" + kinds[spot.kind] + ",count=" + to_string(spot.count) +
+				",error=" + to_string(spot.error) + ",wait_ns=" + to_string(spot.wait_ns) + ",key=");
+			info::key(out, spot.key);
+			out.append("\r\n");
+		}
+	}
+}
+
+#endif
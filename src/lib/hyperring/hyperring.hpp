@@ -0,0 +1,336 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERRING_H
+#define HYPERRING_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * HyperRing
+ *
+ * Minimal io_uring binding on top of the raw system calls (no liburing).
+ *
+ * Ring owns the submission and completion queue of one io_uring instance, BufferRing registers a
+ * provided buffer ring that the kernel picks receive buffers from (IOSQE_BUFFER_SELECT).
+ * Neither is thread safe, a ring belongs to the thread that submits to it
+ * (it is set up with IORING_SETUP_SINGLE_ISSUER and IORING_SETUP_DEFER_TASKRUN if the kernel supports it).
+ * A ring can be set up and registered by one thread and run by another, the running thread calls enable() first.
+ */
+namespace hyperring {
+	inline int setup(unsigned entries, io_uring_params* params) {
+		return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+	}
+
+	inline int enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+		return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+	}
+
+	inline int register_ring(int fd, unsigned opcode, const void* arg, unsigned count) {
+		return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+	}
+
+	class Ring {
+	public:
+		/**
+		 * Sets up a ring with the given number of submission entries
+		 *
+		 * Throws a system_error if the kernel does not support io_uring (or it is disabled).
+		 */
+		explicit Ring(unsigned entries) {
+			io_uring_params params{};
+			// The submitter of a single issuer ring is bound by enable()
+			params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+			fd = setup(entries, &params);
+			if (fd < 0 && errno == EINVAL) {
+				// Kernels before 6.1 do not know the task run flags
+				params = io_uring_params{};
+				fd = setup(entries, &params);
+			}
+			disabled = params.flags & IORING_SETUP_R_DISABLED;
+			if (fd < 0) throw system_error(errno, system_category(), "io_uring_setup");
+			if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+				close(fd);
+				throw runtime_error("io_uring lacks IORING_FEAT_SINGLE_MMAP or IORING_FEAT_NODROP");
+			}
+
+			ring_size = max<size_t>(params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+				params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+			ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (ring == MAP_FAILED) {
+				const int err = errno;
+				close(fd);
+				throw system_error(err, system_category(), "io_uring mmap");
+			}
+			sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+			if (sqes_map == MAP_FAILED) {
+				const int err = errno;
+				munmap(ring, ring_size);
+				close(fd);
+				throw system_error(err, system_category(), "io_uring mmap");
+			}
+			sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+			uint8_t* base = static_cast<uint8_t*>(ring);
+			sq_head = reinterpret_cast<uint32_t*>(base + params.sq_off.head);
+			sq_tail = reinterpret_cast<uint32_t*>(base + params.sq_off.tail);
+			sq_mask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+			sq_entries = params.sq_entries;
+			cq_head = reinterpret_cast<uint32_t*>(base + params.cq_off.head);
+			cq_tail = reinterpret_cast<uint32_t*>(base + params.cq_off.tail);
+			cq_mask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+			// The index array maps every slot to the sqe with the same index
+			uint32_t* array = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+			for (uint32_t i = 0; i < sq_entries; i++) array[i] = i;
+			tail = submitted = *sq_tail;
+		};
+
+		Ring(const Ring&) = delete;
+		Ring& operator=(const Ring&) = delete;
+
+		~Ring() {
+			munmap(sqes, sqes_size);
+			munmap(ring, ring_size);
+			close(fd);
+		};
+
+		int descriptor() const noexcept {
+			return fd;
+		};
+
+		/**
+		 * Binds the ring to the calling thread, must be called before the first submit()
+		 */
+		void enable() {
+			if (!disabled) return;
+			if (register_ring(fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0)
+				throw system_error(errno, system_category(), "io_uring enable");
+			disabled = false;
+		};
+
+		/**
+		 * Returns a zeroed submission entry
+		 *
+		 * Entries are only handed to the kernel by submit(), if the queue is full the queued entries are submitted first.
+		 */
+		io_uring_sqe* sqe() {
+			if (tail - atomic_ref<uint32_t>(*sq_head).load(memory_order_acquire) == sq_entries) submit(0);
+			io_uring_sqe* entry = &sqes[tail & sq_mask];
+			tail++;
+			memset(entry, 0, sizeof(io_uring_sqe));
+			return entry;
+		};
+
+		/**
+		 * Submits all queued entries with one system call and waits until at least wait completions are available
+		 *
+		 * Returns the number of submitted entries, interrupted waits return early.
+		 */
+		unsigned submit(unsigned wait) {
+			const unsigned count = tail - submitted;
+			atomic_ref<uint32_t>(*sq_tail).store(tail, memory_order_release);
+			submitted = tail;
+			const int result = enter(fd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+			if (result < 0) {
+				if (errno == EINTR || errno == EAGAIN || errno == EBUSY) return 0;
+				throw system_error(errno, system_category(), "io_uring_enter");
+			}
+			return static_cast<unsigned>(result);
+		};
+
+		/**
+		 * Calls handler(const io_uring_cqe&) for every available completion and consumes them
+		 */
+		template <typename Handler_T>
+		unsigned drain(Handler_T&& handler) {
+			uint32_t head = *cq_head;
+			const uint32_t end = atomic_ref<uint32_t>(*cq_tail).load(memory_order_acquire);
+			for (; head != end; head++) {
+				const io_uring_cqe cqe = cqes[head & cq_mask];
+				handler(cqe);
+			}
+			const unsigned count = head - *cq_head;
+			atomic_ref<uint32_t>(*cq_head).store(head, memory_order_release);
+			return count;
+		};
+
+		/**
+		 * Registers a sparse table of count direct descriptors (see IORING_FILE_INDEX_ALLOC)
+		 */
+		void register_files(unsigned count) {
+			io_uring_rsrc_register reg{};
+			reg.nr = count;
+			reg.flags = IORING_RSRC_REGISTER_SPARSE;
+			if (register_ring(fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0)
+				throw system_error(errno, system_category(), "io_uring register files");
+		};
+
+		/**
+		 * Returns true if the kernel supports every opcode of the list
+		 */
+		bool supports(const vector<uint8_t>& opcodes) const {
+			vector<uint8_t> memory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+			io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+			if (register_ring(fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+			for (uint8_t opcode : opcodes) {
+				if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) return false;
+			}
+			return true;
+		};
+
+	private:
+		int fd;
+		void* ring;
+		size_t ring_size;
+		io_uring_sqe* sqes;
+		size_t sqes_size;
+		uint32_t* sq_head;
+		uint32_t* sq_tail;
+		uint32_t sq_mask;
+		uint32_t sq_entries;
+		uint32_t* cq_head;
+		uint32_t* cq_tail;
+		uint32_t cq_mask;
+		io_uring_cqe* cqes;
+		// Local tail of the submission queue, [submitted, tail) is queued but not submitted
+		uint32_t tail;
+		uint32_t submitted;
+		bool disabled;
+	};
+
+	/**
+	 * BufferRing provides count buffers of size bytes to the kernel (IORING_REGISTER_PBUF_RING)
+	 *
+	 * Receives with IOSQE_BUFFER_SELECT and the group of the ring take a buffer when data arrives,
+	 * the completion carries the buffer id (cqe.flags >> IORING_CQE_BUFFER_SHIFT).
+	 * Consumed buffers are handed back with recycle() and published in one step with publish().
+	 */
+	class BufferRing {
+	public:
+		BufferRing(Ring& ring, uint16_t group, uint16_t count, uint32_t size)
+			: ring(ring), group(group), count(count), size(size), mask(count - 1), memory(size_t(count) * size) {
+			if (!count || (count & (count - 1))) throw invalid_argument("BufferRing count must be a power of two");
+			entries_size = count * sizeof(io_uring_buf);
+			void* entries_map = mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (entries_map == MAP_FAILED) throw system_error(errno, system_category(), "BufferRing mmap");
+			// The ring is accessed as plain io_uring_buf array, the flexible array of io_uring_buf_ring
+			// is wrapped in an empty struct that is not empty in C++ (the bufs would be shifted by 8 bytes)
+			entries = static_cast<io_uring_buf*>(entries_map);
+
+			io_uring_buf_reg reg{};
+			reg.ring_addr = reinterpret_cast<uint64_t>(entries);
+			reg.ring_entries = count;
+			reg.bgid = group;
+			if (register_ring(ring.descriptor(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+				const int err = errno;
+				munmap(entries, entries_size);
+				throw system_error(err, system_category(), "io_uring register buffer ring");
+			}
+			for (uint16_t id = 0; id < count; id++) recycle(id);
+			publish();
+		};
+
+		BufferRing(const BufferRing&) = delete;
+		BufferRing& operator=(const BufferRing&) = delete;
+
+		~BufferRing() {
+			io_uring_buf_reg reg{};
+			reg.bgid = group;
+			register_ring(ring.descriptor(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+			munmap(entries, entries_size);
+		};
+
+		uint16_t id() const noexcept {
+			return group;
+		};
+
+		/**
+		 * Returns the buffer with the id
+		 */
+		const uint8_t* buffer(uint16_t id) const noexcept {
+			return memory.data() + size_t(id) * size;
+		};
+
+		/**
+		 * Hands the buffer back to the kernel (visible after publish())
+		 */
+		void recycle(uint16_t id) noexcept {
+			io_uring_buf* entry = &entries[(tail + pending) & mask];
+			entry->addr = reinterpret_cast<uint64_t>(memory.data() + size_t(id) * size);
+			entry->len = size;
+			entry->bid = id;
+			pending++;
+		};
+
+		void publish() noexcept {
+			if (!pending) return;
+			tail += pending;
+			pending = 0;
+			// The tail overlays the reserved field of the first entry
+			atomic_ref<uint16_t>(entries[0].resv).store(tail, memory_order_release);
+		};
+
+	private:
+		Ring& ring;
+		uint16_t group;
+		uint16_t count;
+		uint32_t size;
+		uint16_t mask;
+		vector<uint8_t> memory;
+		io_uring_buf* entries;
+		size_t entries_size;
+		uint16_t tail = 0;
+		uint16_t pending = 0;
+	};
+
+	/**
+	 * Returns true if the kernel supports the features used by the hypercache backends
+	 *
+	 * Multishot receive was added in the same release as IORING_OP_SEND_ZC (6.0), the probe uses it as marker.
+	 */
+	inline bool supported() noexcept {
+		try {
+			Ring ring(8);
+			ring.enable();
+			if (!ring.supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_CLOSE,
+				IORING_OP_ASYNC_CANCEL, IORING_OP_READ, IORING_OP_SEND_ZC})) return false;
+			ring.register_files(8);
+			BufferRing buffers(ring, 0, 8, 64);
+			return true;
+		} catch (const exception&) {
+			return false;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,538 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HYPERSHM_H
+#define HYPERSHM_H
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lib/protocol/protocol.hpp"
+
+using namespace std;
+
+/**
+ * HyperShm
+ *
+ * Shared memory transport of the native protocol for clients on the same host.
+ *
+ * A channel is a memfd with a control page and two single producer / single consumer byte rings
+ * (requests: client -> server, responses: server -> client) that carry the frames of the native protocol unchanged.
+ * Each ring is mapped twice back to back, so every readable or writable range is contiguous in memory
+ * and frames that wrap around the end of the ring can be parsed in place.
+ *
+ * Both sides busy poll for a short time before they sleep, a sleeping side sets its flag in the control page
+ * and waits on its eventfd. After making progress (producing or consuming bytes) a side wakes its peer
+ * if the peer sleeps (see Channel::notify()).
+ *
+ * The server hands out channels on a Unix socket: it creates the memfd and the eventfds for every connection
+ * and passes them with SCM_RIGHTS (see send_channel() and Client). The connection stays open for the lifetime
+ * of the channel, closing it ends the channel.
+ */
+namespace hypershm {
+	inline static constexpr uint64_t magic = 0x68797065'72736801;
+	inline static constexpr size_t page_size = 4096;
+
+	static_assert(atomic<uint64_t>::is_always_lock_free, "HyperShm requires lock free 64 bit atomics");
+
+	/**
+	 * Control page at the start of the memfd
+	 *
+	 * The indices count bytes since the creation of the channel (they never wrap).
+	 */
+	struct Control {
+		uint64_t magic;
+		uint64_t ring_size;
+		alignas(64) atomic<uint64_t> request_head;
+		alignas(64) atomic<uint64_t> request_tail;
+		alignas(64) atomic<uint64_t> response_head;
+		alignas(64) atomic<uint64_t> response_tail;
+		alignas(64) atomic<uint32_t> server_sleeping;
+		alignas(64) atomic<uint32_t> client_sleeping;
+	};
+	static_assert(sizeof(Control) <= page_size, "Control must fit into one page");
+
+	/**
+	 * Ring is one direction of a channel
+	 */
+	class Ring {
+	public:
+		Ring() = default;
+		Ring(uint8_t* data, size_t size, atomic<uint64_t>* head, atomic<uint64_t>* tail)
+			: data(data), size(size), head(head), tail(tail) {};
+
+		/**
+		 * Returns the number of bytes that can be read (consumer side)
+		 */
+		size_t readable() const noexcept {
+			return static_cast<size_t>(tail->load(memory_order_acquire) - head->load(memory_order_relaxed));
+		};
+
+		/**
+		 * Returns the readable bytes (contiguous, readable() bytes)
+		 */
+		const uint8_t* read_data() const noexcept {
+			return data + (head->load(memory_order_relaxed) & (size - 1));
+		};
+
+		void consume(size_t count) noexcept {
+			head->store(head->load(memory_order_relaxed) + count, memory_order_release);
+		};
+
+		/**
+		 * Returns the number of bytes that can be written (producer side)
+		 */
+		size_t writable() const noexcept {
+			return size - static_cast<size_t>(tail->load(memory_order_relaxed) - head->load(memory_order_acquire));
+		};
+
+		/**
+		 * Returns the writable space (contiguous, writable() bytes)
+		 */
+		uint8_t* write_data() const noexcept {
+			return data + (tail->load(memory_order_relaxed) & (size - 1));
+		};
+
+		void produce(size_t count) noexcept {
+			tail->store(tail->load(memory_order_relaxed) + count, memory_order_release);
+		};
+
+		size_t capacity() const noexcept {
+			return size;
+		};
+
+	private:
+		uint8_t* data = nullptr;
+		size_t size = 0;
+		atomic<uint64_t>* head = nullptr;
+		atomic<uint64_t>* tail = nullptr;
+	};
+
+	/**
+	 * Channel maps the shared memory of one client and owns its descriptors
+	 */
+	class Channel {
+	public:
+		enum Side {
+			SERVER,
+			CLIENT,
+		};
+
+		/**
+		 * Creates a new channel (server side) with rings of ring_size bytes
+		 *
+		 * The ring size must be a power of two and a multiple of the page size.
+		 * Throws a system_error if the memfd or the eventfds can not be created.
+		 */
+		static Channel create(size_t ring_size) {
+			if (ring_size < page_size || (ring_size & (ring_size - 1)))
+				throw invalid_argument("Channel ring size must be a power of two and a multiple of the page size");
+			Channel channel(SERVER);
+			channel.memfd = memfd_create("hypercache", MFD_CLOEXEC);
+			if (channel.memfd < 0) throw system_error(errno, system_category(), "memfd_create");
+			if (ftruncate(channel.memfd, static_cast<off_t>(page_size + 2 * ring_size)) < 0)
+				throw system_error(errno, system_category(), "ftruncate");
+			channel.server_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			channel.client_event = eventfd(0, EFD_CLOEXEC);
+			if (channel.server_event < 0 || channel.client_event < 0) throw system_error(errno, system_category(), "eventfd");
+			channel.map(ring_size);
+			channel.control->magic = magic;
+			channel.control->ring_size = ring_size;
+			return channel;
+		};
+
+		/**
+		 * Attaches to the descriptors received from the server (client side), takes their ownership
+		 *
+		 * Throws a runtime_error if the memfd does not contain a channel.
+		 */
+		static Channel attach(int memfd, int server_event, int client_event) {
+			Channel channel(CLIENT);
+			channel.memfd = memfd;
+			channel.server_event = server_event;
+			channel.client_event = client_event;
+			struct stat info{};
+			if (fstat(memfd, &info) < 0) throw system_error(errno, system_category(), "fstat");
+			if (static_cast<size_t>(info.st_size) < page_size) throw runtime_error("Channel memory is truncated");
+			const size_t ring_size = (static_cast<size_t>(info.st_size) - page_size) / 2;
+			if (ring_size < page_size || (ring_size & (ring_size - 1))) throw runtime_error("Channel memory has an invalid size");
+			channel.map(ring_size);
+			if (channel.control->magic != magic || channel.control->ring_size != ring_size)
+				throw runtime_error("Channel memory does not contain a channel");
+			return channel;
+		};
+
+		Channel(Channel&& other) noexcept {
+			*this = std::move(other);
+		};
+
+		Channel& operator=(Channel&& other) noexcept {
+			if (this == &other) return *this;
+			release();
+			side = other.side;
+			memfd = exchange(other.memfd, -1);
+			server_event = exchange(other.server_event, -1);
+			client_event = exchange(other.client_event, -1);
+			control = exchange(other.control, nullptr);
+			mapped = exchange(other.mapped, vector<pair<void*, size_t>>());
+			requests = other.requests;
+			responses = other.responses;
+			return *this;
+		};
+
+		Channel(const Channel&) = delete;
+		Channel& operator=(const Channel&) = delete;
+
+		~Channel() {
+			release();
+		};
+
+		/**
+		 * Returns the ring this side reads from
+		 */
+		Ring& inbound() noexcept {
+			return side == SERVER ? requests : responses;
+		};
+
+		/**
+		 * Returns the ring this side writes to
+		 */
+		Ring& outbound() noexcept {
+			return side == SERVER ? responses : requests;
+		};
+
+		/**
+		 * Returns the eventfd this side sleeps on
+		 */
+		int event() const noexcept {
+			return side == SERVER ? server_event : client_event;
+		};
+
+		/**
+		 * Releases the eventfd of this side (the caller takes its ownership)
+		 */
+		int release_event() noexcept {
+			return exchange(side == SERVER ? server_event : client_event, -1);
+		};
+
+		/**
+		 * Returns the descriptors that are passed to the client (memfd, server eventfd, client eventfd)
+		 */
+		array<int, 3> descriptors() const noexcept {
+			return {memfd, server_event, client_event};
+		};
+
+		/**
+		 * Wakes the peer if it sleeps, called after this side produced or consumed bytes
+		 */
+		void notify() const noexcept {
+			atomic<uint32_t>& peer = side == SERVER ? control->client_sleeping : control->server_sleeping;
+			// Orders the ring update before the flag check (pairs with the fence in sleep())
+			atomic_thread_fence(memory_order_seq_cst);
+			if (!peer.load(memory_order_relaxed)) return;
+			const uint64_t value = 1;
+			[[maybe_unused]] const ssize_t written = ::write(side == SERVER ? client_event : server_event, &value, sizeof(value));
+		};
+
+		/**
+		 * Announces that this side is about to sleep
+		 *
+		 * The caller must check for work after this call and only wait on event() if there is none,
+		 * a peer that makes progress afterwards sees the flag and wakes it.
+		 */
+		void sleep() noexcept {
+			own_flag().store(1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+		};
+
+		void wake() noexcept {
+			own_flag().store(0, memory_order_relaxed);
+		};
+
+	private:
+		explicit Channel(Side side) : side(side) {};
+
+		atomic<uint32_t>& own_flag() noexcept {
+			return side == SERVER ? control->server_sleeping : control->client_sleeping;
+		};
+
+		/**
+		 * Maps the control page and both rings (each ring twice back to back)
+		 */
+		void map(size_t ring_size) {
+			void* page = mmap(nullptr, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+			if (page == MAP_FAILED) throw system_error(errno, system_category(), "mmap");
+			mapped.emplace_back(page, page_size);
+			control = static_cast<Control*>(page);
+			uint8_t* request_data = map_ring(page_size, ring_size);
+			uint8_t* response_data = map_ring(page_size + ring_size, ring_size);
+			requests = Ring(request_data, ring_size, &control->request_head, &control->request_tail);
+			responses = Ring(response_data, ring_size, &control->response_head, &control->response_tail);
+		};
+
+		uint8_t* map_ring(size_t offset, size_t size) {
+			void* area = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (area == MAP_FAILED) throw system_error(errno, system_category(), "mmap");
+			mapped.emplace_back(area, 2 * size);
+			uint8_t* base = static_cast<uint8_t*>(area);
+			for (uint8_t* half : {base, base + size}) {
+				if (mmap(half, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, static_cast<off_t>(offset)) == MAP_FAILED)
+					throw system_error(errno, system_category(), "mmap");
+			}
+			return base;
+		};
+
+		void release() noexcept {
+			for (const auto& [address, size] : mapped) munmap(address, size);
+			mapped.clear();
+			for (int fd : {memfd, server_event, client_event}) if (fd >= 0) ::close(fd);
+			memfd = server_event = client_event = -1;
+		};
+
+		Side side;
+		int memfd = -1;
+		int server_event = -1;
+		int client_event = -1;
+		Control* control = nullptr;
+		vector<pair<void*, size_t>> mapped;
+		Ring requests;
+		Ring responses;
+	};
+
+	/**
+	 * Sends the descriptors of the channel over the connected Unix socket (server side)
+	 */
+	inline void send_channel(int socket, const Channel& channel) {
+		const array<int, 3> fds = channel.descriptors();
+		uint64_t payload = magic;
+		iovec iov{&payload, sizeof(payload)};
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+		msghdr message{};
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(header), fds.data(), sizeof(fds));
+		if (sendmsg(socket, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(payload)))
+			throw system_error(errno, system_category(), "sendmsg");
+	}
+
+	/**
+	 * Client of a shared memory channel
+	 *
+	 * The client connects to the channel socket of the server and attaches to the received channel.
+	 * It is a byte stream of native protocol frames (write() and read_some()), get(), set() and del() are
+	 * blocking single request helpers. A client must only be used by one thread at a time.
+	 */
+	class Client {
+	public:
+		/**
+		 * Connects to the channel socket at path, polls for spin before sleeping on a response
+		 *
+		 * Polling is disabled on a single core (the server can not make progress while the client polls).
+		 * Throws a system_error if the socket can not be connected and a runtime_error if the server sends no channel.
+		 */
+		explicit Client(const string& path, chrono::nanoseconds spin = chrono::microseconds(50))
+			: spin(thread::hardware_concurrency() > 1 ? spin : chrono::nanoseconds(0)), channel(connect(path, socket)) {};
+
+		Client(const Client&) = delete;
+		Client& operator=(const Client&) = delete;
+
+		~Client() {
+			::close(socket);
+		};
+
+		/**
+		 * Writes all bytes to the request ring (waits for space if the ring is full, throws if the channel was closed)
+		 */
+		void write(const uint8_t* data, size_t size) {
+			Ring& ring = channel.outbound();
+			while (size) {
+				const size_t count = min(size, ring.writable());
+				if (!count) {
+					wait([&] { return ring.writable() > 0; });
+					continue;
+				}
+				memcpy(ring.write_data(), data, count);
+				ring.produce(count);
+				channel.notify();
+				data += count;
+				size -= count;
+			}
+		};
+
+		/**
+		 * Reads at least one and up to size bytes from the response ring (waits if the ring is empty, throws if the channel was closed)
+		 */
+		size_t read_some(uint8_t* data, size_t size) {
+			Ring& ring = channel.inbound();
+			wait([&] { return ring.readable() > 0; });
+			const size_t count = min(size, ring.readable());
+			memcpy(data, ring.read_data(), count);
+			ring.consume(count);
+			channel.notify();
+			return count;
+		};
+
+		/**
+		 * Returns the value of key (nullopt if the key does not exist)
+		 *
+		 * Throws a runtime_error if the request fails.
+		 */
+		optional<string> get(string_view key) {
+			request(protocol::GET, {}, key);
+			if (status == protocol::NOT_FOUND) return nullopt;
+			return string(reinterpret_cast<const char*>(body.data()), body.size());
+		};
+
+		void set(string_view key, string_view value) {
+			request(protocol::SET, key, value);
+		};
+
+		void del(string_view key) {
+			request(protocol::DEL, {}, key);
+		};
+
+	private:
+		static Channel connect(const string& path, int& socket) {
+			sockaddr_un address{};
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path)) throw invalid_argument("Socket path is too long");
+			memcpy(address.sun_path, path.data(), path.size());
+			socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (socket < 0) throw system_error(errno, system_category(), "socket");
+			if (::connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+				const int err = errno;
+				::close(socket);
+				throw system_error(err, system_category(), "connect " + path);
+			}
+
+			uint64_t payload = 0;
+			iovec iov{&payload, sizeof(payload)};
+			alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+			msghdr message{};
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+			const ssize_t received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+			const cmsghdr* header = CMSG_FIRSTHDR(&message);
+			if (received != sizeof(payload) || payload != magic || !header || header->cmsg_type != SCM_RIGHTS ||
+				header->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+				::close(socket);
+				throw runtime_error("Server did not send a channel");
+			}
+			int fds[3];
+			memcpy(fds, CMSG_DATA(header), sizeof(fds));
+			return Channel::attach(fds[0], fds[1], fds[2]);
+		};
+
+		/**
+		 * Waits until ready() returns true: busy polls for spin, then sleeps on the eventfd
+		 *
+		 * Throws a runtime_error if the server closed the channel.
+		 */
+		template <typename Ready_T>
+		void wait(Ready_T&& ready) {
+			if (ready()) return;
+			const auto deadline = chrono::steady_clock::now() + spin;
+			while (chrono::steady_clock::now() < deadline) {
+				if (ready()) return;
+			}
+			for (;;) {
+				channel.sleep();
+				if (ready()) break;
+				// The server never writes to the socket, a readable socket means that the channel was closed
+				pollfd fds[2] = {{channel.event(), POLLIN, 0}, {socket, POLLIN, 0}};
+				if (::poll(fds, 2, -1) < 0 && errno != EINTR) throw system_error(errno, system_category(), "poll");
+				if (fds[1].revents) {
+					channel.wake();
+					throw runtime_error("Channel was closed by the server");
+				}
+				uint64_t value;
+				if (fds[0].revents && ::read(channel.event(), &value, sizeof(value)) < 0 && errno != EINTR)
+					throw system_error(errno, system_category(), "read eventfd");
+			}
+			channel.wake();
+		};
+
+		/**
+		 * Sends a request with an optional length prefixed field and the last field, reads the response into body
+		 */
+		void request(protocol::Op op, string_view field, string_view last) {
+			frame.clear();
+			protocol::Writer writer(frame);
+			writer.begin(++id, op);
+			if (op == protocol::SET) writer.str(field);
+			writer.raw(last);
+			writer.end();
+			write(frame.data(), frame.size());
+
+			uint8_t header[protocol::header_size];
+			read_all(header, sizeof(header));
+			const size_t length = protocol::get_u32(header);
+			if (length < protocol::header_size - protocol::length_size) throw runtime_error("Invalid response frame");
+			body.resize(length + protocol::length_size - protocol::header_size);
+			read_all(body.data(), body.size());
+			status = header[protocol::header_size - 1];
+			if (status != protocol::OK && status != protocol::NOT_FOUND)
+				throw runtime_error("Request failed: " + string(reinterpret_cast<const char*>(body.data()), body.size()));
+		};
+
+		void read_all(uint8_t* data, size_t size) {
+			while (size) {
+				const size_t count = read_some(data, size);
+				data += count;
+				size -= count;
+			}
+		};
+
+		chrono::nanoseconds spin;
+		int socket = -1;
+		Channel channel;
+		uint32_t id = 0;
+		vector<uint8_t> frame;
+		vector<uint8_t> body;
+		uint8_t status = protocol::OK;
+	};
+}
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * HyperCache System
+ *
+ * Copyright (C) 2024  Linus Ilian Moser <linus.moser@megakuul.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Native binary protocol of hypercache_db (also spoken between hypercache_proxy and the db shards)
+ *
+ * All integers are little endian. Every message is a frame:
+ *
+ *   request:  [u32 length][u32 id][u8 op][payload]
+ *   response: [u32 length][u32 id][u8 status][body]
+ *
+ * length counts all bytes after the length field (id + op/status + payload/body).
+ * Requests are pipelined, a client can send any number of requests without waiting for the responses.
+ * Responses are sent in request order and carry the id of their request.
+ *
+ * Payloads (str = [u32 size][bytes], the last field of a payload is not length prefixed, it spans the rest of the frame):
+ *
+ *   PING             -                           -> -
+ *   GET              key                         -> value
+ *   SET              str key, value              -> -
+ *   DEL              key                         -> -
+ *   INC              u64 delta, key              -> u64 count (delta is two's complement, 0 reads the count, a missing key is 0 and not created)
+ *   GROUP_ADD        str key, member             -> u8 added
+ *   GROUP_DEL        str key, member             -> u8 removed
+ *   GROUP_GET        key                         -> u32 count, str member...
+ *   GROUP_INTER      str key...                  -> u32 count, str member...
+ *   GROUP_UNION      str key...                  -> u32 count, str member...
+ *   GROUP_DIFF       str key...                  -> u32 count, str member...
+ *   GROUP_INTERCARD  u64 limit, str key...       -> u64 count
+ *   MGET             str key...                  -> (u8 status, str value if status is OK)... per key
+ *   MSET             (str key, str value)...     -> u8 status... per key
+ *   LEASE            u32 lease ms, key           -> u32 granted lease ms (0 = not granted), value
+ *   STATS            key                         -> stats report (text, see core::stats in hypercache_db)
+ *   GET_FRAMES       key                         -> u32 count, (u8 compressed, u32 raw size, u32 size)... per frame, frame bytes
+ *   COUNT_CAS        u64 expected, u64 desired, key -> u8 swapped, u64 count (desired if swapped, else the current count)
+ *   COUNT_STRIPE     u8 striped, key             -> - (switches the counter to / from the striped representation)
+ *
+ * If the status is not OK, the body is empty (NOT_FOUND) or contains an error message.
+ * GROUP_INTER / UNION / DIFF / INTERCARD accept at most 1024 keys (BAD_REQUEST otherwise).
+ * The per key status of MGET / MSET is OK, NOT_FOUND, WRONG_TYPE or ERROR (the shard of the key did not reply, see hypercache_proxy).
+ *
+ * LEASE reads a key like GET and registers the connection as holder of the key (also if it is not found).
+ * The lease is 0 if it was not granted (the table is full or the connection can not receive pushes, e.g. io_uring),
+ * the value must not be cached then.
+ * Until the granted lease expires, the first write of the key pushes an unsolicited frame to the connection:
+ *
+ *   push:     [u32 length][u32 push_id][u8 INVALIDATE][key]
+ *
+ * Pushes can arrive between any two responses, a client that sends LEASE must not use push_id as request id.
+ * A lost push (e.g. the connection failed) is bounded by the lease, holders must drop the value when it expires.
+ *
+ * GET_FRAMES reads a key like GET, but passes the value through as it is stored: the frame descriptors are followed by the
+ * bytes of all frames, a compressed frame is a hyperlz (LZ4 block format) block that decompresses to raw size bytes.
+ * Clients that can decompress use it to save the decompression on the server and the bandwidth (see --compress_threshold).
+ *
+ * A missing counter has a count of 0 for COUNT_CAS. Striped counters take increments from many threads without
+ * contention on one cache line, they do not support COUNT_CAS (ERROR).
+ *
+ * The key of STATS is only used by hypercache_proxy: it forwards STATS to the shard that owns the key,
+ * with an empty key the proxy reports its own stats (the near cache map).
+ */
+namespace protocol {
+	enum Op : uint8_t {
+		PING = 0,
+		GET = 1,
+		SET = 2,
+		DEL = 3,
+		INC = 4,
+		GROUP_ADD = 5,
+		GROUP_DEL = 6,
+		GROUP_GET = 7,
+		GROUP_INTER = 8,
+		GROUP_UNION = 9,
+		GROUP_DIFF = 10,
+		GROUP_INTERCARD = 11,
+		MGET = 12,
+		MSET = 13,
+		LEASE = 14,
+		STATS = 15,
+		GET_FRAMES = 16,
+		COUNT_CAS = 17,
+		COUNT_STRIPE = 18,
+	};
+
+	enum Status : uint8_t {
+		OK = 0,
+		NOT_FOUND = 1,
+		WRONG_TYPE = 2,
+		BAD_REQUEST = 3,
+		ERROR = 4,
+		// Status of a push frame (see LEASE)
+		INVALIDATE = 5,
+	};
+
+	// Id of the push frames
+	inline static constexpr uint32_t push_id = UINT32_MAX;
+
+	// Size of the frame header (length + id + op / status)
+	inline static constexpr size_t header_size = 9;
+	// Size of the length field
+	inline static constexpr size_t length_size = 4;
+
+	inline void put_u32(uint8_t* dst, uint32_t val) {
+		for (size_t i = 0; i < 4; i++) dst[i] = static_cast<uint8_t>(val >> (i * 8));
+	}
+
+	inline void put_u64(uint8_t* dst, uint64_t val) {
+		for (size_t i = 0; i < 8; i++) dst[i] = static_cast<uint8_t>(val >> (i * 8));
+	}
+
+	inline uint32_t get_u32(const uint8_t* src) {
+		uint32_t val = 0;
+		for (size_t i = 0; i < 4; i++) val |= static_cast<uint32_t>(src[i]) << (i * 8);
+		return val;
+	}
+
+	inline uint64_t get_u64(const uint8_t* src) {
+		uint64_t val = 0;
+		for (size_t i = 0; i < 8; i++) val |= static_cast<uint64_t>(src[i]) << (i * 8);
+		return val;
+	}
+
+	/**
+	 * Reads the fields of a payload
+	 *
+	 * Throws an invalid_argument if a field exceeds the payload.
+	 */
+	class Reader {
+	public:
+		Reader(const uint8_t* data, size_t size) : data(data), size(size) {};
+
+		uint8_t u8() {
+			need(1);
+			return data[pos++];
+		};
+
+		uint32_t u32() {
+			need(4);
+			const uint32_t val = get_u32(data + pos);
+			pos += 4;
+			return val;
+		};
+
+		uint64_t u64() {
+			need(8);
+			const uint64_t val = get_u64(data + pos);
+			pos += 8;
+			return val;
+		};
+
+		/**
+		 * Reads a length prefixed string
+		 */
+		string_view str() {
+			const size_t len = u32();
+			need(len);
+			const string_view val(reinterpret_cast<const char*>(data + pos), len);
+			pos += len;
+			return val;
+		};
+
+		/**
+		 * Reads the rest of the payload
+		 */
+		string_view rest() {
+			const string_view val(reinterpret_cast<const char*>(data + pos), size - pos);
+			pos = size;
+			return val;
+		};
+
+		bool done() const noexcept {
+			return pos == size;
+		};
+	private:
+		void need(size_t len) const {
+			if (size - pos < len) throw invalid_argument("Payload is truncated");
+		};
+
+		const uint8_t* data;
+		size_t size;
+		size_t pos = 0;
+	};
+
+	/**
+	 * Appends frames to a byte buffer
+	 *
+	 * Usage: begin() the frame, append the fields of the payload and end() it (patches the length).
+	 */
+	class Writer {
+	public:
+		explicit Writer(vector<uint8_t>& out) : out(out) {};
+
+		void begin(uint32_t id, uint8_t code) {
+			frame = out.size();
+			out.resize(frame + header_size);
+			put_u32(out.data() + frame + length_size, id);
+			out[frame + header_size - 1] = code;
+		};
+
+		/**
+		 * Patches the frame length, extra is the size of body bytes that are sent outside of the buffer
+		 */
+		void end(size_t extra = 0) {
+			put_u32(out.data() + frame, static_cast<uint32_t>(out.size() - frame - length_size + extra));
+		};
+
+		void u8(uint8_t val) {
+			out.push_back(val);
+		};
+
+		void u32(uint32_t val) {
+			const size_t pos = out.size();
+			out.resize(pos + 4);
+			put_u32(out.data() + pos, val);
+		};
+
+		void u64(uint64_t val) {
+			const size_t pos = out.size();
+			out.resize(pos + 8);
+			put_u64(out.data() + pos, val);
+		};
+
+		void str(string_view val) {
+			u32(static_cast<uint32_t>(val.size()));
+			raw(val);
+		};
+
+		void raw(string_view val) {
+			out.insert(out.end(), val.begin(), val.end());
+		};
+	private:
+		vector<uint8_t>& out;
+		size_t frame = 0;
+	};
+}
+
+#endif